@@ -0,0 +1,528 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runs many independent programs on a pool of threads. Each job gets its
+ * own CP/M machine and console buffer, and the results are printed as one
+ * line of JSON per job in the order of the manifest.
+ *
+ * Each line of the manifest names an image and optionally the address to
+ * load it at and its instruction and cycle limits:
+ *
+ *   file [offset [instructions [cycles]]]
+ *
+ * Numbers may be given in decimal or with a 0x prefix in hex, a limit of
+ * 0 means none. Blank lines and everything after a '#' are ignored.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080-cpm.h"
+#include "i8080.h"
+
+/* No instruction takes fewer cycles than this. */
+#define MIN_CYCLES 4
+
+struct job
+{
+  char *file;
+  uint16_t offset;
+  uintmax_t max_instructions; /* Zero for no limit */
+  uintmax_t max_cycles;
+  const char *status;
+  uintmax_t instructions;
+  uintmax_t cycles;
+  uint16_t pc;
+  char *output; /* Console output */
+  size_t output_size;
+  bool done;
+};
+
+/*
+ * The jobs a worker has left, which is always a range of the manifest.
+ * The worker takes from the front and other workers steal the back half
+ * when they run out.
+ */
+struct deque
+{
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+};
+
+struct pool
+{
+  struct job *jobs;
+  size_t count;
+  struct deque *deques;
+  int workers;
+  bool use_cache;
+  pthread_mutex_t print_lock;
+  size_t printed; /* Jobs before this have been printed */
+};
+
+struct worker
+{
+  struct pool *pool;
+  int index;
+};
+
+static void usage (void);
+static int read_manifest (struct pool *, const char *, uintmax_t, uintmax_t);
+static void free_jobs (struct pool *);
+static void *pool_worker (void *);
+static bool take_job (struct pool *, int, size_t *);
+static void run_job (struct job *, bool);
+static const char *execute (struct cpm *, struct job *);
+static void finish_job (struct pool *, size_t);
+static void print_job (const struct job *, size_t);
+static void print_json_string (const char *, size_t);
+
+int
+main (int argc, char **argv)
+{
+  struct pool pool;
+  struct worker *workers;
+  pthread_t *threads;
+  uintmax_t max_instructions, max_cycles;
+  int ch, i, jobs, status;
+  char *end;
+
+  memset (&pool, 0, sizeof (pool));
+  max_instructions = max_cycles = 0;
+  jobs = 0;
+  while ((ch = getopt (argc, argv, "C:ci:j:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'C':
+          max_cycles = strtoumax (optarg, &end, 0);
+          if (*optarg == '\0' || *end != '\0')
+            usage ();
+          break;
+        case 'c':
+          pool.use_cache = true;
+          break;
+        case 'i':
+          max_instructions = strtoumax (optarg, &end, 0);
+          if (*optarg == '\0' || *end != '\0')
+            usage ();
+          break;
+        case 'j':
+          jobs = atoi (optarg);
+          if (jobs < 1)
+            usage ();
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc != 1)
+    usage ();
+
+  if (read_manifest (&pool, argv[0], max_instructions, max_cycles) < 0)
+    return 1;
+  if (pool.count == 0)
+    return 0;
+
+  if (jobs == 0)
+    jobs = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+  if ((size_t) jobs > pool.count)
+    jobs = (int) pool.count;
+
+  pool.workers = jobs;
+  pool.deques = (struct deque *) calloc (jobs, sizeof (struct deque));
+  workers = (struct worker *) calloc (jobs, sizeof (struct worker));
+  threads = (pthread_t *) calloc (jobs, sizeof (pthread_t));
+  if (pool.deques == NULL || workers == NULL || threads == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      free (pool.deques);
+      free (workers);
+      free (threads);
+      free_jobs (&pool);
+      return 1;
+    }
+
+  /* Start every worker with an equal slice of the manifest. */
+  pthread_mutex_init (&pool.print_lock, NULL);
+  for (i = 0; i < jobs; ++i)
+    {
+      pthread_mutex_init (&pool.deques[i].lock, NULL);
+      pool.deques[i].head = pool.count * i / jobs;
+      pool.deques[i].tail = pool.count * (i + 1) / jobs;
+      workers[i].pool = &pool;
+      workers[i].index = i;
+    }
+
+  /* The calling thread is worker 0. */
+  for (i = 1; i < jobs; ++i)
+    if (pthread_create (&threads[i], NULL, pool_worker, &workers[i]) != 0)
+      {
+        fprintf (stderr, "Failed to create a thread.\n");
+        /* Its jobs get stolen by the others. */
+        jobs = i;
+        break;
+      }
+  pool_worker (&workers[0]);
+  for (i = 1; i < jobs; ++i)
+    pthread_join (threads[i], NULL);
+
+  status = 0;
+  for (i = 0; (size_t) i < pool.count; ++i)
+    if (strcmp (pool.jobs[i].status, "error") == 0)
+      status = 1;
+
+  for (i = 0; i < pool.workers; ++i)
+    pthread_mutex_destroy (&pool.deques[i].lock);
+  pthread_mutex_destroy (&pool.print_lock);
+  free (pool.deques);
+  free (workers);
+  free (threads);
+  free_jobs (&pool);
+  return status;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "i8080-batch [-c] [-C cycles] [-i instructions] "
+                   "[-j jobs] manifest\n");
+  fprintf (stderr, "  -C  Default cycle limit of a job\n");
+  fprintf (stderr, "  -c  Execute from a cache of pre-decoded blocks\n");
+  fprintf (stderr, "  -i  Default instruction limit of a job\n");
+  fprintf (stderr, "  -j  Threads to use (default one per CPU)\n");
+  fprintf (stderr, "The manifest is read from stdin if it is '-'.\n");
+  exit (1);
+}
+
+static int
+read_manifest (struct pool *pool, const char *name, uintmax_t max_instructions,
+               uintmax_t max_cycles)
+{
+  struct job *jobs, *job;
+  size_t capacity, size, lineno;
+  uintmax_t numbers[3];
+  char *line, *field, *end;
+  FILE *fp;
+  int i;
+
+  fp = strcmp (name, "-") == 0 ? stdin : fopen (name, "r");
+  if (fp == NULL)
+    {
+      perror (name);
+      return -1;
+    }
+
+  line = NULL;
+  size = capacity = lineno = 0;
+  while (getline (&line, &size, fp) != -1)
+    {
+      ++lineno;
+      if ((end = strchr (line, '#')) != NULL)
+        *end = '\0';
+      field = strtok (line, " \t\r\n");
+      if (field == NULL)
+        continue;
+
+      if (pool->count == capacity)
+        {
+          capacity = capacity == 0 ? 64 : capacity * 2;
+          jobs = (struct job *) realloc (pool->jobs,
+                                         capacity * sizeof (struct job));
+          if (jobs == NULL)
+            {
+              fprintf (stderr, "Failed to allocate memory.\n");
+              goto fail;
+            }
+          pool->jobs = jobs;
+        }
+      job = &pool->jobs[pool->count];
+      memset (job, 0, sizeof (*job));
+      job->file = strdup (field);
+      if (job->file == NULL)
+        {
+          fprintf (stderr, "Failed to allocate memory.\n");
+          goto fail;
+        }
+      ++pool->count;
+
+      numbers[0] = CPM_TPA;
+      numbers[1] = max_instructions;
+      numbers[2] = max_cycles;
+      for (i = 0; (field = strtok (NULL, " \t\r\n")) != NULL; ++i)
+        {
+          if (i == 3)
+            {
+              fprintf (stderr, "%s:%zu: Too many fields.\n", name, lineno);
+              goto fail;
+            }
+          numbers[i] = strtoumax (field, &end, 0);
+          if (*end != '\0')
+            {
+              fprintf (stderr, "%s:%zu: Invalid number '%s'.\n", name,
+                       lineno, field);
+              goto fail;
+            }
+        }
+      if (numbers[0] > UINT16_MAX)
+        {
+          fprintf (stderr, "%s:%zu: Offset out of range.\n", name, lineno);
+          goto fail;
+        }
+      job->offset = (uint16_t) numbers[0];
+      job->max_instructions = numbers[1];
+      job->max_cycles = numbers[2];
+    }
+
+  free (line);
+  if (fp != stdin)
+    fclose (fp);
+  return 0;
+
+fail:
+  free (line);
+  if (fp != stdin)
+    fclose (fp);
+  free_jobs (pool);
+  return -1;
+}
+
+static void
+free_jobs (struct pool *pool)
+{
+  size_t i;
+
+  for (i = 0; i < pool->count; ++i)
+    {
+      free (pool->jobs[i].file);
+      free (pool->jobs[i].output);
+    }
+  free (pool->jobs);
+  pool->jobs = NULL;
+  pool->count = 0;
+}
+
+static void *
+pool_worker (void *workerptr)
+{
+  struct worker *worker = (struct worker *) workerptr;
+  struct pool *pool = worker->pool;
+  size_t i;
+
+  while (take_job (pool, worker->index, &i))
+    {
+      run_job (&pool->jobs[i], pool->use_cache);
+      finish_job (pool, i);
+    }
+  return NULL;
+}
+
+/*
+ * Take the next job of worker SELF, stealing the back half of another
+ * worker's jobs if it has none left. Returns false when every worker is
+ * out of jobs.
+ */
+static bool
+take_job (struct pool *pool, int self, size_t *index)
+{
+  struct deque *own, *victim;
+  size_t head, tail;
+  int i;
+
+  own = &pool->deques[self];
+  pthread_mutex_lock (&own->lock);
+  if (own->head < own->tail)
+    {
+      *index = own->head++;
+      pthread_mutex_unlock (&own->lock);
+      return true;
+    }
+  pthread_mutex_unlock (&own->lock);
+
+  for (i = 1; i < pool->workers; ++i)
+    {
+      victim = &pool->deques[(self + i) % pool->workers];
+      pthread_mutex_lock (&victim->lock);
+      head = victim->head;
+      tail = victim->tail;
+      if (head < tail)
+        {
+          head = tail - (tail - head + 1) / 2;
+          victim->tail = head;
+        }
+      pthread_mutex_unlock (&victim->lock);
+      if (head == tail)
+        continue;
+
+      /* Only this worker adds to its own jobs, so they are still empty. */
+      pthread_mutex_lock (&own->lock);
+      own->head = head + 1;
+      own->tail = tail;
+      pthread_mutex_unlock (&own->lock);
+      *index = head;
+      return true;
+    }
+  return false;
+}
+
+static void
+run_job (struct job *job, bool use_cache)
+{
+  struct cpm *cpm;
+  FILE *out;
+
+  job->status = "error";
+  cpm = cpm_create ();
+  if (cpm == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      return;
+    }
+  out = open_memstream (&job->output, &job->output_size);
+  if (out == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      cpm_destroy (cpm);
+      return;
+    }
+  cpm->out = out;
+
+  if (cpm_load (cpm, job->file, job->offset) == 0)
+    {
+      if (use_cache && i8080_cache_enable (&cpm->cpu) < 0)
+        fprintf (stderr, "Failed to allocate memory.\n");
+      else
+        {
+          job->status = execute (cpm, job);
+          job->cycles = cpm->cpu.cycles;
+          job->pc = cpm->cpu.pc;
+        }
+    }
+
+  fclose (out);
+  cpm_destroy (cpm);
+}
+
+/*
+ * Run until the program halts or reaches a limit. The instruction limit
+ * is exact. The cycle limit stops at the first instruction that ends at
+ * or past it.
+ */
+static const char *
+execute (struct cpm *cpm, struct job *job)
+{
+  struct i8080 *cpu = &cpm->cpu;
+  uintmax_t budget, remaining, retired;
+
+  for (;;)
+    {
+      if (cpu->halted)
+        return "halted";
+      if (job->max_instructions != 0
+          && job->instructions >= job->max_instructions)
+        return "instruction-limit";
+      if (job->max_cycles != 0 && cpu->cycles >= job->max_cycles)
+        return "cycle-limit";
+
+      budget = job->max_cycles != 0 ? job->max_cycles - cpu->cycles
+                                    : UINTMAX_MAX;
+      if (job->max_instructions != 0)
+        {
+          remaining = job->max_instructions - job->instructions;
+          if (remaining < budget / MIN_CYCLES)
+            budget = remaining * MIN_CYCLES;
+        }
+      i8080_run (cpu, budget, &retired);
+      job->instructions += retired;
+    }
+}
+
+/* Print every finished job that is next in the manifest. */
+static void
+finish_job (struct pool *pool, size_t index)
+{
+  struct job *job;
+
+  pthread_mutex_lock (&pool->print_lock);
+  pool->jobs[index].done = true;
+  while (pool->printed < pool->count && pool->jobs[pool->printed].done)
+    {
+      job = &pool->jobs[pool->printed];
+      print_job (job, pool->printed);
+      free (job->output);
+      job->output = NULL;
+      ++pool->printed;
+    }
+  fflush (stdout);
+  pthread_mutex_unlock (&pool->print_lock);
+}
+
+static void
+print_job (const struct job *job, size_t index)
+{
+  printf ("{\"job\": %zu, \"file\": ", index);
+  print_json_string (job->file, strlen (job->file));
+  printf (", \"offset\": %u, \"status\": \"%s\", \"instructions\": %ju, "
+          "\"cycles\": %ju, \"pc\": %u, \"output\": ",
+          (unsigned int) job->offset, job->status, job->instructions,
+          job->cycles, (unsigned int) job->pc);
+  print_json_string (job->output, job->output_size);
+  printf ("}\n");
+}
+
+/* Bytes outside of printable ASCII are written as \u00XX. */
+static void
+print_json_string (const char *string, size_t size)
+{
+  unsigned char ch;
+  size_t i;
+
+  putchar ('"');
+  for (i = 0; i < size; ++i)
+    {
+      ch = (unsigned char) string[i];
+      if (ch == '"' || ch == '\\')
+        printf ("\\%c", ch);
+      else if (ch == '\n')
+        printf ("\\n");
+      else if (ch < 0x20 || ch >= 0x7f)
+        printf ("\\u%04x", ch);
+      else
+        putchar (ch);
+    }
+  putchar ('"');
+}
@@ -0,0 +1,320 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runs the CP/M test programs from external/ a few times each and
+ * reports how fast the core executes them. The instruction and cycle
+ * counts are checked against the published ones, so a run that is fast
+ * because it is wrong fails.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080-cpm.h"
+#include "i8080.h"
+
+#ifndef I8080_EXTERNAL_DIR
+#  define I8080_EXTERNAL_DIR "external"
+#endif
+
+#define MAX_RUNS 100
+
+/* The programs translated by i8080-recompile, see CMakeLists.txt. */
+#ifdef I8080_AOT
+extern const struct i8080_aot_block *const aot_TST8080[];
+extern const struct i8080_aot_block *const aot_8080PRE[];
+extern const struct i8080_aot_block *const aot_CPUTEST[];
+extern const struct i8080_aot_block *const aot_8080EXM[];
+#  define AOT(name) aot_##name
+#else
+#  define AOT(name) NULL
+#endif
+
+struct program
+{
+  const char *name;
+  uintmax_t instructions; /* Expected counts */
+  uintmax_t cycles;
+  const struct i8080_aot_block *const *aot; /* NULL without I8080_AOT */
+};
+
+static const struct program programs[] = {
+  { "TST8080", 651, 4924, AOT (TST8080) },
+  { "8080PRE", 1061, 7814, AOT (8080PRE) },
+  { "CPUTEST", 33971311, 255665052, AOT (CPUTEST) },
+  { "8080EXM", 2919050698, 23835665055, AOT (8080EXM) },
+};
+
+#define PROGRAM_COUNT (sizeof (programs) / sizeof (programs[0]))
+
+struct result
+{
+  const struct program *program;
+  uintmax_t instructions;
+  uintmax_t cycles;
+  double seconds[MAX_RUNS];
+  double best;
+  double median;
+  bool ok;
+};
+
+static void usage (void);
+static const struct program *find_program (const char *);
+static int bench_program (struct result *, const char *, int, bool, bool);
+static int compare_seconds (const void *, const void *);
+static void print_text (const struct result *, size_t);
+static void print_json (const struct result *, size_t, int, bool, bool);
+
+int
+main (int argc, char **argv)
+{
+  struct result results[PROGRAM_COUNT];
+  const char *dir;
+  size_t count, i;
+  bool use_cache, use_aot, json, ok;
+  int ch, runs;
+
+  dir = I8080_EXTERNAL_DIR;
+  use_cache = use_aot = json = false;
+  runs = 3;
+  while ((ch = getopt (argc, argv, "acd:jn:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'a':
+#ifndef I8080_AOT
+          fprintf (stderr, "Built without the translated programs, is "
+                           "I8080_AOT enabled?\n");
+          exit (1);
+#endif
+          use_aot = true;
+          break;
+        case 'c':
+          use_cache = true;
+          break;
+        case 'd':
+          dir = optarg;
+          break;
+        case 'j':
+          json = true;
+          break;
+        case 'n':
+          runs = atoi (optarg);
+          if (runs < 1 || runs > MAX_RUNS)
+            {
+              fprintf (stderr, "Runs must be between 1 and %d.\n", MAX_RUNS);
+              exit (1);
+            }
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if ((size_t) argc > PROGRAM_COUNT)
+    usage ();
+
+  count = 0;
+  if (argc == 0)
+    for (; count < PROGRAM_COUNT; ++count)
+      results[count].program = &programs[count];
+  else
+    for (; count < (size_t) argc; ++count)
+      {
+        results[count].program = find_program (argv[count]);
+        if (results[count].program == NULL)
+          {
+            fprintf (stderr, "Unknown program '%s'.\n", argv[count]);
+            exit (1);
+          }
+      }
+
+  ok = true;
+  for (i = 0; i < count; ++i)
+    {
+      if (bench_program (&results[i], dir, runs, use_cache, use_aot) < 0)
+        exit (1);
+      ok = ok && results[i].ok;
+    }
+
+  if (json)
+    print_json (results, count, runs, use_cache, use_aot);
+  else
+    print_text (results, count);
+  return ok ? 0 : 1;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "i8080-bench [-acj] [-d dir] [-n runs] [program ...]\n");
+  fprintf (stderr, "  -a  Execute the code translated by i8080-recompile\n");
+  fprintf (stderr, "  -c  Execute from a cache of pre-decoded blocks\n");
+  fprintf (stderr, "  -d  Directory holding the .COM files\n");
+  fprintf (stderr, "  -j  Print the results as JSON\n");
+  fprintf (stderr, "  -n  Runs of each program (default 3)\n");
+  exit (1);
+}
+
+static const struct program *
+find_program (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < PROGRAM_COUNT; ++i)
+    if (strcmp (programs[i].name, name) == 0)
+      return &programs[i];
+  return NULL;
+}
+
+static int
+bench_program (struct result *result, const char *dir, int runs,
+               bool use_cache, bool use_aot)
+{
+  struct timespec start, end;
+  struct cpm *cpm;
+  double sorted[MAX_RUNS];
+  char path[4096];
+  int i;
+
+  snprintf (path, sizeof (path), "%s/%s.COM", dir, result->program->name);
+  result->ok = true;
+  for (i = 0; i < runs; ++i)
+    {
+      cpm = cpm_create ();
+      if (cpm == NULL || (use_cache && i8080_cache_enable (&cpm->cpu) < 0))
+        {
+          fprintf (stderr, "Failed to allocate memory.\n");
+          if (cpm != NULL)
+            cpm_destroy (cpm);
+          return -1;
+        }
+      if (cpm_load (cpm, path, CPM_TPA) < 0)
+        {
+          cpm_destroy (cpm);
+          return -1;
+        }
+      if (use_aot)
+        i8080_aot_enable (&cpm->cpu, result->program->aot);
+
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      result->instructions = cpm_run (cpm);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      result->cycles = cpm->cpu.cycles;
+      result->seconds[i] = (double) (end.tv_sec - start.tv_sec)
+                           + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+      cpm_destroy (cpm);
+
+      if (result->instructions != result->program->instructions
+          || result->cycles != result->program->cycles)
+        {
+          fprintf (stderr,
+                   "%s: Executed %ju instructions and %ju cycles, expected "
+                   "%ju and %ju.\n",
+                   result->program->name, result->instructions,
+                   result->cycles, result->program->instructions,
+                   result->program->cycles);
+          result->ok = false;
+        }
+    }
+
+  memcpy (sorted, result->seconds, runs * sizeof (double));
+  qsort (sorted, runs, sizeof (double), compare_seconds);
+  result->best = sorted[0];
+  if (runs % 2 == 1)
+    result->median = sorted[runs / 2];
+  else
+    result->median = (sorted[runs / 2 - 1] + sorted[runs / 2]) / 2;
+  return 0;
+}
+
+static int
+compare_seconds (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Rates are taken from the best run. */
+static void
+print_text (const struct result *results, size_t count)
+{
+  const struct result *r;
+  size_t i;
+
+  printf ("%-8s %12s %12s %11s %11s %9s %9s %8s  %s\n", "program",
+          "instructions", "cycles", "best (s)", "median (s)", "MIPS", "MHz",
+          "ns/insn", "counts");
+  for (i = 0; i < count; ++i)
+    {
+      r = &results[i];
+      printf ("%-8s %12ju %12ju %11.6f %11.6f %9.2f %9.2f %8.2f  %s\n",
+              r->program->name, r->instructions, r->cycles, r->best,
+              r->median, (double) r->instructions / r->best / 1e6,
+              (double) r->cycles / r->best / 1e6,
+              r->best * 1e9 / (double) r->instructions,
+              r->ok ? "ok" : "WRONG");
+    }
+}
+
+static void
+print_json (const struct result *results, size_t count, int runs,
+            bool use_cache, bool use_aot)
+{
+  const struct result *r;
+  size_t i;
+  int j;
+
+  printf ("{\"cache\": %s, \"aot\": %s, \"runs\": %d, \"programs\": [",
+          use_cache ? "true" : "false", use_aot ? "true" : "false", runs);
+  for (i = 0; i < count; ++i)
+    {
+      r = &results[i];
+      printf ("%s\n  {\"name\": \"%s\", \"ok\": %s, "
+              "\"instructions\": %ju, \"cycles\": %ju, "
+              "\"expected_instructions\": %ju, \"expected_cycles\": %ju, "
+              "\"seconds\": [",
+              i == 0 ? "" : ",", r->program->name, r->ok ? "true" : "false",
+              r->instructions, r->cycles, r->program->instructions,
+              r->program->cycles);
+      for (j = 0; j < runs; ++j)
+        printf ("%s%.9f", j == 0 ? "" : ", ", r->seconds[j]);
+      printf ("], \"best_seconds\": %.9f, \"median_seconds\": %.9f, "
+              "\"mips\": %.3f, \"mhz\": %.3f, \"ns_per_instruction\": %.3f}",
+              r->best, r->median, (double) r->instructions / r->best / 1e6,
+              (double) r->cycles / r->best / 1e6,
+              r->best * 1e9 / (double) r->instructions);
+    }
+  printf ("\n]}\n");
+}
@@ -0,0 +1,336 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080-cc.h"
+#include "i8080-cgen.h"
+#include "i8080.h"
+
+/* Blocks waiting for the compiler at most, and blocks compiled at once. */
+#define CC_QUEUE 256
+
+/* Where i8080.h and i8080-tables.h are and the tables to use. */
+#ifndef I8080_CC_FLAGS
+#  define I8080_CC_FLAGS "-I."
+#endif
+
+struct cc_block
+{
+  uint16_t start;
+  uint32_t length;
+  uint8_t code[CC_MAX_LENGTH];
+};
+
+struct cc
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  char dir[256]; /* Where the sources and objects are written */
+  cc_read read;
+  unsigned int objects;
+  void **handles; /* Of every object loaded */
+
+  /* Guarded by lock. */
+  bool quit;
+  bool failed;
+  size_t queued;
+  struct cc_block queue[CC_QUEUE];
+  size_t compiled;
+  uint16_t starts[CC_QUEUE];
+  uint32_t lengths[CC_QUEUE];
+  cc_code codes[CC_QUEUE];
+  atomic_bool ready; /* Set with compiled, read without the lock */
+
+  /* Only used by the thread. */
+  struct cc_block batch[CC_QUEUE];
+  cc_code batch_codes[CC_QUEUE];
+};
+
+static void *cc_thread (void *);
+static int cc_compile (struct cc *, size_t);
+
+struct cc *
+cc_create (cc_read read)
+{
+  struct cc *cc;
+  const char *tmpdir;
+
+  cc = (struct cc *) calloc (1, sizeof (*cc));
+  if (cc == NULL)
+    return NULL;
+  tmpdir = getenv ("TMPDIR");
+  if (tmpdir == NULL || *tmpdir == '\0')
+    tmpdir = "/tmp";
+  /* The paths are put in single quotes for the shell. */
+  if (strchr (tmpdir, '\'') != NULL)
+    {
+      free (cc);
+      return NULL;
+    }
+  if ((size_t) snprintf (cc->dir, sizeof (cc->dir), "%s/i8080-cc-XXXXXX",
+                         tmpdir)
+          >= sizeof (cc->dir)
+      || mkdtemp (cc->dir) == NULL)
+    {
+      free (cc);
+      return NULL;
+    }
+  cc->read = read;
+  atomic_init (&cc->ready, false);
+  pthread_mutex_init (&cc->lock, NULL);
+  pthread_cond_init (&cc->wake, NULL);
+  if (pthread_create (&cc->thread, NULL, cc_thread, cc) != 0)
+    {
+      pthread_cond_destroy (&cc->wake);
+      pthread_mutex_destroy (&cc->lock);
+      rmdir (cc->dir);
+      free (cc);
+      return NULL;
+    }
+  return cc;
+}
+
+void
+cc_destroy (struct cc *cc)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&cc->lock);
+  cc->quit = true;
+  pthread_cond_signal (&cc->wake);
+  pthread_mutex_unlock (&cc->lock);
+  pthread_join (cc->thread, NULL);
+
+  for (i = 0; i < cc->objects; ++i)
+    if (cc->handles[i] != NULL)
+      dlclose (cc->handles[i]);
+  free (cc->handles);
+  pthread_cond_destroy (&cc->wake);
+  pthread_mutex_destroy (&cc->lock);
+  rmdir (cc->dir);
+  free (cc);
+}
+
+void
+cc_request (struct cc *cc, uint16_t start, const uint8_t *code,
+            uint32_t length)
+{
+  struct cc_block *blk;
+
+  if (length > CC_MAX_LENGTH)
+    return;
+  pthread_mutex_lock (&cc->lock);
+  if (!cc->failed && cc->queued < CC_QUEUE)
+    {
+      blk = &cc->queue[cc->queued++];
+      blk->start = start;
+      blk->length = length;
+      memcpy (blk->code, code, length);
+      pthread_cond_signal (&cc->wake);
+    }
+  pthread_mutex_unlock (&cc->lock);
+}
+
+size_t
+cc_collect (struct cc *cc, uint16_t *starts, uint32_t *lengths,
+            cc_code *codes, size_t max)
+{
+  size_t n;
+
+  if (!atomic_load_explicit (&cc->ready, memory_order_relaxed))
+    return 0;
+  pthread_mutex_lock (&cc->lock);
+  n = cc->compiled < max ? cc->compiled : max;
+  memcpy (starts, cc->starts, n * sizeof (*starts));
+  memcpy (lengths, cc->lengths, n * sizeof (*lengths));
+  memcpy (codes, cc->codes, n * sizeof (*codes));
+  cc->compiled -= n;
+  memmove (cc->starts, &cc->starts[n], cc->compiled * sizeof (*starts));
+  memmove (cc->lengths, &cc->lengths[n], cc->compiled * sizeof (*lengths));
+  memmove (cc->codes, &cc->codes[n], cc->compiled * sizeof (*codes));
+  atomic_store_explicit (&cc->ready, cc->compiled > 0, memory_order_relaxed);
+  if (n > 0)
+    pthread_cond_signal (&cc->wake);
+  pthread_mutex_unlock (&cc->lock);
+  return n;
+}
+
+/*
+ * Takes whatever is queued, as long as there is room for the results,
+ * so the blocks that get hot while the compiler runs go in one object.
+ */
+static void *
+cc_thread (void *arg)
+{
+  struct cc *cc;
+  size_t i, n;
+  int status;
+
+  cc = (struct cc *) arg;
+  pthread_mutex_lock (&cc->lock);
+  for (;;)
+    {
+      while (!cc->quit && (cc->queued == 0 || cc->compiled == CC_QUEUE))
+        pthread_cond_wait (&cc->wake, &cc->lock);
+      if (cc->quit)
+        break;
+      n = CC_QUEUE - cc->compiled;
+      if (n > cc->queued)
+        n = cc->queued;
+      memcpy (cc->batch, cc->queue, n * sizeof (*cc->batch));
+      cc->queued -= n;
+      memmove (cc->queue, &cc->queue[n], cc->queued * sizeof (*cc->queue));
+      pthread_mutex_unlock (&cc->lock);
+
+      status = cc_compile (cc, n);
+
+      pthread_mutex_lock (&cc->lock);
+      if (status < 0)
+        {
+          /* Most likely there is no compiler, do not try again. */
+          cc->failed = true;
+          cc->queued = 0;
+          break;
+        }
+      for (i = 0; i < n; ++i)
+        {
+          cc->starts[cc->compiled] = cc->batch[i].start;
+          cc->lengths[cc->compiled] = cc->batch[i].length;
+          cc->codes[cc->compiled++] = cc->batch_codes[i];
+        }
+      atomic_store_explicit (&cc->ready, true, memory_order_relaxed);
+    }
+  pthread_mutex_unlock (&cc->lock);
+  return NULL;
+}
+
+/*
+ * The object gets the handler table and the function for reads that are
+ * not mapped from cc_init() rather than linking against the library,
+ * whose symbols the program may not export. Both files are removed once
+ * it is loaded.
+ */
+static int
+cc_compile (struct cc *cc, size_t n)
+{
+  char source[300], object[300], name[32], *command;
+  const char *compiler;
+  void (*init) (const i8080_handler *, cc_read);
+  cc_code const *codes;
+  void **handles;
+  void *handle;
+  size_t i, size;
+  FILE *fp;
+  int status;
+
+  snprintf (source, sizeof (source), "%s/blocks%u.c", cc->dir, cc->objects);
+  snprintf (object, sizeof (object), "%s/blocks%u.so", cc->dir, cc->objects);
+  fp = fopen (source, "w");
+  if (fp == NULL)
+    return -1;
+  fprintf (fp, "#include <stdbool.h>\n#include <stdint.h>\n"
+               "#include <string.h>\n\n#include \"i8080-ops.h\"\n"
+               "#include \"i8080.h\"\n\n");
+  fprintf (fp, "static const i8080_handler *handlers;\n"
+               "static uint8_t (*read_callback) (struct i8080 *, uint16_t);"
+               "\n\n");
+  fprintf (fp, "static inline uint8_t\n"
+               "read_byte (struct i8080 *ctx, uint16_t address)\n{\n"
+               "  const uint8_t *page;\n\n"
+               "  page = ctx->read_map[address / I8080_PAGE_SIZE];\n"
+               "  if (page != NULL)\n"
+               "    return page[address %% I8080_PAGE_SIZE];\n"
+               "  return read_callback (ctx, address);\n}\n\n");
+  for (i = 0; i < n; ++i)
+    {
+      snprintf (name, sizeof (name), "block_%zu", i);
+      cgen_block (fp, name, cc->batch[i].start, cc->batch[i].code,
+                  cc->batch[i].length, "handlers", true);
+    }
+  fprintf (fp, "void\ncc_init (const i8080_handler *table,\n"
+               "         uint8_t (*read) (struct i8080 *, uint16_t))\n{\n"
+               "  handlers = table;\n  read_callback = read;\n}\n\n");
+  fprintf (fp, "bool (*const cc_blocks[]) (struct i8080 *) = {\n");
+  for (i = 0; i < n; ++i)
+    fprintf (fp, "  block_%zu,\n", i);
+  fprintf (fp, "};\n");
+  if (fclose (fp) != 0)
+    {
+      unlink (source);
+      return -1;
+    }
+
+  compiler = getenv ("CC");
+  if (compiler == NULL || *compiler == '\0')
+    compiler = "cc";
+  size = strlen (compiler) + strlen (I8080_CC_FLAGS) + strlen (source)
+         + strlen (object) + 64;
+  command = (char *) malloc (size);
+  if (command == NULL)
+    {
+      unlink (source);
+      return -1;
+    }
+  snprintf (command, size, "%s -O2 -fPIC -shared %s -o '%s' '%s'", compiler,
+            I8080_CC_FLAGS, object, source);
+  status = system (command);
+  free (command);
+  unlink (source);
+  if (status != 0)
+    {
+      unlink (object);
+      return -1;
+    }
+
+  handle = dlopen (object, RTLD_NOW | RTLD_LOCAL);
+  unlink (object);
+  if (handle == NULL)
+    return -1;
+  init = (void (*) (const i8080_handler *, cc_read)) dlsym (handle,
+                                                           "cc_init");
+  codes = (cc_code const *) dlsym (handle, "cc_blocks");
+  handles = (void **) realloc (cc->handles,
+                               (cc->objects + 1) * sizeof (*handles));
+  if (init == NULL || codes == NULL || handles == NULL)
+    {
+      dlclose (handle);
+      return -1;
+    }
+  cc->handles = handles;
+  cc->handles[cc->objects++] = handle;
+  init (i8080_handlers, cc->read);
+  memcpy (cc->batch_codes, codes, n * sizeof (*codes));
+  return 0;
+}
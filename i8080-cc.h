@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hot blocks compiled to C with the host compiler on a thread of its
+ * own and loaded with dlopen(). This is internal to i8080.c and only
+ * built with I8080_CC_TIER.
+ */
+
+#ifndef I8080_CC_H
+#define I8080_CC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i8080.h"
+
+/* Bytes of code in a block at most. */
+#define CC_MAX_LENGTH 96
+
+/* Returns false if the code there was changed since it was compiled. */
+typedef bool (*cc_code) (struct i8080 *);
+/* Reads a byte of a page that is not in read_map. */
+typedef uint8_t (*cc_read) (struct i8080 *, uint16_t);
+
+struct cc;
+
+/*
+ * The compiled code reads memory through the given function when it is
+ * not mapped. Returns NULL if the thread or the directory the compiler
+ * works in cannot be created, or if TMPDIR has a single quote, which the
+ * command line cannot quote.
+ */
+struct cc *cc_create (cc_read);
+/* Waits for the compiler if it is running. */
+void cc_destroy (struct cc *);
+/*
+ * Queue the code of a block for compiling. Nothing is queued once the
+ * queue is full or the compiler failed.
+ */
+void cc_request (struct cc *, uint16_t, const uint8_t *, uint32_t);
+/*
+ * Take up to the given number of compiled blocks, their start addresses,
+ * lengths and code. Returns how many there were. This does not wait for
+ * the compiler and is cheap when it has nothing new.
+ */
+size_t cc_collect (struct cc *, uint16_t *, uint32_t *, cc_code *, size_t);
+
+#endif /* I8080_CC_H */
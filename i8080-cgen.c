@@ -0,0 +1,265 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i8080-cgen.h"
+#include "i8080-disasm.h"
+#include "i8080.h"
+
+/* Registers by the 3 bit field of an opcode, M left out. */
+static const char *const reg_names[8]
+    = { "b", "c", "d", "e", "h", "l", NULL, "a" };
+
+/*
+ * Write the C for an instruction that only moves registers around, so
+ * it does not need the flags or memory. Returns false for the others.
+ */
+static bool
+inline_op (FILE *fp, uint8_t opcode, uint16_t imm)
+{
+  static const char *const pairs[4][2]
+      = { { "b", "c" }, { "d", "e" }, { "h", "l" }, { NULL, NULL } };
+  const char *dst, *src;
+  int rp;
+
+  dst = reg_names[(opcode >> 3) & 0x07];
+  src = reg_names[opcode & 0x07];
+  rp = (opcode >> 4) & 0x03;
+  if (opcode >= 0x40 && opcode <= 0x7f && dst != NULL && src != NULL)
+    fprintf (fp, "  ctx->%s = ctx->%s;\n", dst, src);
+  else if ((opcode & 0xc7) == 0x06 && dst != NULL)
+    fprintf (fp, "  ctx->%s = 0x%02x;\n", dst, imm);
+  else if ((opcode & 0xcf) == 0x01 && rp == 3)
+    fprintf (fp, "  ctx->sp = 0x%04x;\n", imm);
+  else if ((opcode & 0xcf) == 0x01)
+    fprintf (fp, "  ctx->%s = 0x%02x;\n  ctx->%s = 0x%02x;\n", pairs[rp][0],
+             imm >> 8, pairs[rp][1], imm & 0xff);
+  else if ((opcode & 0xcf) == 0x03 && rp == 3)
+    fprintf (fp, "  ctx->sp++;\n");
+  else if ((opcode & 0xcf) == 0x0b && rp == 3)
+    fprintf (fp, "  ctx->sp--;\n");
+  else if ((opcode & 0xcf) == 0x03)
+    fprintf (fp, "  if (++ctx->%s == 0)\n    ctx->%s++;\n", pairs[rp][1],
+             pairs[rp][0]);
+  else if ((opcode & 0xcf) == 0x0b)
+    fprintf (fp, "  if (ctx->%s-- == 0)\n    ctx->%s--;\n", pairs[rp][1],
+             pairs[rp][0]);
+  else if (opcode == 0x00)
+    ;
+  else if (opcode == 0x2f)
+    fprintf (fp, "  ctx->a = ~ctx->a;\n");
+  else if (opcode == 0xeb)
+    fprintf (fp, "  tmp = ctx->d;\n  ctx->d = ctx->h;\n  ctx->h = tmp;\n"
+                 "  tmp = ctx->e;\n  ctx->e = ctx->l;\n  ctx->l = tmp;\n");
+  else if (opcode == 0xf9)
+    fprintf (fp, "  ctx->sp = ((uint16_t) ctx->h << 8) | ctx->l;\n");
+  else if (opcode == 0xc3)
+    fprintf (fp, "  ctx->pc = 0x%04x;\n", imm);
+  else
+    return false;
+  return true;
+}
+
+/*
+ * Write the C for an instruction that only works on registers and flags
+ * with the functions of i8080-ops.h, the way i8080-opcodes.h does.
+ * Returns false for the others.
+ */
+static bool
+flag_op (FILE *fp, uint8_t opcode, uint16_t imm)
+{
+  static const char *const alu_names[8]
+      = { "add", "adc", "sub", "sbb", "ana", "xra", "ora", "cmp" };
+  static const char *const dad_args[4]
+      = { "get_bc (ctx)", "get_de (ctx)", "get_hl (ctx)", "ctx->sp" };
+  static const char *const rotate_names[4] = { "rlc", "rrc", "ral", "rar" };
+  static const char *const condition_names[4]
+      = { "FLAG_Z", "FLAG_C", "FLAG_P", "FLAG_S" };
+  const char *dst, *src;
+  int cond;
+
+  dst = reg_names[(opcode >> 3) & 0x07];
+  src = reg_names[opcode & 0x07];
+  cond = (opcode >> 3) & 0x07;
+  if ((opcode & 0xc7) == 0x04 && dst != NULL)
+    fprintf (fp, "  ctx->%s = op_inr (ctx, ctx->%s);\n", dst, dst);
+  else if ((opcode & 0xc7) == 0x05 && dst != NULL)
+    fprintf (fp, "  ctx->%s = op_dcr (ctx, ctx->%s);\n", dst, dst);
+  else if ((opcode & 0xcf) == 0x09)
+    fprintf (fp, "  op_dad (ctx, %s);\n", dad_args[(opcode >> 4) & 0x03]);
+  else if ((opcode & 0xe7) == 0x07)
+    fprintf (fp, "  op_%s (ctx);\n", rotate_names[(opcode >> 3) & 0x03]);
+  else if (opcode == 0x27)
+    fprintf (fp, "  op_daa (ctx);\n");
+  else if (opcode == 0x37)
+    fprintf (fp, "  set_flag_to (ctx, FLAG_C, 1);\n");
+  else if (opcode == 0x3f)
+    fprintf (fp, "  set_flag_to (ctx, FLAG_C, !get_flag (ctx, FLAG_C));\n");
+  else if (opcode >= 0x80 && opcode <= 0xbf && src != NULL)
+    fprintf (fp, "  op_%s (ctx, ctx->%s);\n", alu_names[cond], src);
+  else if ((opcode & 0xc7) == 0xc6)
+    fprintf (fp, "  op_%s (ctx, 0x%02x);\n", alu_names[cond], imm);
+  else if ((opcode & 0xc7) == 0xc2)
+    fprintf (fp, "  if (%sget_flag (ctx, %s))\n    ctx->pc = 0x%04x;\n",
+             cond % 2 == 0 ? "!" : "", condition_names[cond / 2], imm);
+  else
+    return false;
+  return true;
+}
+
+/*
+ * Write the C for an instruction that reads memory but does not write
+ * it, through read_byte() like i8080-opcodes.h. Returns false for the
+ * others.
+ */
+static bool
+read_op (FILE *fp, uint8_t opcode, uint16_t imm)
+{
+  static const char *const alu_names[8]
+      = { "add", "adc", "sub", "sbb", "ana", "xra", "ora", "cmp" };
+  static const char *const pairs[3][2]
+      = { { "b", "c" }, { "d", "e" }, { "h", "l" } };
+  const char *dst;
+  int rp;
+
+  dst = reg_names[(opcode >> 3) & 0x07];
+  rp = (opcode >> 4) & 0x03;
+  if ((opcode & 0xc7) == 0x46 && dst != NULL)
+    fprintf (fp, "  ctx->%s = read_byte (ctx, get_hl (ctx));\n", dst);
+  else if ((opcode & 0xc7) == 0x86)
+    fprintf (fp, "  op_%s (ctx, read_byte (ctx, get_hl (ctx)));\n",
+             alu_names[(opcode >> 3) & 0x07]);
+  else if (opcode == 0x0a || opcode == 0x1a)
+    fprintf (fp, "  ctx->a = read_byte (ctx, get_%s%s (ctx));\n",
+             pairs[rp][0], pairs[rp][1]);
+  else if (opcode == 0x3a)
+    fprintf (fp, "  ctx->a = read_byte (ctx, 0x%04x);\n", imm);
+  else if (opcode == 0x2a)
+    fprintf (fp, "  ctx->l = read_byte (ctx, 0x%04x);\n"
+                 "  ctx->h = read_byte (ctx, 0x%04x);\n",
+             imm, (imm + 1) & UINT16_MAX);
+  else if ((opcode & 0xcf) == 0xc1 && rp < 3)
+    fprintf (fp, "  ctx->%s = read_byte (ctx, ctx->sp);\n"
+                 "  ctx->%s = read_byte (ctx, ctx->sp + 1);\n"
+                 "  ctx->sp += 2;\n",
+             pairs[rp][1], pairs[rp][0]);
+  else
+    return false;
+  return true;
+}
+
+/*
+ * The code is compared with memory a page at a time first, which the
+ * compiler does with a few loads since the sizes are known. The cycles
+ * of the inlined instructions are added at once, before anything that
+ * could look at them, which includes a read_byte callback.
+ */
+void
+cgen_block (FILE *fp, const char *name, uint16_t start, const uint8_t *code,
+            uint32_t length, const char *handlers, bool ops)
+{
+  char text[32];
+  uint8_t bytes[3];
+  uint32_t address, end, offset, page, n;
+  uint16_t imm;
+  uint8_t opcode, last;
+  int cycles;
+
+  end = start + length;
+  fprintf (fp, "static bool\n%s (struct i8080 *ctx)\n{\n", name);
+  fprintf (fp, "  static const uint8_t code[%u] = {", length);
+  for (offset = 0; offset < length; ++offset)
+    fprintf (fp, "%s0x%02x%s", offset % 12 == 0 ? "\n    " : " ", code[offset],
+             offset + 1 < length ? "," : "");
+  fprintf (fp, "\n  };\n");
+  last = 0;
+  for (offset = 0; offset < length; offset += i8080_opcode_length (last))
+    {
+      last = code[offset];
+      if (last == 0xeb)
+        {
+          fprintf (fp, "  uint8_t tmp;\n");
+          break;
+        }
+    }
+  for (offset = 0; offset < length; offset += i8080_opcode_length (last))
+    last = code[offset];
+
+  fprintf (fp, "\n  if (");
+  for (page = start / I8080_PAGE_SIZE; page <= (end - 1) / I8080_PAGE_SIZE;
+       ++page)
+    fprintf (fp, "ctx->read_map[0x%02x] == NULL\n      || ", page);
+  for (address = start; address < end; address += n)
+    {
+      n = I8080_PAGE_SIZE - address % I8080_PAGE_SIZE;
+      if (n > end - address)
+        n = end - address;
+      fprintf (fp,
+               "%smemcmp (&ctx->read_map[0x%02x][0x%02x], &code[%u], %u) "
+               "!= 0",
+               address == start ? "" : "\n      || ",
+               address / I8080_PAGE_SIZE, address % I8080_PAGE_SIZE,
+               address - start, n);
+    }
+  fprintf (fp, ")\n    return false;\n");
+  if (last != 0xc3)
+    fprintf (fp, "  ctx->pc = 0x%04x;\n", end & UINT16_MAX);
+
+  cycles = 0;
+  for (offset = 0; offset < length; offset += i8080_opcode_length (opcode))
+    {
+      memset (bytes, 0, sizeof (bytes));
+      memcpy (bytes, &code[offset],
+              length - offset < 3 ? length - offset : 3);
+      opcode = bytes[0];
+      imm = 0;
+      if (i8080_opcode_length (opcode) >= 2)
+        imm = bytes[1];
+      if (i8080_opcode_length (opcode) == 3)
+        imm |= bytes[2] << 8;
+      i8080_disasm (text, sizeof (text), bytes);
+      fprintf (fp, "  /* %04x: %s */\n", start + offset, text);
+      if (inline_op (fp, opcode, imm) || (ops && flag_op (fp, opcode, imm)))
+        {
+          cycles += i8080_opcode_cycles (opcode);
+          continue;
+        }
+      if (cycles > 0)
+        fprintf (fp, "  ctx->cycles += %d;\n", cycles);
+      cycles = 0;
+      if (ops && read_op (fp, opcode, imm))
+        cycles = i8080_opcode_cycles (opcode);
+      else
+        fprintf (fp, "  %s[0x%02x] (ctx, 0x%04x);\n", handlers, opcode,
+                 imm);
+    }
+  if (cycles > 0)
+    fprintf (fp, "  ctx->cycles += %d;\n", cycles);
+  fprintf (fp, "  return true;\n}\n\n");
+}
@@ -0,0 +1,52 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * C source for blocks of straight-line code, shared by i8080-recompile
+ * and the compiler tier of the block cache in i8080-cc.c.
+ */
+
+#ifndef I8080_CGEN_H
+#define I8080_CGEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Write a static function called NAME that runs the LENGTH bytes of CODE
+ * as if they were at START and returns true, or returns false without
+ * doing anything if the memory there holds something else now. Anything
+ * that is not generated inline is called through HANDLERS, an expression
+ * for a table laid out like i8080_handlers. The file has to include
+ * <stdbool.h>, <stdint.h>, <string.h> and "i8080.h" first. If OPS is
+ * true it also has to include "i8080-ops.h" and define read_byte() as in
+ * i8080.c, and the instructions that use flags or only read memory are
+ * generated inline too.
+ */
+void cgen_block (FILE *, const char *, uint16_t, const uint8_t *, uint32_t,
+                 const char *, bool);
+
+#endif /* I8080_CGEN_H */
@@ -0,0 +1,199 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080-cpm.h"
+#include "i8080-replay.h"
+#include "i8080.h"
+
+static uint8_t cpm_read_byte (void *, uint16_t);
+static void cpm_write_byte (void *, uint16_t, uint8_t);
+static uint8_t cpm_io_inb (void *, uint8_t);
+static void cpm_io_outb (void *, uint8_t, uint8_t);
+
+struct cpm *
+cpm_create (void)
+{
+  struct cpm *cpm;
+
+  cpm = (struct cpm *) calloc (1, sizeof (struct cpm));
+  if (cpm == NULL)
+    return NULL;
+  i8080_init (&cpm->cpu);
+  cpm->cpu.user_data = cpm;
+  cpm->cpu.read_byte = cpm_read_byte;
+  cpm->cpu.write_byte = cpm_write_byte;
+  cpm->cpu.io_inb = cpm_io_inb;
+  cpm->cpu.io_outb = cpm_io_outb;
+  i8080_map_read (&cpm->cpu, 0, sizeof (cpm->memory), cpm->memory);
+  i8080_map_write (&cpm->cpu, 0, sizeof (cpm->memory), cpm->memory);
+  return cpm;
+}
+
+void
+cpm_destroy (struct cpm *cpm)
+{
+  i8080_cache_disable (&cpm->cpu);
+  i8080_snapshot_free (&cpm->cpu);
+  i8080_trace_disable (&cpm->cpu);
+  i8080_stats_disable (&cpm->cpu);
+  free (cpm);
+}
+
+int
+cpm_load (struct cpm *cpm, const char *name, uint16_t offset)
+{
+  struct stat st;
+  FILE *fp;
+
+  if (stat (name, &st) < 0)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+
+  if (!S_ISREG (st.st_mode))
+    {
+      fprintf (stderr, "%s: Not a regular file.\n", name);
+      return -1;
+    }
+
+  if (st.st_size <= 0 || st.st_size > UINT16_MAX)
+    {
+      fprintf (stderr, "%s: Invalid file size (%jd bytes).\n", name,
+               (intmax_t) st.st_size);
+      return -1;
+    }
+
+  if (st.st_size + offset > UINT16_MAX)
+    {
+      fprintf (stderr, "%s: Offset too large to address file.\n", name);
+      return -1;
+    }
+
+  /* Set the start of memory to HLT's for when the test finishes. */
+  memset (cpm->memory, 0x76, 0x100);
+
+  /* Substitute CP/M BDOS calls with an OUT 1 followed by a RET. */
+  cpm->memory[0x0005] = 0xd3;
+  cpm->memory[0x0006] = 0x01;
+  /* RET */
+  cpm->memory[0x0007] = 0xc9;
+
+  fp = fopen (name, "rb");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+
+  if (fread (&cpm->memory[offset], st.st_size, 1, fp) != 1)
+    {
+      fprintf (stderr, "%s: Failed to load file.\n", name);
+      fclose (fp);
+      return -1;
+    }
+  fclose (fp);
+
+  cpm->cpu.pc = offset;
+  i8080_cache_flush (&cpm->cpu);
+  return 0;
+}
+
+uintmax_t
+cpm_run (struct cpm *cpm)
+{
+  uintmax_t opcount, retired;
+
+  for (opcount = 0; !cpm->cpu.halted; opcount += retired)
+    i8080_run (&cpm->cpu, UINTMAX_MAX, &retired);
+  return opcount;
+}
+
+static uint8_t
+cpm_read_byte (void *cpmptr, uint16_t address)
+{
+  struct cpm *cpm = (struct cpm *) cpmptr;
+
+  return cpm->memory[address];
+}
+
+static void
+cpm_write_byte (void *cpmptr, uint16_t address, uint8_t value)
+{
+  struct cpm *cpm = (struct cpm *) cpmptr;
+
+  cpm->memory[address] = value;
+}
+
+static uint8_t
+cpm_io_inb (void *cpmptr, uint8_t port)
+{
+  struct cpm *cpm = (struct cpm *) cpmptr;
+
+  if (cpm->replay != NULL)
+    return replay_inb (cpm->replay, cpm->cpu.cycles, port, 0);
+  return 0;
+}
+
+/*
+ * Handles the output port from the CPU. This is used to replace
+ * CP/M BDOS system calls used by the test binaries. The tests use
+ * functions 5 and 9. Function 5 is used when the 8-bit register C contains
+ * 2. This function prints the ASCII character stored in E to the screen.
+ * Function 9 sends a memory address to a string in the 16-bit register
+ * DE. Characters a read and printed until a terminating $ character.
+ */
+static void
+cpm_io_outb (void *cpmptr, uint8_t port, [[maybe_unused]] uint8_t value)
+{
+  struct cpm *cpm = (struct cpm *) cpmptr;
+  struct i8080 *cpu = &cpm->cpu;
+  uint16_t de;
+  uint8_t ch;
+
+  if (port != 1 || cpm->out == NULL)
+    return;
+  if (cpu->c == 2)
+    putc (cpu->e, cpm->out);
+  else if (cpu->c == 9)
+    {
+      de = ((uint16_t) cpu->d << 8) | ((uint16_t) cpu->e);
+      ch = cpm->memory[de++];
+      while (ch != '$')
+        {
+          putc (ch, cpm->out);
+          ch = cpm->memory[de++];
+        }
+    }
+}
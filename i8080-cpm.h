@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Just enough of a CP/M machine to run the test programs in external/.
+ * Programs are loaded at 0x100 and the two BDOS calls they use are
+ * caught with an OUT 1 at the BDOS entry point.
+ */
+
+#ifndef I8080_CPM_H
+#define I8080_CPM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "i8080-replay.h"
+#include "i8080.h"
+
+/* Where CP/M loads and starts programs. */
+#define CPM_TPA 0x100
+
+struct cpm
+{
+  struct i8080 cpu;
+  FILE *out;             /* Console output, discarded if NULL */
+  struct replay *replay; /* Log of port input, if any */
+  uint8_t memory[UINT16_MAX + 1];
+};
+
+/* Returns NULL if memory cannot be allocated. */
+struct cpm *cpm_create (void);
+void cpm_destroy (struct cpm *);
+/*
+ * Load a program into a new machine at the given address and start it
+ * there. The image is loaded over page zero, so one loaded below CPM_TPA
+ * brings its own. Returns -1 and prints a message if the file cannot be
+ * loaded.
+ */
+int cpm_load (struct cpm *, const char *, uint16_t);
+/* Run until the program returns to CP/M. Returns the instruction count. */
+uintmax_t cpm_run (struct cpm *);
+
+#endif /* I8080_CPM_H */
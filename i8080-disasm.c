@@ -0,0 +1,133 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "i8080-disasm.h"
+
+/* %b stands for the byte operand and %w for the word operand. */
+static const char *const mnemonics[256] = {
+  "NOP", "LXI B,%w", "STAX B", "INX B",
+  "INR B", "DCR B", "MVI B,%b", "RLC",
+  "*NOP", "DAD B", "LDAX B", "DCX B",
+  "INR C", "DCR C", "MVI C,%b", "RRC",
+  "*NOP", "LXI D,%w", "STAX D", "INX D",
+  "INR D", "DCR D", "MVI D,%b", "RAL",
+  "*NOP", "DAD D", "LDAX D", "DCX D",
+  "INR E", "DCR E", "MVI E,%b", "RAR",
+  "*NOP", "LXI H,%w", "SHLD %w", "INX H",
+  "INR H", "DCR H", "MVI H,%b", "DAA",
+  "*NOP", "DAD H", "LHLD %w", "DCX H",
+  "INR L", "DCR L", "MVI L,%b", "CMA",
+  "*NOP", "LXI SP,%w", "STA %w", "INX SP",
+  "INR M", "DCR M", "MVI M,%b", "STC",
+  "*NOP", "DAD SP", "LDA %w", "DCX SP",
+  "INR A", "DCR A", "MVI A,%b", "CMC",
+  "MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E",
+  "MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A",
+  "MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E",
+  "MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A",
+  "MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E",
+  "MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A",
+  "MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E",
+  "MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A",
+  "MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E",
+  "MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A",
+  "MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E",
+  "MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A",
+  "MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E",
+  "MOV M,H", "MOV M,L", "HLT", "MOV M,A",
+  "MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E",
+  "MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A",
+  "ADD B", "ADD C", "ADD D", "ADD E",
+  "ADD H", "ADD L", "ADD M", "ADD A",
+  "ADC B", "ADC C", "ADC D", "ADC E",
+  "ADC H", "ADC L", "ADC M", "ADC A",
+  "SUB B", "SUB C", "SUB D", "SUB E",
+  "SUB H", "SUB L", "SUB M", "SUB A",
+  "SBB B", "SBB C", "SBB D", "SBB E",
+  "SBB H", "SBB L", "SBB M", "SBB A",
+  "ANA B", "ANA C", "ANA D", "ANA E",
+  "ANA H", "ANA L", "ANA M", "ANA A",
+  "XRA B", "XRA C", "XRA D", "XRA E",
+  "XRA H", "XRA L", "XRA M", "XRA A",
+  "ORA B", "ORA C", "ORA D", "ORA E",
+  "ORA H", "ORA L", "ORA M", "ORA A",
+  "CMP B", "CMP C", "CMP D", "CMP E",
+  "CMP H", "CMP L", "CMP M", "CMP A",
+  "RNZ", "POP B", "JNZ %w", "JMP %w",
+  "CNZ %w", "PUSH B", "ADI %b", "RST 0",
+  "RZ", "RET", "JZ %w", "*JMP %w",
+  "CZ %w", "CALL %w", "ACI %b", "RST 1",
+  "RNC", "POP D", "JNC %w", "OUT %b",
+  "CNC %w", "PUSH D", "SUI %b", "RST 2",
+  "RC", "*RET", "JC %w", "IN %b",
+  "CC %w", "*CALL %w", "SBI %b", "RST 3",
+  "RPO", "POP H", "JPO %w", "XTHL",
+  "CPO %w", "PUSH H", "ANI %b", "RST 4",
+  "RPE", "PCHL", "JPE %w", "XCHG",
+  "CPE %w", "*CALL %w", "XRI %b", "RST 5",
+  "RP", "POP PSW", "JP %w", "DI",
+  "CP %w", "PUSH PSW", "ORI %b", "RST 6",
+  "RM", "SPHL", "JM %w", "EI",
+  "CM %w", "*CALL %w", "CPI %b", "RST 7",
+};
+
+int
+i8080_disasm (char *buf, size_t size, const uint8_t *code)
+{
+  const char *p;
+  size_t n;
+  int length, written;
+
+  length = 1;
+  n = 0;
+  for (p = mnemonics[code[0]]; *p != '\0' && n + 1 < size; ++p)
+    {
+      if (p[0] == '%' && p[1] == 'b')
+        {
+          written = snprintf (&buf[n], size - n, "0x%02x", code[1]);
+          length = 2;
+        }
+      else if (p[0] == '%' && p[1] == 'w')
+        {
+          written = snprintf (&buf[n], size - n, "0x%04x",
+                              code[1] | (code[2] << 8));
+          length = 3;
+        }
+      else
+        {
+          buf[n++] = *p;
+          continue;
+        }
+      ++p;
+      n += (size_t) written < size - n ? (size_t) written : size - n - 1;
+    }
+  if (size > 0)
+    buf[n] = '\0';
+  return length;
+}
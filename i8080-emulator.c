@@ -23,219 +23,531 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/stat.h>
-#include <sys/types.h>
-
-#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "i8080-cpm.h"
+#include "i8080-profile.h"
+#include "i8080-replay.h"
+#include "i8080-stats.h"
+#include "i8080-tracefile.h"
 #include "i8080.h"
 
-struct emulator
+/*
+ * 8080EXM and 8080EXER walk a table of test pointers with this loop,
+ * where -1 matches any byte:
+ *
+ *   LXI H, table
+ * loop:
+ *   MOV A, M / INX H / ORA M / JZ done / DCX H / CALL test / JMP loop
+ */
+static const int exerciser_loop[] = {
+  0x21, -1, -1, 0x7e, 0x23, 0xb6, 0xca, -1, -1, 0x2b, 0xcd, -1, -1, 0xc3,
+};
+
+#define EXERCISER_LOOP_SIZE                                                   \
+  (sizeof (exerciser_loop) / sizeof (exerciser_loop[0]))
+
+/* Addresses and subroutines printed after a profile. */
+#define PROFILE_TOP 20
+
+/* Cycles between checks for SIGUSR1 when tracing. */
+#define TRACE_SLICE 1000000
+
+/* A run of the exerciser with its table cut down to one group. */
+struct shard
+{
+  const char *file;
+  bool use_cache;
+  uint16_t patch;   /* Operand of LXI H, table */
+  uint16_t table;   /* First test pointer */
+  int group;        /* Test to run or -1 for none */
+  char *output;     /* Console output */
+  size_t output_size;
+  size_t head_size; /* Output of the first BDOS call, the banner */
+  uintmax_t instructions;
+  uintmax_t cycles;
+  int status;
+};
+
+struct shard_queue
 {
-  struct i8080 cpu;
-  uint8_t *memory;
-  size_t memory_size;
+  struct shard *shards;
+  int count;
+  atomic_int next;
 };
 
 static void usage (void);
-static struct emulator *emulator_create (void);
-static void emulator_destroy (struct emulator *);
-static int emulator_load_file (struct emulator *, const char *, uint16_t);
-static uint8_t emulator_read_byte (void *, uint16_t);
-static void emulator_write_byte (void *, uint16_t, uint8_t);
-static uint8_t emulator_io_inb (void *, uint8_t);
-static void emulator_io_outb (void *, uint8_t, uint8_t);
+static void request_dump (int);
+static uintmax_t run_traced (struct cpm *);
+static int run_sharded (const char *, bool, int);
+static int find_exerciser_table (const struct cpm *, uint16_t *, uint16_t *,
+                                 int *);
+static void *shard_worker (void *);
+static void shard_run (struct shard *);
+
+static volatile sig_atomic_t dump_requested;
 
 int
 main (int argc, char **argv)
 {
-  struct emulator *emu;
+  struct cpm *cpm;
+  struct tracefile_writer *writer;
+  struct profile *prof;
+  const char *record, *play, *trace_file, *profile_file, *stats_file;
   uintmax_t opcount;
-
-  if (argc != 2)
+  bool use_cache, sharded;
+  int ch, jobs, status, trace;
+
+  status = 0;
+  use_cache = sharded = false;
+  record = play = trace_file = profile_file = stats_file = NULL;
+  jobs = trace = 0;
+  while ((ch = getopt (argc, argv, "cj:P:p:r:S:st:T:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'c':
+          use_cache = true;
+          break;
+        case 'j':
+          jobs = atoi (optarg);
+          if (jobs < 1)
+            usage ();
+          break;
+        case 'P':
+          profile_file = optarg;
+          break;
+        case 'p':
+          play = optarg;
+          break;
+        case 'r':
+          record = optarg;
+          break;
+        case 'S':
+          stats_file = optarg;
+          break;
+        case 's':
+          sharded = true;
+          break;
+        case 't':
+          trace = atoi (optarg);
+          if (trace < 1 || (trace & (trace - 1)) != 0)
+            usage ();
+          break;
+        case 'T':
+          trace_file = optarg;
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc != 1 || (record != NULL && play != NULL)
+      || (trace != 0) + (trace_file != NULL) + (profile_file != NULL) > 1
+      || (sharded
+          && (record != NULL || play != NULL || trace != 0
+              || trace_file != NULL || profile_file != NULL
+              || stats_file != NULL)))
     usage ();
 
-  emu = emulator_create ();
-  if (emu == NULL)
+  if (sharded)
+    return run_sharded (argv[0], use_cache, jobs);
+
+  cpm = cpm_create ();
+  if (cpm == NULL)
     {
       fprintf (stderr, "Failed to allocate memory.\n");
       exit (1);
     }
+  cpm->out = stdout;
 
-  if (emulator_load_file (emu, argv[1], 0x100) < 0)
+  if (cpm_load (cpm, argv[0], CPM_TPA) < 0)
     {
-      emulator_destroy (emu);
+      cpm_destroy (cpm);
       exit (1);
     }
 
-  /* Set the start of memory to HLT's for when the test finishes. */
-  memset (emu->memory, 0x76, 0x100);
+  if (use_cache && i8080_cache_enable (&cpm->cpu) < 0)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      cpm_destroy (cpm);
+      exit (1);
+    }
+
+  if (stats_file != NULL && i8080_stats_enable (&cpm->cpu) < 0)
+    {
+      fprintf (stderr, "Cannot count opcodes, is I8080_STATS enabled?\n");
+      cpm_destroy (cpm);
+      exit (1);
+    }
 
-  /* Substitute CP/M BDOS calls with an OUT 1 followed by a RET. */
-  emu->memory[0x0005] = 0xd3;
-  emu->memory[0x0006] = 0x01;
-  /* RET */
-  emu->memory[0x0007] = 0xc9;
+  if (record != NULL)
+    cpm->replay = replay_open (record, REPLAY_RECORD);
+  else if (play != NULL)
+    cpm->replay = replay_open (play, REPLAY_PLAY);
+  if ((record != NULL || play != NULL) && cpm->replay == NULL)
+    {
+      cpm_destroy (cpm);
+      exit (1);
+    }
 
-  for (opcount = 0; !emu->cpu.halted; ++opcount)
-    i8080_step (&emu->cpu);
+  if (trace != 0)
+    {
+      if (i8080_trace_enable (&cpm->cpu, trace) < 0)
+        {
+          fprintf (stderr, "Cannot trace, is I8080_TRACE enabled?\n");
+          cpm_destroy (cpm);
+          exit (1);
+        }
+      signal (SIGUSR1, request_dump);
+      opcount = run_traced (cpm);
+    }
+  else if (trace_file != NULL)
+    {
+      writer = tracefile_create (&cpm->cpu, trace_file);
+      if (writer == NULL)
+        {
+          cpm_destroy (cpm);
+          exit (1);
+        }
+      opcount = cpm_run (cpm);
+      if (tracefile_finish (writer) < 0)
+        status = 1;
+    }
+  else if (profile_file != NULL)
+    {
+      prof = profile_create (&cpm->cpu);
+      if (prof == NULL)
+        {
+          cpm_destroy (cpm);
+          exit (1);
+        }
+      opcount = cpm_run (cpm);
+      if (profile_stop (prof) < 0
+          || profile_write_folded (prof, profile_file) < 0)
+        status = 1;
+      profile_print (prof, stderr, PROFILE_TOP);
+      profile_destroy (prof);
+    }
+  else
+    opcount = cpm_run (cpm);
 
   printf ("\n");
   printf ("Instruction count: %ju\n", opcount);
-  printf ("Cycle count:       %ju\n", emu->cpu.cycles);
-  emulator_destroy (emu);
-  return 0;
+  printf ("Cycle count:       %ju\n", cpm->cpu.cycles);
+  if (stats_file != NULL && stats_write_json (cpm->cpu.stats, stats_file) < 0)
+    status = 1;
+  if (cpm->replay != NULL
+      && replay_close (cpm->replay, cpm->cpu.cycles,
+                       replay_hash (cpm->memory, sizeof (cpm->memory)))
+             < 0)
+    status = 1;
+  cpm_destroy (cpm);
+  return status;
 }
 
 static void
 usage (void)
 {
-  fprintf (stderr, "i8080-emulator file\n");
+  fprintf (stderr, "i8080-emulator [-cs] [-j jobs] [-p log | -r log] "
+                   "[-S json]\n"
+                   "               [-t records | -T trace | -P folded] "
+                   "file\n");
+  fprintf (stderr, "  -c  Execute from a cache of pre-decoded blocks\n");
+  fprintf (stderr, "  -j  Threads to use with -s (default one per CPU)\n");
+  fprintf (stderr, "  -P  Profile the program, write its call graph as "
+                   "folded stacks to a\n");
+  fprintf (stderr, "      file and print the busiest code to stderr\n");
+  fprintf (stderr, "  -p  Replay port input from a log and check the end\n");
+  fprintf (stderr, "  -r  Record port input to a log\n");
+  fprintf (stderr, "  -S  Write opcode counts and cycles to a file as "
+                   "JSON\n");
+  fprintf (stderr, "  -s  Run each 8080EXM/8080EXER test group on its own\n");
+  fprintf (stderr, "  -t  Trace the last records instructions, a power of "
+                   "two, to stderr\n");
+  fprintf (stderr, "      at the end and on SIGUSR1\n");
+  fprintf (stderr, "  -T  Write a compressed trace of every instruction to "
+                   "a file\n");
   exit (1);
 }
 
-static struct emulator *
-emulator_create (void)
+static void
+request_dump ([[maybe_unused]] int sig)
 {
-  struct emulator *emu;
-
-  emu = (struct emulator *) calloc (1, sizeof (struct emulator));
-  if (emu == NULL)
-    return NULL;
-  i8080_init (&emu->cpu);
-  emu->cpu.user_data = emu;
-  emu->cpu.read_byte = emulator_read_byte;
-  emu->cpu.write_byte = emulator_write_byte;
-  emu->cpu.io_inb = emulator_io_inb;
-  emu->cpu.io_outb = emulator_io_outb;
-  return emu;
+  dump_requested = 1;
 }
 
-static void
-emulator_destroy (struct emulator *emu)
+/*
+ * cpm_run() in slices, so the trace can be printed when asked for, and
+ * printed once more after the HLT the program ends on.
+ */
+static uintmax_t
+run_traced (struct cpm *cpm)
 {
-  free (emu->memory);
-  free (emu);
+  uintmax_t opcount, retired;
+
+  for (opcount = 0; !cpm->cpu.halted; opcount += retired)
+    {
+      i8080_run (&cpm->cpu, TRACE_SLICE, &retired);
+      if (dump_requested)
+        {
+          dump_requested = 0;
+          i8080_trace_dump (&cpm->cpu, stderr);
+        }
+    }
+  i8080_trace_dump (&cpm->cpu, stderr);
+  return opcount;
 }
 
+/*
+ * Run every test group of the exerciser in its own machine, spread over
+ * JOBS threads, and print the output as if they had run in order. The
+ * counts printed are what a single run would take: the parts outside
+ * the groups are counted once.
+ */
 static int
-emulator_load_file (struct emulator *emu, const char *name, uint16_t offset)
+run_sharded (const char *file, bool use_cache, int jobs)
 {
-  struct stat st;
-  FILE *fp;
-  uint8_t *memory;
-
-  if (stat (name, &st) < 0)
+  struct shard_queue queue;
+  struct shard *frame, *shard;
+  struct cpm *cpm;
+  pthread_t *threads;
+  uintmax_t instructions, cycles;
+  uint16_t patch, table;
+  size_t tail_size;
+  int i, groups, status;
+
+  cpm = cpm_create ();
+  if (cpm == NULL)
     {
-      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
-      return -1;
+      fprintf (stderr, "Failed to allocate memory.\n");
+      return 1;
     }
-
-  if (!S_ISREG (st.st_mode))
+  if (cpm_load (cpm, file, CPM_TPA) < 0)
     {
-      fprintf (stderr, "%s: Not a regular file.\n", name);
-      return -1;
+      cpm_destroy (cpm);
+      return 1;
     }
-
-  if (st.st_size <= 0 || st.st_size > UINT16_MAX)
+  status = find_exerciser_table (cpm, &patch, &table, &groups);
+  cpm_destroy (cpm);
+  if (status < 0)
     {
-      fprintf (stderr, "%s: Invalid file size (%jd bytes).\n", name,
-               (intmax_t) st.st_size);
-      return -1;
+      fprintf (stderr, "%s: Cannot find the exerciser's test table.\n", file);
+      return 1;
     }
 
-  if (st.st_size + offset > UINT16_MAX)
+  if (jobs == 0)
+    jobs = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > groups)
+    jobs = groups;
+
+  /* Shard 0 runs no tests to find the banner and closing message. */
+  queue.count = groups + 1;
+  queue.shards = (struct shard *) calloc (queue.count, sizeof (struct shard));
+  threads = (pthread_t *) calloc (jobs, sizeof (pthread_t));
+  if (queue.shards == NULL || threads == NULL)
     {
-      fprintf (stderr, "%s: Offset too large to address file.\n", name);
-      return -1;
+      fprintf (stderr, "Failed to allocate memory.\n");
+      free (queue.shards);
+      free (threads);
+      return 1;
     }
-
-  fp = fopen (name, "rb");
-  if (fp == NULL)
+  for (i = 0; i < queue.count; ++i)
     {
-      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
-      return -1;
+      queue.shards[i].file = file;
+      queue.shards[i].use_cache = use_cache;
+      queue.shards[i].patch = patch;
+      queue.shards[i].table = table;
+      queue.shards[i].group = i - 1;
     }
-
-  memory = (uint8_t *) calloc (1, UINT16_MAX);
-  if (memory == NULL)
+  atomic_init (&queue.next, 0);
+
+  for (i = 0; i < jobs; ++i)
+    if (pthread_create (&threads[i], NULL, shard_worker, &queue) != 0)
+      {
+        fprintf (stderr, "Failed to create a thread.\n");
+        /* The threads already started finish the queue. */
+        jobs = i;
+        if (jobs == 0)
+          shard_worker (&queue);
+        break;
+      }
+  for (i = 0; i < jobs; ++i)
+    pthread_join (threads[i], NULL);
+
+  frame = &queue.shards[0];
+  status = 0;
+  for (i = 0; i < queue.count && status == 0; ++i)
+    status = queue.shards[i].status;
+  tail_size = frame->output_size - frame->head_size;
+  for (i = 1; i < queue.count && status == 0; ++i)
     {
-      fprintf (stderr, "Memory allocation failed.\n");
-      fclose (fp);
-      return -1;
+      shard = &queue.shards[i];
+      if (shard->output_size < frame->output_size
+          || memcmp (shard->output, frame->output, frame->head_size) != 0
+          || memcmp (&shard->output[shard->output_size - tail_size],
+                     &frame->output[frame->head_size], tail_size)
+                 != 0)
+        {
+          fprintf (stderr, "Test group %d printed unexpected output.\n",
+                   shard->group);
+          status = 1;
+        }
     }
 
-  if (fread (&memory[offset], st.st_size, 1, fp) != 1)
+  if (status == 0)
     {
-      fprintf (stderr, "%s: Failed to load file.\n", name);
-      fclose (fp);
-      free (memory);
-      return -1;
+      fwrite (frame->output, 1, frame->head_size, stdout);
+      instructions = frame->instructions;
+      cycles = frame->cycles;
+      for (i = 1; i < queue.count; ++i)
+        {
+          shard = &queue.shards[i];
+          fwrite (&shard->output[frame->head_size], 1,
+                  shard->output_size - frame->output_size, stdout);
+          instructions += shard->instructions - frame->instructions;
+          cycles += shard->cycles - frame->cycles;
+        }
+      fwrite (&frame->output[frame->head_size], 1, tail_size, stdout);
+
+      printf ("\n");
+      printf ("Instruction count: %ju\n", instructions);
+      printf ("Cycle count:       %ju\n", cycles);
     }
 
-  emu->memory = memory;
-  emu->memory_size = UINT16_MAX;
-  emu->cpu.pc = offset;
-  fclose (fp);
-  return 0;
+  for (i = 0; i < queue.count; ++i)
+    free (queue.shards[i].output);
+  free (queue.shards);
+  free (threads);
+  return status;
 }
 
-static uint8_t
-emulator_read_byte (void *emuptr, uint16_t address)
+/*
+ * Find the LXI H that loads the test table and count the tests in it.
+ * Returns -1 if the program does not look like the exerciser.
+ */
+static int
+find_exerciser_table (const struct cpm *cpm, uint16_t *patch,
+                      uint16_t *table, int *groups)
 {
-  struct emulator *emu = (struct emulator *) emuptr;
+  const uint8_t *memory;
+  uint32_t address, entry;
+  size_t i;
 
-  return (emu->memory_size > address) ? emu->memory[address] : UINT8_C (0);
+  memory = cpm->memory;
+  for (address = 0x100; address < 0x200; ++address)
+    {
+      for (i = 0; i < EXERCISER_LOOP_SIZE; ++i)
+        if (exerciser_loop[i] >= 0
+            && memory[address + i] != (uint8_t) exerciser_loop[i])
+          break;
+      if (i != EXERCISER_LOOP_SIZE)
+        continue;
+
+      *patch = address + 1;
+      *table = memory[address + 1] | (memory[address + 2] << 8);
+      *groups = 0;
+      for (entry = *table; entry + 1 <= UINT16_MAX; entry += 2)
+        {
+          if (memory[entry] == 0 && memory[entry + 1] == 0)
+            return *groups > 0 ? 0 : -1;
+          ++*groups;
+        }
+      return -1;
+    }
+  return -1;
 }
 
-static void
-emulator_write_byte (void *emuptr, uint16_t address, uint8_t value)
+static void *
+shard_worker (void *queueptr)
 {
-  struct emulator *emu = (struct emulator *) emuptr;
+  struct shard_queue *queue = (struct shard_queue *) queueptr;
+  int i;
 
-  if (emu->memory_size > address)
-    emu->memory[address] = value;
+  while ((i = atomic_fetch_add (&queue->next, 1)) < queue->count)
+    shard_run (&queue->shards[i]);
+  return NULL;
 }
 
-static uint8_t
-emulator_io_inb (void *emuptr, uint8_t port)
-{
-  return 0;
-}
-
-/*
- * Handles the output port from the CPU. This is used to replace
- * CP/M BDOS system calls used by the test binaries. The tests use
- * functions 5 and 9. Function 5 is used when the 8-bit register C contains
- * 2. This function prints the ASCII character stored in E to the screen.
- * Function 9 sends a memory address to a string in the 16-bit register
- * DE. Characters a read and printed until a terminating $ character.
- */
 static void
-emulator_io_outb (void *emuptr, uint8_t port, uint8_t value)
+shard_run (struct shard *shard)
 {
-  struct emulator *emu = (struct emulator *) emuptr;
-  struct i8080 *cpu = &emu->cpu;
-  uint16_t de;
-  uint8_t ch;
+  struct cpm *cpm;
+  uintmax_t retired;
+  uint16_t start;
+  FILE *out;
+
+  shard->status = 1;
+  cpm = cpm_create ();
+  if (cpm == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      return;
+    }
+  out = open_memstream (&shard->output, &shard->output_size);
+  if (out == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      cpm_destroy (cpm);
+      return;
+    }
+  cpm->out = out;
+  if (cpm_load (cpm, shard->file, CPM_TPA) < 0)
+    goto done;
+
+  /*
+   * Point the table at this group's entry and end it right after. With
+   * no group it starts at the terminating zero.
+   */
+  if (shard->group < 0)
+    {
+      start = shard->table;
+      while (cpm->memory[start] != 0 || cpm->memory[start + 1] != 0)
+        start += 2;
+    }
+  else
+    {
+      start = shard->table + 2 * shard->group;
+      cpm->memory[start + 2] = 0;
+      cpm->memory[start + 3] = 0;
+    }
+  cpm->memory[shard->patch] = start & UINT8_MAX;
+  cpm->memory[shard->patch + 1] = start >> 8;
 
-  if (port == 1)
+  if (shard->use_cache && i8080_cache_enable (&cpm->cpu) < 0)
     {
-      if (cpu->c == 2)
-        putchar (cpu->e);
-      else if (cpu->c == 9)
-        {
-          de = ((uint16_t) cpu->d << 8) | ((uint16_t) cpu->e);
-          ch = emulator_read_byte (cpu->user_data, de++);
-          while (ch != '$')
-            {
-              putchar (ch);
-              ch = emulator_read_byte (cpu->user_data, de++);
-            }
-        }
+      fprintf (stderr, "Failed to allocate memory.\n");
+      goto done;
     }
+
+  /* Note where the banner ends, which is after the first BDOS call. */
+  cpm->cpu.io_exit = true;
+  shard->head_size = SIZE_MAX;
+  for (shard->instructions = 0; !cpm->cpu.halted;
+       shard->instructions += retired)
+    if (i8080_run (&cpm->cpu, UINTMAX_MAX, &retired) == I8080_EXIT_IO
+        && shard->head_size == SIZE_MAX)
+      {
+        fflush (out);
+        shard->head_size = shard->output_size;
+      }
+  shard->cycles = cpm->cpu.cycles;
+  shard->status = 0;
+
+done:
+  fclose (out);
+  if (shard->head_size > shard->output_size)
+    shard->status = 1;
+  cpm_destroy (cpm);
 }
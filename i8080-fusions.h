@@ -0,0 +1,49 @@
+/* Generated by misc/makefusions.c, do not edit. */
+
+/*
+ * Opcode pairs the block cache runs as one instruction, most frequent
+ * first, with their share of the instructions in:
+ *
+ *   TST8080.json
+ *   8080PRE.json
+ *   CPUTEST.json
+ *   8080EXM.json
+ *
+ * This file has no include guard. The includer defines
+ * FUSE(first, second).
+ */
+
+FUSE (0x3c, 0xc2) /* INR A; JNZ, 12.35% */
+FUSE (0x05, 0xc2) /* DCR B; JNZ, 7.28% */
+FUSE (0x23, 0x05) /* INX H; DCR B, 6.19% */
+FUSE (0xfe, 0xc4) /* CPI; CNZ, 1.28% */
+FUSE (0xfe, 0xc2) /* CPI; JNZ, 0.90% */
+FUSE (0x21, 0xe5) /* LXI H; PUSH H, 0.80% */
+FUSE (0xfe, 0xca) /* CPI; JZ, 0.80% */
+FUSE (0x13, 0x23) /* INX D; INX H, 0.56% */
+FUSE (0x0d, 0xc2) /* DCR C; JNZ, 0.52% */
+FUSE (0x1a, 0xa8) /* LDAX D; XRA B, 0.52% */
+FUSE (0x23, 0x0d) /* INX H; DCR C, 0.52% */
+FUSE (0x46, 0x77) /* MOV B,M; MOV M,A, 0.52% */
+FUSE (0xa8, 0x46) /* XRA B; MOV B,M, 0.52% */
+FUSE (0x21, 0x7e) /* LXI H; MOV A,M, 0.50% */
+FUSE (0x11, 0x19) /* LXI D; DAD D, 0.49% */
+FUSE (0x0f, 0x4f) /* RRC; MOV C,A, 0.49% */
+FUSE (0x0f, 0xf5) /* RRC; PUSH PSW, 0.49% */
+FUSE (0x3e, 0xdc) /* MVI A; CC, 0.49% */
+FUSE (0x4f, 0xf1) /* MOV C,A; POP PSW, 0.49% */
+FUSE (0xa9, 0x0f) /* XRA C; RRC, 0.49% */
+FUSE (0xf1, 0x05) /* POP PSW; DCR B, 0.49% */
+FUSE (0x2a, 0x46) /* LHLD; MOV B,M, 0.44% */
+FUSE (0xe1, 0xc1) /* POP H; POP B, 0.44% */
+FUSE (0x07, 0x77) /* RLC; MOV M,A, 0.44% */
+FUSE (0x46, 0x21) /* MOV B,M; LXI H, 0.44% */
+FUSE (0x4f, 0x07) /* MOV C,A; RLC, 0.44% */
+FUSE (0x78, 0xa1) /* MOV A,B; ANA C, 0.44% */
+FUSE (0x7e, 0x4f) /* MOV A,M; MOV C,A, 0.44% */
+FUSE (0xa1, 0xe1) /* ANA C; POP H, 0.44% */
+FUSE (0xc1, 0xc8) /* POP B; RZ, 0.44% */
+FUSE (0x3a, 0xfe) /* LDA; CPI, 0.43% */
+FUSE (0x7e, 0xfe) /* MOV A,M; CPI, 0.42% */
+
+/* 32 pairs, 41.51% of the instructions. */
@@ -0,0 +1,588 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Translates pre-decoded blocks to x86-64. The 8080 registers stay in
+ * struct i8080, which is kept in rbx. Instructions that only use
+ * registers are generated inline, with the flags taken from the host
+ * through lahf, and loads read mapped pages directly. Anything else
+ * that touches memory, the stack or the program counter calls the same
+ * function from i8080-opcodes.h the interpreter uses.
+ *
+ * The code buffer is mapped twice through a memfd, once writable and
+ * once executable, so no page is ever both.
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "i8080-jit.h"
+#include "i8080.h"
+
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+
+/* Longest sequence emitted for one instruction, rounded up. */
+#define JIT_INSN_MAX 96
+
+struct jit
+{
+  uint8_t *rw; /* Writable view of the code buffer */
+  uint8_t *rx; /* Executable view of the same pages */
+  size_t used;
+};
+
+/* Everything is addressed as [rbx + disp8]. */
+#define OFFSET(field) ((uint8_t) offsetof (struct i8080, field))
+
+static_assert (offsetof (struct i8080, read_map) < 128,
+               "registers must be reachable with an 8-bit displacement");
+
+/* Offsets of the registers in the order they are encoded in opcodes. */
+static const uint8_t reg_offset[8] = {
+  OFFSET (b), OFFSET (c), OFFSET (d), OFFSET (e),
+  OFFSET (h), OFFSET (l), 0,          OFFSET (a),
+};
+
+#define REG_M 6
+
+#define FLAG_C 0x01
+#define FLAG_AC 0x10
+/* Every flag lahf sets. */
+#define FLAGS_ALL 0xd5
+
+static uint8_t *
+emit8 (uint8_t *p, uint8_t val)
+{
+  *p++ = val;
+  return p;
+}
+
+static uint8_t *
+emit16 (uint8_t *p, uint16_t val)
+{
+  p = emit8 (p, val & UINT8_MAX);
+  return emit8 (p, val >> 8);
+}
+
+static uint8_t *
+emit32 (uint8_t *p, uint32_t val)
+{
+  p = emit16 (p, val & UINT16_MAX);
+  return emit16 (p, val >> 16);
+}
+
+static uint8_t *
+emit64 (uint8_t *p, uint64_t val)
+{
+  p = emit32 (p, val & UINT32_MAX);
+  return emit32 (p, val >> 32);
+}
+
+/* An opcode and ModRM byte for [rbx + disp8] with REG in the reg field. */
+static uint8_t *
+emit_rbx (uint8_t *p, uint8_t opcode, uint8_t reg, uint8_t disp)
+{
+  p = emit8 (p, opcode);
+  p = emit8 (p, 0x43 | (reg << 3));
+  return emit8 (p, disp);
+}
+
+/* add qword [rbx + cycles], imm32 */
+static uint8_t *
+emit_add_cycles (uint8_t *p, uint32_t cycles)
+{
+  p = emit8 (p, 0x48);
+  p = emit_rbx (p, 0x81, 0, OFFSET (cycles));
+  return emit32 (p, cycles);
+}
+
+/*
+ * Call the interpreter's function for an instruction. P is in the
+ * writable view, which is DELTA bytes below the code that runs.
+ */
+static uint8_t *
+emit_call (uint8_t *p, const struct jit_insn *insn, intptr_t delta)
+{
+  intptr_t rel;
+
+  p = emit8 (p, 0x48); /* mov rdi, rbx */
+  p = emit8 (p, 0x89);
+  p = emit8 (p, 0xdf);
+  p = emit8 (p, 0xbe); /* mov esi, imm32 */
+  p = emit32 (p, insn->imm);
+
+  rel = (intptr_t) insn->handler - ((intptr_t) p + delta + 5);
+  if (rel >= INT32_MIN && rel <= INT32_MAX)
+    {
+      p = emit8 (p, 0xe8); /* call rel32 */
+      return emit32 (p, (uint32_t) rel);
+    }
+  p = emit8 (p, 0x48); /* mov rax, imm64 */
+  p = emit8 (p, 0xb8);
+  p = emit64 (p, (uint64_t) (uintptr_t) insn->handler);
+  p = emit8 (p, 0xff); /* call rax */
+  return emit8 (p, 0xd0);
+}
+
+/*
+ * Register pairs are stored high byte first, so load them into ax a
+ * byte at a time. SP is an ordinary little-endian word.
+ */
+static uint8_t *
+emit_load_pair (uint8_t *p, int rp)
+{
+  p = emit8 (p, 0x0f); /* movzx eax, byte [low] */
+  p = emit_rbx (p, 0xb6, 0, reg_offset[rp * 2 + 1]);
+  return emit_rbx (p, 0x8a, 4, reg_offset[rp * 2]); /* mov ah, [high] */
+}
+
+static uint8_t *
+emit_store_pair (uint8_t *p, int rp)
+{
+  p = emit_rbx (p, 0x88, 0, reg_offset[rp * 2 + 1]); /* mov [low], al */
+  return emit_rbx (p, 0x88, 4, reg_offset[rp * 2]);  /* mov [high], ah */
+}
+
+/*
+ * lahf puts SF, ZF, AF, PF and CF in ah at the same positions as the
+ * 8080 flags. Merge the ones in MASK into f, leaving the rest alone, and
+ * mark them as up to date.
+ */
+static uint8_t *
+emit_store_flags (uint8_t *p, uint8_t mask)
+{
+  p = emit_rbx (p, 0x8a, 1, OFFSET (f)); /* mov cl, [f] */
+  p = emit8 (p, 0x80);                   /* and cl, ~mask */
+  p = emit8 (p, 0xe1);
+  p = emit8 (p, ~mask);
+  p = emit8 (p, 0x80); /* and ah, mask */
+  p = emit8 (p, 0xe4);
+  p = emit8 (p, mask);
+  p = emit8 (p, 0x08); /* or ah, cl */
+  p = emit8 (p, 0xcc);
+  p = emit_rbx (p, 0x88, 4, OFFSET (f)); /* mov [f], ah */
+  p = emit_rbx (p, 0x80, 4, OFFSET (lazy_flags)); /* and byte [lazy], ~mask */
+  return emit8 (p, ~mask);
+}
+
+/* xor ah, imm8 */
+static uint8_t *
+emit_xor_ah (uint8_t *p, uint8_t val)
+{
+  p = emit8 (p, 0x80);
+  p = emit8 (p, 0xf4);
+  return emit8 (p, val);
+}
+
+/*
+ * ADD, ADC, SUB, SBB, ANA, XRA, ORA and CMP with a register or an
+ * immediate. The x86 instructions compute the same flags, except that
+ * the 8080 sets AC on subtraction when there is no borrow, and AND sets
+ * it from bit 3 of the operands.
+ */
+static uint8_t *
+emit_alu (uint8_t *p, int alu, const struct jit_insn *insn, bool immediate)
+{
+  /* The x86 opcodes for op al, r/m8 with op al, imm8 two above them. */
+  static const uint8_t host_opcode[8]
+      = { 0x02, 0x12, 0x2a, 0x1a, 0x22, 0x32, 0x0a, 0x3a };
+  uint8_t src;
+
+  src = reg_offset[insn->opcode & 0x07];
+  if (alu == 1 || alu == 3)
+    {
+      /* ADC and SBB need the carry in CF, either from f or bit 8 of
+         lazy_result. */
+      p = emit8 (p, 0x0f); /* movzx ecx, byte [f] */
+      p = emit_rbx (p, 0xb6, 1, OFFSET (f));
+      p = emit_rbx (p, 0xf6, 0, OFFSET (lazy_flags)); /* test byte, C */
+      p = emit8 (p, FLAG_C);
+      p = emit8 (p, 0x74); /* jz +4 */
+      p = emit8 (p, 0x04);
+      p = emit8 (p, 0x0f); /* movzx ecx, byte [lazy_result + 1] */
+      p = emit_rbx (p, 0xb6, 1, OFFSET (lazy_result) + 1);
+      p = emit8 (p, 0xd1); /* shr ecx, 1 */
+      p = emit8 (p, 0xe9);
+    }
+  p = emit8 (p, 0x0f); /* movzx eax, byte [a] */
+  p = emit_rbx (p, 0xb6, 0, OFFSET (a));
+
+  if (alu == 4)
+    {
+      /* ANA: edx = (a | src) & 8, shifted up to AC. */
+      if (immediate)
+        {
+          p = emit8 (p, 0xb9); /* mov ecx, imm32 */
+          p = emit32 (p, insn->imm & UINT8_MAX);
+        }
+      else
+        {
+          p = emit8 (p, 0x0f); /* movzx ecx, byte [src] */
+          p = emit_rbx (p, 0xb6, 1, src);
+        }
+      p = emit8 (p, 0x89); /* mov edx, eax */
+      p = emit8 (p, 0xc2);
+      p = emit8 (p, 0x09); /* or edx, ecx */
+      p = emit8 (p, 0xca);
+      p = emit8 (p, 0x83); /* and edx, 8 */
+      p = emit8 (p, 0xe2);
+      p = emit8 (p, 0x08);
+      p = emit8 (p, 0xd1); /* shl edx, 1 */
+      p = emit8 (p, 0xe2);
+      p = emit8 (p, 0x20); /* and al, cl */
+      p = emit8 (p, 0xc8);
+    }
+  else if (immediate)
+    {
+      p = emit8 (p, host_opcode[alu] + 2);
+      p = emit8 (p, insn->imm & UINT8_MAX);
+    }
+  else
+    p = emit_rbx (p, host_opcode[alu], 0, src);
+
+  if (alu != 7)
+    p = emit_rbx (p, 0x88, 0, OFFSET (a)); /* mov [a], al */
+  p = emit8 (p, 0x9f);                     /* lahf */
+
+  if (alu == 2 || alu == 3 || alu == 7)
+    p = emit_xor_ah (p, FLAG_AC);
+  else if (alu == 4)
+    {
+      p = emit8 (p, 0x80); /* and ah, ~AC */
+      p = emit8 (p, 0xe4);
+      p = emit8 (p, (uint8_t) ~FLAG_AC);
+      p = emit8 (p, 0x08); /* or ah, dl */
+      p = emit8 (p, 0xd4);
+    }
+  else if (alu == 5 || alu == 6)
+    {
+      p = emit8 (p, 0x80); /* and ah, ~AC */
+      p = emit8 (p, 0xe4);
+      p = emit8 (p, (uint8_t) ~FLAG_AC);
+    }
+  return emit_store_flags (p, FLAGS_ALL);
+}
+
+/*
+ * Generate an instruction inline if it can be done without touching
+ * memory. Returns NULL if it has to be called instead.
+ */
+static uint8_t *
+emit_inline (uint8_t *p, const struct jit_insn *insn)
+{
+  uint8_t opcode, dst, src;
+  int rp;
+
+  opcode = insn->opcode;
+  dst = (opcode >> 3) & 0x07;
+  src = opcode & 0x07;
+  rp = (opcode >> 4) & 0x03;
+
+  if ((opcode & 0xc7) == 0x00) /* NOP and the undocumented NOPs */
+    return p;
+  else if (opcode >= 0x40 && opcode <= 0x7f) /* MOV */
+    {
+      if (dst == REG_M || src == REG_M)
+        return NULL;
+      if (dst == src)
+        return p;
+      /* movzx eax, byte [src]; mov [dst], al */
+      p = emit8 (p, 0x0f);
+      p = emit_rbx (p, 0xb6, 0, reg_offset[src]);
+      return emit_rbx (p, 0x88, 0, reg_offset[dst]);
+    }
+  else if ((opcode & 0xc7) == 0x06) /* MVI */
+    {
+      if (dst == REG_M)
+        return NULL;
+      p = emit_rbx (p, 0xc6, 0, reg_offset[dst]); /* mov byte [dst], imm8 */
+      return emit8 (p, insn->imm & UINT8_MAX);
+    }
+  else if ((opcode & 0xcf) == 0x01) /* LXI */
+    {
+      if (rp == 3)
+        {
+          /* mov word [sp], imm16 */
+          p = emit8 (p, 0x66);
+          p = emit_rbx (p, 0xc7, 0, OFFSET (sp));
+          return emit16 (p, insn->imm);
+        }
+      p = emit_rbx (p, 0xc6, 0, reg_offset[rp * 2]);
+      p = emit8 (p, insn->imm >> 8);
+      p = emit_rbx (p, 0xc6, 0, reg_offset[rp * 2 + 1]);
+      return emit8 (p, insn->imm & UINT8_MAX);
+    }
+  else if ((opcode & 0xc7) == 0x03) /* INX and DCX */
+    {
+      /* Bit 3 selects DCX, which is /1 instead of /0 for inc. */
+      if (rp == 3)
+        {
+          /* inc/dec word [sp] */
+          p = emit8 (p, 0x66);
+          return emit_rbx (p, 0xff, (opcode >> 3) & 1, OFFSET (sp));
+        }
+      p = emit_load_pair (p, rp);
+      p = emit8 (p, 0x66); /* inc/dec ax */
+      p = emit8 (p, 0xff);
+      p = emit8 (p, 0xc0 | (opcode & 0x08));
+      return emit_store_pair (p, rp);
+    }
+  else if (opcode == 0xeb) /* XCHG */
+    {
+      /* movzx eax, word [d]; movzx ecx, word [h]; swap them */
+      p = emit8 (p, 0x0f);
+      p = emit_rbx (p, 0xb7, 0, OFFSET (d));
+      p = emit8 (p, 0x0f);
+      p = emit_rbx (p, 0xb7, 1, OFFSET (h));
+      p = emit8 (p, 0x66);
+      p = emit_rbx (p, 0x89, 1, OFFSET (d));
+      p = emit8 (p, 0x66);
+      return emit_rbx (p, 0x89, 0, OFFSET (h));
+    }
+  else if (opcode == 0xf9) /* SPHL */
+    {
+      p = emit_load_pair (p, 2);
+      p = emit8 (p, 0x66); /* mov [sp], ax */
+      return emit_rbx (p, 0x89, 0, OFFSET (sp));
+    }
+  else if (opcode == 0x2f) /* CMA */
+    return emit_rbx (p, 0xf6, 2, OFFSET (a)); /* not byte [a] */
+  else if ((opcode & 0xc6) == 0x04) /* INR and DCR, which keep CY */
+    {
+      if (dst == REG_M)
+        return NULL;
+      /* inc/dec byte [dst] */
+      p = emit_rbx (p, 0xfe, opcode & 0x01, reg_offset[dst]);
+      p = emit8 (p, 0x9f); /* lahf */
+      if (opcode & 0x01)
+        p = emit_xor_ah (p, FLAG_AC);
+      return emit_store_flags (p, FLAGS_ALL & ~FLAG_C);
+    }
+  else if (opcode >= 0x80 && opcode <= 0xbf) /* ALU with a register */
+    {
+      if (src == REG_M)
+        return NULL;
+      return emit_alu (p, dst, insn, false);
+    }
+  else if ((opcode & 0xc7) == 0xc6) /* ALU with an immediate */
+    return emit_alu (p, dst, insn, true);
+
+  return NULL;
+}
+
+/* MOV r, M, LDAX and LDA. */
+static bool
+is_load (uint8_t opcode)
+{
+  return opcode == 0x0a || opcode == 0x1a || opcode == 0x3a
+         || (opcode >= 0x40 && opcode <= 0x7f && opcode != 0x76
+             && (opcode & 0x07) == REG_M);
+}
+
+/*
+ * Read through read_map when the page is mapped and call the
+ * interpreter's function otherwise. Either way the cycles are left for
+ * the caller to add.
+ */
+static uint8_t *
+emit_load (uint8_t *p, const struct jit_insn *insn, intptr_t delta)
+{
+  uint8_t *jz, *jmp;
+
+  if (insn->opcode == 0x3a)
+    {
+      p = emit8 (p, 0xb8); /* mov eax, imm32 */
+      p = emit32 (p, insn->imm);
+    }
+  else
+    p = emit_load_pair (p, insn->opcode < 0x40 ? insn->opcode >> 4 : 2);
+
+  p = emit8 (p, 0x0f); /* movzx ecx, al */
+  p = emit8 (p, 0xb6);
+  p = emit8 (p, 0xc8);
+  p = emit8 (p, 0xc1); /* shr eax, 8 */
+  p = emit8 (p, 0xe8);
+  p = emit8 (p, 0x08);
+  p = emit8 (p, 0x48); /* mov rdx, [rbx + rax * 8 + read_map] */
+  p = emit8 (p, 0x8b);
+  p = emit8 (p, 0x54);
+  p = emit8 (p, 0xc3);
+  p = emit8 (p, OFFSET (read_map));
+  p = emit8 (p, 0x48); /* test rdx, rdx */
+  p = emit8 (p, 0x85);
+  p = emit8 (p, 0xd2);
+  p = emit8 (p, 0x74); /* jz slow */
+  jz = p = emit8 (p, 0);
+
+  p = emit8 (p, 0x0f); /* movzx eax, byte [rdx + rcx] */
+  p = emit8 (p, 0xb6);
+  p = emit8 (p, 0x04);
+  p = emit8 (p, 0x0a);
+  if (insn->opcode < 0x40)
+    p = emit_rbx (p, 0x88, 0, OFFSET (a));
+  else
+    p = emit_rbx (p, 0x88, 0, reg_offset[(insn->opcode >> 3) & 0x07]);
+  p = emit8 (p, 0xeb); /* jmp done */
+  jmp = p = emit8 (p, 0);
+
+  /* slow: the function adds the cycles too, so take them back. */
+  jz[-1] = p - jz;
+  p = emit_call (p, insn, delta);
+  p = emit_add_cycles (p, -(uint32_t) insn->cycles);
+  jmp[-1] = p - jmp;
+  return p;
+}
+
+struct jit *
+jit_create (void)
+{
+  struct jit *jit;
+  void *rw, *rx, *hint;
+  int fd;
+
+  fd = memfd_create ("i8080-jit", MFD_CLOEXEC);
+  if (fd < 0)
+    {
+      perror ("memfd_create");
+      return NULL;
+    }
+  if (ftruncate (fd, JIT_CODE_SIZE) < 0)
+    {
+      perror ("ftruncate");
+      close (fd);
+      return NULL;
+    }
+
+  /*
+   * Ask for the executable view just below this file's code so calls
+   * into the interpreter fit in a rel32. Anywhere else still works.
+   */
+  hint = (void *) (((uintptr_t) &jit_create & ~(uintptr_t) 0xfffff)
+                   - 2 * JIT_CODE_SIZE);
+  rw = mmap (NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  rx = mmap (hint, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+  close (fd);
+  if (rw == MAP_FAILED || rx == MAP_FAILED)
+    {
+      perror ("mmap");
+      if (rw != MAP_FAILED)
+        munmap (rw, JIT_CODE_SIZE);
+      if (rx != MAP_FAILED)
+        munmap (rx, JIT_CODE_SIZE);
+      return NULL;
+    }
+
+  jit = (struct jit *) malloc (sizeof (struct jit));
+  if (jit == NULL)
+    {
+      munmap (rw, JIT_CODE_SIZE);
+      munmap (rx, JIT_CODE_SIZE);
+      return NULL;
+    }
+  jit->rw = (uint8_t *) rw;
+  jit->rx = (uint8_t *) rx;
+  jit->used = 0;
+  return jit;
+}
+
+void
+jit_destroy (struct jit *jit)
+{
+  munmap (jit->rw, JIT_CODE_SIZE);
+  munmap (jit->rx, JIT_CODE_SIZE);
+  free (jit);
+}
+
+void
+jit_reset (struct jit *jit)
+{
+  jit->used = 0;
+}
+
+jit_code
+jit_translate (struct jit *jit, const struct jit_insn *insns, size_t count,
+               uint16_t pc)
+{
+  uint8_t *start, *p, *next;
+  uint32_t pending;
+  size_t i;
+
+  if (JIT_CODE_SIZE - jit->used < (count + 1) * JIT_INSN_MAX)
+    return NULL;
+
+  start = p = &jit->rw[jit->used];
+  p = emit8 (p, 0x53); /* push rbx */
+  p = emit8 (p, 0x48); /* mov rbx, rdi */
+  p = emit8 (p, 0x89);
+  p = emit8 (p, 0xfb);
+
+  /* Only the last instruction can look at the program counter. */
+  p = emit8 (p, 0x66); /* mov word [pc], imm16 */
+  p = emit_rbx (p, 0xc7, 0, OFFSET (pc));
+  p = emit16 (p, pc);
+
+  /* Cycles for inline instructions are added up and stored once. */
+  pending = 0;
+  for (i = 0; i < count; ++i)
+    {
+      if (is_load (insns[i].opcode))
+        {
+          /* A callback may look at the cycle count. */
+          if (pending != 0)
+            p = emit_add_cycles (p, pending);
+          p = emit_load (p, &insns[i], jit->rx - jit->rw);
+          pending = insns[i].cycles;
+          continue;
+        }
+      next = emit_inline (p, &insns[i]);
+      if (next != NULL)
+        {
+          p = next;
+          pending += insns[i].cycles;
+          continue;
+        }
+      if (pending != 0)
+        p = emit_add_cycles (p, pending);
+      pending = 0;
+      p = emit_call (p, &insns[i], jit->rx - jit->rw);
+    }
+  if (pending != 0)
+    p = emit_add_cycles (p, pending);
+
+  p = emit8 (p, 0x5b); /* pop rbx */
+  p = emit8 (p, 0xc3); /* ret */
+
+  /* Keep each block 16-byte aligned. */
+  jit->used = (p - jit->rw + 15) & ~(size_t) 15;
+  return (jit_code) (void *) &jit->rx[start - jit->rw];
+}
@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Native code generation for the block cache. This is internal to
+ * i8080.c and only built for x86-64 Linux with I8080_JIT.
+ */
+
+#ifndef I8080_JIT_H
+#define I8080_JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i8080.h"
+
+typedef void (*jit_handler) (struct i8080 *, uint16_t);
+typedef void (*jit_code) (struct i8080 *);
+
+/* One decoded instruction of a block. */
+struct jit_insn
+{
+  jit_handler handler; /* Called for anything not generated inline */
+  uint16_t imm;        /* Operand */
+  uint8_t opcode;
+  uint8_t cycles;
+};
+
+struct jit;
+
+/* Returns NULL if the code buffer cannot be allocated. */
+struct jit *jit_create (void);
+void jit_destroy (struct jit *);
+/*
+ * Translate a block of instructions that leaves the program counter at
+ * the given address. Returns NULL once the code buffer is full.
+ */
+jit_code jit_translate (struct jit *, const struct jit_insn *, size_t,
+                        uint16_t);
+/* Throw away all translated code. */
+void jit_reset (struct jit *);
+
+#endif /* I8080_JIT_H */
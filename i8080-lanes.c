@@ -0,0 +1,1065 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i8080-lanes.h"
+#include "i8080.h"
+
+#ifndef __GNUC__
+#  error "i8080-lanes.c needs the GNU C vector extensions."
+#endif
+
+#if I8080_LANES != 8 && I8080_LANES != 16 && I8080_LANES != 32
+#  error "I8080_LANES must be 8, 16 or 32."
+#endif
+
+/*
+ * One element per lane. These compile to SSE2 by default and to AVX2
+ * with -mavx2, see I8080_AVX2 in CMakeLists.txt.
+ */
+typedef uint8_t vbyte __attribute__ ((vector_size (I8080_LANES)));
+typedef int8_t vmask __attribute__ ((vector_size (I8080_LANES)));
+typedef uint16_t vword __attribute__ ((vector_size (2 * I8080_LANES)));
+typedef int16_t vwmask __attribute__ ((vector_size (2 * I8080_LANES)));
+
+#define FLAG_C 0x01
+#define FLAG_P 0x04
+#define FLAG_AC 0x10
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+#define FLAGS_ALL (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)
+
+/* Index of each register in reg. */
+#define REG_B 0
+#define REG_C 1
+#define REG_D 2
+#define REG_E 3
+#define REG_H 4
+#define REG_L 5
+#define REG_F 6
+#define REG_A 7
+
+/* Conversions between byte and word vectors, element by element. */
+#define widen(v) __builtin_convertvector ((v), vword)
+#define narrow(v) __builtin_convertvector ((v), vbyte)
+#define word_mask(mask)                                                     \
+  ((vword) __builtin_convertvector ((vmask) (mask), vwmask))
+
+static void lanes_load (struct i8080_lanes *, int);
+static void lanes_store (struct i8080_lanes *, int);
+static void lanes_step (struct i8080_lanes *, uint32_t, uint32_t *,
+                        uint32_t *);
+static uintmax_t lanes_events (struct i8080_lanes *, int, uintmax_t,
+                               uint32_t *, uint32_t *);
+static bool lanes_lockstep (struct i8080_lanes *, uint32_t, const uint32_t *,
+                            const uintmax_t *, uint32_t);
+static uint32_t lanes_match (const struct i8080_lanes *, uint32_t,
+                             const uint32_t *, uint16_t, int);
+static uint8_t lane_read (const struct i8080 *, uint16_t);
+static void lane_write (struct i8080 *, uint16_t, uint8_t);
+static int vector_length (uint8_t);
+static int vector_exec (struct i8080_lanes *, uint32_t, vbyte, uint16_t *,
+                        int, uint8_t, uint16_t, bool *);
+
+void
+i8080_lanes_init (struct i8080_lanes *lanes)
+{
+  int i;
+
+  memset (lanes, 0, sizeof (*lanes));
+  for (i = 0; i < I8080_LANES; ++i)
+    i8080_init (&lanes->cpu[i]);
+}
+
+uint32_t
+i8080_lanes_run (struct i8080_lanes *lanes, uintmax_t budget)
+{
+  uintmax_t target[I8080_LANES], stop[I8080_LANES], next_event;
+  uint32_t shared[I8080_PAGE_COUNT / 32];
+  uint32_t stopped, pending, tracked, group, low, next, bit, rest;
+  struct i8080 *cpu;
+  int i, page;
+
+  stopped = pending = tracked = 0;
+  for (i = 0; i < I8080_LANES; ++i)
+    {
+      cpu = &lanes->cpu[i];
+      lanes_load (lanes, i);
+      if (budget > UINTMAX_MAX - cpu->cycles)
+        target[i] = UINTMAX_MAX;
+      else
+        target[i] = cpu->cycles + budget;
+      if (cpu->int_requested && cpu->int_enable)
+        pending |= UINT32_C (1) << i;
+      else if (cpu->halted)
+        stopped |= UINT32_C (1) << i;
+      if (cpu->snapshot != NULL)
+        tracked |= UINT32_C (1) << i;
+    }
+
+  /*
+   * Pages that every lane reads from the same host memory hold the same
+   * code in all of them, so the instruction bytes need no comparing.
+   */
+  memset (shared, 0, sizeof (shared));
+  for (page = 0; page < I8080_PAGE_COUNT; ++page)
+    {
+      for (i = 1; i < I8080_LANES; ++i)
+        if (lanes->cpu[i].read_map[page] != lanes->cpu[0].read_map[page])
+          break;
+      if (i == I8080_LANES && lanes->cpu[0].read_map[page] != NULL)
+        shared[page / 32] |= UINT32_C (1) << (page % 32);
+    }
+
+  for (;;)
+    {
+      /*
+       * Run the lanes at the lowest address first so the others catch up,
+       * and only until they reach the next lowest.
+       */
+      group = 0;
+      low = next = UINT32_MAX;
+      for (i = 0; i < I8080_LANES; ++i)
+        {
+          bit = UINT32_C (1) << i;
+          stop[i] = target[i];
+          if (lanes->cpu[i].events != NULL)
+            {
+              next_event
+                  = lanes_events (lanes, i, target[i], &stopped, &pending);
+              stop[i] = next_event < target[i] ? next_event : target[i];
+            }
+          if ((stopped & bit) || lanes->cycles[i] >= target[i])
+            continue;
+          if (lanes->pc[i] < low)
+            {
+              next = low;
+              low = lanes->pc[i];
+              group = 0;
+            }
+          else if (lanes->pc[i] > low && lanes->pc[i] < next)
+            next = lanes->pc[i];
+          if (lanes->pc[i] == low)
+            group |= bit;
+        }
+      if (group == 0)
+        break;
+
+      /*
+       * Interrupts are only taken by the normal core, and only it can
+       * save a page before the first write since a snapshot.
+       */
+      if (group & (pending | tracked))
+        {
+          lanes_step (lanes, group & (pending | tracked), &stopped,
+                      &pending);
+          continue;
+        }
+
+      if ((group & (group - 1)) == 0
+          || !lanes_lockstep (lanes, group, shared, stop, next))
+        lanes_step (lanes, group, &stopped, &pending);
+    }
+
+  rest = 0;
+  for (i = 0; i < I8080_LANES; ++i)
+    {
+      lanes_store (lanes, i);
+      if (!lanes->cpu[i].halted)
+        rest |= UINT32_C (1) << i;
+    }
+  return rest;
+}
+
+static void
+lanes_load (struct i8080_lanes *lanes, int i)
+{
+  struct i8080 *cpu = &lanes->cpu[i];
+
+  lanes->reg[REG_B][i] = cpu->b;
+  lanes->reg[REG_C][i] = cpu->c;
+  lanes->reg[REG_D][i] = cpu->d;
+  lanes->reg[REG_E][i] = cpu->e;
+  lanes->reg[REG_H][i] = cpu->h;
+  lanes->reg[REG_L][i] = cpu->l;
+  lanes->reg[REG_F][i] = cpu->f;
+  lanes->reg[REG_A][i] = cpu->a;
+  lanes->sp[i] = cpu->sp;
+  lanes->pc[i] = cpu->pc;
+  lanes->cycles[i] = cpu->cycles;
+}
+
+static void
+lanes_store (struct i8080_lanes *lanes, int i)
+{
+  struct i8080 *cpu = &lanes->cpu[i];
+
+  cpu->b = lanes->reg[REG_B][i];
+  cpu->c = lanes->reg[REG_C][i];
+  cpu->d = lanes->reg[REG_D][i];
+  cpu->e = lanes->reg[REG_E][i];
+  cpu->h = lanes->reg[REG_H][i];
+  cpu->l = lanes->reg[REG_L][i];
+  cpu->f = lanes->reg[REG_F][i];
+  cpu->a = lanes->reg[REG_A][i];
+  cpu->sp = lanes->sp[i];
+  cpu->pc = lanes->pc[i];
+  cpu->cycles = lanes->cycles[i];
+}
+
+/*
+ * Execute one instruction on each lane in GROUP with the normal core.
+ * Only these can change the interrupt state or halt.
+ */
+static void
+lanes_step (struct i8080_lanes *lanes, uint32_t group, uint32_t *stopped,
+            uint32_t *pending)
+{
+  struct i8080 *cpu;
+  uint32_t bit;
+  int i;
+
+  for (; group != 0; group &= group - 1)
+    {
+      i = __builtin_ctz (group);
+      cpu = &lanes->cpu[i];
+      lanes_store (lanes, i);
+      i8080_step (cpu);
+      lanes_load (lanes, i);
+      ++lanes->retired[i];
+      bit = UINT32_C (1) << i;
+      *pending &= ~bit;
+      if (cpu->int_requested && cpu->int_enable)
+        *pending |= bit;
+      else if (cpu->halted)
+        *stopped |= bit;
+    }
+}
+
+/*
+ * Call the events of lane I that are due, and bring the lane up to its
+ * next event while it waits in HLT for an interrupt, as i8080_run()
+ * would. Returns the cycle count of the next event.
+ */
+static uintmax_t
+lanes_events (struct i8080_lanes *lanes, int i, uintmax_t target,
+              uint32_t *stopped, uint32_t *pending)
+{
+  struct i8080 *cpu;
+  uintmax_t next;
+  uint32_t bit;
+
+  cpu = &lanes->cpu[i];
+  bit = UINT32_C (1) << i;
+  for (;;)
+    {
+      next = i8080_events_next (cpu);
+      if (next > lanes->cycles[i])
+        {
+          if (!(*stopped & bit) || !cpu->int_enable || next > target)
+            return next;
+          lanes->cycles[i] = next;
+        }
+      lanes_store (lanes, i);
+      i8080_events_fire (cpu);
+      lanes_load (lanes, i);
+      *pending &= ~bit;
+      *stopped &= ~bit;
+      if (cpu->int_requested && cpu->int_enable)
+        *pending |= bit;
+      else if (cpu->halted)
+        *stopped |= bit;
+    }
+}
+
+/*
+ * Run GROUP, several lanes at the same address, in lockstep for as long
+ * as the lanes stay together below the address LIMIT, there is a kernel
+ * for the instruction and none of them has reached its cycle count in
+ * STOP, the end of its budget or its next event. Returns false if the
+ * first instruction has to go through the normal core.
+ */
+static bool
+lanes_lockstep (struct i8080_lanes *lanes, uint32_t group,
+                const uint32_t *shared, const uintmax_t *stop,
+                uint32_t limit)
+{
+  const struct i8080 *cpu;
+  uintmax_t room, used, steps;
+  uint32_t rest;
+  uint16_t pc, operand;
+  uint8_t opcode;
+  vbyte mask;
+  int i, first, length, cycles;
+  bool split;
+
+  first = __builtin_ctz (group);
+  cpu = &lanes->cpu[first];
+  pc = lanes->pc[first];
+  opcode = lane_read (cpu, pc);
+  length = vector_length (opcode);
+  if (length == 0)
+    return false;
+  group = lanes_match (lanes, group, shared, pc, length);
+  if ((group & (group - 1)) == 0)
+    return false;
+
+  room = UINTMAX_MAX;
+  for (rest = group; rest != 0; rest &= rest - 1)
+    {
+      i = __builtin_ctz (rest);
+      if (stop[i] - lanes->cycles[i] < room)
+        room = stop[i] - lanes->cycles[i];
+    }
+  for (i = 0; i < I8080_LANES; ++i)
+    mask[i] = (group >> i) & 1 ? UINT8_MAX : 0;
+
+  /*
+   * The address, cycles and counts are the same for every lane until the
+   * end, so they are only written back then.
+   */
+  used = steps = 0;
+  split = false;
+  for (;;)
+    {
+      operand = 0;
+      if (length > 1)
+        operand = lane_read (cpu, pc + 1);
+      if (length > 2)
+        operand |= lane_read (cpu, pc + 2) << 8;
+      cycles = vector_exec (lanes, group, mask, &pc, length, opcode, operand,
+                            &split);
+      if (cycles == 0)
+        break;
+      used += cycles;
+      ++steps;
+      if (split || used >= room || pc >= limit)
+        break;
+
+      opcode = lane_read (cpu, pc);
+      length = vector_length (opcode);
+      if (length == 0
+          || lanes_match (lanes, group, shared, pc, length) != group)
+        break;
+    }
+  if (steps == 0)
+    return false;
+
+  for (rest = group; rest != 0; rest &= rest - 1)
+    {
+      i = __builtin_ctz (rest);
+      if (!split)
+        lanes->pc[i] = pc;
+      lanes->cycles[i] += used;
+      lanes->retired[i] += steps;
+    }
+  lanes->lockstep += steps * __builtin_popcount (group);
+  return true;
+}
+
+/*
+ * Drop the lanes of GROUP whose instruction differs from the first one's.
+ * They are at the same address, so they get their turn next.
+ */
+static uint32_t
+lanes_match (const struct i8080_lanes *lanes, uint32_t group,
+             const uint32_t *shared, uint16_t pc, int length)
+{
+  const struct i8080 *first;
+  uint32_t match, rest;
+  uint16_t last;
+  uint8_t code[3];
+  int i, j;
+
+  first = &lanes->cpu[__builtin_ctz (group)];
+  last = pc + length - 1;
+  if ((shared[pc / I8080_PAGE_SIZE / 32] >> (pc / I8080_PAGE_SIZE % 32) & 1)
+      && (shared[last / I8080_PAGE_SIZE / 32]
+              >> (last / I8080_PAGE_SIZE % 32)
+          & 1))
+    return group;
+
+  for (j = 0; j < length; ++j)
+    code[j] = lane_read (first, pc + j);
+  match = group;
+  for (rest = group & (group - 1); rest != 0; rest &= rest - 1)
+    {
+      i = __builtin_ctz (rest);
+      for (j = 0; j < length; ++j)
+        if (lane_read (&lanes->cpu[i], pc + j) != code[j])
+          {
+            match &= ~(UINT32_C (1) << i);
+            break;
+          }
+    }
+  return match;
+}
+
+/* The same as read_byte() and write_byte() in i8080.c, without a cache. */
+static uint8_t
+lane_read (const struct i8080 *cpu, uint16_t address)
+{
+  const uint8_t *page;
+
+  page = cpu->read_map[address / I8080_PAGE_SIZE];
+  if (page != NULL)
+    return page[address % I8080_PAGE_SIZE];
+  return cpu->read_byte (cpu->user_data, address);
+}
+
+static void
+lane_write (struct i8080 *cpu, uint16_t address, uint8_t value)
+{
+  uint8_t *page;
+
+  page = cpu->write_map[address / I8080_PAGE_SIZE];
+  if (page != NULL)
+    page[address % I8080_PAGE_SIZE] = value;
+  else
+    cpu->write_byte (cpu->user_data, address, value);
+}
+
+/*
+ * Length of the instructions vector_exec() handles. The ones that halt,
+ * do I/O, change the interrupt state or need DAA return 0.
+ */
+static int
+vector_length (uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case 0x27: /* DAA */
+    case 0x76: /* HLT */
+    case 0xd3: /* OUT */
+    case 0xdb: /* IN */
+    case 0xf3: /* DI */
+    case 0xfb: /* EI */
+      return 0;
+    case 0x22: /* SHLD */
+    case 0x2a: /* LHLD */
+    case 0x32: /* STA */
+    case 0x3a: /* LDA */
+    case 0xc3: /* JMP */
+    case 0xcb:
+    case 0xcd: /* CALL */
+    case 0xdd:
+    case 0xed:
+    case 0xfd:
+      return 3;
+    }
+
+  switch (opcode & 0xc7)
+    {
+    case 0x01:
+      return (opcode & 0x08) ? 1 : 3; /* DAD or LXI */
+    case 0x06: /* MVI */
+    case 0xc6: /* ALU immediate */
+      return 2;
+    case 0xc2: /* Jcc */
+    case 0xc4: /* Ccc */
+      return 3;
+    default:
+      return 1;
+    }
+}
+
+static inline vbyte
+load_bytes (const uint8_t *src)
+{
+  vbyte v;
+
+  memcpy (&v, src, sizeof (v));
+  return v;
+}
+
+static inline void
+store_bytes (uint8_t *dst, vbyte v, vbyte mask)
+{
+  v = (v & mask) | (load_bytes (dst) & ~mask);
+  memcpy (dst, &v, sizeof (v));
+}
+
+static inline vword
+load_words (const uint16_t *src)
+{
+  vword v;
+
+  memcpy (&v, src, sizeof (v));
+  return v;
+}
+
+static inline void
+store_words (uint16_t *dst, vword v, vword mask)
+{
+  v = (v & mask) | (load_words (dst) & ~mask);
+  memcpy (dst, &v, sizeof (v));
+}
+
+static inline bool
+all_zero (vbyte v)
+{
+  uint64_t words[I8080_LANES / 8], any;
+  size_t i;
+
+  memcpy (words, &v, sizeof (words));
+  for (any = 0, i = 0; i < I8080_LANES / 8; ++i)
+    any |= words[i];
+  return any == 0;
+}
+
+/*
+ * Memory is accessed one lane at a time, each through its own maps or
+ * callbacks, in the same order as the normal core.
+ */
+static vbyte
+gather (struct i8080_lanes *lanes, uint32_t group, vword address)
+{
+  vbyte v = {};
+  int i;
+
+  for (; group != 0; group &= group - 1)
+    {
+      i = __builtin_ctz (group);
+      v[i] = lane_read (&lanes->cpu[i], address[i]);
+    }
+  return v;
+}
+
+static void
+scatter (struct i8080_lanes *lanes, uint32_t group, vword address, vbyte v)
+{
+  int i;
+
+  for (; group != 0; group &= group - 1)
+    {
+      i = __builtin_ctz (group);
+      lane_write (&lanes->cpu[i], address[i], v[i]);
+    }
+}
+
+static vword
+gather_word (struct i8080_lanes *lanes, uint32_t group, vword address)
+{
+  vword low;
+
+  low = widen (gather (lanes, group, address));
+  return low | (widen (gather (lanes, group, address + 1)) << 8);
+}
+
+static void
+scatter_word (struct i8080_lanes *lanes, uint32_t group, vword address,
+              vword v)
+{
+  scatter (lanes, group, address, narrow (v));
+  scatter (lanes, group, address + 1, narrow (v >> 8));
+}
+
+/*
+ * S, Z and P of each result. Folding the bits gives the same parity as
+ * parity_table without a lookup per lane.
+ */
+static inline vbyte
+szp_flags (vbyte result)
+{
+  vbyte parity;
+
+  parity = result ^ (result >> 4);
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  return (result & FLAG_S) | ((vbyte) (result == 0) & FLAG_Z)
+         | ((~parity & 1) << 2);
+}
+
+/* Register pairs in the order of the opcode's rp field, SP last. */
+static vword
+get_pair (struct i8080_lanes *lanes, int rp)
+{
+  if (rp == 3)
+    return load_words (lanes->sp);
+  return (widen (load_bytes (lanes->reg[2 * rp])) << 8)
+         | widen (load_bytes (lanes->reg[2 * rp + 1]));
+}
+
+static void
+set_pair (struct i8080_lanes *lanes, int rp, vword v, vbyte mask)
+{
+  if (rp == 3)
+    store_words (lanes->sp, v, word_mask (mask));
+  else
+    {
+      store_bytes (lanes->reg[2 * rp], narrow (v >> 8), mask);
+      store_bytes (lanes->reg[2 * rp + 1], narrow (v), mask);
+    }
+}
+
+/*
+ * The ALU instructions, with the flags worked out as in op_add() and
+ * friends in i8080.c.
+ */
+static void
+vector_alu (struct i8080_lanes *lanes, int op, vbyte val, vbyte mask)
+{
+  vbyte a, f, result, carry, aux;
+  vword tmp16;
+
+  a = load_bytes (lanes->reg[REG_A]);
+  f = load_bytes (lanes->reg[REG_F]);
+  carry = f & FLAG_C;
+  switch (op)
+    {
+    case 0: /* ADD */
+    case 1: /* ADC */
+      tmp16 = widen (a) + widen (val);
+      if (op == 1)
+        tmp16 += widen (carry);
+      result = narrow (tmp16);
+      carry = narrow (tmp16 >> 8) & FLAG_C;
+      aux = (a ^ val ^ result) & FLAG_AC;
+      break;
+    case 2: /* SUB */
+    case 3: /* SBB */
+    case 7: /* CMP */
+      tmp16 = widen (a) - widen (val);
+      if (op == 3)
+        tmp16 -= widen (carry);
+      result = narrow (tmp16);
+      carry = narrow (tmp16 >> 8) & FLAG_C;
+      aux = ~(a ^ val ^ result) & FLAG_AC;
+      break;
+    case 4: /* ANA */
+      result = a & val;
+      carry = (vbyte) {};
+      aux = ((a | val) << 1) & FLAG_AC;
+      break;
+    default: /* XRA, ORA */
+      result = op == 5 ? a ^ val : a | val;
+      carry = aux = (vbyte) {};
+      break;
+    }
+
+  f = (f & ~FLAGS_ALL) | szp_flags (result) | aux | carry;
+  store_bytes (lanes->reg[REG_F], f, mask);
+  if (op != 7)
+    store_bytes (lanes->reg[REG_A], result, mask);
+}
+
+/* INR and DCR, which leave the carry flag alone. */
+static vbyte
+vector_inr (struct i8080_lanes *lanes, vbyte val, bool decrement, vbyte mask)
+{
+  vbyte result, aux, f;
+
+  result = decrement ? val - 1 : val + 1;
+  aux = (val ^ 1 ^ result) & FLAG_AC;
+  if (decrement)
+    aux ^= FLAG_AC;
+  f = load_bytes (lanes->reg[REG_F]);
+  f = (f & ~(FLAGS_ALL & ~FLAG_C)) | szp_flags (result) | aux;
+  store_bytes (lanes->reg[REG_F], f, mask);
+  return result;
+}
+
+/*
+ * Move the lanes in MASK to their own TARGET. Sets SPLIT and stores the
+ * addresses in pc if they are not all the same.
+ */
+static void
+vector_branch (struct i8080_lanes *lanes, vbyte mask, uint16_t *pc,
+               vword target, bool *split)
+{
+  vword wmask;
+  int i;
+
+  i = 0;
+  while (mask[i] == 0)
+    ++i;
+  wmask = word_mask (mask);
+  *pc = target[i];
+  if (all_zero (narrow ((vword) ((target ^ *pc) & wmask) != 0)))
+    return;
+  store_words (lanes->pc, target, wmask);
+  *split = true;
+}
+
+/*
+ * Execute an instruction accepted by vector_length() on the lanes in
+ * GROUP, which are all at PC and selected by MASK, and move PC on.
+ * Returns its cycles, or 0 without executing anything for a conditional
+ * call or return that not every lane takes. If the lanes branch apart,
+ * SPLIT is set and their addresses are stored in pc instead.
+ */
+static int
+vector_exec (struct i8080_lanes *lanes, uint32_t group, vbyte mask,
+             uint16_t *pc, int length, uint8_t opcode, uint16_t operand,
+             bool *split)
+{
+  static const uint8_t condition_flags[4] = { FLAG_Z, FLAG_C, FLAG_P, FLAG_S };
+  vbyte a, f, v, taken;
+  vword pair, sp, next;
+  int dst, src, rp;
+
+  dst = (opcode >> 3) & 7;
+  src = opcode & 7;
+  rp = dst >> 1;
+  next = (vword) {} + (uint16_t) (*pc + length);
+  *pc += length;
+
+  /* Conditions are taken where the flag matches the low bit of DST. */
+  if ((opcode & 0xc0) == 0xc0 && (src == 0 || src == 2 || src == 4))
+    {
+      f = load_bytes (lanes->reg[REG_F]);
+      taken = (vbyte) ((f & condition_flags[rp]) != 0);
+      if (!(dst & 1))
+        taken = ~taken;
+      taken &= mask;
+      if (all_zero (taken))
+        return src == 0 ? 5 : src == 2 ? 10 : 11;
+      if (!all_zero (taken ^ mask))
+        {
+          if (src != 2)
+            {
+              *pc -= length;
+              return 0;
+            }
+          /* Jcc costs the same either way. */
+          vector_branch (lanes, mask, pc,
+                         (((vword) {} + operand) & word_mask (taken))
+                             | (next & ~word_mask (taken)),
+                         split);
+          return 10;
+        }
+    }
+
+  switch (opcode)
+    {
+    case 0x00: /* NOP */
+    case 0x08:
+    case 0x10:
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+      return 4;
+
+    case 0x01: /* LXI */
+    case 0x11:
+    case 0x21:
+    case 0x31:
+      set_pair (lanes, rp, (vword) {} + operand, mask);
+      return 10;
+
+    case 0x02: /* STAX */
+    case 0x12:
+      scatter (lanes, group, get_pair (lanes, rp),
+               load_bytes (lanes->reg[REG_A]));
+      return 7;
+
+    case 0x0a: /* LDAX */
+    case 0x1a:
+      store_bytes (lanes->reg[REG_A],
+                   gather (lanes, group, get_pair (lanes, rp)), mask);
+      return 7;
+
+    case 0x03: /* INX */
+    case 0x13:
+    case 0x23:
+    case 0x33:
+      set_pair (lanes, rp, get_pair (lanes, rp) + 1, mask);
+      return 5;
+
+    case 0x0b: /* DCX */
+    case 0x1b:
+    case 0x2b:
+    case 0x3b:
+      set_pair (lanes, rp, get_pair (lanes, rp) - 1, mask);
+      return 5;
+
+    case 0x09: /* DAD */
+    case 0x19:
+    case 0x29:
+    case 0x39:
+      pair = get_pair (lanes, 2) + get_pair (lanes, rp);
+      v = narrow ((vword) (pair < get_pair (lanes, 2))) & FLAG_C;
+      f = load_bytes (lanes->reg[REG_F]);
+      store_bytes (lanes->reg[REG_F], (f & ~FLAG_C) | v, mask);
+      set_pair (lanes, 2, pair, mask);
+      return 10;
+
+    case 0x04: /* INR */
+    case 0x0c:
+    case 0x14:
+    case 0x1c:
+    case 0x24:
+    case 0x2c:
+    case 0x3c:
+    case 0x05: /* DCR */
+    case 0x0d:
+    case 0x15:
+    case 0x1d:
+    case 0x25:
+    case 0x2d:
+    case 0x3d:
+      v = vector_inr (lanes, load_bytes (lanes->reg[dst]), src == 5, mask);
+      store_bytes (lanes->reg[dst], v, mask);
+      return 5;
+
+    case 0x34: /* INR M */
+    case 0x35: /* DCR M */
+      pair = get_pair (lanes, 2);
+      v = vector_inr (lanes, gather (lanes, group, pair), src == 5, mask);
+      scatter (lanes, group, pair, v);
+      return 10;
+
+    case 0x06: /* MVI */
+    case 0x0e:
+    case 0x16:
+    case 0x1e:
+    case 0x26:
+    case 0x2e:
+    case 0x3e:
+      store_bytes (lanes->reg[dst], (vbyte) {} + (uint8_t) operand, mask);
+      return 7;
+
+    case 0x36: /* MVI M */
+      scatter (lanes, group, get_pair (lanes, 2),
+               (vbyte) {} + (uint8_t) operand);
+      return 10;
+
+    case 0x07: /* RLC */
+    case 0x0f: /* RRC */
+    case 0x17: /* RAL */
+    case 0x1f: /* RAR */
+      a = load_bytes (lanes->reg[REG_A]);
+      f = load_bytes (lanes->reg[REG_F]);
+      v = f & FLAG_C;
+      if (opcode & 0x08)
+        f = (f & ~FLAG_C) | (a & FLAG_C);
+      else
+        f = (f & ~FLAG_C) | (a >> 7);
+      if (opcode == 0x07)
+        a = (a << 1) | (a >> 7);
+      else if (opcode == 0x0f)
+        a = (a >> 1) | (a << 7);
+      else if (opcode == 0x17)
+        a = (a << 1) | v;
+      else
+        a = (a >> 1) | (v << 7);
+      store_bytes (lanes->reg[REG_A], a, mask);
+      store_bytes (lanes->reg[REG_F], f, mask);
+      return 4;
+
+    case 0x22: /* SHLD */
+      pair = (vword) {} + operand;
+      scatter (lanes, group, pair, load_bytes (lanes->reg[REG_L]));
+      scatter (lanes, group, pair + 1, load_bytes (lanes->reg[REG_H]));
+      return 16;
+
+    case 0x2a: /* LHLD */
+      pair = (vword) {} + operand;
+      store_bytes (lanes->reg[REG_L], gather (lanes, group, pair), mask);
+      store_bytes (lanes->reg[REG_H], gather (lanes, group, pair + 1), mask);
+      return 16;
+
+    case 0x2f: /* CMA */
+      store_bytes (lanes->reg[REG_A], ~load_bytes (lanes->reg[REG_A]), mask);
+      return 4;
+
+    case 0x32: /* STA */
+      scatter (lanes, group, (vword) {} + operand,
+               load_bytes (lanes->reg[REG_A]));
+      return 13;
+
+    case 0x3a: /* LDA */
+      store_bytes (lanes->reg[REG_A],
+                   gather (lanes, group, (vword) {} + operand), mask);
+      return 13;
+
+    case 0x37: /* STC */
+      store_bytes (lanes->reg[REG_F], load_bytes (lanes->reg[REG_F]) | FLAG_C,
+                   mask);
+      return 4;
+
+    case 0x3f: /* CMC */
+      store_bytes (lanes->reg[REG_F], load_bytes (lanes->reg[REG_F]) ^ FLAG_C,
+                   mask);
+      return 4;
+
+    case 0x40 ... 0x75: /* MOV */
+    case 0x77 ... 0x7f:
+      if (src == 6)
+        v = gather (lanes, group, get_pair (lanes, 2));
+      else
+        v = load_bytes (lanes->reg[src]);
+      if (dst == 6)
+        scatter (lanes, group, get_pair (lanes, 2), v);
+      else
+        store_bytes (lanes->reg[dst], v, mask);
+      return src == 6 || dst == 6 ? 7 : 5;
+
+    case 0x80 ... 0xbf: /* ALU */
+      if (src == 6)
+        v = gather (lanes, group, get_pair (lanes, 2));
+      else
+        v = load_bytes (lanes->reg[src]);
+      vector_alu (lanes, dst, v, mask);
+      return src == 6 ? 7 : 4;
+
+    case 0xc6: /* ALU immediate */
+    case 0xce:
+    case 0xd6:
+    case 0xde:
+    case 0xe6:
+    case 0xee:
+    case 0xf6:
+    case 0xfe:
+      vector_alu (lanes, dst, (vbyte) {} + (uint8_t) operand, mask);
+      return 7;
+
+    case 0xc0: /* Rcc, taken by every lane */
+    case 0xc8:
+    case 0xd0:
+    case 0xd8:
+    case 0xe0:
+    case 0xe8:
+    case 0xf0:
+    case 0xf8:
+    case 0xc9: /* RET */
+    case 0xd9:
+      sp = load_words (lanes->sp);
+      vector_branch (lanes, mask, pc, gather_word (lanes, group, sp), split);
+      store_words (lanes->sp, sp + 2, word_mask (mask));
+      return src == 0 ? 11 : 10;
+
+    case 0xc1: /* POP */
+    case 0xd1:
+    case 0xe1:
+    case 0xf1:
+      sp = load_words (lanes->sp);
+      pair = gather_word (lanes, group, sp);
+      store_words (lanes->sp, sp + 2, word_mask (mask));
+      if (rp != 3)
+        set_pair (lanes, rp, pair, mask);
+      else
+        {
+          /* Make sure the unused bits are set. */
+          store_bytes (lanes->reg[REG_F], (narrow (pair) | 0x02) & ~0x28,
+                       mask);
+          store_bytes (lanes->reg[REG_A], narrow (pair >> 8), mask);
+        }
+      return 10;
+
+    case 0xc2: /* Jcc, taken by every lane */
+    case 0xca:
+    case 0xd2:
+    case 0xda:
+    case 0xe2:
+    case 0xea:
+    case 0xf2:
+    case 0xfa:
+    case 0xc3: /* JMP */
+    case 0xcb:
+      *pc = operand;
+      return 10;
+
+    case 0xc4: /* Ccc, taken by every lane */
+    case 0xcc:
+    case 0xd4:
+    case 0xdc:
+    case 0xe4:
+    case 0xec:
+    case 0xf4:
+    case 0xfc:
+    case 0xcd: /* CALL */
+    case 0xdd:
+    case 0xed:
+    case 0xfd:
+      sp = load_words (lanes->sp) - 2;
+      scatter_word (lanes, group, sp, next);
+      store_words (lanes->sp, sp, word_mask (mask));
+      *pc = operand;
+      return 17;
+
+    case 0xc5: /* PUSH */
+    case 0xd5:
+    case 0xe5:
+    case 0xf5:
+      if (rp != 3)
+        pair = get_pair (lanes, rp);
+      else
+        {
+          /* Make sure the unused bits are set. */
+          f = (load_bytes (lanes->reg[REG_F]) | 0x02) & ~0x28;
+          store_bytes (lanes->reg[REG_F], f, mask);
+          pair = (widen (load_bytes (lanes->reg[REG_A])) << 8) | widen (f);
+        }
+      sp = load_words (lanes->sp) - 2;
+      scatter_word (lanes, group, sp, pair);
+      store_words (lanes->sp, sp, word_mask (mask));
+      return 11;
+
+    case 0xc7: /* RST */
+    case 0xcf:
+    case 0xd7:
+    case 0xdf:
+    case 0xe7:
+    case 0xef:
+    case 0xf7:
+    case 0xff:
+      sp = load_words (lanes->sp) - 2;
+      scatter_word (lanes, group, sp, next);
+      store_words (lanes->sp, sp, word_mask (mask));
+      *pc = opcode & 0x38;
+      return 11;
+
+    case 0xe3: /* XTHL */
+      sp = load_words (lanes->sp);
+      pair = gather_word (lanes, group, sp);
+      scatter_word (lanes, group, sp, get_pair (lanes, 2));
+      set_pair (lanes, 2, pair, mask);
+      return 18;
+
+    case 0xe9: /* PCHL */
+      vector_branch (lanes, mask, pc, get_pair (lanes, 2), split);
+      return 5;
+
+    case 0xeb: /* XCHG */
+      pair = get_pair (lanes, 1);
+      set_pair (lanes, 1, get_pair (lanes, 2), mask);
+      set_pair (lanes, 2, pair, mask);
+      return 5;
+
+    case 0xf9: /* SPHL */
+      store_words (lanes->sp, get_pair (lanes, 2), word_mask (mask));
+      return 5;
+
+    default:
+      *pc -= length;
+      return 0;
+    }
+}
@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runs up to 32 copies of the CPU in lockstep. While a group of lanes is
+ * at the same address with the same instruction bytes, most instructions
+ * are executed for all of them at once on a structure of arrays. HLT,
+ * IN, OUT, EI, DI and DAA, and any lane on its own, are stepped through
+ * the normal core.
+ */
+
+#ifndef I8080_LANES_H
+#define I8080_LANES_H
+
+#include <stdint.h>
+
+#include "i8080.h"
+
+/* Lanes in a group, one of 8, 16 or 32. */
+#ifndef I8080_LANES
+#  define I8080_LANES 16
+#endif
+
+struct i8080_lanes
+{
+  /*
+   * Each lane is set up and read through its own CPU. Memory maps,
+   * callbacks, interrupts and scheduled events work as usual, except
+   * that io_exit is ignored. A lane stops after the instruction that
+   * reaches an event, and one halted with interrupts enabled waits for
+   * its next event, as in i8080_run(). Lockstep memory accesses skip
+   * the block cache, so it must not be enabled in a lane that writes to
+   * its code. Lanes holding a snapshot are always stepped through the
+   * normal core.
+   */
+  struct i8080 cpu[I8080_LANES];
+  uintmax_t retired[I8080_LANES]; /* Instructions executed by each lane */
+  uintmax_t lockstep;             /* Of those, how many ran in lockstep */
+  /*
+   * Registers of every lane while i8080_lanes_run() is running, indexed
+   * by the register field of the opcode. F takes the place of M.
+   */
+  uint8_t reg[8][I8080_LANES];
+  uint16_t sp[I8080_LANES];
+  uint16_t pc[I8080_LANES];
+  uintmax_t cycles[I8080_LANES];
+};
+
+void i8080_lanes_init (struct i8080_lanes *);
+/*
+ * Give every lane the cycle budget and run until each one has used it
+ * or halted. Interrupts are taken between instructions as in
+ * i8080_step(). Returns a mask of the lanes that have not halted.
+ */
+uint32_t i8080_lanes_run (struct i8080_lanes *, uintmax_t);
+
+#endif /* I8080_LANES_H */
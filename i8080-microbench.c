@@ -0,0 +1,520 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times tight loops of each instruction family through
+ * i8080_exec_opcode(), so a change to one helper or to the memory path
+ * shows up against the instructions that use it. Each loop repeats a
+ * short sequence of the family's instructions and jumps back to the
+ * start. The jump is counted as an instruction too.
+ *
+ * With -l the same loops run on I8080_LANES machines, once one after the
+ * other through i8080_run() and once in lockstep through
+ * i8080_lanes_run(), for the same number of slices. Each lane must then
+ * match its scalar machine in every register, the cycle and instruction
+ * counts and memory, or the program exits with status 1.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080-lanes.h"
+#include "i8080.h"
+
+#define CODE_START 0x0100
+#define SUBROUTINE 0x0f00 /* Holds a RET for CALL */
+#define DATA 0x8000       /* HL and the LHLD/SHLD address */
+#define STACK 0xf000
+#define REPEAT 32          /* Copies of the sequence in each loop */
+#define LANES_BUDGET 10000 /* Cycles per call with -l */
+
+/* Marks an operand to be replaced with the address after the instruction. */
+#define NEXT_ADDRESS 0xffff
+
+struct insn
+{
+  uint8_t opcode;
+  uint16_t operand; /* Used according to the instruction length */
+};
+
+struct family
+{
+  const char *name;
+  struct insn insns[8];
+  int count;
+};
+
+static const struct family families[] = {
+  { "MOV r,r",
+    { { 0x41, 0 }, { 0x4a, 0 }, { 0x53, 0 }, { 0x5c, 0 },
+      { 0x78, 0 }, { 0x79, 0 }, { 0x47, 0 }, { 0x4f, 0 } },
+    8 },
+  { "MOV r,M",
+    { { 0x46, 0 }, { 0x4e, 0 }, { 0x56, 0 }, { 0x5e, 0 }, { 0x7e, 0 } },
+    5 },
+  { "MOV M,r",
+    { { 0x70, 0 }, { 0x71, 0 }, { 0x72, 0 }, { 0x73, 0 }, { 0x77, 0 } },
+    5 },
+  { "ALU reg",
+    { { 0x80, 0 }, { 0x89, 0 }, { 0x92, 0 }, { 0x9b, 0 },
+      { 0xa0, 0 }, { 0xa9, 0 }, { 0xb2, 0 }, { 0xbb, 0 } },
+    8 },
+  { "ALU imm",
+    { { 0xc6, 0x12 }, { 0xce, 0x34 }, { 0xd6, 0x56 }, { 0xde, 0x78 },
+      { 0xe6, 0x9a }, { 0xee, 0xbc }, { 0xf6, 0xde }, { 0xfe, 0xf0 } },
+    8 },
+  { "INX/DCX",
+    { { 0x03, 0 }, { 0x13, 0 }, { 0x23, 0 }, { 0x33, 0 },
+      { 0x0b, 0 }, { 0x1b, 0 }, { 0x2b, 0 }, { 0x3b, 0 } },
+    8 },
+  { "DAD",
+    { { 0x09, 0 }, { 0x19, 0 }, { 0x29, 0 }, { 0x39, 0 } },
+    4 },
+  { "PUSH/POP",
+    { { 0xc5, 0 }, { 0xc1, 0 }, { 0xd5, 0 }, { 0xd1, 0 },
+      { 0xe5, 0 }, { 0xe1, 0 }, { 0xf5, 0 }, { 0xf1, 0 } },
+    8 },
+  { "CALL/RET",
+    { { 0xcd, SUBROUTINE } },
+    1 },
+  { "Jcc",
+    { { 0xc2, NEXT_ADDRESS }, { 0xca, NEXT_ADDRESS }, { 0xd2, NEXT_ADDRESS },
+      { 0xda, NEXT_ADDRESS }, { 0xe2, NEXT_ADDRESS }, { 0xea, NEXT_ADDRESS },
+      { 0xf2, NEXT_ADDRESS }, { 0xfa, NEXT_ADDRESS } },
+    8 },
+  { "LHLD/SHLD",
+    { { 0x2a, DATA }, { 0x22, DATA + 2 } },
+    2 },
+  { "XTHL",
+    { { 0xe3, 0 } },
+    1 },
+};
+
+#define FAMILY_COUNT (sizeof (families) / sizeof (families[0]))
+
+struct machine
+{
+  struct i8080 cpu;
+  uint8_t memory[UINT16_MAX + 1];
+};
+
+static void usage (void);
+static int insn_length (uint8_t);
+static void load_family (struct machine *, const struct family *, bool);
+static double run_family (struct machine *, uintmax_t);
+static void load_lanes (struct machine *, const struct family *, bool);
+static double run_scalar (struct machine *, uintmax_t, uintmax_t *,
+                          uintmax_t *);
+static double run_lanes (struct i8080_lanes *, struct machine *,
+                         const uintmax_t *);
+static bool check_lanes (const struct machine *, const struct machine *,
+                         const struct i8080_lanes *, const uintmax_t *,
+                         const char *);
+static uint8_t machine_read_byte (void *, uint16_t);
+static void machine_write_byte (void *, uint16_t, uint8_t);
+
+int
+main (int argc, char **argv)
+{
+  struct machine *machine;
+  struct i8080_lanes *lanes;
+  uintmax_t count, scalar_count, lanes_count, rounds[2];
+  uintmax_t retired[I8080_LANES];
+  double seconds, scalar_seconds, lanes_seconds;
+  size_t i;
+  bool json, callbacks, use_lanes, matched;
+  int ch, lane;
+
+  count = 20000000;
+  json = callbacks = use_lanes = false;
+  while ((ch = getopt (argc, argv, "jln:u")) != -1)
+    {
+      switch (ch)
+        {
+        case 'j':
+          json = true;
+          break;
+        case 'l':
+          use_lanes = true;
+          break;
+        case 'n':
+          count = strtoumax (optarg, NULL, 10);
+          if (count == 0)
+            usage ();
+          break;
+        case 'u':
+          callbacks = true;
+          break;
+        default:
+          usage ();
+        }
+    }
+  if (optind != argc)
+    usage ();
+
+  /* With -l the scalar machines come first and the lanes' copies after. */
+  machine = (struct machine *) calloc (use_lanes ? 2 * I8080_LANES : 1,
+                                       sizeof (struct machine));
+  lanes = (struct i8080_lanes *) malloc (sizeof (struct i8080_lanes));
+  if (machine == NULL || lanes == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      exit (1);
+    }
+
+  if (use_lanes)
+    {
+      if (json)
+        printf ("{\"callbacks\": %s, \"lanes\": %d, \"families\": [",
+                callbacks ? "true" : "false", I8080_LANES);
+      else
+        printf ("%-10s %8s %8s %8s %9s\n", "family", "scalar", "lanes",
+                "speedup", "lockstep");
+      matched = true;
+      for (i = 0; i < FAMILY_COUNT; ++i)
+        {
+          load_lanes (machine, &families[i], callbacks);
+          scalar_seconds = run_scalar (machine, count, rounds, retired);
+          load_lanes (machine + I8080_LANES, &families[i], callbacks);
+          lanes_seconds = run_lanes (lanes, machine + I8080_LANES, rounds);
+          scalar_count = lanes_count = 0;
+          for (lane = 0; lane < I8080_LANES; ++lane)
+            {
+              scalar_count += retired[lane];
+              lanes_count += lanes->retired[lane];
+            }
+          scalar_seconds = scalar_seconds * 1e9 / (double) scalar_count;
+          lanes_seconds = lanes_seconds * 1e9 / (double) lanes_count;
+          if (json)
+            printf ("%s\n  {\"name\": \"%s\", \"scalar_ns_per_op\": %.3f, "
+                    "\"lanes_ns_per_op\": %.3f, \"lockstep\": %.3f}",
+                    i == 0 ? "" : ",", families[i].name, scalar_seconds,
+                    lanes_seconds,
+                    (double) lanes->lockstep / (double) lanes_count);
+          else
+            printf ("%-10s %8.2f %8.2f %7.2fx %8.1f%%\n", families[i].name,
+                    scalar_seconds, lanes_seconds,
+                    scalar_seconds / lanes_seconds,
+                    100.0 * (double) lanes->lockstep / (double) lanes_count);
+          if (!check_lanes (machine, machine + I8080_LANES, lanes, retired,
+                            families[i].name))
+            matched = false;
+        }
+      if (json)
+        printf ("\n]}\n");
+      free (lanes);
+      free (machine);
+      return matched ? 0 : 1;
+    }
+
+  if (json)
+    printf ("{\"callbacks\": %s, \"instructions\": %ju, \"families\": [",
+            callbacks ? "true" : "false", count);
+  else
+    printf ("%-10s %8s\n", "family", "ns/op");
+  for (i = 0; i < FAMILY_COUNT; ++i)
+    {
+      load_family (machine, &families[i], callbacks);
+      seconds = run_family (machine, count);
+      if (json)
+        printf ("%s\n  {\"name\": \"%s\", \"ns_per_op\": %.3f}",
+                i == 0 ? "" : ",", families[i].name,
+                seconds * 1e9 / (double) count);
+      else
+        printf ("%-10s %8.2f\n", families[i].name,
+                seconds * 1e9 / (double) count);
+    }
+  if (json)
+    printf ("\n]}\n");
+
+  free (lanes);
+  free (machine);
+  return 0;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "i8080-microbench [-jlu] [-n count]\n");
+  fprintf (stderr, "  -j  Print the results as JSON\n");
+  fprintf (stderr,
+           "  -l  Compare %d machines in lockstep against one by one\n",
+           I8080_LANES);
+  fprintf (stderr, "  -n  Instructions to run for each family\n");
+  fprintf (stderr,
+           "  -u  Access memory through the callbacks, not the maps\n");
+  exit (1);
+}
+
+static int
+insn_length (uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case 0xc6:
+    case 0xce:
+    case 0xd6:
+    case 0xde:
+    case 0xe6:
+    case 0xee:
+    case 0xf6:
+    case 0xfe:
+      return 2;
+    case 0x22:
+    case 0x2a:
+    case 0xcd:
+      return 3;
+    default:
+      /* The conditional jumps. */
+      return ((opcode & 0xc7) == 0xc2) ? 3 : 1;
+    }
+}
+
+/* Write REPEAT copies of the family's sequence followed by JMP back. */
+static void
+load_family (struct machine *machine, const struct family *family,
+             bool callbacks)
+{
+  struct i8080 *cpu;
+  uint16_t address, operand;
+  int i, j, length;
+
+  memset (machine->memory, 0, sizeof (machine->memory));
+  address = CODE_START;
+  for (i = 0; i < REPEAT; ++i)
+    for (j = 0; j < family->count; ++j)
+      {
+        length = insn_length (family->insns[j].opcode);
+        operand = family->insns[j].operand;
+        if (operand == NEXT_ADDRESS)
+          operand = address + length;
+        machine->memory[address] = family->insns[j].opcode;
+        machine->memory[address + 1] = operand & UINT8_MAX;
+        if (length == 3)
+          machine->memory[address + 2] = operand >> 8;
+        address += length;
+      }
+  machine->memory[address] = 0xc3; /* JMP CODE_START */
+  machine->memory[address + 1] = CODE_START & UINT8_MAX;
+  machine->memory[address + 2] = CODE_START >> 8;
+  machine->memory[SUBROUTINE] = 0xc9; /* RET */
+
+  cpu = &machine->cpu;
+  i8080_init (cpu);
+  cpu->user_data = machine;
+  cpu->read_byte = machine_read_byte;
+  cpu->write_byte = machine_write_byte;
+  if (!callbacks)
+    {
+      i8080_map_read (cpu, 0, sizeof (machine->memory), machine->memory);
+      i8080_map_write (cpu, 0, sizeof (machine->memory), machine->memory);
+    }
+  cpu->pc = CODE_START;
+  cpu->sp = STACK;
+  cpu->h = DATA >> 8;
+  cpu->l = DATA & UINT8_MAX;
+}
+
+static double
+run_family (struct machine *machine, uintmax_t count)
+{
+  struct timespec start, end;
+  struct i8080 *cpu;
+  uintmax_t i;
+
+  /* Warm up the caches and branch predictors first. */
+  cpu = &machine->cpu;
+  for (i = 0; i < count / 10; ++i)
+    i8080_exec_opcode (cpu, machine->memory[cpu->pc++]);
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; i < count; ++i)
+    i8080_exec_opcode (cpu, machine->memory[cpu->pc++]);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return (double) (end.tv_sec - start.tv_sec)
+         + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Load the family into every machine. They share the code pages, as
+ * machines running the same ROM would, and differ in the registers.
+ */
+static void
+load_lanes (struct machine *machines, const struct family *family,
+            bool callbacks)
+{
+  struct i8080 *cpu;
+  int i;
+
+  for (i = 0; i < I8080_LANES; ++i)
+    {
+      load_family (&machines[i], family, callbacks);
+      cpu = &machines[i].cpu;
+      if (!callbacks)
+        i8080_map_read (cpu, 0, DATA, machines[0].memory);
+      cpu->a = i * 17;
+      cpu->b = i * 3;
+      cpu->c = i * 5;
+      cpu->d = i * 7;
+      cpu->e = i * 11;
+    }
+}
+
+/*
+ * Run each machine for a slice at a time until COUNT instructions. The
+ * number of warmup and timed rounds of slices goes in ROUNDS and each
+ * machine's instructions in the timed rounds in RETIRED.
+ */
+static double
+run_scalar (struct machine *machines, uintmax_t count, uintmax_t *rounds,
+            uintmax_t *retired)
+{
+  struct timespec start, end;
+  uintmax_t slice, total;
+  int i;
+
+  rounds[0] = total = 0;
+  while (total < count / 10)
+    {
+      for (i = 0; i < I8080_LANES; ++i)
+        {
+          i8080_run (&machines[i].cpu, LANES_BUDGET, &slice);
+          total += slice;
+        }
+      ++rounds[0];
+    }
+
+  memset (retired, 0, I8080_LANES * sizeof (*retired));
+  rounds[1] = total = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while (total < count)
+    {
+      for (i = 0; i < I8080_LANES; ++i)
+        {
+          i8080_run (&machines[i].cpu, LANES_BUDGET, &slice);
+          retired[i] += slice;
+          total += slice;
+        }
+      ++rounds[1];
+    }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return (double) (end.tv_sec - start.tv_sec)
+         + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Run the machines in lockstep for as many rounds as run_scalar() did. */
+static double
+run_lanes (struct i8080_lanes *lanes, struct machine *machines,
+           const uintmax_t *rounds)
+{
+  struct timespec start, end;
+  uintmax_t round;
+  int i;
+
+  i8080_lanes_init (lanes);
+  for (i = 0; i < I8080_LANES; ++i)
+    lanes->cpu[i] = machines[i].cpu;
+
+  for (round = 0; round < rounds[0]; ++round)
+    i8080_lanes_run (lanes, LANES_BUDGET);
+  memset (lanes->retired, 0, sizeof (lanes->retired));
+  lanes->lockstep = 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (round = 0; round < rounds[1]; ++round)
+    i8080_lanes_run (lanes, LANES_BUDGET);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return (double) (end.tv_sec - start.tv_sec)
+         + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Check that each lane ended where its scalar machine did. Prints the
+ * first difference in each lane and returns false if there was any.
+ */
+static bool
+check_lanes (const struct machine *scalar, const struct machine *machines,
+             const struct i8080_lanes *lanes, const uintmax_t *retired,
+             const char *name)
+{
+  const struct i8080 *expected, *cpu;
+  const char *what;
+  bool matched;
+  int i;
+
+  matched = true;
+  for (i = 0; i < I8080_LANES; ++i)
+    {
+      expected = &scalar[i].cpu;
+      cpu = &lanes->cpu[i];
+      if (cpu->a != expected->a || cpu->f != expected->f
+          || cpu->b != expected->b || cpu->c != expected->c
+          || cpu->d != expected->d || cpu->e != expected->e
+          || cpu->h != expected->h || cpu->l != expected->l)
+        what = "registers";
+      else if (cpu->sp != expected->sp || cpu->pc != expected->pc)
+        what = "SP or PC";
+      else if (cpu->halted != expected->halted
+               || cpu->int_enable != expected->int_enable
+               || cpu->int_requested != expected->int_requested)
+        what = "interrupt state";
+      else if (cpu->cycles != expected->cycles)
+        what = "cycle count";
+      else if (lanes->retired[i] != retired[i])
+        what = "instruction count";
+      else if (memcmp (machines[i].memory, scalar[i].memory,
+                       sizeof (scalar[i].memory))
+               != 0)
+        what = "memory";
+      else
+        continue;
+      fprintf (stderr, "%s: Lane %d differs from the scalar run in its %s.\n",
+               name, i, what);
+      matched = false;
+    }
+  return matched;
+}
+
+static uint8_t
+machine_read_byte (void *machineptr, uint16_t address)
+{
+  struct machine *machine = (struct machine *) machineptr;
+
+  return machine->memory[address];
+}
+
+static void
+machine_write_byte (void *machineptr, uint16_t address, uint8_t value)
+{
+  struct machine *machine = (struct machine *) machineptr;
+
+  machine->memory[address] = value;
+}
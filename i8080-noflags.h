@@ -0,0 +1,129 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Bodies of the instructions that set flags, for when the flags they set
+ * are all overwritten before anything reads them. This file has no
+ * include guard since i8080.c includes it for every use of the list. The
+ * includer defines:
+ *
+ *	NOFLAGS(n, body)	Opcode n is BODY without the flags. The
+ *				cycles are added by the includer.
+ *	FETCH_BYTE()		As in i8080-opcodes.h.
+ *
+ * INR M and DCR M are left out since they end a block, where every flag
+ * is live.
+ */
+
+NOFLAGS (0x04, ctx->b++) /* INR B */
+NOFLAGS (0x05, ctx->b--) /* DCR B */
+NOFLAGS (0x0c, ctx->c++) /* INR C */
+NOFLAGS (0x0d, ctx->c--) /* DCR C */
+NOFLAGS (0x14, ctx->d++) /* INR D */
+NOFLAGS (0x15, ctx->d--) /* DCR D */
+NOFLAGS (0x1c, ctx->e++) /* INR E */
+NOFLAGS (0x1d, ctx->e--) /* DCR E */
+NOFLAGS (0x24, ctx->h++) /* INR H */
+NOFLAGS (0x25, ctx->h--) /* DCR H */
+NOFLAGS (0x2c, ctx->l++) /* INR L */
+NOFLAGS (0x2d, ctx->l--) /* DCR L */
+NOFLAGS (0x3c, ctx->a++) /* INR A */
+NOFLAGS (0x3d, ctx->a--) /* DCR A */
+NOFLAGS (0x80, ctx->a += ctx->b) /* ADD B */
+NOFLAGS (0x81, ctx->a += ctx->c) /* ADD C */
+NOFLAGS (0x82, ctx->a += ctx->d) /* ADD D */
+NOFLAGS (0x83, ctx->a += ctx->e) /* ADD E */
+NOFLAGS (0x84, ctx->a += ctx->h) /* ADD H */
+NOFLAGS (0x85, ctx->a += ctx->l) /* ADD L */
+NOFLAGS (0x86, ctx->a += read_byte (ctx, get_hl (ctx))) /* ADD M */
+NOFLAGS (0x87, ctx->a += ctx->a) /* ADD A */
+NOFLAGS (0x88, ctx->a += ctx->b + get_flag (ctx, FLAG_C)) /* ADC B */
+NOFLAGS (0x89, ctx->a += ctx->c + get_flag (ctx, FLAG_C)) /* ADC C */
+NOFLAGS (0x8a, ctx->a += ctx->d + get_flag (ctx, FLAG_C)) /* ADC D */
+NOFLAGS (0x8b, ctx->a += ctx->e + get_flag (ctx, FLAG_C)) /* ADC E */
+NOFLAGS (0x8c, ctx->a += ctx->h + get_flag (ctx, FLAG_C)) /* ADC H */
+NOFLAGS (0x8d, ctx->a += ctx->l + get_flag (ctx, FLAG_C)) /* ADC L */
+/* ADC M */
+NOFLAGS (0x8e,
+         ctx->a += read_byte (ctx, get_hl (ctx)) + get_flag (ctx, FLAG_C))
+NOFLAGS (0x8f, ctx->a += ctx->a + get_flag (ctx, FLAG_C)) /* ADC A */
+NOFLAGS (0x90, ctx->a -= ctx->b) /* SUB B */
+NOFLAGS (0x91, ctx->a -= ctx->c) /* SUB C */
+NOFLAGS (0x92, ctx->a -= ctx->d) /* SUB D */
+NOFLAGS (0x93, ctx->a -= ctx->e) /* SUB E */
+NOFLAGS (0x94, ctx->a -= ctx->h) /* SUB H */
+NOFLAGS (0x95, ctx->a -= ctx->l) /* SUB L */
+NOFLAGS (0x96, ctx->a -= read_byte (ctx, get_hl (ctx))) /* SUB M */
+NOFLAGS (0x97, ctx->a -= ctx->a) /* SUB A */
+NOFLAGS (0x98, ctx->a -= ctx->b + get_flag (ctx, FLAG_C)) /* SBB B */
+NOFLAGS (0x99, ctx->a -= ctx->c + get_flag (ctx, FLAG_C)) /* SBB C */
+NOFLAGS (0x9a, ctx->a -= ctx->d + get_flag (ctx, FLAG_C)) /* SBB D */
+NOFLAGS (0x9b, ctx->a -= ctx->e + get_flag (ctx, FLAG_C)) /* SBB E */
+NOFLAGS (0x9c, ctx->a -= ctx->h + get_flag (ctx, FLAG_C)) /* SBB H */
+NOFLAGS (0x9d, ctx->a -= ctx->l + get_flag (ctx, FLAG_C)) /* SBB L */
+/* SBB M */
+NOFLAGS (0x9e,
+         ctx->a -= read_byte (ctx, get_hl (ctx)) + get_flag (ctx, FLAG_C))
+NOFLAGS (0x9f, ctx->a -= ctx->a + get_flag (ctx, FLAG_C)) /* SBB A */
+NOFLAGS (0xa0, ctx->a &= ctx->b) /* ANA B */
+NOFLAGS (0xa1, ctx->a &= ctx->c) /* ANA C */
+NOFLAGS (0xa2, ctx->a &= ctx->d) /* ANA D */
+NOFLAGS (0xa3, ctx->a &= ctx->e) /* ANA E */
+NOFLAGS (0xa4, ctx->a &= ctx->h) /* ANA H */
+NOFLAGS (0xa5, ctx->a &= ctx->l) /* ANA L */
+NOFLAGS (0xa6, ctx->a &= read_byte (ctx, get_hl (ctx))) /* ANA M */
+NOFLAGS (0xa7, ctx->a &= ctx->a) /* ANA A */
+NOFLAGS (0xa8, ctx->a ^= ctx->b) /* XRA B */
+NOFLAGS (0xa9, ctx->a ^= ctx->c) /* XRA C */
+NOFLAGS (0xaa, ctx->a ^= ctx->d) /* XRA D */
+NOFLAGS (0xab, ctx->a ^= ctx->e) /* XRA E */
+NOFLAGS (0xac, ctx->a ^= ctx->h) /* XRA H */
+NOFLAGS (0xad, ctx->a ^= ctx->l) /* XRA L */
+NOFLAGS (0xae, ctx->a ^= read_byte (ctx, get_hl (ctx))) /* XRA M */
+NOFLAGS (0xaf, ctx->a ^= ctx->a) /* XRA A */
+NOFLAGS (0xb0, ctx->a |= ctx->b) /* ORA B */
+NOFLAGS (0xb1, ctx->a |= ctx->c) /* ORA C */
+NOFLAGS (0xb2, ctx->a |= ctx->d) /* ORA D */
+NOFLAGS (0xb3, ctx->a |= ctx->e) /* ORA E */
+NOFLAGS (0xb4, ctx->a |= ctx->h) /* ORA H */
+NOFLAGS (0xb5, ctx->a |= ctx->l) /* ORA L */
+NOFLAGS (0xb6, ctx->a |= read_byte (ctx, get_hl (ctx))) /* ORA M */
+NOFLAGS (0xb7, ctx->a |= ctx->a) /* ORA A */
+NOFLAGS (0xb8, (void) 0) /* CMP B */
+NOFLAGS (0xb9, (void) 0) /* CMP C */
+NOFLAGS (0xba, (void) 0) /* CMP D */
+NOFLAGS (0xbb, (void) 0) /* CMP E */
+NOFLAGS (0xbc, (void) 0) /* CMP H */
+NOFLAGS (0xbd, (void) 0) /* CMP L */
+NOFLAGS (0xbe, (void) read_byte (ctx, get_hl (ctx))) /* CMP M */
+NOFLAGS (0xbf, (void) 0) /* CMP A */
+NOFLAGS (0xc6, ctx->a += FETCH_BYTE ()) /* ADI */
+NOFLAGS (0xce, ctx->a += FETCH_BYTE () + get_flag (ctx, FLAG_C)) /* ACI */
+NOFLAGS (0xd6, ctx->a -= FETCH_BYTE ()) /* SUI */
+NOFLAGS (0xde, ctx->a -= FETCH_BYTE () + get_flag (ctx, FLAG_C)) /* SBI */
+NOFLAGS (0xe6, ctx->a &= FETCH_BYTE ()) /* ANI */
+NOFLAGS (0xee, ctx->a ^= FETCH_BYTE ()) /* XRI */
+NOFLAGS (0xf6, ctx->a |= FETCH_BYTE ()) /* ORI */
+NOFLAGS (0xfe, (void) FETCH_BYTE ()) /* CPI */
@@ -0,0 +1,1969 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Instruction bodies for every opcode. This file has no include guard
+ * since i8080.c includes it once for each dispatch method. The includer
+ * defines:
+ *
+ *	OPCODE(n)	Placed before the body of opcode n, which is a
+ *			compound statement.
+ *	NEXT		End of a body.
+ *	NEXT_IO		End of the IN and OUT bodies.
+ *	FETCH_BYTE()	The 8-bit operand of the instruction.
+ *	FETCH_WORD()	The 16-bit operand of the instruction.
+ *	SKIP_WORD()	Step over a 16-bit operand that is not used.
+ *
+ * The program counter points past the operands once FETCH_BYTE(),
+ * FETCH_WORD() or SKIP_WORD() has been used.
+ */
+
+OPCODE (0x00) /* NOP */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x01) /* LXI B */
+{
+  set_bc (ctx, FETCH_WORD ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x02) /* STAX B */
+{
+  write_byte (ctx, get_bc (ctx), ctx->a);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x03) /* INX B */
+{
+  if (++ctx->c == 0)
+    ctx->b++;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x04) /* INR B */
+{
+  ctx->b = op_inr (ctx, ctx->b);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x05) /* DCR B */
+{
+  ctx->b = op_dcr (ctx, ctx->b);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x06) /* MVI B */
+{
+  ctx->b = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x07) /* RLC */
+{
+  op_rlc (ctx);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x08) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x09) /* DAD B */
+{
+  op_dad (ctx, get_bc (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x0a) /* LDAX B */
+{
+  ctx->a = read_byte (ctx, get_bc (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x0b) /* DCX B */
+{
+  if (--ctx->c == UINT8_MAX)
+    ctx->b--;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x0c) /* INR C */
+{
+  ctx->c = op_inr (ctx, ctx->c);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x0d) /* DCR C */
+{
+  ctx->c = op_dcr (ctx, ctx->c);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x0e) /* MVI C */
+{
+  ctx->c = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x0f) /* RRC */
+{
+  op_rrc (ctx);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x10) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x11) /* LXI D */
+{
+  set_de (ctx, FETCH_WORD ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x12) /* STAX D */
+{
+  write_byte (ctx, get_de (ctx), ctx->a);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x13) /* INX D */
+{
+  if (++ctx->e == 0)
+    ctx->d++;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x14) /* INR D */
+{
+  ctx->d = op_inr (ctx, ctx->d);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x15) /* DCR D */
+{
+  ctx->d = op_dcr (ctx, ctx->d);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x16) /* MVI D */
+{
+  ctx->d = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x17) /* RAL */
+{
+  op_ral (ctx);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x18) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x19) /* DAD D */
+{
+  op_dad (ctx, get_de (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x1a) /* LDAX D */
+{
+  ctx->a = read_byte (ctx, get_de (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x1b) /* DCX D */
+{
+  if (--ctx->e == UINT8_MAX)
+    ctx->d--;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x1c) /* INR E */
+{
+  ctx->e = op_inr (ctx, ctx->e);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x1d) /* DCR E */
+{
+  ctx->e = op_dcr (ctx, ctx->e);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x1e) /* MVI E */
+{
+  ctx->e = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x1f) /* RAR */
+{
+  op_rar (ctx);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x20) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x21) /* LXI H */
+{
+  set_hl (ctx, FETCH_WORD ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x22) /* SHLD */
+{
+  write_word (ctx, FETCH_WORD (), get_hl (ctx));
+  ctx->cycles += 16;
+  NEXT;
+}
+
+OPCODE (0x23) /* INX H */
+{
+  if (++ctx->l == 0)
+    ctx->h++;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x24) /* INR H */
+{
+  ctx->h = op_inr (ctx, ctx->h);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x25) /* DCR H */
+{
+  ctx->h = op_dcr (ctx, ctx->h);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x26) /* MVI H */
+{
+  ctx->h = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x27) /* DAA */
+{
+  op_daa (ctx);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x28) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x29) /* DAD H */
+{
+  op_dad (ctx, get_hl (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x2a) /* LHLD */
+{
+  set_hl (ctx, read_word (ctx, FETCH_WORD ()));
+  ctx->cycles += 16;
+  NEXT;
+}
+
+OPCODE (0x2b) /* DCX H */
+{
+  if (--ctx->l == UINT8_MAX)
+    ctx->h--;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x2c) /* INR L */
+{
+  ctx->l = op_inr (ctx, ctx->l);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x2d) /* DCR L */
+{
+  ctx->l = op_dcr (ctx, ctx->l);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x2e) /* MVI L */
+{
+  ctx->l = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x2f) /* CMA */
+{
+  ctx->a ^= UINT8_MAX;
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x30) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x31) /* LXI SP */
+{
+  ctx->sp = FETCH_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x32) /* STA */
+{
+  write_byte (ctx, FETCH_WORD (), ctx->a);
+  ctx->cycles += 13;
+  NEXT;
+}
+
+OPCODE (0x33) /* INX SP */
+{
+  ctx->sp++;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x34) /* INR M */
+{
+  write_byte (ctx, get_hl (ctx),
+              op_inr (ctx, read_byte (ctx, get_hl (ctx))));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x35) /* DCR M */
+{
+  write_byte (ctx, get_hl (ctx),
+              op_dcr (ctx, read_byte (ctx, get_hl (ctx))));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x36) /* MVI M */
+{
+  write_byte (ctx, get_hl (ctx), FETCH_BYTE ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x37) /* STC */
+{
+  set_flag_to (ctx, FLAG_C, 1);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x38) /* NOP (Undocumented) */
+{
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x39) /* DAD SP */
+{
+  op_dad (ctx, ctx->sp);
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0x3a) /* LDA */
+{
+  ctx->a = read_byte (ctx, FETCH_WORD ());
+  ctx->cycles += 13;
+  NEXT;
+}
+
+OPCODE (0x3b) /* DCX SP */
+{
+  ctx->sp--;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x3c) /* INR A */
+{
+  ctx->a = op_inr (ctx, ctx->a);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x3d) /* DCR A */
+{
+  ctx->a = op_dcr (ctx, ctx->a);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x3e) /* MVI A */
+{
+  ctx->a = FETCH_BYTE ();
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x3f) /* CMC */
+{
+  set_flag_to (ctx, FLAG_C, !get_flag (ctx, FLAG_C));
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x40) /* MOV B, B */
+{
+  ctx->b = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x41) /* MOV B, C */
+{
+  ctx->b = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x42) /* MOV B, D */
+{
+  ctx->b = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x43) /* MOV B, E */
+{
+  ctx->b = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x44) /* MOV B, H */
+{
+  ctx->b = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x45) /* MOV B, L */
+{
+  ctx->b = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x46) /* MOV B, M */
+{
+  ctx->b = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x47) /* MOV B, A */
+{
+  ctx->b = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x48) /* MOV C, B */
+{
+  ctx->c = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x49) /* MOV C, C */
+{
+  ctx->c = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x4a) /* MOV C, D */
+{
+  ctx->c = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x4b) /* MOV C, E */
+{
+  ctx->c = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x4c) /* MOV C, H */
+{
+  ctx->c = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x4d) /* MOV C, L */
+{
+  ctx->c = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x4e) /* MOV C, M */
+{
+  ctx->c = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x4f) /* MOV C, A */
+{
+  ctx->c = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x50) /* MOV D, B */
+{
+  ctx->d = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x51) /* MOV D, C */
+{
+  ctx->d = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x52) /* MOV D, D */
+{
+  ctx->d = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x53) /* MOV D, E */
+{
+  ctx->d = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x54) /* MOV D, H */
+{
+  ctx->d = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x55) /* MOV D, L */
+{
+  ctx->d = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x56) /* MOV D, M */
+{
+  ctx->d = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x57) /* MOV D, A */
+{
+  ctx->d = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x58) /* MOV E, B */
+{
+  ctx->e = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x59) /* MOV E, C */
+{
+  ctx->e = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x5a) /* MOV E, D */
+{
+  ctx->e = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x5b) /* MOV E, E */
+{
+  ctx->e = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x5c) /* MOV E, H */
+{
+  ctx->e = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x5d) /* MOV E, L */
+{
+  ctx->e = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x5e) /* MOV E, M */
+{
+  ctx->e = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x5f) /* MOV E, A */
+{
+  ctx->e = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x60) /* MOV H, B */
+{
+  ctx->h = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x61) /* MOV H, C */
+{
+  ctx->h = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x62) /* MOV H, D */
+{
+  ctx->h = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x63) /* MOV H, E */
+{
+  ctx->h = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x64) /* MOV H, H */
+{
+  ctx->h = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x65) /* MOV H, L */
+{
+  ctx->h = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x66) /* MOV H, M */
+{
+  ctx->h = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x67) /* MOV H, A */
+{
+  ctx->h = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x68) /* MOV L, B */
+{
+  ctx->l = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x69) /* MOV L, C */
+{
+  ctx->l = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x6a) /* MOV L, D */
+{
+  ctx->l = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x6b) /* MOV L, E */
+{
+  ctx->l = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x6c) /* MOV L, H */
+{
+  ctx->l = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x6d) /* MOV L, L */
+{
+  ctx->l = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x6e) /* MOV L, M */
+{
+  ctx->l = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x6f) /* MOV L, A */
+{
+  ctx->l = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x70) /* MOV M, B */
+{
+  write_byte (ctx, get_hl (ctx), ctx->b);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x71) /* MOV M, C */
+{
+  write_byte (ctx, get_hl (ctx), ctx->c);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x72) /* MOV M, D */
+{
+  write_byte (ctx, get_hl (ctx), ctx->d);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x73) /* MOV M, E */
+{
+  write_byte (ctx, get_hl (ctx), ctx->e);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x74) /* MOV M, H */
+{
+  write_byte (ctx, get_hl (ctx), ctx->h);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x75) /* MOV M, L */
+{
+  write_byte (ctx, get_hl (ctx), ctx->l);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x76) /* HLT */
+{
+  ctx->halted = true;
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x77) /* MOV M, A */
+{
+  write_byte (ctx, get_hl (ctx), ctx->a);
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x78) /* MOV A, B */
+{
+  ctx->a = ctx->b;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x79) /* MOV A, C */
+{
+  ctx->a = ctx->c;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x7a) /* MOV A, D */
+{
+  ctx->a = ctx->d;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x7b) /* MOV A, E */
+{
+  ctx->a = ctx->e;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x7c) /* MOV A, H */
+{
+  ctx->a = ctx->h;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x7d) /* MOV A, L */
+{
+  ctx->a = ctx->l;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x7e) /* MOV A, M */
+{
+  ctx->a = read_byte (ctx, get_hl (ctx));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x7f) /* MOV A, A */
+{
+  ctx->a = ctx->a;
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0x80) /* ADD B */
+{
+  op_add (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x81) /* ADD C */
+{
+  op_add (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x82) /* ADD D */
+{
+  op_add (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x83) /* ADD E */
+{
+  op_add (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x84) /* ADD H */
+{
+  op_add (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x85) /* ADD L */
+{
+  op_add (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x86) /* ADD M */
+{
+  op_add (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x87) /* ADD A */
+{
+  op_add (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x88) /* ADC B */
+{
+  op_adc (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x89) /* ADC C */
+{
+  op_adc (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x8a) /* ADC D */
+{
+  op_adc (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x8b) /* ADC E */
+{
+  op_adc (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x8c) /* ADC H */
+{
+  op_adc (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x8d) /* ADC L */
+{
+  op_adc (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x8e) /* ADC M */
+{
+  op_adc (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x8f) /* ADC A */
+{
+  op_adc (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x90) /* SUB B */
+{
+  op_sub (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x91) /* SUB C */
+{
+  op_sub (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x92) /* SUB D */
+{
+  op_sub (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x93) /* SUB E */
+{
+  op_sub (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x94) /* SUB H */
+{
+  op_sub (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x95) /* SUB L */
+{
+  op_sub (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x96) /* SUB M */
+{
+  op_sub (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x97) /* SUB A */
+{
+  op_sub (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x98) /* SBB B */
+{
+  op_sbb (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x99) /* SBB C */
+{
+  op_sbb (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x9a) /* SBB D */
+{
+  op_sbb (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x9b) /* SBB E */
+{
+  op_sbb (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x9c) /* SBB H */
+{
+  op_sbb (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x9d) /* SBB L */
+{
+  op_sbb (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0x9e) /* SBB M */
+{
+  op_sbb (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0x9f) /* SBB A */
+{
+  op_sbb (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa0) /* ANA B */
+{
+  op_ana (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa1) /* ANA C */
+{
+  op_ana (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa2) /* ANA D */
+{
+  op_ana (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa3) /* ANA E */
+{
+  op_ana (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa4) /* ANA H */
+{
+  op_ana (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa5) /* ANA L */
+{
+  op_ana (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa6) /* ANA M */
+{
+  op_ana (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xa7) /* ANA A */
+{
+  op_ana (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa8) /* XRA B */
+{
+  op_xra (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xa9) /* XRA C */
+{
+  op_xra (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xaa) /* XRA D */
+{
+  op_xra (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xab) /* XRA E */
+{
+  op_xra (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xac) /* XRA H */
+{
+  op_xra (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xad) /* XRA L */
+{
+  op_xra (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xae) /* XRA M */
+{
+  op_xra (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xaf) /* XRA A */
+{
+  op_xra (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb0) /* ORA B */
+{
+  op_ora (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb1) /* ORA C */
+{
+  op_ora (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb2) /* ORA D */
+{
+  op_ora (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb3) /* ORA E */
+{
+  op_ora (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb4) /* ORA H */
+{
+  op_ora (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb5) /* ORA L */
+{
+  op_ora (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb6) /* ORA M */
+{
+  op_ora (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xb7) /* ORA A */
+{
+  op_ora (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb8) /* CMP B */
+{
+  op_cmp (ctx, ctx->b);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xb9) /* CMP C */
+{
+  op_cmp (ctx, ctx->c);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xba) /* CMP D */
+{
+  op_cmp (ctx, ctx->d);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xbb) /* CMP E */
+{
+  op_cmp (ctx, ctx->e);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xbc) /* CMP H */
+{
+  op_cmp (ctx, ctx->h);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xbd) /* CMP L */
+{
+  op_cmp (ctx, ctx->l);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xbe) /* CMP M */
+{
+  op_cmp (ctx, read_byte (ctx, get_hl (ctx)));
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xbf) /* CMP A */
+{
+  op_cmp (ctx, ctx->a);
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xc0) /* RNZ */
+{
+  if (!get_flag (ctx, FLAG_Z))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xc1) /* POP B */
+{
+  set_bc (ctx, pop_word (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xc2) /* JNZ */
+{
+  if (!get_flag (ctx, FLAG_Z))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xc3) /* JMP */
+{
+  op_jmp (ctx, FETCH_WORD ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xc4) /* CNZ */
+{
+  if (!get_flag (ctx, FLAG_Z))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xc5) /* PUSH B */
+{
+  push_word (ctx, get_bc (ctx));
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xc6) /* ADI */
+{
+  op_add (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xc7) /* RST 0 */
+{
+  op_rst (ctx, 0x0000);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xc8) /* RZ */
+{
+  if (get_flag (ctx, FLAG_Z))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xc9) /* RET */
+{
+  op_ret (ctx);
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xca) /* JZ */
+{
+  if (get_flag (ctx, FLAG_Z))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xcb) /* JMP (Undocumented) */
+{
+  op_jmp (ctx, FETCH_WORD ());
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xcc) /* CZ */
+{
+  if (get_flag (ctx, FLAG_Z))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xcd) /* CALL */
+{
+  op_call (ctx, FETCH_WORD ());
+  ctx->cycles += 17;
+  NEXT;
+}
+
+OPCODE (0xce) /* ACI */
+{
+  op_adc (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xcf) /* RST 1 */
+{
+  op_rst (ctx, 0x008);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xd0) /* RNC */
+{
+  if (!get_flag (ctx, FLAG_C))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xd1) /* POP D */
+{
+  set_de (ctx, pop_word (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xd2) /* JNC */
+{
+  if (!get_flag (ctx, FLAG_C))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xd3) /* OUT */
+{
+  ctx->io_outb (ctx->user_data, FETCH_BYTE (), ctx->a);
+  ctx->cycles += 10;
+  NEXT_IO;
+}
+
+OPCODE (0xd4) /* CNC */
+{
+  if (!get_flag (ctx, FLAG_C))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xd5) /* PUSH D */
+{
+  push_word (ctx, get_de (ctx));
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xd6) /* SUI */
+{
+  op_sub (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xd7) /* RST 2 */
+{
+  op_rst (ctx, 0x0010);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xd8) /* RC */
+{
+  if (get_flag (ctx, FLAG_C))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xd9) /* RET (Undocumented) */
+{
+  op_ret (ctx);
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xda) /* JC */
+{
+  if (get_flag (ctx, FLAG_C))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xdb) /* IN */
+{
+  ctx->a = ctx->io_inb (ctx->user_data, FETCH_BYTE ());
+  ctx->cycles += 10;
+  NEXT_IO;
+}
+
+OPCODE (0xdc) /* CC */
+{
+  if (get_flag (ctx, FLAG_C))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xdd) /* CALL (Undocumented) */
+{
+  op_call (ctx, FETCH_WORD ());
+  ctx->cycles += 17;
+  NEXT;
+}
+
+OPCODE (0xde) /* SBI */
+{
+  op_sbb (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xdf) /* RST 3 */
+{
+  op_rst (ctx, 0x0018);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xe0) /* RPO */
+{
+  if (!get_flag (ctx, FLAG_P))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xe1) /* POP H */
+{
+  set_hl (ctx, pop_word (ctx));
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xe2) /* JPO */
+{
+  if (!get_flag (ctx, FLAG_P))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xe3) /* XTHL */
+{
+  op_xthl (ctx);
+  ctx->cycles += 18;
+  NEXT;
+}
+
+OPCODE (0xe4) /* CPO */
+{
+  if (!get_flag (ctx, FLAG_P))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xe5) /* PUSH H */
+{
+  push_word (ctx, get_hl (ctx));
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xe6) /* ANI */
+{
+  op_ana (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xe7) /* RST 4 */
+{
+  op_rst (ctx, 0x0020);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xe8) /* RPE */
+{
+  if (get_flag (ctx, FLAG_P))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xe9) /* PCHL */
+{
+  ctx->pc = get_hl (ctx);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xea) /* JPE */
+{
+  if (get_flag (ctx, FLAG_P))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xeb) /* XCHG */
+{
+  op_xchg (ctx);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xec) /* CPE */
+{
+  if (get_flag (ctx, FLAG_P))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xed) /* CALL (Undocumented) */
+{
+  op_call (ctx, FETCH_WORD ());
+  ctx->cycles += 17;
+  NEXT;
+}
+
+OPCODE (0xee) /* XRI */
+{
+  op_xra (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xef) /* RST 5 */
+{
+  op_rst (ctx, 0x0028);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xf0) /* RP */
+{
+  if (!get_flag (ctx, FLAG_S))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xf1) /* POP PSW */
+{
+  set_psw (ctx, pop_word (ctx));
+  /* Make sure the unused bits are set. */
+  ctx->f |= 0x02;
+  ctx->f &= ~0x08;
+  ctx->f &= ~0x20;
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xf2) /* JP */
+{
+  if (!get_flag (ctx, FLAG_S))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xf3) /* DI */
+{
+  ctx->int_enable = false;
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xf4) /* CP */
+{
+  if (!get_flag (ctx, FLAG_S))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xf5) /* PUSH PSW */
+{
+  /* Make sure the unused bits are set. */
+  ctx->f |= 0x02;
+  ctx->f &= ~0x08;
+  ctx->f &= ~0x20;
+  push_word (ctx, get_psw (ctx));
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xf6) /* ORI */
+{
+  op_ora (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xf7) /* RST 6 */
+{
+  op_rst (ctx, 0x0030);
+  ctx->cycles += 11;
+  NEXT;
+}
+
+OPCODE (0xf8) /* RM */
+{
+  if (get_flag (ctx, FLAG_S))
+    {
+      op_ret (ctx);
+      ctx->cycles += 11;
+    }
+  else
+    ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xf9) /* SPHL */
+{
+  ctx->sp = get_hl (ctx);
+  ctx->cycles += 5;
+  NEXT;
+}
+
+OPCODE (0xfa) /* JM */
+{
+  if (get_flag (ctx, FLAG_S))
+    op_jmp (ctx, FETCH_WORD ());
+  else
+    SKIP_WORD ();
+  ctx->cycles += 10;
+  NEXT;
+}
+
+OPCODE (0xfb) /* EI */
+{
+  ctx->int_enable = true;
+  ctx->cycles += 4;
+  NEXT;
+}
+
+OPCODE (0xfc) /* CM */
+{
+  if (get_flag (ctx, FLAG_S))
+    {
+      op_call (ctx, FETCH_WORD ());
+      ctx->cycles += 17;
+    }
+  else
+    {
+      SKIP_WORD ();
+      ctx->cycles += 11;
+    }
+  NEXT;
+}
+
+OPCODE (0xfd) /* CALL (Undocumented) */
+{
+  op_call (ctx, FETCH_WORD ());
+  ctx->cycles += 17;
+  NEXT;
+}
+
+OPCODE (0xfe) /* CPI */
+{
+  op_cmp (ctx, FETCH_BYTE ());
+  ctx->cycles += 7;
+  NEXT;
+}
+
+OPCODE (0xff) /* RST 7 */
+{
+  op_rst (ctx, 0x0038);
+  ctx->cycles += 11;
+  NEXT;
+}
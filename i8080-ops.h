@@ -0,0 +1,445 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Flags, register pairs and the instructions that only work on them, as
+ * static functions. i8080.c adds memory, the stack and I/O. The blocks
+ * the compiler tier builds include this too, see i8080-cc.c, so they run
+ * the same code as the interpreter.
+ */
+
+#ifndef I8080_OPS_H
+#define I8080_OPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i8080.h"
+
+#define FLAG_C 0x01 /* Carry flag */
+/* 0x02 is always set to 1. */
+#define FLAG_P 0x04 /* Parity flag */
+/* 0x08 is always set to 0. */
+#define FLAG_AC 0x10 /* Aux. carry flag */
+/* 0x20 is always set to 0. */
+#define FLAG_Z 0x40 /* Zero flag */
+#define FLAG_S 0x80 /* Sign flag */
+
+/*
+ * parity_table has 1 for even parity and 0 for odd. The others are
+ * optional and described in misc/makeparitytable.c, which generates
+ * this file during the build.
+ */
+#include "i8080-tables.h"
+
+/* Flags that can be left for flags_sync() to compute. */
+#define FLAGS_LAZY (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)
+
+/*
+ * Flag tested by the conditions of Jcc, Ccc and Rcc, which are bits 3-5
+ * of the opcode, by the condition over two. The even conditions hold
+ * when the flag is clear and the odd ones when it is set.
+ */
+static const uint8_t condition_flags[4] = { FLAG_Z, FLAG_C, FLAG_P, FLAG_S };
+
+static void
+set_flag_to (struct i8080 *ctx, uint8_t mask, int val)
+{
+  ctx->lazy_flags &= ~mask;
+  if (val == 0)
+    ctx->f &= ~mask;
+  else
+    ctx->f |= mask;
+}
+
+static inline bool
+get_flag (struct i8080 *ctx, uint8_t flag)
+{
+  if (!(ctx->lazy_flags & flag))
+    return (ctx->f & flag) != 0;
+  switch (flag)
+    {
+    case FLAG_S:
+      return (ctx->lazy_result & 0x80) != 0;
+    case FLAG_Z:
+      return (ctx->lazy_result & UINT8_MAX) == 0;
+    case FLAG_AC:
+      return (ctx->lazy_aux & 0x10) != 0;
+    case FLAG_P:
+      return parity_table[ctx->lazy_result & UINT8_MAX];
+    default:
+      return (ctx->lazy_result & 0x100) != 0;
+    }
+}
+
+/* Bring f up to date. */
+static void
+flags_sync (struct i8080 *ctx)
+{
+  uint8_t flags, result;
+
+  if (ctx->lazy_flags == 0)
+    return;
+  result = ctx->lazy_result & UINT8_MAX;
+#ifdef I8080_SZP_TABLE
+  flags = szp_table[result] | (ctx->lazy_aux & FLAG_AC);
+#else
+  flags = (result & FLAG_S) | (ctx->lazy_aux & FLAG_AC);
+  if (result == 0)
+    flags |= FLAG_Z;
+  if (parity_table[result])
+    flags |= FLAG_P;
+#endif
+  if (ctx->lazy_result & 0x100)
+    flags |= FLAG_C;
+  ctx->f = (ctx->f & ~ctx->lazy_flags) | (flags & ctx->lazy_flags);
+  ctx->lazy_flags = 0;
+}
+
+/*
+ * Record the result of an instruction that sets the flags in MASK. AUX
+ * holds the AC flag in bit 4 and RESULT the carry in bit 8.
+ */
+static inline void
+flags_lazy (struct i8080 *ctx, uint8_t mask, uint16_t result, uint8_t aux)
+{
+  /* The carry only lives in lazy_result until it is overwritten. */
+  if ((ctx->lazy_flags & FLAG_C) && !(mask & FLAG_C))
+    set_flag_to (ctx, FLAG_C, (ctx->lazy_result & 0x100) != 0);
+  ctx->lazy_flags = mask;
+  ctx->lazy_result = result;
+  ctx->lazy_aux = aux;
+}
+
+#if defined(I8080_ARITH_TABLES) || defined(I8080_DAA_TABLE)
+/* Set A and every flag from a table entry. See misc/makeparitytable.c. */
+static inline void
+flags_from_entry (struct i8080 *ctx, uint16_t entry)
+{
+  ctx->a = entry & UINT8_MAX;
+  ctx->f = (ctx->f & ~FLAGS_LAZY) | (entry >> 8);
+  ctx->lazy_flags = 0;
+}
+#endif
+
+static uint16_t
+get_psw (struct i8080 *ctx)
+{
+  flags_sync (ctx);
+  return ((uint16_t) ctx->a << 8) | ((uint16_t) ctx->f);
+}
+
+static uint16_t
+get_bc (struct i8080 *ctx)
+{
+  return ((uint16_t) ctx->b << 8) | ((uint16_t) ctx->c);
+}
+
+static uint16_t
+get_de (struct i8080 *ctx)
+{
+  return ((uint16_t) ctx->d << 8) | ((uint16_t) ctx->e);
+}
+
+static uint16_t
+get_hl (struct i8080 *ctx)
+{
+  return ((uint16_t) ctx->h << 8) | ((uint16_t) ctx->l);
+}
+
+static void
+set_psw (struct i8080 *ctx, uint16_t val)
+{
+  ctx->a = (val >> 8) & UINT8_MAX;
+  ctx->f = val & UINT8_MAX;
+  ctx->lazy_flags = 0;
+}
+
+static void
+set_bc (struct i8080 *ctx, uint16_t val)
+{
+  ctx->b = (val >> 8) & UINT8_MAX;
+  ctx->c = val & UINT8_MAX;
+}
+
+static void
+set_de (struct i8080 *ctx, uint16_t val)
+{
+  ctx->d = (val >> 8) & UINT8_MAX;
+  ctx->e = val & UINT8_MAX;
+}
+
+static void
+set_hl (struct i8080 *ctx, uint16_t val)
+{
+  ctx->h = (val >> 8) & UINT8_MAX;
+  ctx->l = val & UINT8_MAX;
+}
+
+static void
+op_jmp (struct i8080 *ctx, uint16_t address)
+{
+  ctx->pc = address;
+}
+
+static void
+op_xchg (struct i8080 *ctx)
+{
+  uint16_t tmp16;
+
+  tmp16 = get_hl (ctx);
+  set_hl (ctx, get_de (ctx));
+  set_de (ctx, tmp16);
+}
+
+#ifdef I8080_ARITH_TABLES
+
+/* The result and all the flags come from one lookup. */
+static void
+op_add (struct i8080 *ctx, uint8_t val)
+{
+  flags_from_entry (ctx, add_table[0][(ctx->a << 8) | val]);
+}
+
+static void
+op_adc (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t carry;
+
+  carry = get_flag (ctx, FLAG_C);
+  flags_from_entry (ctx, add_table[carry][(ctx->a << 8) | val]);
+}
+
+static void
+op_sub (struct i8080 *ctx, uint8_t val)
+{
+  flags_from_entry (ctx, sub_table[0][(ctx->a << 8) | val]);
+}
+
+static void
+op_sbb (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t borrow;
+
+  borrow = get_flag (ctx, FLAG_C);
+  flags_from_entry (ctx, sub_table[borrow][(ctx->a << 8) | val]);
+}
+
+static void
+op_cmp (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t a;
+
+  /* Same as SUB but the accumulator is put back. */
+  a = ctx->a;
+  flags_from_entry (ctx, sub_table[0][(a << 8) | val]);
+  ctx->a = a;
+}
+
+#else /* !I8080_ARITH_TABLES */
+
+/*
+ * The AC flag is the carry out of bit 3, which is bit 4 of
+ * a ^ val ^ result. Subtraction sets it when there is no borrow.
+ */
+static void
+op_add (struct i8080 *ctx, uint8_t val)
+{
+  uint16_t tmp16;
+
+  tmp16 = ctx->a + val;
+  flags_lazy (ctx, FLAGS_LAZY, tmp16, ctx->a ^ val ^ tmp16);
+  ctx->a = tmp16 & UINT8_MAX;
+}
+
+static void
+op_adc (struct i8080 *ctx, uint8_t val)
+{
+  uint16_t tmp16;
+
+  tmp16 = ctx->a + val + get_flag (ctx, FLAG_C);
+  flags_lazy (ctx, FLAGS_LAZY, tmp16, ctx->a ^ val ^ tmp16);
+  ctx->a = tmp16 & UINT8_MAX;
+}
+
+static void
+op_sub (struct i8080 *ctx, uint8_t val)
+{
+  uint16_t tmp16;
+
+  tmp16 = ctx->a - val;
+  flags_lazy (ctx, FLAGS_LAZY, tmp16 & 0x1ff, ~(ctx->a ^ val ^ tmp16));
+  ctx->a = tmp16 & UINT8_MAX;
+}
+
+static void
+op_sbb (struct i8080 *ctx, uint8_t val)
+{
+  uint16_t tmp16;
+
+  tmp16 = ctx->a - val - get_flag (ctx, FLAG_C);
+  flags_lazy (ctx, FLAGS_LAZY, tmp16 & 0x1ff, ~(ctx->a ^ val ^ tmp16));
+  ctx->a = tmp16 & UINT8_MAX;
+}
+
+static void
+op_cmp (struct i8080 *ctx, uint8_t val)
+{
+  uint16_t tmp16;
+
+  tmp16 = ctx->a - val;
+  flags_lazy (ctx, FLAGS_LAZY, tmp16 & 0x1ff, ~(ctx->a ^ val ^ tmp16));
+}
+
+#endif /* !I8080_ARITH_TABLES */
+
+static void
+op_ana (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t tmp8;
+
+  tmp8 = ctx->a & val;
+  flags_lazy (ctx, FLAGS_LAZY, tmp8, (ctx->a | val) << 1);
+  ctx->a = tmp8;
+}
+
+static void
+op_xra (struct i8080 *ctx, uint8_t val)
+{
+  ctx->a ^= val;
+  flags_lazy (ctx, FLAGS_LAZY, ctx->a, 0);
+}
+
+static void
+op_ora (struct i8080 *ctx, uint8_t val)
+{
+  ctx->a |= val;
+  flags_lazy (ctx, FLAGS_LAZY, ctx->a, 0);
+}
+
+/* INR and DCR leave the carry flag alone. */
+static uint8_t
+op_inr (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t tmp8;
+
+  tmp8 = val + 1;
+  flags_lazy (ctx, FLAGS_LAZY & ~FLAG_C, tmp8, val ^ 1 ^ tmp8);
+  return tmp8;
+}
+
+static uint8_t
+op_dcr (struct i8080 *ctx, uint8_t val)
+{
+  uint8_t tmp8;
+
+  tmp8 = val - 1;
+  flags_lazy (ctx, FLAGS_LAZY & ~FLAG_C, tmp8, ~(val ^ 1 ^ tmp8));
+  return tmp8;
+}
+
+static void
+op_dad (struct i8080 *ctx, uint16_t val)
+{
+  uint32_t tmp32;
+
+  tmp32 = get_hl (ctx) + val;
+  set_flag_to (ctx, FLAG_C, (tmp32 & 0x10000) != 0);
+  set_hl (ctx, tmp32 & UINT16_MAX);
+}
+
+static void
+op_rlc (struct i8080 *ctx)
+{
+  set_flag_to (ctx, FLAG_C, (ctx->a & 0x80) != 0);
+  ctx->a = (ctx->a << 1) | get_flag (ctx, FLAG_C);
+}
+
+static void
+op_rrc (struct i8080 *ctx)
+{
+  set_flag_to (ctx, FLAG_C, ctx->a & 0x01);
+  ctx->a = (ctx->a >> 1) | (get_flag (ctx, FLAG_C) << 7);
+}
+
+static void
+op_ral (struct i8080 *ctx)
+{
+  uint8_t tmp8;
+
+  tmp8 = get_flag (ctx, FLAG_C);
+  set_flag_to (ctx, FLAG_C, (ctx->a & 0x80) != 0);
+  ctx->a = (ctx->a << 1) | tmp8;
+}
+
+static void
+op_rar (struct i8080 *ctx)
+{
+  uint8_t tmp8;
+
+  tmp8 = get_flag (ctx, FLAG_C);
+  set_flag_to (ctx, FLAG_C, ctx->a & 0x01);
+  ctx->a = (ctx->a >> 1) | (tmp8 << 7);
+}
+
+#ifdef I8080_DAA_TABLE
+
+static void
+op_daa (struct i8080 *ctx)
+{
+  uint8_t row;
+
+  row = (get_flag (ctx, FLAG_AC) << 1) | get_flag (ctx, FLAG_C);
+  flags_from_entry (ctx, daa_table[row][ctx->a]);
+}
+
+#else /* !I8080_DAA_TABLE */
+
+static void
+op_daa (struct i8080 *ctx)
+{
+  uint8_t ahi, alo, c, auxc, newc, inc;
+
+  ahi = (ctx->a >> 4) & 0x0f;
+  alo = ctx->a & 0x0f;
+  c = get_flag (ctx, FLAG_C);
+  auxc = get_flag (ctx, FLAG_AC);
+  newc = inc = 0;
+
+  if (alo > 9 || auxc != 0)
+    inc += 0x06;
+  if (ahi > 9 || c != 0 || (ahi >= 9 && alo > 9))
+    {
+      newc = 1;
+      inc += 0x60;
+    }
+
+  op_add (ctx, inc);
+  set_flag_to (ctx, FLAG_C, newc == 1);
+}
+
+#endif /* !I8080_DAA_TABLE */
+
+#endif /* I8080_OPS_H */
@@ -0,0 +1,487 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080-disasm.h"
+#include "i8080-profile.h"
+#include "i8080.h"
+
+/* Records handed over at a time, the ring holds two of these. */
+#define PROFILE_BLOCK 4096
+
+/* Calls the shadow stack follows, deeper ones are charged to the caller. */
+#define PROFILE_DEPTH 1024
+
+/* No node, the end of a list of children. */
+#define NODE_NONE UINT32_MAX
+
+struct address
+{
+  uint64_t instructions;
+  uint64_t cycles;
+  uint8_t bytes[3]; /* Instruction seen here first */
+};
+
+struct routine
+{
+  uint64_t calls;
+  uint64_t inclusive; /* Cycles from entry to return */
+  uint64_t exclusive; /* The same without the subroutines it called */
+  uint32_t active;    /* Calls not returned from yet */
+};
+
+/* A call path in the call graph, with the cycles spent at its end. */
+struct node
+{
+  uint16_t address;
+  uint32_t parent;
+  uint32_t child;
+  uint32_t sibling;
+  uint64_t cycles;
+};
+
+struct frame
+{
+  uint16_t return_address;
+  uint16_t slot; /* Where it is on the stack */
+  uint32_t node;
+  uint64_t start; /* Cycle count on entry */
+};
+
+struct profile
+{
+  struct i8080 *ctx;
+  struct address addresses[UINT16_MAX + 1];
+  struct routine routines[UINT16_MAX + 1];
+  struct frame frames[PROFILE_DEPTH];
+  int depth;
+  uintmax_t lost;  /* Calls too deep for the shadow stack */
+  bool failed;     /* Ran out of memory for the call graph */
+  struct node *nodes;
+  uint32_t node_count;
+  uint32_t node_size;
+  struct i8080_trace_record last; /* Until the next one shows its cycles */
+  bool started;
+  bool stopped;
+  uint64_t first_cycles;
+  uint64_t end_cycles;
+};
+
+static void profile_sink (void *, const struct i8080_trace_record *, size_t);
+static void profile_start (struct profile *,
+                           const struct i8080_trace_record *);
+static void profile_account (struct profile *,
+                             const struct i8080_trace_record *, uint16_t,
+                             uint16_t, uint64_t);
+static void profile_call (struct profile *, uint16_t, uint16_t, uint16_t,
+                          uint64_t);
+static void profile_return (struct profile *, uint16_t, uint16_t, uint64_t);
+static void profile_pop (struct profile *, uint64_t);
+static uint32_t profile_child (struct profile *, uint32_t, uint16_t);
+static uint64_t profile_key (const struct profile *, bool, int);
+static int profile_top (const struct profile *, bool, uint16_t *, int);
+
+struct profile *
+profile_create (struct i8080 *ctx)
+{
+  struct profile *prof;
+
+  if (i8080_trace_enable (ctx, 2 * PROFILE_BLOCK) < 0)
+    {
+      fprintf (stderr, "Cannot profile, is I8080_TRACE enabled?\n");
+      return NULL;
+    }
+  prof = (struct profile *) calloc (1, sizeof (*prof));
+  if (prof == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      i8080_trace_disable (ctx);
+      return NULL;
+    }
+  prof->ctx = ctx;
+  i8080_trace_sink (ctx, PROFILE_BLOCK, profile_sink, prof);
+  return prof;
+}
+
+int
+profile_stop (struct profile *prof)
+{
+  struct i8080 *ctx = prof->ctx;
+
+  if (prof->stopped)
+    return prof->failed ? -1 : 0;
+  i8080_trace_flush (ctx);
+  i8080_trace_disable (ctx);
+  prof->stopped = true;
+  if (prof->started)
+    {
+      /* The last instruction ran up to where the CPU is now. */
+      profile_account (prof, &prof->last, ctx->pc, ctx->sp, ctx->cycles);
+      while (prof->depth > 0)
+        profile_pop (prof, ctx->cycles);
+      prof->end_cycles = ctx->cycles;
+    }
+  if (prof->failed)
+    {
+      fprintf (stderr, "Failed to allocate memory, the call graph is "
+                       "incomplete.\n");
+      return -1;
+    }
+  return 0;
+}
+
+int
+profile_write_folded (const struct profile *prof, const char *name)
+{
+  uint16_t path[PROFILE_DEPTH + 1];
+  uint32_t i, j;
+  int n;
+  FILE *fp;
+
+  fp = fopen (name, "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+  for (i = 0; i < prof->node_count; ++i)
+    {
+      if (prof->nodes[i].cycles == 0)
+        continue;
+      n = 0;
+      for (j = i; j != NODE_NONE; j = prof->nodes[j].parent)
+        path[n++] = prof->nodes[j].address;
+      while (n-- > 0)
+        fprintf (fp, "%04x%c", path[n], n > 0 ? ';' : ' ');
+      fprintf (fp, "%" PRIu64 "\n", prof->nodes[i].cycles);
+    }
+  if (ferror (fp) || fclose (fp) == EOF)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+  return 0;
+}
+
+void
+profile_print (const struct profile *prof, FILE *fp, int count)
+{
+  const struct address *addr;
+  const struct routine *r;
+  uint16_t *order;
+  uint64_t total;
+  char text[32];
+  int i, n;
+
+  order = (uint16_t *) malloc (count * sizeof (*order));
+  if (order == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      return;
+    }
+  total = prof->end_cycles - prof->first_cycles;
+  if (total == 0)
+    total = 1;
+
+  n = profile_top (prof, false, order, count);
+  fprintf (fp, "%-7s %14s %14s %6s  %s\n", "Address", "Instructions",
+           "Cycles", "%", "Instruction");
+  for (i = 0; i < n; ++i)
+    {
+      addr = &prof->addresses[order[i]];
+      i8080_disasm (text, sizeof (text), addr->bytes);
+      fprintf (fp, "%04x    %14" PRIu64 " %14" PRIu64 " %6.2f  %s\n",
+               order[i], addr->instructions, addr->cycles,
+               100.0 * addr->cycles / total, text);
+    }
+
+  n = profile_top (prof, true, order, count);
+  fprintf (fp, "\n%-10s %12s %14s %6s %14s %6s\n", "Subroutine", "Calls",
+           "Inclusive", "%", "Exclusive", "%");
+  for (i = 0; i < n; ++i)
+    {
+      r = &prof->routines[order[i]];
+      fprintf (fp,
+               "%04x       %12" PRIu64 " %14" PRIu64 " %6.2f %14" PRIu64
+               " %6.2f\n",
+               order[i], r->calls, r->inclusive, 100.0 * r->inclusive / total,
+               r->exclusive, 100.0 * r->exclusive / total);
+    }
+  if (prof->lost != 0)
+    fprintf (fp, "\n%ju calls were deeper than %d and charged to their "
+                 "callers.\n",
+             prof->lost, PROFILE_DEPTH);
+  free (order);
+}
+
+void
+profile_destroy (struct profile *prof)
+{
+  if (prof != NULL)
+    {
+      if (!prof->stopped)
+        i8080_trace_disable (prof->ctx);
+      free (prof->nodes);
+      free (prof);
+    }
+}
+
+/*
+ * A record only shows where an instruction started, so each one is
+ * counted when the next arrives with the cycles it took.
+ */
+static void
+profile_sink (void *data, const struct i8080_trace_record *records,
+              size_t count)
+{
+  struct profile *prof = (struct profile *) data;
+  size_t i;
+
+  i = 0;
+  if (!prof->started)
+    profile_start (prof, &records[i++]);
+  for (; i < count; ++i)
+    {
+      profile_account (prof, &prof->last, records[i].pc, records[i].sp,
+                       records[i].cycles);
+      prof->last = records[i];
+    }
+}
+
+/* The first instruction is the root of the call graph. */
+static void
+profile_start (struct profile *prof, const struct i8080_trace_record *rec)
+{
+  prof->first_cycles = rec->cycles;
+  prof->last = *rec;
+  prof->started = true;
+  prof->nodes = (struct node *) malloc (256 * sizeof (struct node));
+  if (prof->nodes == NULL)
+    {
+      prof->failed = true;
+      return;
+    }
+  prof->node_size = 256;
+  prof->node_count = 1;
+  prof->nodes[0] = (struct node){ rec->pc, NODE_NONE, NODE_NONE, NODE_NONE,
+                                  0 };
+  prof->frames[0] = (struct frame){ 0, 0, 0, rec->cycles };
+  prof->depth = 1;
+  prof->routines[rec->pc].calls = 1;
+  prof->routines[rec->pc].active = 1;
+}
+
+/*
+ * Count the instruction of the record, which ran until the CPU was at
+ * PC and SP with the cycle count CYCLES. A CALL, RST or interrupt that
+ * pushed, or a RET that popped, moves along the call graph.
+ */
+static void
+profile_account (struct profile *prof, const struct i8080_trace_record *rec,
+                 uint16_t pc, uint16_t sp, uint64_t cycles)
+{
+  struct address *addr = &prof->addresses[rec->pc];
+  uint64_t spent = cycles - rec->cycles;
+  uint8_t opcode = rec->bytes[0];
+  uint16_t return_address;
+  bool call, ret;
+
+  if (addr->instructions++ == 0)
+    memcpy (addr->bytes, rec->bytes, sizeof (addr->bytes));
+  addr->cycles += spent;
+  if (prof->depth == 0)
+    return;
+  prof->nodes[prof->frames[prof->depth - 1].node].cycles += spent;
+  prof->routines[prof->nodes[prof->frames[prof->depth - 1].node].address]
+      .exclusive
+      += spent;
+
+  /* CALL, Ccc and RST, with the undocumented CALLs. */
+  call = rec->interrupt || (opcode & 0xcf) == 0xcd || (opcode & 0xc7) == 0xc4
+         || (opcode & 0xc7) == 0xc7;
+  /* RET, Rcc and the undocumented RET. */
+  ret = !rec->interrupt
+        && ((opcode & 0xef) == 0xc9 || (opcode & 0xc7) == 0xc0);
+  if (call && sp == (uint16_t) (rec->sp - 2))
+    {
+      return_address = rec->pc;
+      if (!rec->interrupt)
+        return_address += i8080_opcode_length (opcode);
+      profile_call (prof, pc, return_address, sp, cycles);
+    }
+  else if (ret && sp == (uint16_t) (rec->sp + 2))
+    profile_return (prof, pc, rec->sp, cycles);
+}
+
+static void
+profile_call (struct profile *prof, uint16_t address, uint16_t return_address,
+              uint16_t slot, uint64_t cycles)
+{
+  struct routine *r = &prof->routines[address];
+  uint32_t node;
+
+  if (prof->depth == PROFILE_DEPTH)
+    {
+      ++prof->lost;
+      return;
+    }
+  node = profile_child (prof, prof->frames[prof->depth - 1].node, address);
+  if (node == NODE_NONE)
+    {
+      ++prof->lost;
+      return;
+    }
+  ++r->calls;
+  ++r->active;
+  prof->frames[prof->depth++]
+      = (struct frame){ return_address, slot, node, cycles };
+}
+
+/*
+ * Return to PC from the stack at SLOT. A subroutine may drop its return
+ * address and jump back, so the frame returned to can be further down
+ * the stack. One that reads data after its CALL moves its return address
+ * past it, which still returns from the slot of the last call. Any other
+ * RET is a jump through the stack.
+ */
+static void
+profile_return (struct profile *prof, uint16_t pc, uint16_t slot,
+                uint64_t cycles)
+{
+  int i;
+
+  if (prof->lost > 0)
+    {
+      --prof->lost;
+      return;
+    }
+  for (i = prof->depth - 1; i > 0; --i)
+    if (prof->frames[i].return_address == pc)
+      break;
+  if (i == 0 && prof->depth > 1 && prof->frames[prof->depth - 1].slot == slot)
+    i = prof->depth - 1;
+  if (i == 0)
+    return;
+  while (prof->depth > i)
+    profile_pop (prof, cycles);
+}
+
+/* Only the outermost of recursive calls counts toward the inclusive time. */
+static void
+profile_pop (struct profile *prof, uint64_t cycles)
+{
+  struct frame *frame = &prof->frames[--prof->depth];
+  struct routine *r = &prof->routines[prof->nodes[frame->node].address];
+
+  if (--r->active == 0)
+    r->inclusive += cycles - frame->start;
+}
+
+/* Find or add the call of ADDRESS from the path PARENT. */
+static uint32_t
+profile_child (struct profile *prof, uint32_t parent, uint16_t address)
+{
+  struct node *nodes = prof->nodes;
+  uint32_t i;
+
+  for (i = nodes[parent].child; i != NODE_NONE; i = nodes[i].sibling)
+    if (nodes[i].address == address)
+      return i;
+
+  if (prof->node_count == prof->node_size)
+    {
+      if (prof->node_size >= NODE_NONE / 2)
+        {
+          prof->failed = true;
+          return NODE_NONE;
+        }
+      nodes = (struct node *) realloc (nodes, 2 * prof->node_size
+                                                  * sizeof (struct node));
+      if (nodes == NULL)
+        {
+          prof->failed = true;
+          return NODE_NONE;
+        }
+      prof->nodes = nodes;
+      prof->node_size *= 2;
+    }
+  i = prof->node_count++;
+  nodes[i] = (struct node){ address, parent, NODE_NONE, nodes[parent].child,
+                            0 };
+  nodes[parent].child = i;
+  return i;
+}
+
+/* Cycles spent at an address, or in a subroutine with what it called. */
+static uint64_t
+profile_key (const struct profile *prof, bool routines, int address)
+{
+  if (routines)
+    return prof->routines[address].inclusive;
+  return prof->addresses[address].cycles;
+}
+
+/*
+ * Put the addresses with the most cycles, at most COUNT, first in ORDER
+ * and return how many there are.
+ */
+static int
+profile_top (const struct profile *prof, bool routines, uint16_t *order,
+             int count)
+{
+  uint64_t key;
+  uint16_t tmp;
+  int i, j, n;
+
+  /* An insertion sort that keeps only the top, the counts are small. */
+  n = 0;
+  for (i = 0; i <= UINT16_MAX && count > 0; ++i)
+    {
+      key = profile_key (prof, routines, i);
+      if (key == 0
+          || (n == count && key <= profile_key (prof, routines, order[n - 1])))
+        continue;
+      if (n < count)
+        ++n;
+      order[n - 1] = i;
+      for (j = n - 1; j > 0
+                      && profile_key (prof, routines, order[j])
+                             > profile_key (prof, routines, order[j - 1]);
+           --j)
+        {
+          tmp = order[j];
+          order[j] = order[j - 1];
+          order[j - 1] = tmp;
+        }
+    }
+  return n;
+}
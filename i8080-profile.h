@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Counts the instructions and cycles spent at every address while a CPU
+ * runs, and follows CALL, RST, interrupts and RET on a shadow stack to
+ * charge the cycles to subroutines, both with and without the ones they
+ * call. Records come from the trace of the CPU, so the core has to be
+ * built with I8080_TRACE.
+ *
+ * The call graph can be written as folded stacks, one line per call
+ * path with the cycles spent in its last frame:
+ *
+ *   0100;01ab;0005 1234
+ *
+ * which flamegraph.pl and most other flame graph tools read. Frames are
+ * named by the address the subroutine was entered at.
+ */
+
+#ifndef I8080_PROFILE_H
+#define I8080_PROFILE_H
+
+#include <stdio.h>
+
+#include "i8080.h"
+
+struct profile;
+
+/*
+ * Profile the CPU from now on, which replaces any trace it has. Returns
+ * NULL and prints a message if the profile cannot be started, which
+ * includes builds without I8080_TRACE.
+ */
+struct profile *profile_create (struct i8080 *);
+/*
+ * Count the last instructions, stop tracing the CPU and charge the
+ * subroutines still running. Returns -1 and prints a message if the call
+ * graph ran out of memory on the way, which leaves it incomplete.
+ */
+int profile_stop (struct profile *);
+/*
+ * Write the call graph as folded stacks. Returns -1 and prints a message
+ * if the file cannot be written.
+ */
+int profile_write_folded (const struct profile *, const char *);
+/* Print the busiest addresses and subroutines, at most the given count. */
+void profile_print (const struct profile *, FILE *, int);
+void profile_destroy (struct profile *);
+
+#endif /* I8080_PROFILE_H */
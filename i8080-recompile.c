@@ -0,0 +1,322 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Translates a fixed image, a CP/M program or a ROM, to C ahead of time:
+ *
+ *   i8080-recompile [-b base] [-e entry ...] [-n name] [-o file] image
+ *
+ * The code is found by following every jump, call and RST from the
+ * entry points, the load address unless -e is given. Each block of
+ * straight-line code becomes a function that moves registers itself and
+ * calls i8080_handlers for everything else, so the flags and memory
+ * behave exactly as in the interpreter. The file defines the blocks as
+ * an array of 65536 pointers indexed by address, named by -n, for
+ * i8080_aot_enable(). Code reached through PCHL or a return address that
+ * was never called, and code changed since, is left to the interpreter.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080-cgen.h"
+#include "i8080.h"
+
+/* Instructions in a block at most, like the block cache. */
+#define MAX_OPS 32
+
+struct image
+{
+  uint8_t memory[UINT16_MAX + 3]; /* Room for the operands at the end */
+  uint32_t base;
+  uint32_t end; /* One past the last byte */
+  bool start[UINT16_MAX + 1];   /* Blocks to translate */
+  bool visited[UINT16_MAX + 1]; /* Searched from already */
+};
+
+static void usage (void);
+static int parse_address (const char *, uint32_t *);
+static int load_image (struct image *, const char *);
+static uint32_t block_end (const struct image *, uint32_t, int *,
+                           uint32_t *);
+static void find_code (struct image *, uint32_t);
+static void write_block (FILE *, const struct image *, uint32_t);
+static void write_file (FILE *, const struct image *, const char *,
+                        const char *);
+
+int
+main (int argc, char **argv)
+{
+  static struct image img;
+  uint32_t entries[64];
+  const char *name, *output;
+  FILE *fp;
+  int ch, count, i;
+
+  img.base = 0;
+  name = "aot_blocks";
+  output = NULL;
+  count = 0;
+  while ((ch = getopt (argc, argv, "b:e:n:o:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'b':
+          if (parse_address (optarg, &img.base) < 0)
+            usage ();
+          break;
+        case 'e':
+          if (count == (int) (sizeof (entries) / sizeof (entries[0]))
+              || parse_address (optarg, &entries[count++]) < 0)
+            usage ();
+          break;
+        case 'n':
+          name = optarg;
+          break;
+        case 'o':
+          output = optarg;
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc != 1)
+    usage ();
+
+  if (load_image (&img, argv[0]) < 0)
+    return 1;
+  if (count == 0)
+    entries[count++] = img.base;
+  for (i = 0; i < count; ++i)
+    find_code (&img, entries[i]);
+
+  fp = stdout;
+  if (output != NULL && (fp = fopen (output, "w")) == NULL)
+    {
+      fprintf (stderr, "Could not open '%s': %s.\n", output,
+               strerror (errno));
+      return 1;
+    }
+  write_file (fp, &img, argv[0], name);
+  if (fflush (fp) != 0 || ferror (fp))
+    {
+      fprintf (stderr, "Could not write the output: %s.\n", strerror (errno));
+      return 1;
+    }
+  if (fp != stdout)
+    fclose (fp);
+  return 0;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "i8080-recompile [-b base] [-e entry ...] [-n name] "
+                   "[-o file] image\n");
+  fprintf (stderr, "  -b  Address the image is loaded at (default 0)\n");
+  fprintf (stderr, "  -e  Address execution can start at, such as an "
+                   "interrupt\n");
+  fprintf (stderr, "      vector (default the load address)\n");
+  fprintf (stderr, "  -n  Name of the array of blocks (default "
+                   "aot_blocks)\n");
+  fprintf (stderr, "  -o  File to write the C to (default standard "
+                   "output)\n");
+  exit (1);
+}
+
+static int
+parse_address (const char *str, uint32_t *address)
+{
+  unsigned long val;
+  char *end;
+
+  errno = 0;
+  val = strtoul (str, &end, 0);
+  if (errno != 0 || end == str || *end != '\0' || val > UINT16_MAX)
+    {
+      fprintf (stderr, "Invalid address '%s'.\n", str);
+      return -1;
+    }
+  *address = val;
+  return 0;
+}
+
+static int
+load_image (struct image *img, const char *file)
+{
+  FILE *fp;
+  size_t size;
+
+  fp = fopen (file, "rb");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "Could not open '%s': %s.\n", file, strerror (errno));
+      return -1;
+    }
+  size = fread (&img->memory[img->base], 1, UINT16_MAX + 1 - img->base, fp);
+  if (ferror (fp) || size == 0)
+    {
+      fprintf (stderr, "Could not read '%s'.\n", file);
+      fclose (fp);
+      return -1;
+    }
+  fclose (fp);
+  img->end = img->base + size;
+  return 0;
+}
+
+/*
+ * One past the last byte of the block at the address, with its number
+ * of instructions and the address of the last one. Blocks stop before
+ * an instruction that does not fit in the image.
+ */
+static uint32_t
+block_end (const struct image *img, uint32_t address, int *nops,
+           uint32_t *last)
+{
+  uint8_t opcode;
+
+  *last = address;
+  for (*nops = 0; *nops < MAX_OPS;)
+    {
+      opcode = img->memory[address];
+      if (address + i8080_opcode_length (opcode) > img->end)
+        break;
+      *last = address;
+      address += i8080_opcode_length (opcode);
+      ++*nops;
+      if (i8080_opcode_ends_block (opcode))
+        break;
+    }
+  return address;
+}
+
+/* Mark the blocks reachable from the address. */
+static void
+find_code (struct image *img, uint32_t entry)
+{
+  static uint32_t stack[UINT16_MAX + 1];
+  uint32_t address, end, last, next[2];
+  uint8_t opcode;
+  size_t depth;
+  int nops, i, count;
+
+  depth = 0;
+  stack[depth++] = entry;
+  img->visited[entry] = true;
+  while (depth > 0)
+    {
+      address = stack[--depth];
+      if (address < img->base || address >= img->end)
+        continue;
+      end = block_end (img, address, &nops, &last);
+      if (nops == 0)
+        continue;
+      img->start[address] = true;
+
+      /*
+       * Where the code can go next, see i8080_opcode_ends_block(). What
+       * follows a jump or a return is taken as well, since code reached
+       * through a table or PCHL usually sits there. Data translated by
+       * mistake only takes up space, as it never runs.
+       */
+      opcode = img->memory[last];
+      count = 0;
+      if (opcode == 0xc3 || opcode == 0xcb || (opcode & 0xc7) == 0xc2
+          || (opcode & 0xc7) == 0xc4 || opcode == 0xcd || opcode == 0xdd
+          || opcode == 0xed || opcode == 0xfd)
+        next[count++] = img->memory[last + 1] | (img->memory[last + 2] << 8);
+      else if ((opcode & 0xc7) == 0xc7)
+        next[count++] = opcode & 0x38;
+      next[count++] = end & UINT16_MAX;
+
+      /* Every address is pushed once, so the stack cannot overflow. */
+      for (i = 0; i < count; ++i)
+        if (!img->visited[next[i]])
+          {
+            img->visited[next[i]] = true;
+            stack[depth++] = next[i];
+          }
+    }
+}
+
+static void
+write_block (FILE *fp, const struct image *img, uint32_t start)
+{
+  char name[16];
+  uint32_t end, last;
+  int nops;
+
+  end = block_end (img, start, &nops, &last);
+  snprintf (name, sizeof (name), "block_%04x", start);
+  cgen_block (fp, name, start, &img->memory[start], end - start,
+              "i8080_handlers", false);
+}
+
+static void
+write_file (FILE *fp, const struct image *img, const char *file,
+            const char *name)
+{
+  uint32_t address, last, pc;
+  int cycles, nops, i;
+
+  fprintf (fp, "/* Generated by i8080-recompile from %s, do not edit. */\n\n",
+           file);
+  fprintf (fp, "#include <stdbool.h>\n#include <stdint.h>\n"
+               "#include <string.h>\n\n#include \"i8080.h\"\n\n");
+
+  for (address = img->base; address < img->end; ++address)
+    if (img->start[address])
+      write_block (fp, img, address);
+
+  fprintf (fp, "static const struct i8080_aot_block blocks[] = {\n");
+  for (address = img->base; address < img->end; ++address)
+    {
+      if (!img->start[address])
+        continue;
+      block_end (img, address, &nops, &last);
+      cycles = 0;
+      for (pc = address; pc < last;
+           pc += i8080_opcode_length (img->memory[pc]))
+        cycles += i8080_opcode_cycles (img->memory[pc]);
+      fprintf (fp, "  { block_%04x, %d, %d, 0x%02x },\n", address, cycles,
+               nops, img->memory[last]);
+    }
+  fprintf (fp, "};\n\n");
+
+  fprintf (fp, "const struct i8080_aot_block *const %s[UINT16_MAX + 1] = {\n",
+           name);
+  for (address = img->base, i = 0; address < img->end; ++address)
+    if (img->start[address])
+      fprintf (fp, "  [0x%04x] = &blocks[%d],\n", address, i++);
+  fprintf (fp, "};\n");
+}
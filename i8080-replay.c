@@ -0,0 +1,310 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080-replay.h"
+
+struct replay_event
+{
+  uintmax_t cycles;
+  uint8_t port; /* Unused for interrupts */
+  uint8_t value;
+};
+
+struct replay_events
+{
+  struct replay_event *events;
+  size_t count;
+  size_t capacity;
+  size_t next; /* Next one to replay */
+};
+
+struct replay
+{
+  const char *name;
+  FILE *fp; /* Log being written, NULL when replaying */
+  struct replay_events ins;
+  struct replay_events ints;
+  uintmax_t end_cycles;
+  uint64_t end_hash;
+  bool diverged; /* Reported once */
+};
+
+static int replay_read (struct replay *, FILE *);
+static int replay_push (struct replay_events *, uintmax_t, uint8_t, uint8_t);
+static void replay_diverged (struct replay *, uintmax_t, const char *);
+static void replay_free (struct replay *);
+
+struct replay *
+replay_open (const char *name, enum replay_mode mode)
+{
+  struct replay *replay;
+  FILE *fp;
+
+  replay = (struct replay *) calloc (1, sizeof (*replay));
+  if (replay == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      return NULL;
+    }
+  replay->name = name;
+
+  fp = fopen (name, mode == REPLAY_RECORD ? "w" : "r");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      free (replay);
+      return NULL;
+    }
+
+  if (mode == REPLAY_RECORD)
+    {
+      replay->fp = fp;
+      return replay;
+    }
+
+  if (replay_read (replay, fp) < 0)
+    {
+      fclose (fp);
+      replay_free (replay);
+      return NULL;
+    }
+  fclose (fp);
+  return replay;
+}
+
+/* Load the whole log, so interrupts can be looked up ahead of input. */
+static int
+replay_read (struct replay *replay, FILE *fp)
+{
+  char line[128], kind[8];
+  uintmax_t cycles;
+  unsigned int port, value;
+  uint64_t hash;
+  bool ended;
+  int line_number;
+
+  ended = false;
+  for (line_number = 1; fgets (line, sizeof (line), fp) != NULL;
+       ++line_number)
+    {
+      if (line[0] == '#' || line[0] == '\n')
+        continue;
+      if (sscanf (line, "%7s", kind) == 1 && !ended)
+        {
+          if (strcmp (kind, "in") == 0
+              && sscanf (line, "in %" SCNuMAX " %u %u", &cycles, &port,
+                         &value)
+                     == 3
+              && port <= UINT8_MAX && value <= UINT8_MAX)
+            {
+              if (replay_push (&replay->ins, cycles, port, value) < 0)
+                return -1;
+              continue;
+            }
+          if (strcmp (kind, "int") == 0
+              && sscanf (line, "int %" SCNuMAX " %u", &cycles, &value) == 2
+              && value <= UINT8_MAX)
+            {
+              if (replay_push (&replay->ints, cycles, 0, value) < 0)
+                return -1;
+              continue;
+            }
+          if (strcmp (kind, "end") == 0
+              && sscanf (line, "end %" SCNuMAX " %" SCNx64, &cycles, &hash)
+                     == 2)
+            {
+              replay->end_cycles = cycles;
+              replay->end_hash = hash;
+              ended = true;
+              continue;
+            }
+        }
+      fprintf (stderr, "%s:%d: Invalid line.\n", replay->name, line_number);
+      return -1;
+    }
+
+  if (ferror (fp))
+    {
+      fprintf (stderr, "%s: %s.\n", replay->name, strerror (errno));
+      return -1;
+    }
+  if (!ended)
+    {
+      fprintf (stderr, "%s: Recording was not finished.\n", replay->name);
+      return -1;
+    }
+  return 0;
+}
+
+static int
+replay_push (struct replay_events *list, uintmax_t cycles, uint8_t port,
+             uint8_t value)
+{
+  struct replay_event *events;
+  size_t capacity;
+
+  if (list->count == list->capacity)
+    {
+      capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+      events = (struct replay_event *) realloc (
+          list->events, capacity * sizeof (*events));
+      if (events == NULL)
+        {
+          fprintf (stderr, "Failed to allocate memory.\n");
+          return -1;
+        }
+      list->events = events;
+      list->capacity = capacity;
+    }
+  list->events[list->count].cycles = cycles;
+  list->events[list->count].port = port;
+  list->events[list->count].value = value;
+  ++list->count;
+  return 0;
+}
+
+uint8_t
+replay_inb (struct replay *replay, uintmax_t cycles, uint8_t port,
+            uint8_t value)
+{
+  const struct replay_event *event;
+
+  if (replay->fp != NULL)
+    {
+      fprintf (replay->fp, "in %ju %u %u\n", cycles, port, value);
+      return value;
+    }
+
+  if (replay->ins.next == replay->ins.count)
+    {
+      replay_diverged (replay, cycles, "more input than was recorded");
+      return value;
+    }
+  event = &replay->ins.events[replay->ins.next++];
+  if (event->cycles != cycles || event->port != port)
+    replay_diverged (replay, cycles, "input read at another time");
+  return event->value;
+}
+
+void
+replay_interrupt (struct replay *replay, uintmax_t cycles, uint8_t opcode)
+{
+  if (replay->fp != NULL)
+    fprintf (replay->fp, "int %ju %u\n", cycles, opcode);
+}
+
+bool
+replay_next_interrupt (struct replay *replay, uintmax_t *cycles,
+                       uint8_t *opcode)
+{
+  const struct replay_event *event;
+
+  if (replay->ints.next == replay->ints.count)
+    return false;
+  event = &replay->ints.events[replay->ints.next++];
+  *cycles = event->cycles;
+  *opcode = event->value;
+  return true;
+}
+
+uintmax_t
+replay_end_cycles (const struct replay *replay)
+{
+  return replay->end_cycles;
+}
+
+static void
+replay_diverged (struct replay *replay, uintmax_t cycles, const char *what)
+{
+  if (!replay->diverged)
+    fprintf (stderr, "%s: Replay diverged at cycle %ju, %s.\n", replay->name,
+             cycles, what);
+  replay->diverged = true;
+}
+
+int
+replay_close (struct replay *replay, uintmax_t cycles, uint64_t hash)
+{
+  int status;
+
+  status = 0;
+  if (replay->fp != NULL)
+    {
+      fprintf (replay->fp, "end %ju %016" PRIx64 "\n", cycles, hash);
+      if (fclose (replay->fp) != 0)
+        {
+          fprintf (stderr, "%s: %s.\n", replay->name, strerror (errno));
+          status = -1;
+        }
+      replay->fp = NULL;
+    }
+  else
+    {
+      if (replay->ins.next != replay->ins.count)
+        replay_diverged (replay, cycles, "recorded input left over");
+      else if (replay->ints.next != replay->ints.count)
+        replay_diverged (replay, cycles, "recorded interrupts left over");
+      else if (cycles != replay->end_cycles)
+        replay_diverged (replay, cycles, "stopped at another cycle");
+      else if (hash != replay->end_hash)
+        replay_diverged (replay, cycles, "memory differs at the end");
+      if (replay->diverged)
+        status = -1;
+    }
+
+  replay_free (replay);
+  return status;
+}
+
+static void
+replay_free (struct replay *replay)
+{
+  free (replay->ins.events);
+  free (replay->ints.events);
+  free (replay);
+}
+
+uint64_t
+replay_hash (const uint8_t *mem, size_t size)
+{
+  uint64_t hash;
+  size_t i;
+
+  hash = UINT64_C (0xcbf29ce484222325);
+  for (i = 0; i < size; ++i)
+    {
+      hash ^= mem[i];
+      hash *= UINT64_C (0x100000001b3);
+    }
+  return hash;
+}
@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Records what a machine reads from its input ports and when the host
+ * interrupts it, keyed by the cycle count, so a session can be run again
+ * without the host. The log is text, one event per line:
+ *
+ *   in CYCLES PORT VALUE
+ *   int CYCLES OPCODE
+ *   end CYCLES HASH
+ *
+ * The end line holds the cycle count and a hash of memory when the
+ * recording stopped, which a replay has to reproduce.
+ */
+
+#ifndef I8080_REPLAY_H
+#define I8080_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum replay_mode
+{
+  REPLAY_RECORD,
+  REPLAY_PLAY,
+};
+
+struct replay;
+
+/* Returns NULL and prints a message if the log cannot be opened. */
+struct replay *replay_open (const char *, enum replay_mode);
+/*
+ * Pass the value the host read from the port at the given cycle count.
+ * Recording logs it and returns it, replaying returns the logged one.
+ */
+uint8_t replay_inb (struct replay *, uintmax_t, uint8_t, uint8_t);
+/* Log an interrupt sent at the given cycle count. */
+void replay_interrupt (struct replay *, uintmax_t, uint8_t);
+/*
+ * Get the next logged interrupt when replaying. Returns false when there
+ * are no more.
+ */
+bool replay_next_interrupt (struct replay *, uintmax_t *, uint8_t *);
+/* Cycle count when the recording stopped. */
+uintmax_t replay_end_cycles (const struct replay *);
+/*
+ * Write the end line or check the replay against it, then free the log.
+ * Returns -1 and prints a message if writing fails or the replay went a
+ * different way.
+ */
+int replay_close (struct replay *, uintmax_t, uint64_t);
+/* FNV-1a hash of memory for the end line. */
+uint64_t replay_hash (const uint8_t *, size_t);
+
+#endif /* I8080_REPLAY_H */
@@ -0,0 +1,238 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i8080-disasm.h"
+#include "i8080-stats.h"
+#include "i8080.h"
+
+enum stats_class
+{
+  CLASS_TRANSFER,   /* MOV, MVI, LXI, loads, stores and XCHG */
+  CLASS_ARITHMETIC, /* ADD to SBB, INR, DCR, INX, DCX, DAD and DAA */
+  CLASS_LOGICAL,    /* ANA to CMP, rotates, CMA, CMC and STC */
+  CLASS_BRANCH,     /* JMP, CALL, RET, RST, PCHL and their conditions */
+  CLASS_CONTROL,    /* PUSH, POP, XTHL, SPHL, IN, OUT, EI, DI, HLT, NOP */
+  CLASS_COUNT
+};
+
+static const char *const class_names[CLASS_COUNT] = {
+  "transfer", "arithmetic", "logical", "branch", "control",
+};
+
+/* Conditional instructions by bits 0-2 of their opcode. */
+static const char *const conditional_names[3] = { "return", "jump", "call" };
+
+static enum stats_class stats_class (uint8_t);
+static bool stats_conditional (uint8_t);
+static void stats_mnemonic (char *, size_t, uint8_t);
+
+int
+stats_write_json (const struct i8080_stats *stats, const char *name)
+{
+  uint64_t class_count[CLASS_COUNT], class_cycles[CLASS_COUNT];
+  uint64_t taken[3], not_taken[3];
+  uint64_t instructions, cycles;
+  double total;
+  char mnemonic[16], second[16];
+  bool first;
+  FILE *fp;
+  int i, kind;
+
+  memset (class_count, 0, sizeof (class_count));
+  memset (class_cycles, 0, sizeof (class_cycles));
+  memset (taken, 0, sizeof (taken));
+  memset (not_taken, 0, sizeof (not_taken));
+  instructions = cycles = 0;
+  for (i = 0; i < 256; ++i)
+    {
+      instructions += stats->count[i];
+      cycles += stats->cycles[i];
+      class_count[stats_class (i)] += stats->count[i];
+      class_cycles[stats_class (i)] += stats->cycles[i];
+      if (stats_conditional (i))
+        {
+          kind = (i & 0x07) / 2;
+          taken[kind] += stats->taken[i];
+          not_taken[kind] += stats->count[i] - stats->taken[i];
+        }
+    }
+  total = (cycles != 0) ? (double) cycles : 1.0;
+
+  fp = fopen (name, "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"instructions\": %" PRIu64 ",\n", instructions);
+  fprintf (fp, "  \"cycles\": %" PRIu64 ",\n", cycles);
+  fprintf (fp,
+           "  \"interrupts\": { \"count\": %" PRIu64 ", \"cycles\": %" PRIu64
+           " },\n",
+           stats->interrupts, stats->interrupt_cycles);
+
+  fprintf (fp, "  \"classes\": [\n");
+  for (i = 0; i < CLASS_COUNT; ++i)
+    fprintf (fp,
+             "    { \"class\": \"%s\", \"count\": %" PRIu64
+             ", \"cycles\": %" PRIu64 ", \"cycle_share\": %f }%s\n",
+             class_names[i], class_count[i], class_cycles[i],
+             class_cycles[i] / total, i + 1 < CLASS_COUNT ? "," : "");
+  fprintf (fp, "  ],\n");
+
+  fprintf (fp, "  \"conditionals\": [\n");
+  for (i = 0; i < 3; ++i)
+    fprintf (fp,
+             "    { \"kind\": \"%s\", \"taken\": %" PRIu64
+             ", \"not_taken\": %" PRIu64 " }%s\n",
+             conditional_names[i], taken[i], not_taken[i],
+             i + 1 < 3 ? "," : "");
+  fprintf (fp, "  ],\n");
+
+  fprintf (fp, "  \"opcodes\": [");
+  first = true;
+  for (i = 0; i < 256; ++i)
+    {
+      if (stats->count[i] == 0)
+        continue;
+      stats_mnemonic (mnemonic, sizeof (mnemonic), i);
+      fprintf (fp,
+               "%s\n    { \"opcode\": %d, \"mnemonic\": \"%s\", \"class\": "
+               "\"%s\", \"count\": %" PRIu64 ", \"cycles\": %" PRIu64
+               ", \"cycle_share\": %f",
+               first ? "" : ",", i, mnemonic, class_names[stats_class (i)],
+               stats->count[i], stats->cycles[i], stats->cycles[i] / total);
+      if (stats_conditional (i))
+        fprintf (fp, ", \"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64,
+                 stats->taken[i], stats->count[i] - stats->taken[i]);
+      fprintf (fp, " }");
+      first = false;
+    }
+  fprintf (fp, "\n  ],\n");
+
+  fprintf (fp, "  \"pairs\": [");
+  first = true;
+  for (i = 0; i < 256 * 256; ++i)
+    {
+      if (stats->pairs[i / 256][i % 256] == 0)
+        continue;
+      stats_mnemonic (mnemonic, sizeof (mnemonic), i / 256);
+      stats_mnemonic (second, sizeof (second), i % 256);
+      fprintf (fp,
+               "%s\n    { \"first\": %d, \"second\": %d, \"count\": %" PRIu64
+               ", \"mnemonics\": \"%s; %s\" }",
+               first ? "" : ",", i / 256, i % 256,
+               stats->pairs[i / 256][i % 256], mnemonic, second);
+      first = false;
+    }
+  fprintf (fp, "\n  ]\n}\n");
+
+  if (ferror (fp) || fclose (fp) == EOF)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return -1;
+    }
+  return 0;
+}
+
+static enum stats_class
+stats_class (uint8_t opcode)
+{
+  if (opcode >= 0x40 && opcode < 0x80)
+    return (opcode == 0x76) ? CLASS_CONTROL : CLASS_TRANSFER; /* HLT */
+  if (opcode >= 0x80 && opcode < 0xc0)
+    return (opcode < 0xa0) ? CLASS_ARITHMETIC : CLASS_LOGICAL;
+
+  if (opcode < 0x40)
+    switch (opcode & 0x0f)
+      {
+      case 0x00: /* NOP */
+      case 0x08:
+        return CLASS_CONTROL;
+      case 0x01: /* LXI */
+      case 0x02: /* STAX, SHLD and STA */
+      case 0x06: /* MVI */
+      case 0x0a: /* LDAX, LHLD and LDA */
+      case 0x0e:
+        return CLASS_TRANSFER;
+      case 0x07: /* RLC, RAL, DAA and STC */
+        return (opcode == 0x27) ? CLASS_ARITHMETIC : CLASS_LOGICAL;
+      case 0x0f: /* RRC, RAR, CMA and CMC */
+        return CLASS_LOGICAL;
+      default: /* INX, INR, DCR, DAD and DCX */
+        return CLASS_ARITHMETIC;
+      }
+
+  switch (opcode & 0x07)
+    {
+    case 0x01: /* POP, RET, PCHL and SPHL */
+      return (opcode == 0xc1 || opcode == 0xd1 || opcode == 0xe1
+              || opcode == 0xf1 || opcode == 0xf9)
+                 ? CLASS_CONTROL
+                 : CLASS_BRANCH;
+    case 0x03: /* JMP, OUT, IN, XTHL, XCHG, DI and EI */
+      if (opcode == 0xc3 || opcode == 0xcb)
+        return CLASS_BRANCH;
+      return (opcode == 0xeb) ? CLASS_TRANSFER : CLASS_CONTROL;
+    case 0x05: /* PUSH and CALL */
+      return (opcode & 0x08) ? CLASS_BRANCH : CLASS_CONTROL;
+    case 0x06: /* ADI, ACI, SUI and SBI, then ANI to CPI */
+      return (opcode < 0xe0) ? CLASS_ARITHMETIC : CLASS_LOGICAL;
+    default: /* Rcc, Jcc, Ccc and RST */
+      return CLASS_BRANCH;
+    }
+}
+
+/* Jcc, Ccc and Rcc. */
+static bool
+stats_conditional (uint8_t opcode)
+{
+  return opcode >= 0xc0 && (opcode & 0x01) == 0 && (opcode & 0x07) != 0x06;
+}
+
+/* The mnemonic without its immediate operand. */
+static void
+stats_mnemonic (char *buf, size_t size, uint8_t opcode)
+{
+  const uint8_t code[3] = { opcode, 0, 0 };
+  char *p;
+
+  i8080_disasm (buf, size, code);
+  p = strstr (buf, "0x");
+  if (p != NULL)
+    {
+      if (p > buf && (p[-1] == ' ' || p[-1] == ','))
+        --p;
+      *p = '\0';
+    }
+}
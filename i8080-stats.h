@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Writes the opcode counters of a CPU as JSON for scripts to read:
+ *
+ *   {
+ *     "instructions": 651,
+ *     "cycles": 4924,
+ *     "interrupts": { "count": 0, "cycles": 0 },
+ *     "classes": [
+ *       { "class": "transfer", "count": 201, "cycles": 1516,
+ *         "cycle_share": 0.307880 },
+ *       ...
+ *     ],
+ *     "conditionals": [
+ *       { "kind": "return", "taken": 8, "not_taken": 8 },
+ *       ...
+ *     ],
+ *     "opcodes": [
+ *       { "opcode": 202, "mnemonic": "JZ", "class": "branch",
+ *         "count": 15, "cycles": 150, "cycle_share": 0.030463,
+ *         "taken": 10, "not_taken": 5 },
+ *       ...
+ *     ],
+ *     "pairs": [
+ *       { "first": 205, "second": 229, "count": 21,
+ *         "mnemonics": "CALL; PUSH H" },
+ *       ...
+ *     ]
+ *   }
+ *
+ * Only the opcodes and pairs that ran are listed, in order, one to a
+ * line, which misc/makefusions.c relies on. The classes are the
+ * groups of the Intel 8080 manual, and taken and not_taken are only
+ * given for Jcc, Ccc and Rcc. The cycle shares leave out interrupts.
+ */
+
+#ifndef I8080_STATS_H
+#define I8080_STATS_H
+
+#include "i8080.h"
+
+/*
+ * Write the counters to a file. Returns -1 and prints a message if it
+ * cannot be written.
+ */
+int stats_write_json (const struct i8080_stats *, const char *);
+
+#endif /* I8080_STATS_H */
@@ -0,0 +1,354 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Finds the first instruction where two traces written by
+ * i8080-emulator -T differ. Records are matched by their index in the
+ * trace, whatever block they are in. Blocks that hold the same records
+ * are packed to the same bytes, so runs of equal blocks are compared with
+ * memcmp() straight from the mapped files and only the blocks around
+ * the difference are decoded.
+ *
+ * The exit status is 0 if the traces are the same, 1 if they differ and
+ * 2 if one of them cannot be read, like cmp(1).
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i8080-tracefile.h"
+#include "i8080.h"
+
+/* Where one of the traces is. */
+struct cursor
+{
+  const char *name;
+  struct tracefile *tf;
+  struct tracefile_block block;
+  struct tracefile_block last; /* Block before this one */
+  struct i8080_trace_record *records;
+  uint64_t next;   /* Index of the next record in the trace */
+  uint32_t index;  /* Of the next record in the block */
+  bool has_block;
+  bool has_last;
+  bool decoded;
+};
+
+static void usage (void);
+static int cursor_open (struct cursor *, const char *);
+static void cursor_close (struct cursor *);
+static int cursor_fill (struct cursor *);
+static int cursor_decode (struct cursor *);
+static void cursor_skip (struct cursor *);
+static bool records_equal (const struct i8080_trace_record *,
+                           const struct i8080_trace_record *);
+static int print_context (struct cursor *, unsigned int);
+static void print_differences (const struct i8080_trace_record *,
+                               const struct i8080_trace_record *);
+
+int
+main (int argc, char **argv)
+{
+  struct cursor a, b;
+  const struct i8080_trace_record *ra, *rb;
+  unsigned int context;
+  int ch, sa, sb, status;
+
+  context = 8;
+  while ((ch = getopt (argc, argv, "n:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'n':
+          context = atoi (optarg);
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc != 2)
+    usage ();
+
+  if (cursor_open (&a, argv[0]) < 0)
+    return 2;
+  if (cursor_open (&b, argv[1]) < 0)
+    {
+      cursor_close (&a);
+      return 2;
+    }
+
+  for (;;)
+    {
+      sa = cursor_fill (&a);
+      sb = cursor_fill (&b);
+      if (sa < 0 || sb < 0)
+        {
+          status = 2;
+          break;
+        }
+      if (sa == 0 || sb == 0)
+        {
+          status = (sa != sb);
+          if (sa == 0 && sb != 0)
+            printf ("%s ends after %" PRIu64 " instructions, %s goes on.\n",
+                    a.name, a.next, b.name);
+          else if (sa != 0)
+            printf ("%s ends after %" PRIu64 " instructions, %s goes on.\n",
+                    b.name, b.next, a.name);
+          break;
+        }
+
+      /* Both at the start of blocks that pack to the same bytes. */
+      if (a.index == 0 && b.index == 0 && a.block.count == b.block.count
+          && a.block.packed_size == b.block.packed_size
+          && memcmp (a.block.packed, b.block.packed, a.block.packed_size)
+                 == 0)
+        {
+          cursor_skip (&a);
+          cursor_skip (&b);
+          continue;
+        }
+
+      if (cursor_decode (&a) < 0 || cursor_decode (&b) < 0)
+        {
+          status = 2;
+          break;
+        }
+      while (a.index < a.block.count && b.index < b.block.count)
+        {
+          if (!records_equal (&a.records[a.index], &b.records[b.index]))
+            break;
+          ++a.index;
+          ++a.next;
+          ++b.index;
+          ++b.next;
+        }
+      if (a.index < a.block.count && b.index < b.block.count)
+        {
+          printf ("%s and %s differ at instruction %" PRIu64 ":\n", a.name,
+                  b.name, a.next);
+          status = 1;
+          ra = &a.records[a.index];
+          rb = &b.records[b.index];
+          if (print_context (&a, context) < 0)
+            status = 2;
+          printf ("< ");
+          i8080_trace_print (ra, stdout);
+          printf ("> ");
+          i8080_trace_print (rb, stdout);
+          print_differences (ra, rb);
+          break;
+        }
+    }
+
+  cursor_close (&a);
+  cursor_close (&b);
+  return status;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "i8080-tracediff [-n context] trace1 trace2\n");
+  fprintf (stderr, "  -n  Instructions to show before the difference "
+                   "(default 8)\n");
+  exit (2);
+}
+
+static int
+cursor_open (struct cursor *cur, const char *name)
+{
+  memset (cur, 0, sizeof (*cur));
+  cur->name = name;
+  cur->tf = tracefile_open (name);
+  if (cur->tf == NULL)
+    return -1;
+  cur->records = (struct i8080_trace_record *) malloc (
+      tracefile_block_records (cur->tf) * sizeof (*cur->records));
+  if (cur->records == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      tracefile_close (cur->tf);
+      return -1;
+    }
+  return 0;
+}
+
+static void
+cursor_close (struct cursor *cur)
+{
+  free (cur->records);
+  tracefile_close (cur->tf);
+}
+
+/*
+ * Make sure the cursor is on a record. Returns 1 if it is, 0 at the end
+ * of the trace and -1 if its blocks are out of order.
+ */
+static int
+cursor_fill (struct cursor *cur)
+{
+  int status;
+
+  while (!cur->has_block || cur->index == cur->block.count)
+    {
+      if (cur->has_block)
+        {
+          cur->last = cur->block;
+          cur->has_last = true;
+        }
+      /* A trace cut short by a killed run is still good up to there. */
+      status = tracefile_next (cur->tf, &cur->block);
+      if (status <= 0)
+        {
+          cur->has_block = false;
+          return 0;
+        }
+      if (cur->block.first != cur->next)
+        {
+          fprintf (stderr, "%s: Block at record %" PRIu64 " is out of "
+                           "order.\n",
+                   cur->name, cur->block.first);
+          return -1;
+        }
+      cur->has_block = true;
+      cur->decoded = false;
+      cur->index = 0;
+    }
+  return 1;
+}
+
+static int
+cursor_decode (struct cursor *cur)
+{
+  if (cur->decoded)
+    return 0;
+  if (tracefile_decode (cur->tf, &cur->block, cur->records) < 0)
+    return -1;
+  cur->decoded = true;
+  return 0;
+}
+
+/* Step over the rest of the block without decoding it. */
+static void
+cursor_skip (struct cursor *cur)
+{
+  cur->next += cur->block.count - cur->index;
+  cur->index = cur->block.count;
+}
+
+/*
+ * Decoded records have no lazy flags, so the rest is all there is. Only
+ * the bytes of the instruction count, the ones after it are whatever
+ * memory held.
+ */
+static bool
+records_equal (const struct i8080_trace_record *x,
+               const struct i8080_trace_record *y)
+{
+  return x->cycles == y->cycles && x->pc == y->pc && x->sp == y->sp
+         && memcmp (x->regs, y->regs, sizeof (x->regs)) == 0
+         && x->interrupt == y->interrupt
+         && memcmp (x->bytes, y->bytes, i8080_opcode_length (x->bytes[0]))
+                == 0;
+}
+
+/*
+ * Print the instructions before the one the cursor is on, which both
+ * traces ran. The first of them may be in the block before, which is
+ * decoded again for this.
+ */
+static int
+print_context (struct cursor *cur, unsigned int context)
+{
+  uint32_t i, n;
+
+  n = (context < cur->index) ? context : cur->index;
+  if (n < context && cur->has_last)
+    {
+      struct i8080_trace_record *records;
+      uint32_t from;
+
+      records = (struct i8080_trace_record *) malloc (
+          tracefile_block_records (cur->tf) * sizeof (*records));
+      if (records == NULL)
+        {
+          fprintf (stderr, "Failed to allocate memory.\n");
+          return -1;
+        }
+      if (tracefile_decode (cur->tf, &cur->last, records) < 0)
+        {
+          free (records);
+          return -1;
+        }
+      from = (context - n < cur->last.count) ? cur->last.count - (context - n)
+                                             : 0;
+      for (i = from; i < cur->last.count; ++i)
+        {
+          printf ("  ");
+          i8080_trace_print (&records[i], stdout);
+        }
+      free (records);
+    }
+  for (i = cur->index - n; i < cur->index; ++i)
+    {
+      printf ("  ");
+      i8080_trace_print (&cur->records[i], stdout);
+    }
+  return 0;
+}
+
+/* Name what is different, since a line is easy to misread. */
+static void
+print_differences (const struct i8080_trace_record *x,
+                   const struct i8080_trace_record *y)
+{
+  static const char names[8][2] = { "A", "F", "B", "C", "D", "E", "H", "L" };
+  int i;
+
+  printf ("Different:");
+  if (x->cycles != y->cycles)
+    printf (" cycles");
+  if (x->pc != y->pc)
+    printf (" PC");
+  if (x->interrupt != y->interrupt)
+    printf (" interrupt");
+  else if (memcmp (x->bytes, y->bytes, i8080_opcode_length (x->bytes[0]))
+           != 0)
+    printf (" %s", x->interrupt ? "opcode" : "bytes");
+  for (i = 0; i < 8; ++i)
+    if (x->regs[i] != y->regs[i])
+      printf (" %.1s", names[i]);
+  if (x->sp != y->sp)
+    printf (" SP");
+  printf ("\n");
+}
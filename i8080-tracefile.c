@@ -0,0 +1,867 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i8080-tracefile.h"
+#include "i8080.h"
+
+#define TRACEFILE_MAGIC "I8080TR2"
+#define TRACEFILE_HEADER_SIZE (8 + 4 + 4 + 256 + 256)
+#define TRACEFILE_BLOCK_HEADER_SIZE (8 + 4 + 4 + 4)
+
+/* Blocks the writer can be behind, which sets the size of the ring. */
+#define TRACEFILE_QUEUE 8
+
+/* Most bytes a record takes before packing, see encode_record(). */
+#define RECORD_MAX_SIZE (1 + 3 + 10 + 1 + 3 + 1 + 8 + 3)
+#define RAW_MAX_SIZE (TRACEFILE_BLOCK * RECORD_MAX_SIZE)
+/* LZ77 never grows the input by more than this. */
+#define PACKED_MAX_SIZE (RAW_MAX_SIZE + RAW_MAX_SIZE / 255 + 16)
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+
+/* What is stored for a record besides the tag byte, in this order. */
+#define TAG_PC 0x01        /* Difference from the next address, a varint */
+#define TAG_CYCLES 0x02    /* Cycles since the last record, a varint */
+#define TAG_INTERRUPT 0x04 /* Opcode sent */
+#define TAG_CODE 0x08      /* The instruction bytes */
+#define TAG_REGS 0x10      /* Mask of registers, then their differences */
+#define TAG_SP 0x20        /* Difference, a varint */
+
+/* The registers are handled as the bytes of a word, see bytes_sub(). */
+#define BYTES_HIGH UINT64_C (0x8080808080808080)
+
+/*
+ * The length and cycles of each opcode from the header, and the last
+ * instruction the current block has shown at each address, the same for
+ * encoding and decoding. The code starts out as zeros. The encoder also
+ * keeps the registers of the record before with the flags worked out.
+ */
+struct model
+{
+  uint8_t lengths[256];
+  uint8_t cycles[256];
+  uint32_t code[UINT16_MAX + 1];
+  uint64_t regs;
+};
+
+struct tracefile_writer
+{
+  struct i8080 *ctx;
+  const char *name;
+  FILE *fp;
+  pthread_t thread;
+  struct model *model;
+  uint8_t *raw;
+  uint8_t *packed;
+  uint32_t *hash;
+  uint64_t written; /* Records written */
+  bool failed;
+
+  /* Blocks passed by the CPU's thread and not written yet. */
+  const struct i8080_trace_record *queue[TRACEFILE_QUEUE];
+  size_t counts[TRACEFILE_QUEUE];
+  atomic_size_t head; /* Blocks passed */
+  atomic_size_t tail; /* Blocks written */
+  atomic_bool done;
+};
+
+struct tracefile
+{
+  const char *name;
+  const uint8_t *data;
+  size_t size;
+  size_t offset; /* Of the next block */
+  size_t block_records;
+  struct model *model;
+  uint8_t *raw;
+};
+
+static struct model *model_create (void);
+static void model_reset (struct model *);
+static inline uint64_t bytes_sub (uint64_t, uint64_t);
+static inline uint8_t bytes_nonzero (uint64_t);
+static uint8_t *encode_record (struct model *, uint8_t *,
+                               const struct i8080_trace_record *,
+                               const struct i8080_trace_record *);
+static const uint8_t *decode_record (struct model *, const uint8_t *,
+                                     const uint8_t *,
+                                     const struct i8080_trace_record *,
+                                     struct i8080_trace_record *);
+static size_t lz_pack (const uint8_t *, size_t, uint8_t *, uint32_t *);
+static int lz_unpack (const uint8_t *, size_t, uint8_t *, size_t);
+static void writer_push (void *, const struct i8080_trace_record *, size_t);
+static void *writer_thread (void *);
+static void writer_block (struct tracefile_writer *,
+                          const struct i8080_trace_record *, size_t);
+static inline uint16_t zigzag (int16_t);
+static inline uint16_t unzigzag (uint64_t);
+static inline uint8_t *put_varint (uint8_t *, uint64_t);
+static inline const uint8_t *get_varint (const uint8_t *, const uint8_t *,
+                                         uint64_t *);
+static inline void put_u16 (uint8_t *, uint16_t);
+static inline void put_u32 (uint8_t *, uint32_t);
+static inline void put_u64 (uint8_t *, uint64_t);
+static inline uint16_t get_u16 (const uint8_t *);
+static inline uint32_t get_u32 (const uint8_t *);
+static inline uint64_t get_u64 (const uint8_t *);
+
+struct tracefile_writer *
+tracefile_create (struct i8080 *ctx, const char *name)
+{
+  struct tracefile_writer *writer;
+  uint8_t header[TRACEFILE_HEADER_SIZE];
+  int i;
+
+  if (i8080_trace_enable (ctx, TRACEFILE_BLOCK * TRACEFILE_QUEUE) < 0)
+    {
+      fprintf (stderr, "Cannot trace, is I8080_TRACE enabled?\n");
+      return NULL;
+    }
+
+  writer = (struct tracefile_writer *) calloc (1, sizeof (*writer));
+  if (writer == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      i8080_trace_disable (ctx);
+      return NULL;
+    }
+  writer->ctx = ctx;
+  writer->name = name;
+  writer->model = model_create ();
+  writer->raw = (uint8_t *) malloc (RAW_MAX_SIZE);
+  writer->packed = (uint8_t *) malloc (PACKED_MAX_SIZE);
+  writer->hash = (uint32_t *) malloc (sizeof (uint32_t) << LZ_HASH_BITS);
+  if (writer->model == NULL || writer->raw == NULL || writer->packed == NULL
+      || writer->hash == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      goto fail;
+    }
+  for (i = 0; i <= UINT8_MAX; ++i)
+    {
+      writer->model->lengths[i] = i8080_opcode_length (i);
+      writer->model->cycles[i] = i8080_opcode_cycles (i);
+    }
+  atomic_init (&writer->head, 0);
+  atomic_init (&writer->tail, 0);
+  atomic_init (&writer->done, false);
+
+  writer->fp = fopen (name, "wb");
+  if (writer->fp == NULL)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      goto fail;
+    }
+  memcpy (header, TRACEFILE_MAGIC, 8);
+  put_u32 (&header[8], TRACEFILE_HEADER_SIZE);
+  put_u32 (&header[12], TRACEFILE_BLOCK);
+  memcpy (&header[16], writer->model->lengths, 256);
+  memcpy (&header[16 + 256], writer->model->cycles, 256);
+  if (fwrite (header, 1, sizeof (header), writer->fp) != sizeof (header))
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      goto fail;
+    }
+
+  if (pthread_create (&writer->thread, NULL, writer_thread, writer) != 0)
+    {
+      fprintf (stderr, "Failed to create a thread.\n");
+      goto fail;
+    }
+  i8080_trace_sink (ctx, TRACEFILE_BLOCK, writer_push, writer);
+  return writer;
+
+fail:
+  if (writer->fp != NULL)
+    fclose (writer->fp);
+  free (writer->model);
+  free (writer->raw);
+  free (writer->packed);
+  free (writer->hash);
+  free (writer);
+  i8080_trace_disable (ctx);
+  return NULL;
+}
+
+int
+tracefile_finish (struct tracefile_writer *writer)
+{
+  int status;
+
+  i8080_trace_flush (writer->ctx);
+  atomic_store_explicit (&writer->done, true, memory_order_release);
+  pthread_join (writer->thread, NULL);
+  i8080_trace_disable (writer->ctx);
+
+  status = 0;
+  if (writer->failed || fclose (writer->fp) != 0)
+    {
+      fprintf (stderr, "%s: Failed to write the trace.\n", writer->name);
+      status = -1;
+    }
+  if (writer->failed)
+    fclose (writer->fp);
+  free (writer->model);
+  free (writer->raw);
+  free (writer->packed);
+  free (writer->hash);
+  free (writer);
+  return status;
+}
+
+/*
+ * Called on the CPU's thread. It goes on to write over the oldest block
+ * in the ring, so the writer has to be done with that one first.
+ */
+static void
+writer_push (void *writerptr, const struct i8080_trace_record *records,
+             size_t count)
+{
+  struct tracefile_writer *writer = (struct tracefile_writer *) writerptr;
+  size_t head;
+
+  head = atomic_load_explicit (&writer->head, memory_order_relaxed);
+  writer->queue[head % TRACEFILE_QUEUE] = records;
+  writer->counts[head % TRACEFILE_QUEUE] = count;
+  atomic_store_explicit (&writer->head, head + 1, memory_order_release);
+  while (head + 1 - atomic_load_explicit (&writer->tail, memory_order_acquire)
+         >= TRACEFILE_QUEUE)
+    sched_yield ();
+}
+
+static void *
+writer_thread (void *writerptr)
+{
+  struct tracefile_writer *writer = (struct tracefile_writer *) writerptr;
+  const struct timespec nap = { 0, 100000 };
+  size_t head, tail;
+  bool done;
+
+  tail = atomic_load_explicit (&writer->tail, memory_order_relaxed);
+  for (;;)
+    {
+      done = atomic_load_explicit (&writer->done, memory_order_acquire);
+      head = atomic_load_explicit (&writer->head, memory_order_acquire);
+      if (tail == head)
+        {
+          if (done)
+            return NULL;
+          nanosleep (&nap, NULL);
+          continue;
+        }
+      writer_block (writer, writer->queue[tail % TRACEFILE_QUEUE],
+                    writer->counts[tail % TRACEFILE_QUEUE]);
+      atomic_store_explicit (&writer->tail, ++tail, memory_order_release);
+    }
+}
+
+static void
+writer_block (struct tracefile_writer *writer,
+              const struct i8080_trace_record *records, size_t count)
+{
+  static const struct i8080_trace_record zero;
+  uint8_t header[TRACEFILE_BLOCK_HEADER_SIZE];
+  uint8_t *p;
+  size_t i, packed_size;
+
+  if (writer->failed)
+    return;
+
+  /* The first record is stored against a record of zeros. */
+  model_reset (writer->model);
+  p = writer->raw;
+  for (i = 0; i < count; ++i)
+    p = encode_record (writer->model, p, i > 0 ? &records[i - 1] : &zero,
+                       &records[i]);
+
+  packed_size = lz_pack (writer->raw, p - writer->raw, writer->packed,
+                         writer->hash);
+  put_u64 (&header[0], writer->written);
+  put_u32 (&header[8], count);
+  put_u32 (&header[12], p - writer->raw);
+  put_u32 (&header[16], packed_size);
+  if (fwrite (header, 1, sizeof (header), writer->fp) != sizeof (header)
+      || fwrite (writer->packed, 1, packed_size, writer->fp) != packed_size)
+    writer->failed = true;
+  writer->written += count;
+}
+
+struct tracefile *
+tracefile_open (const char *name)
+{
+  struct tracefile *tf;
+  struct stat st;
+  void *data;
+  int fd;
+
+  fd = open (name, O_RDONLY);
+  if (fd < 0 || fstat (fd, &st) < 0)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return NULL;
+    }
+  if ((uintmax_t) st.st_size < TRACEFILE_HEADER_SIZE)
+    {
+      fprintf (stderr, "%s: Not a trace.\n", name);
+      close (fd);
+      return NULL;
+    }
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      fprintf (stderr, "%s: %s.\n", name, strerror (errno));
+      return NULL;
+    }
+  /* Blocks are read once and in order. */
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+
+  tf = (struct tracefile *) calloc (1, sizeof (*tf));
+  if (tf == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      munmap (data, st.st_size);
+      return NULL;
+    }
+  tf->name = name;
+  tf->data = (const uint8_t *) data;
+  tf->size = st.st_size;
+  if (memcmp (tf->data, TRACEFILE_MAGIC, 8) != 0
+      || get_u32 (&tf->data[8]) < TRACEFILE_HEADER_SIZE
+      || get_u32 (&tf->data[8]) > tf->size
+      || get_u32 (&tf->data[12]) == 0
+      || get_u32 (&tf->data[12]) > TRACEFILE_BLOCK)
+    {
+      fprintf (stderr, "%s: Not a trace.\n", name);
+      tracefile_close (tf);
+      return NULL;
+    }
+  tf->offset = get_u32 (&tf->data[8]);
+  tf->block_records = get_u32 (&tf->data[12]);
+
+  tf->model = model_create ();
+  tf->raw = (uint8_t *) malloc (RAW_MAX_SIZE);
+  if (tf->model == NULL || tf->raw == NULL)
+    {
+      fprintf (stderr, "Failed to allocate memory.\n");
+      tracefile_close (tf);
+      return NULL;
+    }
+  memcpy (tf->model->lengths, &tf->data[16], 256);
+  memcpy (tf->model->cycles, &tf->data[16 + 256], 256);
+  return tf;
+}
+
+void
+tracefile_close (struct tracefile *tf)
+{
+  munmap ((void *) tf->data, tf->size);
+  free (tf->model);
+  free (tf->raw);
+  free (tf);
+}
+
+size_t
+tracefile_block_records (const struct tracefile *tf)
+{
+  return tf->block_records;
+}
+
+int
+tracefile_next (struct tracefile *tf, struct tracefile_block *block)
+{
+  const uint8_t *p;
+  size_t left;
+
+  left = tf->size - tf->offset;
+  if (left == 0)
+    return 0;
+  p = &tf->data[tf->offset];
+  if (left < TRACEFILE_BLOCK_HEADER_SIZE
+      || get_u32 (&p[16]) > left - TRACEFILE_BLOCK_HEADER_SIZE)
+    {
+      fprintf (stderr, "%s: Trace is cut short.\n", tf->name);
+      return -1;
+    }
+  block->first = get_u64 (&p[0]);
+  block->count = get_u32 (&p[8]);
+  block->raw_size = get_u32 (&p[12]);
+  block->packed_size = get_u32 (&p[16]);
+  block->packed = &p[TRACEFILE_BLOCK_HEADER_SIZE];
+  tf->offset += TRACEFILE_BLOCK_HEADER_SIZE + block->packed_size;
+  return 1;
+}
+
+int
+tracefile_decode (struct tracefile *tf, const struct tracefile_block *block,
+                  struct i8080_trace_record *records)
+{
+  static const struct i8080_trace_record zero;
+  const uint8_t *p, *end;
+  uint32_t i;
+
+  if (block->count > tf->block_records
+      || block->raw_size > (size_t) block->count * RECORD_MAX_SIZE
+      || lz_unpack (block->packed, block->packed_size, tf->raw,
+                    block->raw_size)
+             < 0)
+    goto corrupt;
+
+  model_reset (tf->model);
+  p = tf->raw;
+  end = &tf->raw[block->raw_size];
+  for (i = 0; i < block->count && p != NULL; ++i)
+    p = decode_record (tf->model, p, end, i == 0 ? &zero : &records[i - 1],
+                       &records[i]);
+  if (p == end)
+    return 0;
+
+corrupt:
+  fprintf (stderr, "%s: Block at record %ju is corrupt.\n", tf->name,
+           (uintmax_t) block->first);
+  return -1;
+}
+
+static struct model *
+model_create (void)
+{
+  return (struct model *) malloc (sizeof (struct model));
+}
+
+static void
+model_reset (struct model *model)
+{
+  memset (model->code, 0, sizeof (model->code));
+  model->regs = 0;
+}
+
+/* Subtract each byte on its own, without borrows between them. */
+static inline uint64_t
+bytes_sub (uint64_t a, uint64_t b)
+{
+  return ((a | BYTES_HIGH) - (b & ~BYTES_HIGH)) ^ ((a ^ ~b) & BYTES_HIGH);
+}
+
+/* Bit I is set if byte I is not zero. */
+static inline uint8_t
+bytes_nonzero (uint64_t x)
+{
+  x = (((x & ~BYTES_HIGH) + ~BYTES_HIGH) | x) & BYTES_HIGH;
+  return ((x >> 7) * UINT64_C (0x0102040810204080)) >> 56;
+}
+
+/*
+ * Only what differs from the record before is kept: an address other
+ * than the next instruction's, cycles other than the instruction before
+ * took, code the block has not shown at that address, and the registers
+ * and SP that changed.
+ */
+static uint8_t *
+encode_record (struct model *model, uint8_t *p,
+               const struct i8080_trace_record *prev,
+               const struct i8080_trace_record *rec)
+{
+  uint64_t regs, diff, cycles;
+  uint32_t code;
+  uint16_t next;
+  uint8_t *start, tag, mask, m;
+  size_t length;
+
+  start = p++;
+  tag = 0;
+  next = prev->pc + (prev->interrupt ? 0 : model->lengths[prev->bytes[0]]);
+  if (rec->pc != next)
+    {
+      tag |= TAG_PC;
+      p = put_varint (p, zigzag ((int16_t) (rec->pc - next)));
+    }
+
+  cycles = rec->cycles - prev->cycles;
+  if (cycles != model->cycles[prev->bytes[0]])
+    {
+      tag |= TAG_CYCLES;
+      p = put_varint (p, cycles);
+    }
+
+  if (rec->interrupt)
+    {
+      tag |= TAG_INTERRUPT;
+      *p++ = rec->bytes[0];
+    }
+  else
+    {
+      length = model->lengths[rec->bytes[0]];
+      code = (rec->bytes[0] | rec->bytes[1] << 8 | rec->bytes[2] << 16)
+             & (UINT32_MAX >> (32 - 8 * length));
+      if (model->code[rec->pc] != code)
+        {
+          tag |= TAG_CODE;
+          model->code[rec->pc] = code;
+          memcpy (p, rec->bytes, 3);
+          p += length;
+        }
+    }
+
+  regs = (get_u64 (rec->regs) & ~UINT64_C (0xff00))
+         | (uint64_t) i8080_trace_flags (rec) << 8;
+  diff = bytes_sub (regs, model->regs);
+  model->regs = regs;
+  mask = bytes_nonzero (diff);
+  if (mask != 0)
+    {
+      tag |= TAG_REGS;
+      *p++ = mask;
+      for (m = mask; m != 0; m &= m - 1)
+        *p++ = diff >> (8 * __builtin_ctz (m));
+    }
+
+  if (rec->sp != prev->sp)
+    {
+      tag |= TAG_SP;
+      p = put_varint (p, zigzag ((int16_t) (rec->sp - prev->sp)));
+    }
+  *start = tag;
+  return p;
+}
+
+/* Returns NULL if the record runs past END. */
+static const uint8_t *
+decode_record (struct model *model, const uint8_t *p, const uint8_t *end,
+               const struct i8080_trace_record *prev,
+               struct i8080_trace_record *rec)
+{
+  uint64_t value;
+  uint8_t tag, mask;
+  int i, length;
+
+  if (p == end)
+    return NULL;
+  memset (rec, 0, sizeof (*rec));
+  memcpy (rec->regs, prev->regs, sizeof (rec->regs));
+  rec->pc = prev->pc + (prev->interrupt ? 0 : model->lengths[prev->bytes[0]]);
+  rec->cycles = prev->cycles + model->cycles[prev->bytes[0]];
+  rec->sp = prev->sp;
+  tag = *p++;
+  if (tag & TAG_PC)
+    {
+      if ((p = get_varint (p, end, &value)) == NULL)
+        return NULL;
+      rec->pc += unzigzag (value);
+    }
+  if (tag & TAG_CYCLES)
+    {
+      if ((p = get_varint (p, end, &value)) == NULL)
+        return NULL;
+      rec->cycles = prev->cycles + value;
+    }
+  if (tag & TAG_INTERRUPT)
+    {
+      if (p == end)
+        return NULL;
+      rec->bytes[0] = *p++;
+      rec->interrupt = true;
+    }
+  else
+    {
+      if (tag & TAG_CODE)
+        {
+          if (p == end || end - p < model->lengths[*p])
+            return NULL;
+          length = model->lengths[*p];
+          model->code[rec->pc] = 0;
+          for (i = 0; i < length; ++i)
+            model->code[rec->pc] |= (uint32_t) *p++ << (8 * i);
+        }
+      rec->bytes[0] = model->code[rec->pc];
+      rec->bytes[1] = model->code[rec->pc] >> 8;
+      rec->bytes[2] = model->code[rec->pc] >> 16;
+    }
+  if (tag & TAG_REGS)
+    {
+      if (p == end)
+        return NULL;
+      mask = *p++;
+      for (i = 0; i < 8; ++i)
+        if (mask & (1 << i))
+          {
+            if (p == end)
+              return NULL;
+            rec->regs[i] += *p++;
+          }
+    }
+  if (tag & TAG_SP)
+    {
+      if ((p = get_varint (p, end, &value)) == NULL)
+        return NULL;
+      rec->sp += unzigzag (value);
+    }
+  return p;
+}
+
+/*
+ * LZ77 in the way of LZ4: a token with the number of literals in the
+ * high nibble and the match length less LZ_MIN_MATCH in the low one,
+ * either continued in bytes of 255 and a last smaller one, then the
+ * literals, a u16 offset back to the match and the rest of its length.
+ * The last sequence has only literals.
+ */
+static size_t
+lz_pack (const uint8_t *src, size_t size, uint8_t *dst, uint32_t *hash)
+{
+  const uint8_t *anchor, *ip, *match, *end;
+  uint8_t *op, *token;
+  size_t literals, length, n;
+  uint32_t word, h;
+
+  memset (hash, 0, sizeof (uint32_t) << LZ_HASH_BITS);
+  op = dst;
+  anchor = ip = src;
+  end = src + size;
+  while (size >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+      memcpy (&word, ip, sizeof (word));
+      h = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+      match = src + hash[h];
+      hash[h] = ip - src;
+      if (match >= ip || ip - match > UINT16_MAX
+          || memcmp (match, ip, LZ_MIN_MATCH) != 0)
+        {
+          ++ip;
+          continue;
+        }
+
+      length = LZ_MIN_MATCH;
+      while (ip + length < end && match[length] == ip[length])
+        ++length;
+
+      literals = ip - anchor;
+      token = op++;
+      *token = (literals < 15 ? literals : 15) << 4;
+      if (literals >= 15)
+        {
+          for (n = literals - 15; n >= 255; n -= 255)
+            *op++ = 255;
+          *op++ = n;
+        }
+      memcpy (op, anchor, literals);
+      op += literals;
+      put_u16 (op, ip - match);
+      op += 2;
+      n = length - LZ_MIN_MATCH;
+      *token |= n < 15 ? n : 15;
+      if (n >= 15)
+        {
+          for (n -= 15; n >= 255; n -= 255)
+            *op++ = 255;
+          *op++ = n;
+        }
+      ip += length;
+      anchor = ip;
+    }
+
+  literals = end - anchor;
+  token = op++;
+  *token = (literals < 15 ? literals : 15) << 4;
+  if (literals >= 15)
+    {
+      for (n = literals - 15; n >= 255; n -= 255)
+        *op++ = 255;
+      *op++ = n;
+    }
+  memcpy (op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+/* Returns -1 unless the input unpacks to exactly SIZE bytes. */
+static int
+lz_unpack (const uint8_t *src, size_t packed_size, uint8_t *dst, size_t size)
+{
+  const uint8_t *ip, *ip_end;
+  uint8_t *op, *op_end;
+  size_t length, offset;
+  uint8_t token, byte;
+
+  ip = src;
+  ip_end = src + packed_size;
+  op = dst;
+  op_end = dst + size;
+  while (ip != ip_end)
+    {
+      token = *ip++;
+      length = token >> 4;
+      if (length == 15)
+        do
+          {
+            if (ip == ip_end)
+              return -1;
+            byte = *ip++;
+            length += byte;
+          }
+        while (byte == 255);
+      if (length > (size_t) (ip_end - ip) || length > (size_t) (op_end - op))
+        return -1;
+      memcpy (op, ip, length);
+      ip += length;
+      op += length;
+      if (ip == ip_end)
+        break;
+
+      if (ip_end - ip < 2)
+        return -1;
+      offset = get_u16 (ip);
+      ip += 2;
+      length = (token & 15) + LZ_MIN_MATCH;
+      if ((token & 15) == 15)
+        do
+          {
+            if (ip == ip_end)
+              return -1;
+            byte = *ip++;
+            length += byte;
+          }
+        while (byte == 255);
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || length > (size_t) (op_end - op))
+        return -1;
+      /* The match can overlap what it writes. */
+      for (; length > 0; --length, ++op)
+        *op = op[-offset];
+    }
+  return op == op_end ? 0 : -1;
+}
+
+/* Small differences either way as small numbers: 0, -1, 1, -2 and so on. */
+static inline uint16_t
+zigzag (int16_t value)
+{
+  return ((uint16_t) value << 1) ^ (uint16_t) (value >> 15);
+}
+
+static inline uint16_t
+unzigzag (uint64_t value)
+{
+  return (value >> 1) ^ -(value & 1);
+}
+
+/* Seven bits at a time from the lowest, the top bit set on all but last. */
+static inline uint8_t *
+put_varint (uint8_t *p, uint64_t value)
+{
+  for (; value >= 0x80; value >>= 7)
+    *p++ = (value & 0x7f) | 0x80;
+  *p++ = value;
+  return p;
+}
+
+/* Returns NULL if the number runs past END or does not fit. */
+static inline const uint8_t *
+get_varint (const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+  uint8_t byte;
+  int shift;
+
+  *value = 0;
+  shift = 0;
+  do
+    {
+      if (p == end || shift >= 64)
+        return NULL;
+      byte = *p++;
+      *value |= (uint64_t) (byte & 0x7f) << shift;
+      shift += 7;
+    }
+  while (byte & 0x80);
+  return p;
+}
+
+static inline void
+put_u16 (uint8_t *p, uint16_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static inline void
+put_u32 (uint8_t *p, uint32_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static inline void
+put_u64 (uint8_t *p, uint64_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+  p[4] = value >> 32;
+  p[5] = value >> 40;
+  p[6] = value >> 48;
+  p[7] = value >> 56;
+}
+
+static inline uint16_t
+get_u16 (const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+get_u32 (const uint8_t *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+         | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+get_u64 (const uint8_t *p)
+{
+  return (uint64_t) p[0] | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16)
+         | ((uint64_t) p[3] << 24) | ((uint64_t) p[4] << 32)
+         | ((uint64_t) p[5] << 40) | ((uint64_t) p[6] << 48)
+         | ((uint64_t) p[7] << 56);
+}
@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Streams the trace of a CPU to a file while it runs, from a thread of
+ * its own, and reads it back. The trace is cut into blocks, and each
+ * record in a block is stored as the difference from the record before
+ * it: the registers and SP that changed, PC when it is not the address
+ * after the instruction before, cycles when they are not what that
+ * instruction takes, and code the block has not shown at that address
+ * yet. These are then packed with LZ77. Blocks start over from a record
+ * of zeros, so each one can be decoded on its own.
+ *
+ * The file is little endian:
+ *
+ *   "I8080TR2", u32 header size, u32 records per block,
+ *   u8 length of each opcode[256], u8 cycles of each opcode[256]
+ *
+ * followed by blocks of
+ *
+ *   u64 first record, u32 records, u32 unpacked size, u32 packed size,
+ *   packed bytes
+ */
+
+#ifndef I8080_TRACEFILE_H
+#define I8080_TRACEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i8080.h"
+
+/* Records in a block. */
+#define TRACEFILE_BLOCK 65536
+
+struct tracefile_writer;
+struct tracefile;
+
+struct tracefile_block
+{
+  uint64_t first; /* Index of the first record in the trace */
+  uint32_t count;
+  uint32_t raw_size;
+  uint32_t packed_size;
+  const uint8_t *packed;
+};
+
+/*
+ * Trace the CPU to the file from now on, which replaces any trace it
+ * has. Returns NULL and prints a message if the trace cannot be started,
+ * which includes builds without I8080_TRACE.
+ */
+struct tracefile_writer *tracefile_create (struct i8080 *, const char *);
+/*
+ * Write the rest of the trace, stop tracing and close the file. Returns
+ * -1 and prints a message if any of it could not be written.
+ */
+int tracefile_finish (struct tracefile_writer *);
+
+/*
+ * Map a trace file to read it. Returns NULL and prints a message if it
+ * cannot be opened or is not a trace.
+ */
+struct tracefile *tracefile_open (const char *);
+void tracefile_close (struct tracefile *);
+/* Most records a block of the file holds. */
+size_t tracefile_block_records (const struct tracefile *);
+/*
+ * Get the next block. Returns 1 if there is one, 0 at the end of the
+ * file and -1 with a message if the file is cut short.
+ */
+int tracefile_next (struct tracefile *, struct tracefile_block *);
+/*
+ * Unpack the records of a block. The flags are worked out already, so
+ * i8080_trace_flags() returns the F register as it is stored. Returns -1
+ * and prints a message if the block is corrupt.
+ */
+int tracefile_decode (struct tracefile *, const struct tracefile_block *,
+                      struct i8080_trace_record *);
+
+#endif /* I8080_TRACEFILE_H */
@@ -23,118 +23,346 @@
  * SUCH DAMAGE.
  */
 
+#include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "i8080-disasm.h"
+#include "i8080-ops.h"
 #include "i8080.h"
 
-#define FLAG_C 0x01 /* Carry flag */
-/* 0x02 is always set to 1. */
-#define FLAG_P 0x04 /* Parity flag */
-/* 0x08 is always set to 0. */
-#define FLAG_AC 0x10 /* Aux. carry flag */
-/* 0x20 is always set to 0. */
-#define FLAG_Z 0x40 /* Zero flag */
-#define FLAG_S 0x80 /* Sign flag */
+/* Labels as values are a GNU extension. */
+#if defined(I8080_THREADED_DISPATCH) && defined(__GNUC__)
+#  define USE_THREADED_DISPATCH 1
+#endif
+
+/* The code generator only targets x86-64 Linux. */
+#if defined(I8080_JIT) && defined(__x86_64__) && defined(__linux__)
+#  define USE_JIT 1
+#  include "i8080-jit.h"
+#endif
+
+/* Hot blocks are compiled with the host compiler, unless there is a JIT. */
+#if defined(I8080_CC_TIER) && !defined(USE_JIT)
+#  define USE_CC_TIER 1
+#  include "i8080-cc.h"
+#endif
+
+/* Opcode pairs of i8080-fusions.h run as one instruction from blocks. */
+#ifdef I8080_FUSION
+#  define USE_FUSION 1
+#endif
+
+/* Blocks skip the flags no instruction reads, see block_liveness(). */
+#ifdef I8080_FLAG_LIVENESS
+#  define USE_FLAG_LIVENESS 1
+#endif
+
+/* Spin loops in blocks are skipped to the budget, see block_spin(). */
+#ifdef I8080_IDLE_SKIP
+#  define USE_IDLE_SKIP 1
+#endif
+
+/* Initializer with X(n) for every opcode n, in order. */
+#define OPCODE_ROW(X, h)                                                      \
+  X (0x##h##0), X (0x##h##1), X (0x##h##2), X (0x##h##3), X (0x##h##4),       \
+      X (0x##h##5), X (0x##h##6), X (0x##h##7), X (0x##h##8), X (0x##h##9),   \
+      X (0x##h##a), X (0x##h##b), X (0x##h##c), X (0x##h##d), X (0x##h##e),   \
+      X (0x##h##f)
+#define OPCODE_LIST(X)                                                        \
+  OPCODE_ROW (X, 0), OPCODE_ROW (X, 1), OPCODE_ROW (X, 2), OPCODE_ROW (X, 3), \
+      OPCODE_ROW (X, 4), OPCODE_ROW (X, 5), OPCODE_ROW (X, 6),                \
+      OPCODE_ROW (X, 7), OPCODE_ROW (X, 8), OPCODE_ROW (X, 9),                \
+      OPCODE_ROW (X, a), OPCODE_ROW (X, b), OPCODE_ROW (X, c),                \
+      OPCODE_ROW (X, d), OPCODE_ROW (X, e), OPCODE_ROW (X, f)
+#define OPCODE_TABLE(X)                                                       \
+  {                                                                           \
+    OPCODE_LIST (X)                                                           \
+  }
+
+/* Instruction lengths in bytes, including the opcode. */
+static const uint8_t opcode_length[256] = {
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+  1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+  1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1,
+  1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+};
+
+/* Cycles per instruction. Conditional instructions use the shorter time. */
+static const uint8_t opcode_cycles[256] = {
+  4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+  4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+  4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,
+  4, 10, 13, 5, 10, 10, 10, 4, 4, 10, 13, 5, 5, 5, 7, 4,
+  5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+  5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+  5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+  7, 7, 7, 7, 7, 7, 7, 7, 5, 5, 5, 5, 5, 5, 7, 5,
+  4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+  4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+  4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+  4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+  5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11,
+  5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11,
+  5, 10, 10, 18, 11, 11, 7, 11, 5, 5, 10, 5, 11, 17, 7, 11,
+  5, 10, 10, 4, 11, 11, 7, 11, 5, 5, 10, 4, 11, 17, 7, 11,
+};
 
 /*
- * Parity lookup table. 1 for even parity, 0 for odd.
- * This is generated from a file in /misc.
+ * Blocks end after any instruction that can jump, write memory, do I/O
+ * or change the interrupt state. Nothing before the last instruction can
+ * modify the block or make an interrupt pending, so a block runs to the
+ * end without any checks.
  */
-static const uint8_t parity_table[256] = {
-  1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0,
-  0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1,
-  0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1,
-  1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-  0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1,
-  1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0,
-  1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0,
-  0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-  0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0,
-  0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-};
+#define BLOCK_MAX_OPS 32
+
+/* Runs of a block before it is translated to native code. */
+#define JIT_THRESHOLD 16
 
 /*
- * Tables used for setting the auxiliary carry bit in the flags
- * register. The flag should be set when there is a carry out of bit 3.
- * It is affected by all addition, subtraction, increment, decrement,
- * and compare instructions.
+ * Runs of a block before it is compiled with the host compiler, and
+ * block runs between looking for the ones that are done.
  */
-static const uint8_t ac_table[8] = { 0, 0, 1, 0, 1, 0, 1, 1 };
-static const uint8_t subtract_ac_table[8] = { 1, 0, 0, 0, 1, 1, 1, 0 };
+#define CC_THRESHOLD 4096
+#define CC_POLL_INTERVAL 65536
 
-static void
-set_flag_to (struct i8080 *ctx, uint8_t mask, int val)
+struct block_op
 {
-  if (val == 0)
-    ctx->f &= ~mask;
-  else
-    ctx->f |= mask;
-}
+  uint16_t imm;     /* Operand */
+  uint16_t next;    /* Address of the next instruction */
+  uint16_t handler; /* The opcode, or one of the handlers below */
+  uint8_t opcode;
+  uint8_t live; /* Flags read after it before they are set again */
+};
 
-static uint16_t
-get_psw (struct i8080 *ctx)
+/*
+ * A pair of i8080-fusions.h runs as one instruction when both are in a
+ * block, through a handler that inlines both bodies. The handler of the
+ * first op runs both and the second op is skipped.
+ */
+#ifdef USE_FUSION
+#  define FUSE(first, second) FUSION_##first##_##second,
+enum fusion
 {
-  return ((uint16_t) ctx->a << 8) | ((uint16_t) ctx->f);
-}
+#  include "i8080-fusions.h"
+  FUSION_COUNT
+};
+#  undef FUSE
 
-static uint16_t
-get_bc (struct i8080 *ctx)
+#  define FUSE(first, second) { first, second },
+static const uint8_t fusions[FUSION_COUNT][2] = {
+#  include "i8080-fusions.h"
+};
+#  undef FUSE
+#else
+#  define FUSION_COUNT 0
+#endif
+
+/*
+ * An instruction of i8080-noflags.h whose flags are all set again before
+ * they are read runs without working them out. Every flag is live at the
+ * end of a block, which is also the only place an interrupt can come.
+ */
+#ifdef USE_FLAG_LIVENESS
+#  define NOFLAGS(n, body) NOFLAGS_##n,
+enum noflags
 {
-  return ((uint16_t) ctx->b << 8) | ((uint16_t) ctx->c);
-}
+#  include "i8080-noflags.h"
+  NOFLAGS_COUNT
+};
+#  undef NOFLAGS
+#endif
 
-static uint16_t
-get_de (struct i8080 *ctx)
+/* Handlers after the 256 opcodes. */
+#define HANDLER_FUSED 256
+#define HANDLER_NOFLAGS (HANDLER_FUSED + FUSION_COUNT)
+
+struct block
 {
-  return ((uint16_t) ctx->d << 8) | ((uint16_t) ctx->e);
-}
+  struct block *next_free;
+  uint16_t start;
+  uint32_t end;    /* One past the last byte */
+  uint32_t cycles; /* Cycles taken before the last instruction */
+  uint8_t nops;
+#ifdef USE_IDLE_SKIP
+  bool loops;   /* Ends with a jump to its own start */
+  uint8_t runs; /* Checked for spinning every SPIN_INTERVAL runs */
+#endif
+#ifdef USE_JIT
+  uint32_t hits;
+  jit_code native; /* NULL until translated */
+#endif
+#ifdef USE_CC_TIER
+  uint32_t hits;
+  cc_code compiled; /* NULL until compiled */
+#endif
+  struct block_op ops[BLOCK_MAX_OPS];
+};
 
-static uint16_t
-get_hl (struct i8080 *ctx)
+struct i8080_cache
 {
-  return ((uint16_t) ctx->h << 8) | ((uint16_t) ctx->l);
-}
+  struct block *blocks[UINT16_MAX + 1]; /* Indexed by start address */
+  uint8_t code[UINT16_MAX + 1];         /* Blocks using each byte */
+  struct block *free_blocks;            /* Reused before calling malloc() */
+#ifdef USE_IDLE_SKIP
+  uintmax_t callback_reads; /* Reads that went through read_byte */
+#endif
+#ifdef USE_JIT
+  struct jit *jit; /* NULL if the code buffer cannot be allocated */
+#endif
+#ifdef USE_CC_TIER
+  struct cc *cc; /* NULL if there is no thread for the compiler */
+  cc_code compiled[UINT16_MAX + 1]; /* Kept when blocks are freed */
+  uint8_t compiled_length[UINT16_MAX + 1]; /* Bytes the code covers */
+  uint32_t polls;
+#endif
+};
 
-static void
-set_psw (struct i8080 *ctx, uint16_t val)
+/*
+ * While a snapshot is held, the pages in its write_map are left out of
+ * the CPU's, so the first write to each one lands in
+ * snapshot_unprotect() and saves the page before it is changed.
+ */
+struct i8080_snapshot
 {
-  ctx->a = (val >> 8) & UINT8_MAX;
-  ctx->f = val & UINT8_MAX;
-}
+  uint8_t a, f, b, c, d, e, h, l;
+  uint16_t sp, pc;
+  bool halted, int_enable, int_requested;
+  uint8_t int_opcode;
+  uintmax_t cycles;
+  uint8_t *write_map[I8080_PAGE_COUNT];
+  int dirty_count;
+  uint8_t dirty[I8080_PAGE_COUNT]; /* Pages written, oldest first */
+  uint8_t pages[I8080_PAGE_COUNT][I8080_PAGE_SIZE]; /* Their old contents */
+};
 
-static void
-set_bc (struct i8080 *ctx, uint16_t val)
+/* Kept as a binary min-heap, see event_before(). */
+struct event
 {
-  ctx->b = (val >> 8) & UINT8_MAX;
-  ctx->c = val & UINT8_MAX;
-}
+  uintmax_t at;
+  uintmax_t order; /* Of scheduling, for events at the same time */
+  i8080_event_fn fn;
+  void *data;
+};
 
-static void
-set_de (struct i8080 *ctx, uint16_t val)
+struct i8080_events
 {
-  ctx->d = (val >> 8) & UINT8_MAX;
-  ctx->e = val & UINT8_MAX;
-}
+  struct event *heap;
+  size_t count;
+  size_t size;
+  uintmax_t scheduled;
+};
 
-static void
-set_hl (struct i8080 *ctx, uint16_t val)
+#ifdef I8080_TRACE
+
+/* The registers of a record are copied from struct i8080 at once. */
+static_assert (offsetof (struct i8080, l) - offsetof (struct i8080, a) == 7,
+               "registers are not packed");
+
+struct i8080_trace
 {
-  ctx->h = (val >> 8) & UINT8_MAX;
-  ctx->l = val & UINT8_MAX;
-}
+  size_t mask;       /* Records minus one */
+  uintmax_t count;   /* Instructions traced, the newest is count - 1 */
+  uintmax_t block;   /* Records per call to sink */
+  uintmax_t pending; /* Last multiple of block, the first not passed */
+  i8080_trace_sink_fn sink;
+  void *sink_data;
+  struct i8080_trace_record records[];
+};
+
+#  define TRACING(ctx) ((ctx)->trace != NULL)
+#  define TRACE(ctx, pc, opcode, interrupt)                                   \
+    do                                                                        \
+      {                                                                       \
+        if (TRACING (ctx))                                                    \
+          trace_record (ctx, pc, opcode, interrupt);                          \
+      }                                                                       \
+    while (0)
+
+static inline struct i8080_trace_record *trace_next (struct i8080 *,
+                                                     uint16_t);
+static inline void trace_record (struct i8080 *, uint16_t, uint8_t, bool);
+
+#else /* !I8080_TRACE */
+
+#  define TRACING(ctx) false
+#  define TRACE(ctx, pc, opcode, interrupt) ((void) 0)
+
+#endif /* !I8080_TRACE */
+
+#ifdef I8080_STATS
+
+/* Execute through stats_exec() while the opcodes are counted. */
+#  define EXEC(ctx, opcode, interrupt)                                        \
+    do                                                                        \
+      {                                                                       \
+        if ((ctx)->stats != NULL)                                             \
+          stats_exec (ctx, opcode, interrupt);                                \
+        else                                                                  \
+          exec_opcode (ctx, opcode);                                          \
+      }                                                                       \
+    while (0)
+
+static void stats_exec (struct i8080 *, uint8_t, bool);
+
+#else /* !I8080_STATS */
+
+#  define EXEC(ctx, opcode, interrupt) exec_opcode (ctx, opcode)
+
+#endif /* !I8080_STATS */
+
+static void cache_invalidate (struct i8080_cache *, uint16_t);
+static uint8_t *snapshot_unprotect (struct i8080 *, unsigned int);
+static uintmax_t events_next (const struct i8080 *);
+static void events_fire (struct i8080 *);
+static void exec_opcode (struct i8080 *, uint8_t);
 
 static uint8_t
 read_byte (struct i8080 *ctx, uint16_t address)
 {
+  const uint8_t *page;
+
+  page = ctx->read_map[address / I8080_PAGE_SIZE];
+  if (page != NULL)
+    return page[address % I8080_PAGE_SIZE];
+#ifdef USE_IDLE_SKIP
+  if (ctx->cache != NULL)
+    ctx->cache->callback_reads++;
+#endif
   return ctx->read_byte (ctx->user_data, address);
 }
 
 static void
 write_byte (struct i8080 *ctx, uint16_t address, uint8_t val)
 {
-  ctx->write_byte (ctx->user_data, address, val);
+  uint8_t *page;
+
+  page = ctx->write_map[address / I8080_PAGE_SIZE];
+  if (page == NULL && ctx->snapshot != NULL)
+    page = snapshot_unprotect (ctx, address / I8080_PAGE_SIZE);
+  if (page != NULL)
+    page[address % I8080_PAGE_SIZE] = val;
+  else
+    ctx->write_byte (ctx->user_data, address, val);
+  if (ctx->cache != NULL && ctx->cache->code[address] != 0)
+    cache_invalidate (ctx->cache, address);
 }
 
 static uint16_t
@@ -157,6 +385,17 @@ fetch_byte (struct i8080 *ctx)
   return read_byte (ctx, ctx->pc++);
 }
 
+/* Fetch the opcode of the next instruction, which is where it is traced. */
+static inline uint8_t
+fetch_opcode (struct i8080 *ctx)
+{
+  uint8_t opcode;
+
+  opcode = fetch_byte (ctx);
+  TRACE (ctx, ctx->pc - 1, opcode, false);
+  return opcode;
+}
+
 static uint16_t
 fetch_word (struct i8080 *ctx)
 {
@@ -185,16 +424,10 @@ push_word (struct i8080 *ctx, uint16_t val)
 }
 
 static void
-op_jmp (struct i8080 *ctx)
-{
-  ctx->pc = fetch_word (ctx);
-}
-
-static void
-op_call (struct i8080 *ctx)
+op_call (struct i8080 *ctx, uint16_t address)
 {
-  push_word (ctx, ctx->pc + 2);
-  ctx->pc = fetch_word (ctx);
+  push_word (ctx, ctx->pc);
+  ctx->pc = address;
 }
 
 static void
@@ -210,16 +443,6 @@ op_rst (struct i8080 *ctx, uint16_t address)
   ctx->pc = address;
 }
 
-static void
-op_xchg (struct i8080 *ctx)
-{
-  uint16_t tmp16;
-
-  tmp16 = get_hl (ctx);
-  set_hl (ctx, get_de (ctx));
-  set_de (ctx, tmp16);
-}
-
 static void
 op_xthl (struct i8080 *ctx)
 {
@@ -230,1445 +453,1690 @@ op_xthl (struct i8080 *ctx)
   set_hl (ctx, tmp16);
 }
 
-static void
-op_add (struct i8080 *ctx, uint8_t val)
+void
+i8080_init (struct i8080 *ctx)
 {
-  uint16_t tmp16;
-  uint8_t acindex;
-
-  tmp16 = ctx->a + val;
-  acindex
-      = ((ctx->a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp16 & 0x88) >> 3);
-  ctx->a = tmp16 & UINT8_MAX;
-  set_flag_to (ctx, FLAG_C, (tmp16 & 0x100) != 0);
-  set_flag_to (ctx, FLAG_P, parity_table[ctx->a]);
-  set_flag_to (ctx, FLAG_AC, ac_table[acindex & 7]);
-  set_flag_to (ctx, FLAG_Z, ctx->a == 0);
-  set_flag_to (ctx, FLAG_S, (ctx->a & 0x80) != 0);
+  ctx->a = 0;
+  ctx->f = 0x02;
+  ctx->b = 0;
+  ctx->c = 0;
+  ctx->d = 0;
+  ctx->e = 0;
+  ctx->h = 0;
+  ctx->l = 0;
+  ctx->sp = 0;
+  ctx->pc = 0;
+  ctx->halted = false;
+  ctx->int_enable = false;
+  ctx->int_requested = false;
+  ctx->int_opcode = 0;
+  ctx->io_exit = false;
+  ctx->lazy_flags = 0;
+  ctx->lazy_aux = 0;
+  ctx->lazy_result = 0;
+  ctx->cycles = 0;
+  ctx->user_data = NULL;
+  ctx->read_byte = NULL;
+  ctx->write_byte = NULL;
+  ctx->io_inb = NULL;
+  ctx->io_outb = NULL;
+  memset (ctx->read_map, 0, sizeof (ctx->read_map));
+  memset (ctx->write_map, 0, sizeof (ctx->write_map));
+  ctx->cache = NULL;
+  ctx->snapshot = NULL;
+  ctx->trace = NULL;
+  ctx->stats = NULL;
+  ctx->events = NULL;
+  ctx->aot = NULL;
 }
 
-static void
-op_adc (struct i8080 *ctx, uint8_t val)
+void
+i8080_map_read (struct i8080 *ctx, uint16_t address, size_t size,
+                const uint8_t *mem)
 {
-  uint16_t tmp16;
-  uint8_t acindex;
+  size_t i, page;
 
-  tmp16 = ctx->a + val + ((ctx->f & FLAG_C) != 0);
-  acindex
-      = ((ctx->a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp16 & 0x88) >> 3);
-  ctx->a = tmp16 & UINT8_MAX;
-  set_flag_to (ctx, FLAG_C, (tmp16 & 0x100) != 0);
-  set_flag_to (ctx, FLAG_P, parity_table[ctx->a]);
-  set_flag_to (ctx, FLAG_AC, ac_table[acindex & 7]);
-  set_flag_to (ctx, FLAG_Z, ctx->a == 0);
-  set_flag_to (ctx, FLAG_S, (ctx->a & 0x80) != 0);
+  page = address / I8080_PAGE_SIZE;
+  for (i = 0; i < size / I8080_PAGE_SIZE && page < I8080_PAGE_COUNT; ++i)
+    ctx->read_map[page++] = (mem != NULL) ? &mem[i * I8080_PAGE_SIZE] : NULL;
+  if (ctx->cache != NULL)
+    i8080_cache_flush (ctx);
 }
 
-static void
-op_sub (struct i8080 *ctx, uint8_t val)
+void
+i8080_map_write (struct i8080 *ctx, uint16_t address, size_t size,
+                 uint8_t *mem)
 {
-  uint16_t tmp16;
-  uint8_t acindex;
+  size_t i, page;
 
-  tmp16 = ctx->a - val;
-  acindex
-      = ((ctx->a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp16 & 0x88) >> 3);
-  ctx->a = tmp16 & UINT8_MAX;
-  set_flag_to (ctx, FLAG_C, (tmp16 & 0x100) != 0);
-  set_flag_to (ctx, FLAG_P, parity_table[ctx->a]);
-  set_flag_to (ctx, FLAG_AC, subtract_ac_table[acindex & 7]);
-  set_flag_to (ctx, FLAG_Z, ctx->a == 0);
-  set_flag_to (ctx, FLAG_S, (ctx->a & 0x80) != 0);
+  page = address / I8080_PAGE_SIZE;
+  for (i = 0; i < size / I8080_PAGE_SIZE && page < I8080_PAGE_COUNT; ++i)
+    ctx->write_map[page++] = (mem != NULL) ? &mem[i * I8080_PAGE_SIZE] : NULL;
 }
 
-static void
-op_sbb (struct i8080 *ctx, uint8_t val)
+void
+i8080_step (struct i8080 *ctx)
 {
-  uint16_t tmp16;
-  uint8_t acindex;
+  /* If an interrupt is requested */
+  if (ctx->int_requested && ctx->int_enable)
+    {
+      /* Acknowledge request and reset INTE. */
+      ctx->int_enable = false;
+      ctx->int_requested = false;
+      /* Interrupt occured so unhalt */
+      ctx->halted = false;
 
-  tmp16 = ctx->a - val - ((ctx->f & FLAG_C) != 0);
-  acindex
-      = ((ctx->a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp16 & 0x88) >> 3);
-  ctx->a = tmp16 & UINT8_MAX;
-  set_flag_to (ctx, FLAG_C, (tmp16 & 0x100) != 0);
-  set_flag_to (ctx, FLAG_P, parity_table[ctx->a]);
-  set_flag_to (ctx, FLAG_AC, subtract_ac_table[acindex & 7]);
-  set_flag_to (ctx, FLAG_Z, ctx->a == 0);
-  set_flag_to (ctx, FLAG_S, (ctx->a & 0x80) != 0);
+      /* Execute the requested opcode */
+      TRACE (ctx, ctx->pc, ctx->int_opcode, true);
+      EXEC (ctx, ctx->int_opcode, true);
+    }
+  else if (!ctx->halted)
+    EXEC (ctx, fetch_opcode (ctx), false);
+  flags_sync (ctx);
+  if (ctx->events != NULL)
+    events_fire (ctx);
 }
 
-static void
-op_ana (struct i8080 *ctx, uint8_t val)
+/*
+ * Checked by i8080_run() between instructions. See enum i8080_exit.
+ */
+static inline bool
+run_stop (struct i8080 *ctx, uintmax_t target)
 {
-  uint8_t tmp8;
-
-  tmp8 = ctx->a & val;
-  ctx->f &= ~FLAG_C;
-  set_flag_to (ctx, FLAG_P, parity_table[tmp8]);
-  set_flag_to (ctx, FLAG_AC, ((ctx->a | val) & 0x08) != 0);
-  set_flag_to (ctx, FLAG_Z, tmp8 == 0);
-  set_flag_to (ctx, FLAG_S, (tmp8 & 0x80) != 0);
-  ctx->a = tmp8;
+  return ctx->cycles >= target || ctx->halted
+         || (ctx->int_requested && ctx->int_enable);
 }
 
-static void
-op_xra (struct i8080 *ctx, uint8_t val)
+static enum i8080_exit
+run_reason (struct i8080 *ctx, uintmax_t target)
 {
-  uint8_t tmp8;
+  if (ctx->cycles >= target)
+    return I8080_EXIT_BUDGET;
+  else if (ctx->int_requested && ctx->int_enable)
+    return I8080_EXIT_INTERRUPT;
+  else
+    return I8080_EXIT_HALT;
+}
+
+#ifdef USE_THREADED_DISPATCH
 
-  tmp8 = ctx->a ^ val;
-  ctx->f &= ~FLAG_C;
-  set_flag_to (ctx, FLAG_P, parity_table[tmp8]);
-  ctx->f &= ~FLAG_AC;
-  set_flag_to (ctx, FLAG_Z, tmp8 == 0);
-  set_flag_to (ctx, FLAG_S, (tmp8 & 0x80) != 0);
-  ctx->a = tmp8;
+/* Addresses of the labels OPCODE(n) expands to. */
+#  define LABEL_ADDRESS(n) &&opcode_##n
+
+/*
+ * Each body jumps straight to the next one through the dispatch table
+ * instead of returning to a shared switch, which gives every opcode its
+ * own indirect branch to predict.
+ */
+static enum i8080_exit
+run_loop (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
+{
+  static const void *const dispatch[256] = OPCODE_TABLE (LABEL_ADDRESS);
+  uintmax_t count;
+
+  count = *retired;
+  if (run_stop (ctx, target))
+    goto stop;
+  goto *dispatch[fetch_opcode (ctx)];
+
+#  define FETCH_BYTE() fetch_byte (ctx)
+#  define FETCH_WORD() fetch_word (ctx)
+#  define SKIP_WORD() (ctx->pc += 2)
+#  define OPCODE(n) opcode_##n:
+#  define NEXT                                                                \
+    do                                                                        \
+      {                                                                       \
+        ++count;                                                              \
+        if (run_stop (ctx, target))                                           \
+          goto stop;                                                          \
+        goto *dispatch[fetch_opcode (ctx)];                                   \
+      }                                                                       \
+    while (0)
+#  define NEXT_IO                                                             \
+    do                                                                        \
+      {                                                                       \
+        if (ctx->io_exit)                                                     \
+          {                                                                   \
+            *retired = count + 1;                                             \
+            return I8080_EXIT_IO;                                             \
+          }                                                                   \
+        NEXT;                                                                 \
+      }                                                                       \
+    while (0)
+#  include "i8080-opcodes.h"
+#  undef FETCH_BYTE
+#  undef FETCH_WORD
+#  undef SKIP_WORD
+#  undef OPCODE
+#  undef NEXT
+#  undef NEXT_IO
+
+stop:
+  *retired = count;
+  return run_reason (ctx, target);
 }
 
-static void
-op_ora (struct i8080 *ctx, uint8_t val)
+#else /* !USE_THREADED_DISPATCH */
+
+static enum i8080_exit
+run_loop (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
 {
-  uint8_t tmp8;
+  uintmax_t count;
+  uint8_t opcode;
+
+  for (count = *retired; !run_stop (ctx, target);)
+    {
+      opcode = fetch_opcode (ctx);
+      exec_opcode (ctx, opcode);
+      ++count;
+      if (ctx->io_exit && (opcode == 0xd3 || opcode == 0xdb))
+        {
+          *retired = count;
+          return I8080_EXIT_IO;
+        }
+    }
 
-  tmp8 = ctx->a | val;
-  ctx->f &= ~FLAG_C;
-  set_flag_to (ctx, FLAG_P, parity_table[tmp8]);
-  ctx->f &= ~FLAG_AC;
-  set_flag_to (ctx, FLAG_Z, tmp8 == 0);
-  set_flag_to (ctx, FLAG_S, (tmp8 & 0x80) != 0);
-  ctx->a = tmp8;
+  *retired = count;
+  return run_reason (ctx, target);
 }
 
-static void
-op_cmp (struct i8080 *ctx, uint8_t val)
+#endif /* !USE_THREADED_DISPATCH */
+
+/*
+ * Decide whether an instruction ends a block. See BLOCK_MAX_OPS.
+ */
+static bool
+block_ends (uint8_t opcode)
 {
-  uint16_t tmp16;
-  uint8_t acindex;
+  if (opcode < 0xc0)
+    return opcode == 0x02    /* STAX B */
+           || opcode == 0x12 /* STAX D */
+           || opcode == 0x22 /* SHLD */
+           || opcode == 0x32 /* STA */
+           || opcode == 0x34 /* INR M */
+           || opcode == 0x35 /* DCR M */
+           || opcode == 0x36 /* MVI M */
+           || (opcode >= 0x70 && opcode <= 0x77); /* MOV M, r and HLT */
+
+  switch (opcode & 0x07)
+    {
+    case 0x00: /* Rcc */
+    case 0x02: /* Jcc */
+    case 0x04: /* Ccc */
+    case 0x05: /* PUSH and CALL */
+    case 0x07: /* RST */
+      return true;
+    case 0x01: /* RET and PCHL, but not POP or SPHL */
+      return opcode == 0xc9 || opcode == 0xd9 || opcode == 0xe9;
+    case 0x03: /* Everything but XCHG */
+      return opcode != 0xeb;
+    default:
+      return false;
+    }
+}
 
-  tmp16 = ctx->a - val;
-  acindex
-      = ((ctx->a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp16 & 0x88) >> 3);
-  set_flag_to (ctx, FLAG_C, (tmp16 & 0x100) != 0);
-  set_flag_to (ctx, FLAG_P, parity_table[tmp16 & UINT8_MAX]);
-  set_flag_to (ctx, FLAG_AC, subtract_ac_table[acindex & 7]);
-  set_flag_to (ctx, FLAG_Z, (tmp16 & UINT8_MAX) == 0);
-  set_flag_to (ctx, FLAG_S, (tmp16 & 0x80) != 0);
+/*
+ * Read a byte for the decoder. Only mapped memory can be cached since
+ * the callbacks may return something different every time.
+ */
+static bool
+block_peek (struct i8080 *ctx, uint32_t address, uint8_t *val)
+{
+  const uint8_t *page;
+
+  if (address > UINT16_MAX)
+    return false;
+  page = ctx->read_map[address / I8080_PAGE_SIZE];
+  if (page == NULL)
+    return false;
+  *val = page[address % I8080_PAGE_SIZE];
+  return true;
 }
 
+#ifdef USE_FLAG_LIVENESS
+
+/* Flags an instruction reads. */
 static uint8_t
-op_inr (struct i8080 *ctx, uint8_t val)
+flags_read (uint8_t opcode)
 {
-  uint8_t tmp8;
-
-  tmp8 = val + 1;
-  set_flag_to (ctx, FLAG_P, parity_table[tmp8]);
-  set_flag_to (ctx, FLAG_AC, (tmp8 & 0x0f) == 0);
-  set_flag_to (ctx, FLAG_Z, tmp8 == 0);
-  set_flag_to (ctx, FLAG_S, (tmp8 & 0x80) != 0);
-  return tmp8;
+  if (opcode >= 0xc0 && (opcode & 0x01) == 0 && (opcode & 0x07) != 0x06)
+    return condition_flags[(opcode >> 4) & 0x03]; /* Rcc, Jcc and Ccc */
+  switch (opcode)
+    {
+    case 0xf5: /* PUSH PSW */
+      return FLAGS_LAZY;
+    case 0x27: /* DAA */
+      return FLAG_C | FLAG_AC;
+    case 0x17: /* RAL */
+    case 0x1f: /* RAR */
+    case 0x3f: /* CMC */
+    case 0xce: /* ACI */
+    case 0xde: /* SBI */
+      return FLAG_C;
+    default:
+      return (opcode >= 0x88 && opcode < 0xa0) ? FLAG_C : 0; /* ADC, SBB */
+    }
 }
 
+/* Flags an instruction sets without looking at their old values. */
 static uint8_t
-op_dcr (struct i8080 *ctx, uint8_t val)
+flags_written (uint8_t opcode)
 {
-  uint8_t tmp8;
-
-  tmp8 = val - 1;
-  set_flag_to (ctx, FLAG_P, parity_table[tmp8]);
-  set_flag_to (ctx, FLAG_AC, !((tmp8 & 0x0f) == 0x0f));
-  set_flag_to (ctx, FLAG_Z, tmp8 == 0);
-  set_flag_to (ctx, FLAG_S, (tmp8 & 0x80) != 0);
-  return tmp8;
+  if ((opcode >= 0x80 && opcode < 0xc0)
+      || (opcode >= 0xc0 && (opcode & 0x07) == 0x06) || opcode == 0x27
+      || opcode == 0xf1)
+    return FLAGS_LAZY; /* ALU, DAA and POP PSW */
+  if (opcode < 0x40 && ((opcode & 0x07) == 0x04 || (opcode & 0x07) == 0x05))
+    return FLAGS_LAZY & ~FLAG_C; /* INR and DCR */
+  if (opcode < 0x40 && ((opcode & 0x0f) == 0x09 || (opcode & 0x07) == 0x07))
+    return (opcode == 0x2f) ? 0 : FLAG_C; /* DAD, rotates, STC and CMC */
+  return 0;
 }
 
+/*
+ * Work out the live flags backwards from the end of the block, where
+ * they all are, and give the instructions that only set dead flags the
+ * handler that leaves them alone.
+ */
 static void
-op_dad (struct i8080 *ctx, uint16_t val)
+block_liveness (struct block *blk)
 {
-  uint32_t tmp32;
-
-  tmp32 = get_hl (ctx) + val;
-  set_flag_to (ctx, FLAG_C, (tmp32 & 0x10000) != 0);
-  set_hl (ctx, tmp32 & UINT16_MAX);
+#  define NOFLAGS(n, body) [n] = HANDLER_NOFLAGS + NOFLAGS_##n,
+  static const uint16_t handlers[256] = {
+#  include "i8080-noflags.h"
+  };
+#  undef NOFLAGS
+  struct block_op *op;
+  uint8_t live, written;
+
+  live = FLAGS_LAZY;
+  for (op = &blk->ops[blk->nops - 1]; op >= blk->ops; --op)
+    {
+      op->live = live;
+      written = flags_written (op->opcode);
+      if (handlers[op->opcode] != 0 && (live & written) == 0)
+        op->handler = handlers[op->opcode];
+      live = (live & ~written) | flags_read (op->opcode);
+    }
 }
 
-static void
-op_rlc (struct i8080 *ctx)
+#endif /* USE_FLAG_LIVENESS */
+
+#ifdef USE_FUSION
+
+/* The pair in i8080-fusions.h, or -1. The list is short, see below. */
+static int
+fusion_find (const struct block_op *op)
 {
-  set_flag_to (ctx, FLAG_C, (ctx->a & 0x80) != 0);
-  ctx->a = (ctx->a << 1) | ((ctx->f & FLAG_C) != 0);
+  int i;
+
+  for (i = 0; i < FUSION_COUNT; ++i)
+    if (op[0].opcode == fusions[i][0] && op[1].opcode == fusions[i][1])
+      return i;
+  return -1;
 }
 
+/*
+ * Give the first op of each pair in i8080-fusions.h the handler of the
+ * pair. When the second op also starts a pair, the more frequent one,
+ * which comes first in the list, is taken. Blocks are only decoded once
+ * so the list is searched from the top every time.
+ */
 static void
-op_rrc (struct i8080 *ctx)
+block_fuse (struct block *blk)
 {
-  set_flag_to (ctx, FLAG_C, ctx->a & 0x01);
-  ctx->a = (ctx->a >> 1) | (((ctx->f & FLAG_C) != 0) << 7);
+  int i, fusion, next;
+
+  for (i = 0; i < blk->nops - 1; ++i)
+    {
+      fusion = fusion_find (&blk->ops[i]);
+      if (fusion < 0)
+        continue;
+      if (i + 2 < blk->nops)
+        {
+          next = fusion_find (&blk->ops[i + 1]);
+          if (next >= 0 && next < fusion)
+            continue;
+        }
+      blk->ops[i++].handler = HANDLER_FUSED + fusion;
+    }
 }
 
-static void
-op_ral (struct i8080 *ctx)
+#endif /* USE_FUSION */
+
+static struct block *
+block_decode (struct i8080 *ctx, uint16_t start)
 {
-  uint8_t tmp8;
+  struct block *blk;
+  struct block_op *op;
+  uint32_t address;
+  uint8_t opcode, lo, hi;
+  int i;
+
+  blk = ctx->cache->free_blocks;
+  if (blk != NULL)
+    ctx->cache->free_blocks = blk->next_free;
+  else
+    {
+      blk = (struct block *) malloc (sizeof (struct block));
+      if (blk == NULL)
+        return NULL;
+    }
+
+  blk->nops = 0;
+  for (address = start; blk->nops < BLOCK_MAX_OPS;)
+    {
+      if (!block_peek (ctx, address, &opcode))
+        break;
+      op = &blk->ops[blk->nops];
+      op->opcode = opcode;
+      op->imm = 0;
+      if (opcode_length[opcode] == 2)
+        {
+          if (!block_peek (ctx, address + 1, &lo))
+            break;
+          op->imm = lo;
+        }
+      else if (opcode_length[opcode] == 3)
+        {
+          if (!block_peek (ctx, address + 1, &lo)
+              || !block_peek (ctx, address + 2, &hi))
+            break;
+          op->imm = ((uint16_t) hi << 8) | ((uint16_t) lo);
+        }
+      address += opcode_length[opcode];
+      op->next = address & UINT16_MAX;
+      op->handler = opcode;
+      blk->nops++;
+      if (block_ends (opcode))
+        break;
+    }
+
+  if (blk->nops == 0)
+    {
+      blk->next_free = ctx->cache->free_blocks;
+      ctx->cache->free_blocks = blk;
+      return NULL;
+    }
 
-  tmp8 = ((ctx->f & FLAG_C) != 0);
-  set_flag_to (ctx, FLAG_C, (ctx->a & 0x80) != 0);
-  ctx->a = (ctx->a << 1) | tmp8;
+  blk->start = start;
+  blk->end = address;
+  blk->cycles = 0;
+#ifdef USE_IDLE_SKIP
+  opcode = blk->ops[blk->nops - 1].opcode;
+  blk->loops = (opcode == 0xc3 || opcode == 0xcb || (opcode & 0xc7) == 0xc2)
+               && blk->ops[blk->nops - 1].imm == start;
+  blk->runs = 0;
+#endif
+#ifdef USE_JIT
+  blk->hits = 0;
+  blk->native = NULL;
+#endif
+#ifdef USE_CC_TIER
+  blk->hits = 0;
+  /* A page mapped since may make the block longer than the code. */
+  blk->compiled = ctx->cache->compiled_length[start] == blk->end - start
+                      ? ctx->cache->compiled[start]
+                      : NULL;
+#endif
+  for (i = 0; i < blk->nops - 1; ++i)
+    blk->cycles += opcode_cycles[blk->ops[i].opcode];
+#ifdef USE_FLAG_LIVENESS
+  block_liveness (blk);
+#endif
+#ifdef USE_FUSION
+  block_fuse (blk);
+#endif
+  ctx->cache->blocks[start] = blk;
+  for (address = blk->start; address < blk->end; ++address)
+    ctx->cache->code[address]++;
+  return blk;
 }
 
 static void
-op_rar (struct i8080 *ctx)
+block_free (struct i8080_cache *cache, struct block *blk)
 {
-  uint8_t tmp8;
+  uint32_t address;
 
-  tmp8 = ((ctx->f & FLAG_C) != 0);
-  set_flag_to (ctx, FLAG_C, ctx->a & 0x01);
-  ctx->a = (ctx->a >> 1) | (tmp8 << 7);
+  for (address = blk->start; address < blk->end; ++address)
+    cache->code[address]--;
+  cache->blocks[blk->start] = NULL;
+  blk->next_free = cache->free_blocks;
+  cache->free_blocks = blk;
 }
 
+/*
+ * Drop every block decoded from a byte after it was written to. Code
+ * and data often share a page so this is tracked per byte. Blocks are
+ * short enough that only the ones starting shortly before the byte need
+ * to be looked at.
+ */
 static void
-op_daa (struct i8080 *ctx)
+cache_invalidate (struct i8080_cache *cache, uint16_t address)
 {
-  uint8_t ahi, alo, c, auxc, newc, inc;
+  struct block *blk;
+  uint32_t start;
 
-  ahi = (ctx->a >> 4) & 0x0f;
-  alo = ctx->a & 0x0f;
-  c = ((ctx->f & FLAG_C) != 0);
-  auxc = ((ctx->f & FLAG_AC) != 0);
-  newc = inc = 0;
-
-  if (alo > 9 || auxc != 0)
-    inc += 0x06;
-  if (ahi > 9 || c != 0 || (ahi >= 9 && alo > 9))
+  start = (address > BLOCK_MAX_OPS * 3) ? address - BLOCK_MAX_OPS * 3 : 0;
+  for (; start <= address && cache->code[address] != 0; ++start)
     {
-      newc = 1;
-      inc += 0x60;
+      blk = cache->blocks[start];
+      if (blk != NULL && blk->end > address)
+        block_free (cache, blk);
     }
+}
+
+/*
+ * One function per opcode with the operand already decoded, for
+ * translated code to call and for the handlers of fused pairs to inline.
+ * i8080_handlers has them for code translated ahead of time.
+ */
+#define FETCH_BYTE() ((uint8_t) imm)
+#define FETCH_WORD() (imm)
+#define SKIP_WORD() ((void) 0)
+#define OPCODE(n)                                                             \
+  static inline void exec_##n (struct i8080 *ctx,                             \
+                               [[maybe_unused]] uint16_t imm)
+#define NEXT return
+#define NEXT_IO return
+#include "i8080-opcodes.h"
+#undef FETCH_BYTE
+#undef FETCH_WORD
+#undef SKIP_WORD
+#undef OPCODE
+#undef NEXT
+#undef NEXT_IO
+
+#define EXEC_FUNCTION(n) exec_##n
+
+const i8080_handler i8080_handlers[256] = OPCODE_TABLE (EXEC_FUNCTION);
+
+#undef EXEC_FUNCTION
 
-  op_add (ctx, inc);
-  set_flag_to (ctx, FLAG_C, newc == 1);
+#ifdef USE_THREADED_DISPATCH
+
+#  define FUSED_ADDRESS(first, second) &&fused_##first##_##second,
+#  define NOFLAGS_ADDRESS(n, body) &&noflags_##n,
+
+static void
+block_exec (struct i8080 *ctx, const struct block *blk)
+{
+  static const void *const dispatch[] = {
+    OPCODE_LIST (LABEL_ADDRESS),
+#  ifdef USE_FUSION
+#    define FUSE FUSED_ADDRESS
+#    include "i8080-fusions.h"
+#    undef FUSE
+#  endif
+#  ifdef USE_FLAG_LIVENESS
+#    define NOFLAGS NOFLAGS_ADDRESS
+#    include "i8080-noflags.h"
+#    undef NOFLAGS
+#  endif
+  };
+  const struct block_op *op, *end;
+
+  /* Only the last instruction can look at the program counter. */
+  ctx->pc = blk->ops[blk->nops - 1].next;
+  op = blk->ops;
+  end = &blk->ops[blk->nops];
+  goto *dispatch[op->handler];
+
+#  define FETCH_BYTE() ((uint8_t) op->imm)
+#  define FETCH_WORD() (op->imm)
+#  define SKIP_WORD() ((void) 0)
+#  define OPCODE(n) opcode_##n:
+#  define NEXT                                                                \
+    do                                                                        \
+      {                                                                       \
+        if (++op == end)                                                      \
+          return;                                                             \
+        goto *dispatch[op->handler];                                          \
+      }                                                                       \
+    while (0)
+#  define NEXT_IO NEXT
+#  include "i8080-opcodes.h"
+#  ifdef USE_FUSION
+#    define FUSE(first, second)                                               \
+      fused_##first##_##second:                                               \
+      exec_##first (ctx, op[0].imm);                                          \
+      exec_##second (ctx, op[1].imm);                                         \
+      ++op;                                                                   \
+      NEXT;
+#    include "i8080-fusions.h"
+#    undef FUSE
+#  endif
+#  ifdef USE_FLAG_LIVENESS
+#    define NOFLAGS(n, body)                                                  \
+      noflags_##n:                                                            \
+      body;                                                                   \
+      ctx->cycles += opcode_cycles[n];                                        \
+      NEXT;
+#    include "i8080-noflags.h"
+#    undef NOFLAGS
+#  endif
+#  undef FETCH_BYTE
+#  undef FETCH_WORD
+#  undef SKIP_WORD
+#  undef OPCODE
+#  undef NEXT
+#  undef NEXT_IO
 }
 
-void
-i8080_init (struct i8080 *ctx)
+#  undef FUSED_ADDRESS
+#  undef NOFLAGS_ADDRESS
+
+#else /* !USE_THREADED_DISPATCH */
+
+static void
+block_exec (struct i8080 *ctx, const struct block *blk)
 {
-  ctx->a = 0;
-  ctx->f = 0x02;
-  ctx->b = 0;
-  ctx->c = 0;
-  ctx->d = 0;
-  ctx->e = 0;
-  ctx->h = 0;
-  ctx->l = 0;
-  ctx->sp = 0;
-  ctx->pc = 0;
-  ctx->halted = false;
-  ctx->int_enable = false;
-  ctx->int_requested = false;
-  ctx->int_opcode = 0;
-  ctx->cycles = 0;
-  ctx->user_data = NULL;
-  ctx->read_byte = NULL;
-  ctx->write_byte = NULL;
-  ctx->io_inb = NULL;
-  ctx->io_outb = NULL;
+  const struct block_op *op, *end;
+
+  /* Only the last instruction can look at the program counter. */
+  ctx->pc = blk->ops[blk->nops - 1].next;
+  end = &blk->ops[blk->nops];
+  for (op = blk->ops; op != end; ++op)
+    switch (op->handler)
+      {
+#  define FETCH_BYTE() ((uint8_t) op->imm)
+#  define FETCH_WORD() (op->imm)
+#  define SKIP_WORD() ((void) 0)
+#  define OPCODE(n) case n:
+#  define NEXT break
+#  define NEXT_IO break
+#  include "i8080-opcodes.h"
+#  ifdef USE_FUSION
+#    define FUSE(first, second)                                               \
+      case HANDLER_FUSED + FUSION_##first##_##second:                         \
+        exec_##first (ctx, op[0].imm);                                        \
+        exec_##second (ctx, op[1].imm);                                       \
+        ++op;                                                                 \
+        break;
+#    include "i8080-fusions.h"
+#    undef FUSE
+#  endif
+#  ifdef USE_FLAG_LIVENESS
+#    define NOFLAGS(n, body)                                                  \
+      case HANDLER_NOFLAGS + NOFLAGS_##n:                                     \
+        body;                                                                 \
+        ctx->cycles += opcode_cycles[n];                                      \
+        break;
+#    include "i8080-noflags.h"
+#    undef NOFLAGS
+#  endif
+#  undef FETCH_BYTE
+#  undef FETCH_WORD
+#  undef SKIP_WORD
+#  undef OPCODE
+#  undef NEXT
+#  undef NEXT_IO
+      }
 }
 
-void
-i8080_step (struct i8080 *ctx)
+#endif /* !USE_THREADED_DISPATCH */
+
+#ifdef I8080_TRACE
+
+/*
+ * block_exec() while tracing, with a record before each op that takes
+ * the bytes from the op instead of memory. The ops run by opcode rather
+ * than handler, so the two halves of a fused pair get a record each and
+ * the flags block_liveness() leaves out are worked out as they would be
+ * one instruction at a time.
+ */
+static void
+block_trace (struct i8080 *ctx, const struct block *blk)
 {
-  /* If an interrupt is requested */
-  if (ctx->int_requested && ctx->int_enable)
-    {
-      /* Acknowledge request and reset INTE. */
-      ctx->int_enable = false;
-      ctx->int_requested = false;
-      /* Interrupt occured so unhalt */
-      ctx->halted = false;
+  struct i8080_trace_record *rec;
+  const struct block_op *op, *end;
+  uint16_t pc;
 
-      /* Execute the requested opcode */
-      i8080_exec_opcode (ctx, ctx->int_opcode);
+  ctx->pc = blk->ops[blk->nops - 1].next;
+  end = &blk->ops[blk->nops];
+  for (op = blk->ops, pc = blk->start; op != end; pc = op->next, ++op)
+    {
+      rec = trace_next (ctx, pc);
+      rec->bytes[0] = op->opcode;
+      rec->bytes[1] = op->imm & UINT8_MAX;
+      rec->bytes[2] = op->imm >> 8;
+      rec->interrupt = false;
+      i8080_handlers[op->opcode] (ctx, op->imm);
     }
-  else if (!ctx->halted)
-    i8080_exec_opcode (ctx, fetch_byte (ctx));
 }
 
-void
-i8080_interrupt (struct i8080 *ctx, uint8_t opcode)
+#endif /* I8080_TRACE */
+
+#ifdef USE_JIT
+
+static jit_code
+block_translate (struct i8080_cache *cache, const struct block *blk)
 {
-  ctx->int_requested = true;
-  ctx->int_opcode = opcode;
+  struct jit_insn insns[BLOCK_MAX_OPS];
+  uint8_t opcode;
+  int i;
+
+  for (i = 0; i < blk->nops; ++i)
+    {
+      opcode = blk->ops[i].opcode;
+      insns[i].handler = i8080_handlers[opcode];
+      insns[i].imm = blk->ops[i].imm;
+      insns[i].opcode = opcode;
+      insns[i].cycles = opcode_cycles[opcode];
+    }
+  return jit_translate (cache->jit, insns, blk->nops,
+                        blk->ops[blk->nops - 1].next);
 }
 
-void
-i8080_exec_opcode (struct i8080 *ctx, uint8_t opcode)
+/*
+ * Called once a block is hot. When the code buffer fills up everything
+ * is thrown away and translation starts over.
+ */
+static void
+block_compile (struct i8080_cache *cache, struct block *blk)
 {
-  switch (opcode)
+  uint32_t address;
+
+  blk->native = block_translate (cache, blk);
+  if (blk->native != NULL)
+    return;
+
+  for (address = 0; address <= UINT16_MAX; ++address)
+    if (cache->blocks[address] != NULL)
+      {
+        cache->blocks[address]->native = NULL;
+        cache->blocks[address]->hits = 0;
+      }
+  jit_reset (cache->jit);
+  blk->native = block_translate (cache, blk);
+}
+
+#endif /* USE_JIT */
+
+#ifdef USE_CC_TIER
+
+static_assert (BLOCK_MAX_OPS * 3 <= CC_MAX_LENGTH, "blocks are too long");
+static_assert (CC_MAX_LENGTH <= UINT8_MAX, "compiled_length is too small");
+
+/* Called once a block is hot. */
+static void
+block_request (struct i8080 *ctx, const struct block *blk)
+{
+  uint8_t code[CC_MAX_LENGTH];
+  uint32_t address;
+
+  /* The code may not be where it is read from when it wraps around. */
+  if (blk->end > UINT16_MAX + 1)
+    return;
+  for (address = blk->start; address < blk->end; ++address)
+    code[address - blk->start] = ctx->read_map[address / I8080_PAGE_SIZE]
+                                               [address % I8080_PAGE_SIZE];
+  cc_request (ctx->cache->cc, blk->start, code, blk->end - blk->start);
+}
+
+/* Hand the blocks the compiler finished to those decoded already. */
+static void
+block_install (struct i8080_cache *cache)
+{
+  uint16_t starts[64];
+  uint32_t lengths[64];
+  cc_code codes[64];
+  struct block *blk;
+  size_t i, n;
+
+  do
     {
-    case 0x00: /* NOP */
-      ctx->cycles += 4;
-      break;
-    case 0x01: /* LXI B */
-      set_bc (ctx, fetch_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x02: /* STAX B */
-      write_byte (ctx, get_bc (ctx), ctx->a);
-      ctx->cycles += 7;
-      break;
-    case 0x03: /* INX B */
-      if (++ctx->c == 0)
-        ctx->b++;
-      ctx->cycles += 5;
-      break;
-    case 0x04: /* INR B */
-      ctx->b = op_inr (ctx, ctx->b);
-      ctx->cycles += 5;
-      break;
-    case 0x05: /* DCR B */
-      ctx->b = op_dcr (ctx, ctx->b);
-      ctx->cycles += 5;
-      break;
-    case 0x06: /* MVI B */
-      ctx->b = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x07: /* RLC */
-      op_rlc (ctx);
-      ctx->cycles += 4;
-      break;
-    case 0x08: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x09: /* DAD B */
-      op_dad (ctx, get_bc (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x0a: /* LDAX B */
-      ctx->a = read_byte (ctx, get_bc (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x0b: /* DCX B */
-      if (--ctx->c == UINT8_MAX)
-        ctx->b--;
-      ctx->cycles += 5;
-      break;
-    case 0x0c: /* INR C */
-      ctx->c = op_inr (ctx, ctx->c);
-      ctx->cycles += 5;
-      break;
-    case 0x0d: /* DCR C */
-      ctx->c = op_dcr (ctx, ctx->c);
-      ctx->cycles += 5;
-      break;
-    case 0x0e: /* MVI C */
-      ctx->c = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x0f: /* RRC */
-      op_rrc (ctx);
-      ctx->cycles += 4;
-      break;
-    case 0x10: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x11: /* LXI D */
-      set_de (ctx, fetch_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x12: /* STAX D */
-      write_byte (ctx, get_de (ctx), ctx->a);
-      ctx->cycles += 7;
-      break;
-    case 0x13: /* INX D */
-      if (++ctx->e == 0)
-        ctx->d++;
-      ctx->cycles += 5;
-      break;
-    case 0x14: /* INR D */
-      ctx->d = op_inr (ctx, ctx->d);
-      ctx->cycles += 5;
-      break;
-    case 0x15: /* DCR D */
-      ctx->d = op_dcr (ctx, ctx->d);
-      ctx->cycles += 5;
-      break;
-    case 0x16: /* MVI D */
-      ctx->d = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x17: /* RAL */
-      op_ral (ctx);
-      ctx->cycles += 4;
-      break;
-    case 0x18: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x19: /* DAD D */
-      op_dad (ctx, get_de (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x1a: /* LDAX D */
-      ctx->a = read_byte (ctx, get_de (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x1b: /* DCX D */
-      if (--ctx->e == UINT8_MAX)
-        ctx->d--;
-      ctx->cycles += 5;
-      break;
-    case 0x1c: /* INR E */
-      ctx->e = op_inr (ctx, ctx->e);
-      ctx->cycles += 5;
-      break;
-    case 0x1d: /* DCR E */
-      ctx->e = op_dcr (ctx, ctx->e);
-      ctx->cycles += 5;
-      break;
-    case 0x1e: /* MVI E */
-      ctx->e = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x1f: /* RAR */
-      op_rar (ctx);
-      ctx->cycles += 4;
-      break;
-    case 0x20: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x21: /* LXI H */
-      set_hl (ctx, fetch_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x22: /* SHLD */
-      write_word (ctx, fetch_word (ctx), get_hl (ctx));
-      ctx->cycles += 16;
-      break;
-    case 0x23: /* INX H */
-      if (++ctx->l == 0)
-        ctx->h++;
-      ctx->cycles += 5;
-      break;
-    case 0x24: /* INR H */
-      ctx->h = op_inr (ctx, ctx->h);
-      ctx->cycles += 5;
-      break;
-    case 0x25: /* DCR H */
-      ctx->h = op_dcr (ctx, ctx->h);
-      ctx->cycles += 5;
-      break;
-    case 0x26: /* MVI H */
-      ctx->h = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x27: /* DAA */
-      op_daa (ctx);
-      ctx->cycles += 4;
-      break;
-    case 0x28: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x29: /* DAD H */
-      op_dad (ctx, get_hl (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x2a: /* LHLD */
-      set_hl (ctx, read_word (ctx, fetch_word (ctx)));
-      ctx->cycles += 16;
-      break;
-    case 0x2b: /* DCX H */
-      if (--ctx->l == UINT8_MAX)
-        ctx->h--;
-      ctx->cycles += 5;
-      break;
-    case 0x2c: /* INR L */
-      ctx->l = op_inr (ctx, ctx->l);
-      ctx->cycles += 5;
-      break;
-    case 0x2d: /* DCR L */
-      ctx->l = op_dcr (ctx, ctx->l);
-      ctx->cycles += 5;
-      break;
-    case 0x2e: /* MVI L */
-      ctx->l = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x2f: /* CMA */
-      ctx->a ^= UINT8_MAX;
-      ctx->cycles += 4;
-      break;
-    case 0x30: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x31: /* LXI SP */
-      ctx->sp = fetch_word (ctx);
-      ctx->cycles += 10;
-      break;
-    case 0x32: /* STA */
-      write_byte (ctx, fetch_word (ctx), ctx->a);
-      ctx->cycles += 13;
-      break;
-    case 0x33: /* INX SP */
-      ctx->sp++;
-      ctx->cycles += 5;
-      break;
-    case 0x34: /* INR M */
-      write_byte (ctx, get_hl (ctx),
-                  op_inr (ctx, read_byte (ctx, get_hl (ctx))));
-      ctx->cycles += 10;
-      break;
-    case 0x35: /* DCR M */
-      write_byte (ctx, get_hl (ctx),
-                  op_dcr (ctx, read_byte (ctx, get_hl (ctx))));
-      ctx->cycles += 10;
-      break;
-    case 0x36: /* MVI M */
-      write_byte (ctx, get_hl (ctx), fetch_byte (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0x37: /* STC */
-      ctx->f |= FLAG_C;
-      ctx->cycles += 4;
-      break;
-    case 0x38: /* NOP (Undocumented) */
-      ctx->cycles += 4;
-      break;
-    case 0x39: /* DAD SP */
-      op_dad (ctx, ctx->sp);
-      ctx->cycles += 10;
-      break;
-    case 0x3a: /* LDA */
-      ctx->a = read_byte (ctx, fetch_word (ctx));
-      ctx->cycles += 13;
-      break;
-    case 0x3b: /* DCX SP */
-      ctx->sp--;
-      ctx->cycles += 5;
-      break;
-    case 0x3c: /* INR A */
-      ctx->a = op_inr (ctx, ctx->a);
-      ctx->cycles += 5;
-      break;
-    case 0x3d: /* DCR A */
-      ctx->a = op_dcr (ctx, ctx->a);
-      ctx->cycles += 5;
-      break;
-    case 0x3e: /* MVI A */
-      ctx->a = fetch_byte (ctx);
-      ctx->cycles += 7;
-      break;
-    case 0x3f: /* CMC */
-      if (ctx->f & FLAG_C)
-        ctx->f &= ~FLAG_C;
-      else
-        ctx->f |= FLAG_C;
-      ctx->cycles += 4;
-      break;
-    case 0x40: /* MOV B, B */
-      ctx->b = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x41: /* MOV B, C */
-      ctx->b = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x42: /* MOV B, D */
-      ctx->b = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x43: /* MOV B, E */
-      ctx->b = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x44: /* MOV B, H */
-      ctx->b = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x45: /* MOV B, L */
-      ctx->b = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x46: /* MOV B, M */
-      ctx->b = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x47: /* MOV B, A */
-      ctx->b = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x48: /* MOV C, B */
-      ctx->c = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x49: /* MOV C, C */
-      ctx->c = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x4a: /* MOV C, D */
-      ctx->c = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x4b: /* MOV C, E */
-      ctx->c = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x4c: /* MOV C, H */
-      ctx->c = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x4d: /* MOV C, L */
-      ctx->c = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x4e: /* MOV C, M */
-      ctx->c = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x4f: /* MOV C, A */
-      ctx->c = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x50: /* MOV D, B */
-      ctx->d = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x51: /* MOV D, C */
-      ctx->d = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x52: /* MOV D, D */
-      ctx->d = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x53: /* MOV D, E */
-      ctx->d = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x54: /* MOV D, H */
-      ctx->d = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x55: /* MOV D, L */
-      ctx->d = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x56: /* MOV D, M */
-      ctx->d = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x57: /* MOV D, A */
-      ctx->d = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x58: /* MOV E, B */
-      ctx->e = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x59: /* MOV E, C */
-      ctx->e = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x5a: /* MOV E, D */
-      ctx->e = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x5b: /* MOV E, E */
-      ctx->e = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x5c: /* MOV E, H */
-      ctx->e = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x5d: /* MOV E, L */
-      ctx->e = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x5e: /* MOV E, M */
-      ctx->e = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x5f: /* MOV E, A */
-      ctx->e = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x60: /* MOV H, B */
-      ctx->h = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x61: /* MOV H, C */
-      ctx->h = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x62: /* MOV H, D */
-      ctx->h = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x63: /* MOV H, E */
-      ctx->h = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x64: /* MOV H, H */
-      ctx->h = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x65: /* MOV H, L */
-      ctx->h = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x66: /* MOV H, M */
-      ctx->h = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x67: /* MOV H, A */
-      ctx->h = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x68: /* MOV L, B */
-      ctx->l = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x69: /* MOV L, C */
-      ctx->l = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x6a: /* MOV L, D */
-      ctx->l = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x6b: /* MOV L, E */
-      ctx->l = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x6c: /* MOV L, H */
-      ctx->l = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x6d: /* MOV L, L */
-      ctx->l = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x6e: /* MOV L, M */
-      ctx->l = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x6f: /* MOV L, A */
-      ctx->l = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x70: /* MOV M, B */
-      write_byte (ctx, get_hl (ctx), ctx->b);
-      ctx->cycles += 7;
-      break;
-    case 0x71: /* MOV M, C */
-      write_byte (ctx, get_hl (ctx), ctx->c);
-      ctx->cycles += 7;
-      break;
-    case 0x72: /* MOV M, D */
-      write_byte (ctx, get_hl (ctx), ctx->d);
-      ctx->cycles += 7;
-      break;
-    case 0x73: /* MOV M, E */
-      write_byte (ctx, get_hl (ctx), ctx->e);
-      ctx->cycles += 7;
-      break;
-    case 0x74: /* MOV M, H */
-      write_byte (ctx, get_hl (ctx), ctx->h);
-      ctx->cycles += 7;
-      break;
-    case 0x75: /* MOV M, L */
-      write_byte (ctx, get_hl (ctx), ctx->l);
-      ctx->cycles += 7;
-      break;
-    case 0x76: /* HLT */
-      ctx->halted = true;
-      ctx->cycles += 7;
-      break;
-    case 0x77: /* MOV M, A */
-      write_byte (ctx, get_hl (ctx), ctx->a);
-      ctx->cycles += 7;
-      break;
-    case 0x78: /* MOV A, B */
-      ctx->a = ctx->b;
-      ctx->cycles += 5;
-      break;
-    case 0x79: /* MOV A, C */
-      ctx->a = ctx->c;
-      ctx->cycles += 5;
-      break;
-    case 0x7a: /* MOV A, D */
-      ctx->a = ctx->d;
-      ctx->cycles += 5;
-      break;
-    case 0x7b: /* MOV A, E */
-      ctx->a = ctx->e;
-      ctx->cycles += 5;
-      break;
-    case 0x7c: /* MOV A, H */
-      ctx->a = ctx->h;
-      ctx->cycles += 5;
-      break;
-    case 0x7d: /* MOV A, L */
-      ctx->a = ctx->l;
-      ctx->cycles += 5;
-      break;
-    case 0x7e: /* MOV A, M */
-      ctx->a = read_byte (ctx, get_hl (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0x7f: /* MOV A, A */
-      ctx->a = ctx->a;
-      ctx->cycles += 5;
-      break;
-    case 0x80: /* ADD B */
-      op_add (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0x81: /* ADD C */
-      op_add (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0x82: /* ADD D */
-      op_add (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0x83: /* ADD E */
-      op_add (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0x84: /* ADD H */
-      op_add (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0x85: /* ADD L */
-      op_add (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0x86: /* ADD M */
-      op_add (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0x87: /* ADD A */
-      op_add (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0x88: /* ADC B */
-      op_adc (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0x89: /* ADC C */
-      op_adc (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0x8a: /* ADC D */
-      op_adc (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0x8b: /* ADC E */
-      op_adc (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0x8c: /* ADC H */
-      op_adc (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0x8d: /* ADC L */
-      op_adc (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0x8e: /* ADC M */
-      op_adc (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0x8f: /* ADC A */
-      op_adc (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0x90: /* SUB B */
-      op_sub (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0x91: /* SUB C */
-      op_sub (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0x92: /* SUB D */
-      op_sub (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0x93: /* SUB E */
-      op_sub (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0x94: /* SUB H */
-      op_sub (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0x95: /* SUB L */
-      op_sub (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0x96: /* SUB M */
-      op_sub (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0x97: /* SUB A */
-      op_sub (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0x98: /* SBB B */
-      op_sbb (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0x99: /* SBB C */
-      op_sbb (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0x9a: /* SBB D */
-      op_sbb (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0x9b: /* SBB E */
-      op_sbb (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0x9c: /* SBB H */
-      op_sbb (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0x9d: /* SBB L */
-      op_sbb (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0x9e: /* SBB M */
-      op_sbb (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0x9f: /* SBB A */
-      op_sbb (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0xa0: /* ANA B */
-      op_ana (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0xa1: /* ANA C */
-      op_ana (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0xa2: /* ANA D */
-      op_ana (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0xa3: /* ANA E */
-      op_ana (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0xa4: /* ANA H */
-      op_ana (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0xa5: /* ANA L */
-      op_ana (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0xa6: /* ANA M */
-      op_ana (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0xa7: /* ANA A */
-      op_ana (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0xa8: /* XRA B */
-      op_xra (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0xa9: /* XRA C */
-      op_xra (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0xaa: /* XRA D */
-      op_xra (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0xab: /* XRA E */
-      op_xra (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0xac: /* XRA H */
-      op_xra (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0xad: /* XRA L */
-      op_xra (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0xae: /* XRA M */
-      op_xra (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0xaf: /* XRA A */
-      op_xra (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0xb0: /* ORA B */
-      op_ora (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0xb1: /* ORA C */
-      op_ora (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0xb2: /* ORA D */
-      op_ora (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0xb3: /* ORA E */
-      op_ora (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0xb4: /* ORA H */
-      op_ora (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0xb5: /* ORA L */
-      op_ora (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0xb6: /* ORA M */
-      op_ora (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0xb7: /* ORA A */
-      op_ora (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0xb8: /* CMP B */
-      op_cmp (ctx, ctx->b);
-      ctx->cycles += 4;
-      break;
-    case 0xb9: /* CMP C */
-      op_cmp (ctx, ctx->c);
-      ctx->cycles += 4;
-      break;
-    case 0xba: /* CMP D */
-      op_cmp (ctx, ctx->d);
-      ctx->cycles += 4;
-      break;
-    case 0xbb: /* CMP E */
-      op_cmp (ctx, ctx->e);
-      ctx->cycles += 4;
-      break;
-    case 0xbc: /* CMP H */
-      op_cmp (ctx, ctx->h);
-      ctx->cycles += 4;
-      break;
-    case 0xbd: /* CMP L */
-      op_cmp (ctx, ctx->l);
-      ctx->cycles += 4;
-      break;
-    case 0xbe: /* CMP M */
-      op_cmp (ctx, read_byte (ctx, get_hl (ctx)));
-      ctx->cycles += 7;
-      break;
-    case 0xbf: /* CMP A */
-      op_cmp (ctx, ctx->a);
-      ctx->cycles += 4;
-      break;
-    case 0xc0: /* RNZ */
-      if (!(ctx->f & FLAG_Z))
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xc1: /* POP B */
-      set_bc (ctx, pop_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0xc2: /* JNZ */
-      if (!(ctx->f & FLAG_Z))
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xc3: /* JMP */
-      op_jmp (ctx);
-      ctx->cycles += 10;
-      break;
-    case 0xc4: /* CNZ */
-      if (!(ctx->f & FLAG_Z))
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
-        {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xc5: /* PUSH B */
-      push_word (ctx, get_bc (ctx));
-      ctx->cycles += 11;
-      break;
-    case 0xc6: /* ADI */
-      op_add (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xc7: /* RST 0 */
-      op_rst (ctx, 0x0000);
-      ctx->cycles += 11;
-      break;
-    case 0xc8: /* RZ */
-      if (ctx->f & FLAG_Z)
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xc9: /* RET */
-      op_ret (ctx);
-      ctx->cycles += 10;
-      break;
-    case 0xca: /* JZ */
-      if (ctx->f & FLAG_Z)
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xcb: /* JMP (Undocumented) */
-      op_jmp (ctx);
-      ctx->cycles += 10;
-      break;
-    case 0xcc: /* CZ */
-      if (ctx->f & FLAG_Z)
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
-        {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xcd: /* CALL */
-      op_call (ctx);
-      ctx->cycles += 17;
-      break;
-    case 0xce: /* ACI */
-      op_adc (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xcf: /* RST 1 */
-      op_rst (ctx, 0x008);
-      ctx->cycles += 11;
-      break;
-    case 0xd0: /* RNC */
-      if (!(ctx->f & FLAG_C))
+      n = cc_collect (cache->cc, starts, lengths, codes, 64);
+      for (i = 0; i < n; ++i)
         {
-          op_ret (ctx);
-          ctx->cycles += 11;
+          cache->compiled[starts[i]] = codes[i];
+          cache->compiled_length[starts[i]] = lengths[i];
+          blk = cache->blocks[starts[i]];
+          if (blk != NULL && blk->end - blk->start == lengths[i])
+            blk->compiled = codes[i];
         }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xd1: /* POP D */
-      set_de (ctx, pop_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0xd2: /* JNC */
-      if (!(ctx->f & FLAG_C))
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xd3: /* OUT */
-      ctx->io_outb (ctx->user_data, fetch_byte (ctx), ctx->a);
-      ctx->cycles += 10;
-      break;
-    case 0xd4: /* CNC */
-      if (!(ctx->f & FLAG_C))
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
-        {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xd5: /* PUSH D */
-      push_word (ctx, get_de (ctx));
-      ctx->cycles += 11;
-      break;
-    case 0xd6: /* SUI */
-      op_sub (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xd7: /* RST 2 */
-      op_rst (ctx, 0x0010);
-      ctx->cycles += 11;
-      break;
-    case 0xd8: /* RC */
-      if (ctx->f & FLAG_C)
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xd9: /* RET (Undocumented) */
-      op_ret (ctx);
-      ctx->cycles += 10;
-      break;
-    case 0xda: /* JC */
-      if (ctx->f & FLAG_C)
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xdb: /* IN */
-      ctx->a = ctx->io_inb (ctx, fetch_byte (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0xdc: /* CC */
-      if (ctx->f & FLAG_C)
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
-        {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xdd: /* CALL (Undocumented) */
-      op_call (ctx);
-      ctx->cycles += 17;
-      break;
-    case 0xde: /* SBI */
-      op_sbb (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xdf: /* RST 3 */
-      op_rst (ctx, 0x0018);
-      ctx->cycles += 11;
-      break;
-    case 0xe0: /* RPO */
-      if (!(ctx->f & FLAG_P))
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xe1: /* POP H */
-      set_hl (ctx, pop_word (ctx));
-      ctx->cycles += 10;
-      break;
-    case 0xe2: /* JPO */
-      if (!(ctx->f & FLAG_P))
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xe3: /* XTHL */
-      op_xthl (ctx);
-      ctx->cycles += 18;
-      break;
-    case 0xe4: /* CPO */
-      if (!(ctx->f & FLAG_P))
+    }
+  while (n == 64);
+}
+
+/*
+ * The compiled code is kept by address and length and checks the memory
+ * itself, so it is given to blocks of the same length decoded again after
+ * a write. Code that was changed since is forgotten and the new code
+ * counted again.
+ */
+static bool
+block_run_compiled (struct i8080 *ctx, struct block *blk)
+{
+  if (blk->compiled (ctx))
+    return true;
+  ctx->cache->compiled[blk->start] = NULL;
+  blk->compiled = NULL;
+  blk->hits = 0;
+  return false;
+}
+
+#endif /* USE_CC_TIER */
+
+#ifdef USE_IDLE_SKIP
+
+/* Runs of a block that jumps to itself between checks for spinning. */
+#  define SPIN_INTERVAL 64
+
+static_assert (offsetof (struct i8080, l) - offsetof (struct i8080, a) == 7,
+               "registers are not packed");
+
+/* What a spin loop has to leave as it found it. */
+struct spin_state
+{
+  uint8_t regs[8]; /* A, F, B, C, D, E, H and L */
+  uint16_t sp;
+  uintmax_t callback_reads;
+};
+
+static void
+spin_save (struct i8080 *ctx, struct spin_state *state)
+{
+  flags_sync (ctx);
+  memcpy (state->regs, &ctx->a, sizeof (state->regs));
+  state->sp = ctx->sp;
+  state->callback_reads = ctx->cache->callback_reads;
+}
+
+/*
+ * A block that jumped back to its start without changing a register, a
+ * flag or SP, or reading anything through read_byte, does the same thing
+ * every time it runs until the host steps in. Blocks end before any
+ * write or I/O so there is nothing else it could do. Skip all the runs
+ * that fit in the budget but the last one, which is left to the caller
+ * so that it stops where it would have.
+ */
+static void
+block_spin (struct i8080 *ctx, const struct block *blk,
+            const struct spin_state *before, uintmax_t target,
+            uintmax_t *retired)
+{
+  struct spin_state after;
+  uintmax_t period, runs;
+
+  if (ctx->pc != blk->start || ctx->cycles >= target)
+    return;
+  spin_save (ctx, &after);
+  if (memcmp (after.regs, before->regs, sizeof (after.regs)) != 0
+      || after.sp != before->sp
+      || after.callback_reads != before->callback_reads)
+    return;
+
+  period = blk->cycles + opcode_cycles[blk->ops[blk->nops - 1].opcode];
+  runs = (target - ctx->cycles) / period;
+  if (runs > 1)
+    {
+      ctx->cycles += (runs - 1) * period;
+      *retired += (runs - 1) * blk->nops;
+    }
+}
+
+#endif /* USE_IDLE_SKIP */
+
+/* Run a block through its native code if there is any, or block_exec(). */
+static inline void
+block_run (struct i8080 *ctx, struct block *blk)
+{
+#ifdef USE_JIT
+  if (blk->native == NULL && ctx->cache->jit != NULL
+      && ++blk->hits == JIT_THRESHOLD)
+    block_compile (ctx->cache, blk);
+  if (blk->native != NULL)
+    blk->native (ctx);
+  else
+#endif
+#ifdef USE_CC_TIER
+  if (ctx->cache->cc != NULL && ++ctx->cache->polls % CC_POLL_INTERVAL == 0)
+    block_install (ctx->cache);
+  if (blk->compiled == NULL && ctx->cache->cc != NULL
+      && ++blk->hits == CC_THRESHOLD)
+    block_request (ctx, blk);
+  if (blk->compiled == NULL || !block_run_compiled (ctx, blk))
+#endif
+    block_exec (ctx, blk);
+}
+
+/*
+ * Like run_loop() but a block at a time. A block only runs if the budget
+ * lasts until its last instruction so i8080_run() stops at the same
+ * place either way.
+ */
+static enum i8080_exit
+run_blocks (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
+{
+  struct block *blk;
+  uint8_t nops, last;
+#ifdef USE_IDLE_SKIP
+  struct spin_state before;
+  bool spin;
+#endif
+
+  while (!run_stop (ctx, target))
+    {
+      blk = ctx->cache->blocks[ctx->pc];
+      if (blk == NULL)
+        blk = block_decode (ctx, ctx->pc);
+      if (blk == NULL)
         {
-          op_call (ctx);
-          ctx->cycles += 17;
+          /* Not in mapped memory. */
+          last = fetch_opcode (ctx);
+          exec_opcode (ctx, last);
+          nops = 1;
         }
+      else if (ctx->cycles + blk->cycles >= target)
+        return run_loop (ctx, target, retired);
       else
         {
-          ctx->pc += 2;
-          ctx->cycles += 11;
+          /* The last instruction may write to the block and free it. */
+          nops = blk->nops;
+          last = blk->ops[nops - 1].opcode;
+#ifdef USE_IDLE_SKIP
+          /* Nothing to skip to without a budget, or while tracing. */
+          spin = blk->loops && ++blk->runs % SPIN_INTERVAL == 0
+                 && target != UINTMAX_MAX && !TRACING (ctx);
+          if (spin)
+            spin_save (ctx, &before);
+#endif
+#ifdef I8080_TRACE
+          if (TRACING (ctx))
+            block_trace (ctx, blk);
+          else
+#endif
+            block_run (ctx, blk);
+#ifdef USE_IDLE_SKIP
+          if (spin)
+            block_spin (ctx, blk, &before, target, retired);
+#endif
         }
-      break;
-    case 0xe5: /* PUSH H */
-      push_word (ctx, get_hl (ctx));
-      ctx->cycles += 11;
-      break;
-    case 0xe6: /* ANI */
-      op_ana (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xe7: /* RST 4 */
-      op_rst (ctx, 0x0020);
-      ctx->cycles += 11;
-      break;
-    case 0xe8: /* RPE */
-      if (ctx->f & FLAG_P)
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xe9: /* PCHL */
-      ctx->pc = get_hl (ctx);
-      ctx->cycles += 5;
-      break;
-    case 0xea: /* JPE */
-      if (ctx->f & FLAG_P)
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xeb: /* XCHG */
-      op_xchg (ctx);
-      ctx->cycles += 5;
-      break;
-    case 0xec: /* CPE */
-      if (ctx->f & FLAG_P)
+      *retired += nops;
+      if (ctx->io_exit && (last == 0xd3 || last == 0xdb))
+        return I8080_EXIT_IO;
+    }
+
+  return run_reason (ctx, target);
+}
+
+/*
+ * Like run_blocks() with the blocks of i8080_aot_enable(). Anything they
+ * do not cover, or that was written over since, is interpreted one
+ * instruction at a time until it reaches one of them.
+ */
+static enum i8080_exit
+run_aot (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
+{
+  const struct i8080_aot_block *blk;
+  uint8_t last;
+
+  while (!run_stop (ctx, target))
+    {
+      blk = ctx->aot[ctx->pc];
+      if (blk != NULL && ctx->cycles + blk->cycles >= target)
+        return run_loop (ctx, target, retired);
+      if (blk != NULL && blk->run (ctx))
         {
-          op_call (ctx);
-          ctx->cycles += 17;
+          last = blk->last;
+          *retired += blk->nops;
         }
       else
         {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xed: /* CALL (Undocumented) */
-      op_call (ctx);
-      ctx->cycles += 17;
-      break;
-    case 0xee: /* XRI */
-      op_xra (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xef: /* RST 5 */
-      op_rst (ctx, 0x0028);
-      ctx->cycles += 11;
-      break;
-    case 0xf0: /* RP */
-      if (!(ctx->f & FLAG_S))
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
+          last = fetch_opcode (ctx);
+          exec_opcode (ctx, last);
+          ++*retired;
         }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xf1: /* POP PSW */
-      set_psw (ctx, pop_word (ctx));
-      /* Make sure the unused bits are set. */
-      ctx->f |= 0x02;
-      ctx->f &= ~0x08;
-      ctx->f &= ~0x20;
-      ctx->cycles += 10;
-      break;
-    case 0xf2: /* JP */
-      if (!(ctx->f & FLAG_S))
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xf3: /* DI */
+      if (ctx->io_exit && (last == 0xd3 || last == 0xdb))
+        return I8080_EXIT_IO;
+    }
+
+  return run_reason (ctx, target);
+}
+
+#ifdef USE_THREADED_DISPATCH
+#  undef LABEL_ADDRESS
+#endif
+
+#ifdef I8080_STATS
+
+/* Like run_loop() without threaded dispatch, counting every opcode. */
+static enum i8080_exit
+run_counted (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
+{
+  uint8_t opcode;
+
+  while (!run_stop (ctx, target))
+    {
+      opcode = fetch_opcode (ctx);
+      stats_exec (ctx, opcode, false);
+      ++*retired;
+      if (ctx->io_exit && (opcode == 0xd3 || opcode == 0xdb))
+        return I8080_EXIT_IO;
+    }
+
+  return run_reason (ctx, target);
+}
+
+#endif /* I8080_STATS */
+
+/* i8080_run() up to the target without looking at the events. */
+static enum i8080_exit
+run_slice (struct i8080 *ctx, uintmax_t target, uintmax_t *retired)
+{
+  enum i8080_exit reason;
+  uintmax_t count;
+
+  /*
+   * Only take an interrupt on entry. Anything requested while running
+   * is reported so the host sees it before it happens.
+   */
+  count = 0;
+  if (ctx->cycles < target && ctx->int_requested && ctx->int_enable)
+    {
       ctx->int_enable = false;
-      ctx->cycles += 4;
-      break;
-    case 0xf4: /* CP */
-      if (!(ctx->f & FLAG_S))
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
-        {
-          ctx->pc += 2;
-          ctx->cycles += 11;
-        }
-      break;
-    case 0xf5: /* PUSH PSW */
-      /* Make sure the unused bits are set. */
-      ctx->f |= 0x02;
-      ctx->f &= ~0x08;
-      ctx->f &= ~0x20;
-      push_word (ctx, get_psw (ctx));
-      ctx->cycles += 11;
-      break;
-    case 0xf6: /* ORI */
-      op_ora (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case 0xf7: /* RST 6 */
-      op_rst (ctx, 0x0030);
-      ctx->cycles += 11;
-      break;
-    case 0xf8: /* RM */
-      if (ctx->f & FLAG_S)
-        {
-          op_ret (ctx);
-          ctx->cycles += 11;
-        }
-      else
-        ctx->cycles += 5;
-      break;
-    case 0xf9: /* SPHL */
-      ctx->sp = get_hl (ctx);
-      ctx->cycles += 5;
-      break;
-    case 0xfa: /* JM */
-      if (ctx->f & FLAG_S)
-        op_jmp (ctx);
-      else
-        ctx->pc += 2;
-      ctx->cycles += 10;
-      break;
-    case 0xfb: /* EI */
-      ctx->int_enable = true;
-      ctx->cycles += 4;
-      break;
-    case 0xfc: /* CM */
-      if (ctx->f & FLAG_S)
-        {
-          op_call (ctx);
-          ctx->cycles += 17;
-        }
-      else
+      ctx->int_requested = false;
+      ctx->halted = false;
+      TRACE (ctx, ctx->pc, ctx->int_opcode, true);
+      EXEC (ctx, ctx->int_opcode, true);
+      count = 1;
+    }
+
+#ifdef I8080_STATS
+  if (ctx->stats != NULL)
+    reason = run_counted (ctx, target, &count);
+  else
+#endif
+    if (ctx->aot != NULL && !TRACING (ctx))
+    reason = run_aot (ctx, target, &count);
+  else if (ctx->cache != NULL)
+    reason = run_blocks (ctx, target, &count);
+  else
+    reason = run_loop (ctx, target, &count);
+
+  /*
+   * Nothing happens until an interrupt, which the host can only request
+   * once this returns, so skip to the end of the budget.
+   */
+  if (reason == I8080_EXIT_HALT && ctx->int_enable && target != UINTMAX_MAX)
+    {
+      ctx->cycles = target;
+      reason = I8080_EXIT_BUDGET;
+    }
+  flags_sync (ctx);
+  *retired = count;
+  return reason;
+}
+
+enum i8080_exit
+i8080_run (struct i8080 *ctx, uintmax_t budget, uintmax_t *retired)
+{
+  enum i8080_exit reason;
+  uintmax_t target, next, count, total;
+
+  /* Saturate instead of wrapping around for large budgets. */
+  if (budget > UINTMAX_MAX - ctx->cycles)
+    target = UINTMAX_MAX;
+  else
+    target = ctx->cycles + budget;
+
+  /*
+   * Stop at each event, or just after it since instructions are not
+   * split, and carry on with any interrupt it requested.
+   */
+  total = 0;
+  for (;;)
+    {
+      next = events_next (ctx);
+      reason = run_slice (ctx, next < target ? next : target, &count);
+      total += count;
+      if (ctx->events != NULL)
+        events_fire (ctx);
+      if (reason != I8080_EXIT_BUDGET || ctx->cycles >= target)
+        break;
+    }
+  if (retired != NULL)
+    *retired = total;
+  return reason;
+}
+
+int
+i8080_cache_enable (struct i8080 *ctx)
+{
+  if (ctx->cache == NULL)
+    {
+      ctx->cache = (struct i8080_cache *) calloc (1, sizeof (*ctx->cache));
+      if (ctx->cache == NULL)
+        return -1;
+#ifdef USE_JIT
+      /* Fall back to the decoded blocks without native code. */
+      ctx->cache->jit = jit_create ();
+#endif
+#ifdef USE_CC_TIER
+      /* Fall back to the decoded blocks without compiling them. */
+      ctx->cache->cc = cc_create (read_byte);
+#endif
+    }
+  return 0;
+}
+
+void
+i8080_cache_disable (struct i8080 *ctx)
+{
+  struct block *blk;
+
+  if (ctx->cache != NULL)
+    {
+      i8080_cache_flush (ctx);
+      while ((blk = ctx->cache->free_blocks) != NULL)
         {
-          ctx->pc += 2;
-          ctx->cycles += 11;
+          ctx->cache->free_blocks = blk->next_free;
+          free (blk);
         }
-      break;
-    case 0xfd: /* CALL (Undocumented) */
-      op_call (ctx);
-      ctx->cycles += 17;
-      break;
-    case 0xfe: /* CPI */
-      op_cmp (ctx, fetch_byte (ctx));
-      ctx->cycles += 7;
-      break;
-    case UINT8_MAX: /* RST 7 */
-      op_rst (ctx, 0x0038);
-      ctx->cycles += 11;
-      break;
-    default: /* Unreachable */
-      break;
+#ifdef USE_JIT
+      if (ctx->cache->jit != NULL)
+        jit_destroy (ctx->cache->jit);
+#endif
+#ifdef USE_CC_TIER
+      if (ctx->cache->cc != NULL)
+        cc_destroy (ctx->cache->cc);
+#endif
+      free (ctx->cache);
+      ctx->cache = NULL;
+    }
+}
+
+void
+i8080_aot_enable (struct i8080 *ctx,
+                  const struct i8080_aot_block *const *blocks)
+{
+  ctx->aot = blocks;
+}
+
+void
+i8080_aot_disable (struct i8080 *ctx)
+{
+  ctx->aot = NULL;
+}
+
+void
+i8080_cache_flush (struct i8080 *ctx)
+{
+  uint32_t address;
+
+  if (ctx->cache == NULL)
+    return;
+  for (address = 0; address <= UINT16_MAX; ++address)
+    if (ctx->cache->blocks[address] != NULL)
+      block_free (ctx->cache, ctx->cache->blocks[address]);
+#ifdef USE_JIT
+  if (ctx->cache->jit != NULL)
+    jit_reset (ctx->cache->jit);
+#endif
+}
+
+/* Give the CPU back the pages the snapshot has not seen written yet. */
+static void
+snapshot_unprotect_all (struct i8080 *ctx)
+{
+  int page;
+
+  for (page = 0; page < I8080_PAGE_COUNT; ++page)
+    if (ctx->snapshot->write_map[page] != NULL)
+      ctx->write_map[page] = ctx->snapshot->write_map[page];
+}
+
+int
+i8080_snapshot (struct i8080 *ctx)
+{
+  struct i8080_snapshot *snap;
+  int page;
+
+  if (ctx->snapshot == NULL)
+    {
+      snap = (struct i8080_snapshot *) malloc (sizeof (*snap));
+      if (snap == NULL)
+        return -1;
+    }
+  else
+    {
+      snapshot_unprotect_all (ctx);
+      snap = ctx->snapshot;
+    }
+
+  snap->a = ctx->a;
+  snap->f = ctx->f;
+  snap->b = ctx->b;
+  snap->c = ctx->c;
+  snap->d = ctx->d;
+  snap->e = ctx->e;
+  snap->h = ctx->h;
+  snap->l = ctx->l;
+  snap->sp = ctx->sp;
+  snap->pc = ctx->pc;
+  snap->halted = ctx->halted;
+  snap->int_enable = ctx->int_enable;
+  snap->int_requested = ctx->int_requested;
+  snap->int_opcode = ctx->int_opcode;
+  snap->cycles = ctx->cycles;
+  memcpy (snap->write_map, ctx->write_map, sizeof (snap->write_map));
+  snap->dirty_count = 0;
+  for (page = 0; page < I8080_PAGE_COUNT; ++page)
+    ctx->write_map[page] = NULL;
+  ctx->snapshot = snap;
+  return 0;
+}
+
+/*
+ * First write to PAGE since the snapshot or the last restore. Returns
+ * its host memory, or NULL if the page belongs to the callbacks.
+ */
+static uint8_t *
+snapshot_unprotect (struct i8080 *ctx, unsigned int page)
+{
+  struct i8080_snapshot *snap = ctx->snapshot;
+  uint8_t *mem;
+
+  mem = snap->write_map[page];
+  if (mem != NULL)
+    {
+      memcpy (snap->pages[snap->dirty_count], mem, I8080_PAGE_SIZE);
+      snap->dirty[snap->dirty_count++] = page;
+      ctx->write_map[page] = mem;
+    }
+  return mem;
+}
+
+void
+i8080_restore (struct i8080 *ctx)
+{
+  struct i8080_snapshot *snap = ctx->snapshot;
+  uint32_t address, end;
+  int page;
+
+  if (snap == NULL)
+    return;
+
+  /*
+   * Newest first, so host memory mapped at several pages ends up with
+   * the copy taken before any of them was written.
+   */
+  while (snap->dirty_count > 0)
+    {
+      page = snap->dirty[--snap->dirty_count];
+      memcpy (snap->write_map[page], snap->pages[snap->dirty_count],
+              I8080_PAGE_SIZE);
+      ctx->write_map[page] = NULL;
+      if (ctx->cache == NULL)
+        continue;
+      end = (uint32_t) (page + 1) * I8080_PAGE_SIZE;
+      for (address = page * I8080_PAGE_SIZE; address < end; ++address)
+        if (ctx->cache->code[address] != 0)
+          cache_invalidate (ctx->cache, address);
+    }
+
+  ctx->a = snap->a;
+  ctx->f = snap->f;
+  ctx->b = snap->b;
+  ctx->c = snap->c;
+  ctx->d = snap->d;
+  ctx->e = snap->e;
+  ctx->h = snap->h;
+  ctx->l = snap->l;
+  ctx->sp = snap->sp;
+  ctx->pc = snap->pc;
+  ctx->halted = snap->halted;
+  ctx->int_enable = snap->int_enable;
+  ctx->int_requested = snap->int_requested;
+  ctx->int_opcode = snap->int_opcode;
+  ctx->cycles = snap->cycles;
+}
+
+void
+i8080_snapshot_free (struct i8080 *ctx)
+{
+  if (ctx->snapshot != NULL)
+    {
+      snapshot_unprotect_all (ctx);
+      free (ctx->snapshot);
+      ctx->snapshot = NULL;
+    }
+}
+
+/* Earlier, or as early and scheduled first. */
+static bool
+event_before (const struct event *a, const struct event *b)
+{
+  return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+/* Move the event at the index down the heap to where it belongs. */
+static void
+events_sift_down (struct i8080_events *events, size_t i)
+{
+  struct event tmp;
+  size_t child;
+
+  while ((child = 2 * i + 1) < events->count)
+    {
+      if (child + 1 < events->count
+          && event_before (&events->heap[child + 1], &events->heap[child]))
+        child++;
+      if (!event_before (&events->heap[child], &events->heap[i]))
+        break;
+      tmp = events->heap[i];
+      events->heap[i] = events->heap[child];
+      events->heap[child] = tmp;
+      i = child;
+    }
+}
+
+/* Cycle count of the earliest event, or UINTMAX_MAX without one. */
+static uintmax_t
+events_next (const struct i8080 *ctx)
+{
+  if (ctx->events == NULL || ctx->events->count == 0)
+    return UINTMAX_MAX;
+  return ctx->events->heap[0].at;
+}
+
+/*
+ * Call the functions of every event that is due, taking each one off
+ * the heap first since it may schedule more or free them all.
+ */
+static void
+events_fire (struct i8080 *ctx)
+{
+  struct i8080_events *events;
+  struct event ev;
+
+  while ((events = ctx->events) != NULL && events->count > 0
+         && events->heap[0].at <= ctx->cycles)
+    {
+      ev = events->heap[0];
+      events->heap[0] = events->heap[--events->count];
+      events_sift_down (events, 0);
+      ev.fn (ctx, ev.data, ev.at);
+    }
+}
+
+int
+i8080_schedule (struct i8080 *ctx, uintmax_t at, i8080_event_fn fn,
+                void *data)
+{
+  struct i8080_events *events;
+  struct event *heap, tmp;
+  size_t i, size;
+
+  events = ctx->events;
+  if (events == NULL)
+    {
+      events = (struct i8080_events *) calloc (1, sizeof (*events));
+      if (events == NULL)
+        return -1;
+      ctx->events = events;
+    }
+  if (events->count == events->size)
+    {
+      size = events->size == 0 ? 8 : events->size * 2;
+      heap = (struct event *) realloc (events->heap, size * sizeof (*heap));
+      if (heap == NULL)
+        return -1;
+      events->heap = heap;
+      events->size = size;
+    }
+
+  i = events->count++;
+  events->heap[i].at = at;
+  events->heap[i].order = events->scheduled++;
+  events->heap[i].fn = fn;
+  events->heap[i].data = data;
+  while (i > 0 && event_before (&events->heap[i], &events->heap[(i - 1) / 2]))
+    {
+      tmp = events->heap[i];
+      events->heap[i] = events->heap[(i - 1) / 2];
+      events->heap[(i - 1) / 2] = tmp;
+      i = (i - 1) / 2;
+    }
+  return 0;
+}
+
+void
+i8080_unschedule (struct i8080 *ctx, i8080_event_fn fn, void *data)
+{
+  struct i8080_events *events = ctx->events;
+  size_t i, kept;
+
+  if (events == NULL)
+    return;
+  for (i = kept = 0; i < events->count; ++i)
+    if (events->heap[i].fn != fn || events->heap[i].data != data)
+      events->heap[kept++] = events->heap[i];
+  events->count = kept;
+  for (i = kept / 2; i-- > 0;)
+    events_sift_down (events, i);
+}
+
+uintmax_t
+i8080_events_next (const struct i8080 *ctx)
+{
+  return events_next (ctx);
+}
+
+void
+i8080_events_fire (struct i8080 *ctx)
+{
+  events_fire (ctx);
+}
+
+void
+i8080_events_free (struct i8080 *ctx)
+{
+  if (ctx->events != NULL)
+    {
+      free (ctx->events->heap);
+      free (ctx->events);
+      ctx->events = NULL;
+    }
+}
+
+#ifdef I8080_TRACE
+
+/* Take the next record and fill in everything but the bytes. */
+static inline struct i8080_trace_record *
+trace_next (struct i8080 *ctx, uint16_t pc)
+{
+  struct i8080_trace *trace = ctx->trace;
+  struct i8080_trace_record *rec;
+
+  /* Hand over the last block before the ring buffer comes round to it. */
+  if (trace->count - trace->pending == trace->block)
+    {
+      trace->sink (trace->sink_data,
+                   &trace->records[trace->pending & trace->mask],
+                   trace->block);
+      trace->pending = trace->count;
     }
+
+  rec = &trace->records[trace->count++ & trace->mask];
+  rec->cycles = ctx->cycles;
+  rec->pc = pc;
+  rec->sp = ctx->sp;
+  memcpy (rec->regs, &ctx->a, sizeof (rec->regs));
+  rec->lazy_result = ctx->lazy_result;
+  rec->lazy_flags = ctx->lazy_flags;
+  rec->lazy_aux = ctx->lazy_aux;
+  return rec;
+}
+
+/*
+ * The operand bytes are read again here. Memory behind the callbacks
+ * sees the reads twice.
+ */
+static inline void
+trace_record (struct i8080 *ctx, uint16_t pc, uint8_t opcode, bool interrupt)
+{
+  struct i8080_trace_record *rec;
+
+  rec = trace_next (ctx, pc);
+  rec->bytes[0] = opcode;
+  rec->bytes[1] = 0;
+  rec->bytes[2] = 0;
+  rec->interrupt = interrupt;
+  if (!interrupt && opcode_length[opcode] > 1)
+    {
+      rec->bytes[1] = read_byte (ctx, pc + 1);
+      if (opcode_length[opcode] > 2)
+        rec->bytes[2] = read_byte (ctx, pc + 2);
+    }
+}
+
+#endif /* I8080_TRACE */
+
+int
+i8080_trace_enable ([[maybe_unused]] struct i8080 *ctx,
+                    [[maybe_unused]] size_t records)
+{
+#ifdef I8080_TRACE
+  struct i8080_trace *trace;
+
+  if (records == 0 || (records & (records - 1)) != 0)
+    return -1;
+  trace = (struct i8080_trace *) malloc (
+      sizeof (*trace) + records * sizeof (trace->records[0]));
+  if (trace == NULL)
+    return -1;
+  trace->mask = records - 1;
+  trace->count = 0;
+  trace->block = UINTMAX_MAX;
+  trace->pending = 0;
+  trace->sink = NULL;
+  trace->sink_data = NULL;
+  i8080_trace_disable (ctx);
+  ctx->trace = trace;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void
+i8080_trace_disable (struct i8080 *ctx)
+{
+  free (ctx->trace);
+  ctx->trace = NULL;
+}
+
+void
+i8080_trace_dump ([[maybe_unused]] const struct i8080 *ctx,
+                  [[maybe_unused]] FILE *fp)
+{
+#ifdef I8080_TRACE
+  const struct i8080_trace *trace = ctx->trace;
+  uintmax_t n;
+
+  if (trace == NULL)
+    return;
+  n = (trace->count > trace->mask) ? trace->count - trace->mask - 1 : 0;
+  for (; n < trace->count; ++n)
+    i8080_trace_print (&trace->records[n & trace->mask], fp);
+#endif
+}
+
+void
+i8080_trace_print (const struct i8080_trace_record *rec, FILE *fp)
+{
+  const uint8_t *regs = rec->regs;
+  char text[32], bytes[12];
+  int length;
+
+  length = i8080_disasm (text, sizeof (text), rec->bytes);
+  if (rec->interrupt)
+    snprintf (bytes, sizeof (bytes), "int %02x", rec->bytes[0]);
+  else if (length == 1)
+    snprintf (bytes, sizeof (bytes), "%02x", rec->bytes[0]);
+  else if (length == 2)
+    snprintf (bytes, sizeof (bytes), "%02x %02x", rec->bytes[0],
+              rec->bytes[1]);
+  else
+    snprintf (bytes, sizeof (bytes), "%02x %02x %02x", rec->bytes[0],
+              rec->bytes[1], rec->bytes[2]);
+
+  /* The registers are stored in the order of struct i8080. */
+  fprintf (fp,
+           "%12" PRIu64 " %04x  %-8s  %-16s A=%02x F=%02x B=%02x "
+           "C=%02x D=%02x E=%02x H=%02x L=%02x SP=%04x\n",
+           rec->cycles, rec->pc, bytes, text, regs[0],
+           i8080_trace_flags (rec), regs[2], regs[3], regs[4], regs[5],
+           regs[6], regs[7], rec->sp);
+}
+
+int
+i8080_trace_sink ([[maybe_unused]] struct i8080 *ctx,
+                  [[maybe_unused]] size_t block,
+                  [[maybe_unused]] i8080_trace_sink_fn sink,
+                  [[maybe_unused]] void *data)
+{
+#ifdef I8080_TRACE
+  struct i8080_trace *trace = ctx->trace;
+
+  if (trace == NULL || block == 0 || (block & (block - 1)) != 0
+      || block > trace->mask + 1)
+    return -1;
+  trace->block = (sink != NULL) ? block : UINTMAX_MAX;
+  trace->pending = trace->count;
+  trace->sink = sink;
+  trace->sink_data = data;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void
+i8080_trace_flush ([[maybe_unused]] struct i8080 *ctx)
+{
+#ifdef I8080_TRACE
+  struct i8080_trace *trace = ctx->trace;
+
+  if (trace == NULL || trace->sink == NULL)
+    return;
+  if (trace->count != trace->pending)
+    trace->sink (trace->sink_data,
+                 &trace->records[trace->pending & trace->mask],
+                 trace->count - trace->pending);
+  trace->block = UINTMAX_MAX;
+  trace->sink = NULL;
+#endif
+}
+
+uint8_t
+i8080_trace_flags (const struct i8080_trace_record *rec)
+{
+  struct i8080 state;
+
+  /* Work the flags out the way the core would have. */
+  state.f = rec->regs[1];
+  state.lazy_result = rec->lazy_result;
+  state.lazy_flags = rec->lazy_flags;
+  state.lazy_aux = rec->lazy_aux;
+  flags_sync (&state);
+  return state.f;
+}
+
+#ifdef I8080_STATS
+
+/*
+ * Run an instruction whose opcode has been fetched, or an interrupt,
+ * and count it.
+ */
+static void
+stats_exec (struct i8080 *ctx, uint8_t opcode, bool interrupt)
+{
+  struct i8080_stats *stats = ctx->stats;
+  uintmax_t start;
+  unsigned int cond;
+
+  start = ctx->cycles;
+  if (interrupt)
+    {
+      exec_opcode (ctx, opcode);
+      stats->interrupts++;
+      stats->interrupt_cycles += ctx->cycles - start;
+      stats->previous = -1;
+      return;
+    }
+  if (stats->previous >= 0)
+    stats->pairs[stats->previous][opcode]++;
+  stats->previous = opcode;
+  if ((opcode & 0xc1) == 0xc0 && (opcode & 0x06) != 0x06)
+    {
+      cond = (opcode >> 3) & 0x07;
+      if (get_flag (ctx, condition_flags[cond >> 1]) == (cond & 1))
+        stats->taken[opcode]++;
+    }
+  exec_opcode (ctx, opcode);
+  stats->count[opcode]++;
+  stats->cycles[opcode] += ctx->cycles - start;
+}
+
+#endif /* I8080_STATS */
+
+int
+i8080_stats_enable ([[maybe_unused]] struct i8080 *ctx)
+{
+#ifdef I8080_STATS
+  struct i8080_stats *stats;
+
+  stats = (struct i8080_stats *) calloc (1, sizeof (*stats));
+  if (stats == NULL)
+    return -1;
+  stats->previous = -1;
+  i8080_stats_disable (ctx);
+  ctx->stats = stats;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void
+i8080_stats_disable (struct i8080 *ctx)
+{
+  free (ctx->stats);
+  ctx->stats = NULL;
+}
+
+void
+i8080_interrupt (struct i8080 *ctx, uint8_t opcode)
+{
+  ctx->int_requested = true;
+  ctx->int_opcode = opcode;
+}
+
+static void
+exec_opcode (struct i8080 *ctx, uint8_t opcode)
+{
+  switch (opcode)
+    {
+#define FETCH_BYTE() fetch_byte (ctx)
+#define FETCH_WORD() fetch_word (ctx)
+#define SKIP_WORD() (ctx->pc += 2)
+#define OPCODE(n) case n:
+#define NEXT break
+#define NEXT_IO break
+#include "i8080-opcodes.h"
+#undef FETCH_BYTE
+#undef FETCH_WORD
+#undef SKIP_WORD
+#undef OPCODE
+#undef NEXT
+#undef NEXT_IO
+    }
+}
+
+void
+i8080_exec_opcode (struct i8080 *ctx, uint8_t opcode)
+{
+  exec_opcode (ctx, opcode);
+  flags_sync (ctx);
+}
+
+int
+i8080_opcode_length (uint8_t opcode)
+{
+  return opcode_length[opcode];
+}
+
+int
+i8080_opcode_cycles (uint8_t opcode)
+{
+  return opcode_cycles[opcode];
+}
+
+bool
+i8080_opcode_ends_block (uint8_t opcode)
+{
+  return block_ends (opcode);
 }
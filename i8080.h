@@ -27,7 +27,81 @@
 #define I8080_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+/* Granularity of the direct memory maps. */
+#define I8080_PAGE_SIZE 256
+#define I8080_PAGE_COUNT 256
+
+/* Reasons for i8080_run() to return to the caller. */
+enum i8080_exit
+{
+  I8080_EXIT_BUDGET,    /* Cycle budget exhausted */
+  I8080_EXIT_HALT,      /* Halted with interrupts disabled */
+  I8080_EXIT_INTERRUPT, /* An interrupt is pending */
+  I8080_EXIT_IO,        /* IN or OUT executed with io_exit set */
+};
+
+struct i8080;
+struct i8080_cache;
+struct i8080_events;
+struct i8080_snapshot;
+struct i8080_trace;
+
+/* Opcode counters, see i8080_stats_enable(). */
+struct i8080_stats
+{
+  uint64_t count[256];  /* Instructions with each opcode */
+  uint64_t cycles[256]; /* Cycles they took */
+  uint64_t taken[256];  /* Runs of Jcc, Ccc and Rcc whose condition held */
+  uint64_t interrupts;  /* Interrupts, which are left out of the above */
+  uint64_t interrupt_cycles;
+  uint64_t pairs[256][256]; /* Instructions by opcode and the one before */
+  int previous;             /* Opcode before the next, -1 after interrupts */
+};
+
+/*
+ * State before an instruction in the trace, with the flags in the lazy
+ * form of struct i8080. i8080_trace_flags() works them out.
+ */
+struct i8080_trace_record
+{
+  uint64_t cycles;
+  uint16_t pc;
+  uint16_t sp;
+  uint8_t regs[8]; /* A, F, B, C, D, E, H and L */
+  uint16_t lazy_result;
+  uint8_t lazy_flags;
+  uint8_t lazy_aux;
+  uint8_t bytes[3]; /* The instruction, or the opcode of an interrupt */
+  bool interrupt;
+};
+
+/* Receives consecutive records of the trace, see i8080_trace_sink(). */
+typedef void (*i8080_trace_sink_fn) (void *,
+                                     const struct i8080_trace_record *,
+                                     size_t);
+
+/* Receives the data and cycle count an event was scheduled with. */
+typedef void (*i8080_event_fn) (struct i8080 *, void *, uintmax_t);
+
+/* Runs one instruction given its operand, see i8080_handlers. */
+typedef void (*i8080_handler) (struct i8080 *, uint16_t);
+
+/*
+ * Code translated to C ahead of time by i8080-recompile. run() returns
+ * false without doing anything if memory no longer holds the code it
+ * was translated from, or the code is behind the read_byte callback.
+ */
+struct i8080_aot_block
+{
+  bool (*run) (struct i8080 *);
+  uint32_t cycles; /* Taken before the last instruction */
+  uint8_t nops;
+  uint8_t last; /* Opcode of the last instruction */
+};
 
 struct i8080
 {
@@ -45,18 +119,170 @@ struct i8080
   bool int_enable;    /* INTE - Interrupt enable */
   bool int_requested; /* INT - Interrupt requested */
   uint8_t int_opcode; /* In case someone interrupts with a 0x00 nop? */
+  bool io_exit;       /* Return from i8080_run() after IN or OUT */
+  /*
+   * The flags are only worked out when something reads them. The ones
+   * set in lazy_flags are out of date in f and come from the last
+   * result instead. f is always up to date between calls.
+   */
+  uint8_t lazy_flags;
+  uint8_t lazy_aux;     /* AC in bit 4 */
+  uint16_t lazy_result; /* S, Z and P from bits 0-7, C from bit 8 */
   uintmax_t cycles;
   void *user_data;
   uint8_t (*read_byte) (void *, uint16_t);
   void (*write_byte) (void *, uint16_t, uint8_t);
   uint8_t (*io_inb) (void *, uint8_t);
   void (*io_outb) (void *, uint8_t, uint8_t);
+  /*
+   * Host memory backing each page. Pages left NULL go through
+   * read_byte and write_byte instead.
+   */
+  const uint8_t *read_map[I8080_PAGE_COUNT];
+  uint8_t *write_map[I8080_PAGE_COUNT];
+  struct i8080_cache *cache;       /* Pre-decoded blocks, see below */
+  struct i8080_snapshot *snapshot; /* Saved state, see below */
+  struct i8080_trace *trace;       /* Instruction history, see below */
+  struct i8080_stats *stats;       /* Opcode counters, see below */
+  struct i8080_events *events;     /* Scheduled callbacks, see below */
+  const struct i8080_aot_block *const *aot; /* Translated code, see below */
 };
 
 void i8080_init (struct i8080 *);
 void i8080_step (struct i8080 *);
+/*
+ * Execute instructions until the cycle budget is used or one of the
+ * other conditions in enum i8080_exit is met. A pending interrupt is
+ * taken before the first instruction. The number of instructions
+ * executed is stored in the last argument if it is not NULL. A HLT with
+ * interrupts enabled uses up the rest of a budget below UINTMAX_MAX, or
+ * waits for the next event.
+ */
+enum i8080_exit i8080_run (struct i8080 *, uintmax_t, uintmax_t *);
 /* Send an interrupt to execute an instruction */
 void i8080_interrupt (struct i8080 *, uint8_t);
 void i8080_exec_opcode (struct i8080 *, uint8_t);
+/* Length in bytes of the instruction with the opcode. */
+int i8080_opcode_length (uint8_t);
+/* Its cycles, the shorter time for conditional calls and returns. */
+int i8080_opcode_cycles (uint8_t);
+/*
+ * Whether the instruction ends a block of the block cache and of
+ * i8080-recompile: anything that can jump, write memory, do I/O, halt or
+ * change whether interrupts are taken.
+ */
+bool i8080_opcode_ends_block (uint8_t);
+/*
+ * Serve reads or writes of the given address range directly from host
+ * memory. The address and size must be multiples of I8080_PAGE_SIZE.
+ * Passing NULL returns the range to the read_byte/write_byte callbacks.
+ */
+void i8080_map_read (struct i8080 *, uint16_t, size_t, const uint8_t *);
+void i8080_map_write (struct i8080 *, uint16_t, size_t, uint8_t *);
+/*
+ * Make i8080_run() execute from a cache of pre-decoded blocks. Only code
+ * in pages mapped with i8080_map_read() is cached. Blocks are dropped
+ * when the CPU writes to their pages, but the host has to call
+ * i8080_cache_flush() after changing code memory itself. Returns -1 if
+ * the cache cannot be allocated.
+ */
+int i8080_cache_enable (struct i8080 *);
+void i8080_cache_disable (struct i8080 *);
+void i8080_cache_flush (struct i8080 *);
+/*
+ * Save the registers, interrupt state and cycle count, and the host
+ * memory behind the write map. Pages are copied the first time they are
+ * written after that, so i8080_restore() only copies back the pages
+ * that changed and can be called any number of times. Taking another
+ * snapshot replaces the last one. Memory behind the write_byte callback
+ * is up to the host, and the write map must not be changed while a
+ * snapshot is held. Returns -1 if the snapshot cannot be allocated.
+ */
+int i8080_snapshot (struct i8080 *);
+void i8080_restore (struct i8080 *);
+void i8080_snapshot_free (struct i8080 *);
+/*
+ * Keep the registers and bytes of the last instructions executed, a
+ * power of two of them, in a ring buffer. Only builds with I8080_TRACE
+ * have it. While tracing, the block cache runs every block one
+ * instruction at a time without the JIT, the compiled blocks or skipping
+ * spin loops, and the blocks of i8080_aot_enable() are not used.
+ * Instructions run in lockstep by i8080_lanes_run() are left out.
+ * Returns -1 if the build has no trace or the buffer cannot be
+ * allocated.
+ */
+int i8080_trace_enable (struct i8080 *, size_t);
+void i8080_trace_disable (struct i8080 *);
+/* Print the trace oldest first as disassembly and registers. */
+void i8080_trace_dump (const struct i8080 *, FILE *);
+/*
+ * Print one record as a line of the dump, which works in every build so
+ * traces read from files can be shown.
+ */
+void i8080_trace_print (const struct i8080_trace_record *, FILE *);
+/*
+ * Pass every block of records to the function as soon as the block is
+ * full, straight out of the ring buffer. The block size is a power of
+ * two no larger than the buffer. The records stay there until the
+ * buffer comes round to them again, so the function has to be done
+ * with the block the CPU writes next before it returns.
+ * i8080_trace_flush() passes the records since the last full block and
+ * stops passing them, which is for the end of a run. Returns -1 if there
+ * is no trace or the size is not allowed.
+ */
+int i8080_trace_sink (struct i8080 *, size_t, i8080_trace_sink_fn, void *);
+void i8080_trace_flush (struct i8080 *);
+/* The flags register before the instruction. */
+uint8_t i8080_trace_flags (const struct i8080_trace_record *);
+/*
+ * Count the instructions run with each opcode, the cycles they take,
+ * how often each conditional jump, call and return is taken and how
+ * often each opcode follows each other one, starting from zero. Only
+ * builds with I8080_STATS have the counters. Those run i8080_run() one
+ * instruction at a time through a switch while counting. Instructions
+ * run in lockstep by i8080_lanes_run() or passed to i8080_exec_opcode()
+ * are left out. Returns -1 if the build has no counters or they cannot
+ * be allocated.
+ */
+int i8080_stats_enable (struct i8080 *);
+void i8080_stats_disable (struct i8080 *);
+/*
+ * Call the function once the cycle count gets to the given one.
+ * i8080_run() stops after the instruction that reaches it, calls the
+ * functions that are due in order of cycle count and then of scheduling,
+ * and goes on with the rest of the budget. i8080_step() calls them after
+ * each instruction, and i8080_lanes_run() stops each lane as
+ * i8080_run() does. A function can schedule itself again at the count
+ * it was given plus its period without drifting, and an interrupt it
+ * sends is taken before the next instruction if interrupts are enabled.
+ * Snapshots leave the events out. Returns -1 if the event cannot be
+ * allocated.
+ */
+int i8080_schedule (struct i8080 *, uintmax_t, i8080_event_fn, void *);
+/* Drop the events with the function and data. */
+void i8080_unschedule (struct i8080 *, i8080_event_fn, void *);
+void i8080_events_free (struct i8080 *);
+/*
+ * The cycle count of the earliest event, or UINTMAX_MAX without one,
+ * and the call of the events that are due, for running the CPU other
+ * than through i8080_run() or i8080_step().
+ */
+uintmax_t i8080_events_next (const struct i8080 *);
+void i8080_events_fire (struct i8080 *);
+/*
+ * The instruction with each opcode, with its operand passed instead of
+ * fetched. The program counter has to point past the instruction
+ * already for the ones that push or test it.
+ */
+extern const i8080_handler i8080_handlers[256];
+/*
+ * Run the blocks i8080-recompile translated, which are indexed by start
+ * address, from i8080_run(). A block only runs while memory still holds
+ * the code it was translated from, and only from pages mapped with
+ * i8080_map_read(). Everything else is interpreted. The statistics and
+ * the trace take precedence, and the block cache is not used.
+ */
+void i8080_aot_enable (struct i8080 *, const struct i8080_aot_block *const *);
+void i8080_aot_disable (struct i8080 *);
 
 #endif /* I8080_H */
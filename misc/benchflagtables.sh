@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# Build the core with each combination of flag tables and report the
+# size of the code and tables next to the best time of a few runs of a
+# test program.
+#
+# Usage: misc/benchflagtables.sh [program.COM] [runs]
+
+this_file=$0
+this_dir=$(cd "$(dirname "$this_file")/.." && pwd)
+
+program=${1-"$this_dir"/external/CPUTEST.COM}
+runs=${2-5}
+: "${BUILD_DIR=${TMPDIR-/tmp}/i8080-flag-tables}"
+
+printf '%-24s %10s %10s\n' "tables" "bytes" "seconds"
+for tables in none szp szp,daa szp,daa,arith; do
+  szp=OFF
+  daa=OFF
+  arith=OFF
+  case "$tables" in *szp*) szp=ON ;; esac
+  case "$tables" in *daa*) daa=ON ;; esac
+  case "$tables" in *arith*) arith=ON ;; esac
+
+  dir="$BUILD_DIR/$tables"
+  cmake -S "$this_dir" -B "$dir" -DCMAKE_BUILD_TYPE=Release \
+        -DI8080_SZP_TABLE=$szp -DI8080_DAA_TABLE=$daa \
+        -DI8080_ARITH_TABLES=$arith >/dev/null 2>&1 \
+    && cmake --build "$dir" --target i8080-emulator >/dev/null 2>&1
+  if [ $? -ne 0 ]; then
+    echo "Failed to build with $tables."
+    exit 1
+  fi
+
+  # Text and read-only data of the core, which is where the tables live.
+  bytes=$(size "$dir"/libi8080.a | awk '/i8080\.c/ { print $1 }')
+
+  best=
+  i=0
+  while [ $i -lt "$runs" ]; do
+    start=$(date +%s%N)
+    "$dir"/i8080-emulator "$program" >/dev/null
+    end=$(date +%s%N)
+    best=$(awk -v s="$start" -v e="$end" -v b="$best" \
+             'BEGIN { t = (e - s) / 1e9; if (b != "" && b < t) t = b; print t }')
+    i=$((i + 1))
+  done
+
+  printf '%-24s %10s %10.3f\n' "$tables" "$bytes" "$best"
+done
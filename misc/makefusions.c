@@ -0,0 +1,179 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Prints i8080-fusions.h, the opcode pairs the block cache runs as one
+ * instruction, from the JSON files i8080-emulator -S and
+ * space-invaders -S write when the core is built with I8080_STATS:
+ *
+ *   misc/makefusions [-n count] stats.json ... > i8080-fusions.h
+ *
+ * Each file is weighed by its instruction count so that every workload
+ * counts the same however long it ran. The most frequent pairs are
+ * printed first, 32 of them unless -n says otherwise.
+ */
+
+#define DEFAULT_COUNT 32
+
+/* The pair lines of the JSON, see i8080-stats.h. */
+#define PAIR_FORMAT                                                           \
+  "{ \"first\": %d, \"second\": %d, \"count\": %" SCNu64                    \
+  ", \"mnemonics\": \"%63[^\"]\""
+
+static double weights[256][256];
+static char names[256][256][64];
+
+static bool ends_block (int);
+static int read_stats (const char *);
+
+int
+main (int argc, char **argv)
+{
+  double best, total;
+  int ch, count, i, n, first, second;
+
+  count = DEFAULT_COUNT;
+  while ((ch = getopt (argc, argv, "n:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'n':
+          count = atoi (optarg);
+          if (count < 1)
+            count = DEFAULT_COUNT;
+          break;
+        default:
+          fprintf (stderr, "makefusions [-n count] stats.json ...\n");
+          return 1;
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1)
+    {
+      fprintf (stderr, "makefusions [-n count] stats.json ...\n");
+      return 1;
+    }
+
+  for (i = 0; i < argc; ++i)
+    if (read_stats (argv[i]) < 0)
+      return 1;
+
+  printf ("/* Generated by misc/makefusions.c, do not edit. */\n\n");
+  printf ("/*\n");
+  printf (" * Opcode pairs the block cache runs as one instruction, most "
+          "frequent\n");
+  printf (" * first, with their share of the instructions in:\n");
+  printf (" *\n");
+  for (i = 0; i < argc; ++i)
+    printf (" *   %s\n", argv[i]);
+  printf (" *\n");
+  printf (" * This file has no include guard. The includer defines\n");
+  printf (" * FUSE(first, second).\n");
+  printf (" */\n\n");
+
+  total = 0;
+  for (n = 0; n < count; ++n)
+    {
+      best = 0;
+      first = second = 0;
+      for (i = 0; i < 256 * 256; ++i)
+        if (weights[i / 256][i % 256] > best)
+          {
+            best = weights[i / 256][i % 256];
+            first = i / 256;
+            second = i % 256;
+          }
+      if (best == 0)
+        break;
+      printf ("FUSE (0x%02x, 0x%02x) /* %s, %.2f%% */\n", first, second,
+              names[first][second], 100 * best / argc);
+      total += best;
+      weights[first][second] = 0;
+    }
+  printf ("\n/* %d pairs, %.2f%% of the instructions. */\n", n,
+          100 * total / argc);
+  return 0;
+}
+
+/*
+ * Pairs that start with an instruction that ends a block are never
+ * decoded together. This runs before the core is built, so it has its
+ * own copy of i8080_opcode_ends_block(), which is the definition the
+ * block cache and i8080-recompile both use. Keep the two the same.
+ */
+static bool
+ends_block (int opcode)
+{
+  if (opcode < 0xc0)
+    return opcode == 0x02 || opcode == 0x12 || opcode == 0x22
+           || opcode == 0x32 || opcode == 0x34 || opcode == 0x35
+           || opcode == 0x36 || (opcode >= 0x70 && opcode <= 0x77);
+
+  switch (opcode & 0x07)
+    {
+    case 0x00:
+    case 0x02:
+    case 0x04:
+    case 0x05:
+    case 0x07:
+      return true;
+    case 0x01:
+      return opcode == 0xc9 || opcode == 0xd9 || opcode == 0xe9;
+    case 0x03:
+      return opcode != 0xeb;
+    default:
+      return false;
+    }
+}
+
+/* Add the pairs of a file, as a share of its instructions. */
+static int
+read_stats (const char *name)
+{
+  static uint64_t counts[256][256];
+  char line[256], mnemonics[64];
+  uint64_t instructions, n;
+  const char *p;
+  int i, first, second;
+  FILE *fp;
+
+  fp = fopen (name, "r");
+  if (fp == NULL)
+    {
+      perror (name);
+      return -1;
+    }
+  memset (counts, 0, sizeof (counts));
+  instructions = 0;
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      if (instructions == 0
+          && sscanf (line, " \"instructions\": %" SCNu64, &instructions) == 1)
+        continue;
+      p = strstr (line, "{ \"first\":");
+      if (p == NULL
+          || sscanf (p, PAIR_FORMAT, &first, &second, &n, mnemonics) != 4
+          || first < 0 || first > 255 || second < 0 || second > 255)
+        continue;
+      counts[first][second] = n;
+      strcpy (names[first][second], mnemonics);
+    }
+  fclose (fp);
+  if (instructions == 0)
+    {
+      fprintf (stderr, "%s: No instructions counted.\n", name);
+      return -1;
+    }
+
+  for (i = 0; i < 256 * 256; ++i)
+    if (!ends_block (i / 256))
+      weights[i / 256][i % 256]
+          += (double) counts[i / 256][i % 256] / instructions;
+  return 0;
+}
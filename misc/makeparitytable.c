@@ -1,33 +1,62 @@
-
 #include <stdio.h>
+#include <string.h>
+
+/*
+ * Prints the flag lookup tables used by i8080.c. The parity table is
+ * always printed, the others are selected by name on the command line:
+ *
+ * szp   S, Z and P for every result.
+ * arith Result and flags of ADD/ADC and SUB/SBB/CMP for every
+ *       accumulator, operand and carry.
+ * daa   Result and flags of DAA for every accumulator, CY and AC.
+ *
+ * Table entries hold the result in the low byte and the flags in the
+ * high byte.
+ */
+
+#define FLAG_C 0x01
+#define FLAG_P 0x04
+#define FLAG_AC 0x10
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
 
 int count_set_bits (int, int);
 int is_even (int);
+int szp_flags (int);
+int add_flags (int, int, int);
+int sub_flags (int, int, int);
+int daa_entry (int);
+void print_table8 (const char *, int, int (*) (int));
+void print_table16 (const char *, int, int, int (*) (int));
+int parity_entry (int);
+int add_entry (int);
+int sub_entry (int);
 
 int
-main (void)
+main (int argc, char **argv)
 {
-  int i, set, parity;
+  int i;
+
+  printf ("/* Generated by misc/makeparitytable.c, do not edit. */\n\n");
+  print_table8 ("parity_table", 256, parity_entry);
 
-  printf ("static const uint8_t parity_table[256] = {\n");
-  for (i = 1; i <= 256; ++i)
+  for (i = 1; i < argc; ++i)
     {
-      set = count_set_bits (i - 1, 8);
-      parity = is_even (set);
-      switch (i & 15)
+      if (strcmp (argv[i], "szp") == 0)
+        print_table8 ("szp_table", 256, szp_flags);
+      else if (strcmp (argv[i], "arith") == 0)
         {
-        case 0:
-          printf ("%d,\n", parity);
-          break;
-        case 1:
-          printf ("\t%d, ", parity);
-          break;
-        default:
-          printf ("%d, ", parity);
-          break;
+          print_table16 ("add_table", 2, 65536, add_entry);
+          print_table16 ("sub_table", 2, 65536, sub_entry);
+        }
+      else if (strcmp (argv[i], "daa") == 0)
+        print_table16 ("daa_table", 4, 256, daa_entry);
+      else
+        {
+          fprintf (stderr, "Unknown table '%s'.\n", argv[i]);
+          return 1;
         }
     }
-  printf ("};\n");
 
   return 0;
 }
@@ -54,3 +83,138 @@ is_even (int i)
 {
   return (i & 1) != 0 ? 0 : 1;
 }
+
+int
+parity_entry (int i)
+{
+  return is_even (count_set_bits (i, 8));
+}
+
+int
+szp_flags (int result)
+{
+  int flags;
+
+  flags = result & FLAG_S;
+  if (result == 0)
+    flags |= FLAG_Z;
+  if (parity_entry (result))
+    flags |= FLAG_P;
+  return flags;
+}
+
+/*
+ * These follow the original bit by bit code in i8080.c, including its
+ * tables for the auxiliary carry.
+ */
+int
+add_flags (int a, int val, int carry)
+{
+  static const int ac_table[8] = { 0, 0, 1, 0, 1, 0, 1, 1 };
+  int tmp, acindex, flags;
+
+  tmp = a + val + carry;
+  acindex = ((a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp & 0x88) >> 3);
+  flags = szp_flags (tmp & 0xff);
+  if (tmp & 0x100)
+    flags |= FLAG_C;
+  if (ac_table[acindex & 7])
+    flags |= FLAG_AC;
+  return flags;
+}
+
+int
+sub_flags (int a, int val, int borrow)
+{
+  static const int subtract_ac_table[8] = { 1, 0, 0, 0, 1, 1, 1, 0 };
+  int tmp, acindex, flags;
+
+  tmp = (a - val - borrow) & 0xffff;
+  acindex = ((a & 0x88) >> 1) | ((val & 0x88) >> 2) | ((tmp & 0x88) >> 3);
+  flags = szp_flags (tmp & 0xff);
+  if (tmp & 0x100)
+    flags |= FLAG_C;
+  if (subtract_ac_table[acindex & 7])
+    flags |= FLAG_AC;
+  return flags;
+}
+
+/* Indexed by carry << 16 | a << 8 | val. */
+int
+add_entry (int i)
+{
+  int a, val, carry;
+
+  carry = i >> 16;
+  a = (i >> 8) & 0xff;
+  val = i & 0xff;
+  return (add_flags (a, val, carry) << 8) | ((a + val + carry) & 0xff);
+}
+
+int
+sub_entry (int i)
+{
+  int a, val, borrow;
+
+  borrow = i >> 16;
+  a = (i >> 8) & 0xff;
+  val = i & 0xff;
+  return (sub_flags (a, val, borrow) << 8) | ((a - val - borrow) & 0xff);
+}
+
+/* Indexed by AC << 9 | CY << 8 | a. */
+int
+daa_entry (int i)
+{
+  int a, c, auxc, ahi, alo, inc, flags;
+
+  a = i & 0xff;
+  c = (i >> 8) & 1;
+  auxc = (i >> 9) & 1;
+  ahi = (a >> 4) & 0x0f;
+  alo = a & 0x0f;
+
+  inc = 0;
+  if (alo > 9 || auxc != 0)
+    inc += 0x06;
+  if (ahi > 9 || c != 0 || (ahi >= 9 && alo > 9))
+    {
+      c = 1;
+      inc += 0x60;
+    }
+
+  flags = add_flags (a, inc, 0) & ~FLAG_C;
+  if (c)
+    flags |= FLAG_C;
+  return (flags << 8) | ((a + inc) & 0xff);
+}
+
+void
+print_table8 (const char *name, int size, int (*entry) (int))
+{
+  int i;
+
+  printf ("static const uint8_t %s[%d] = {\n", name, size);
+  for (i = 0; i < size; ++i)
+    printf ("%s%d,%s", (i % 16) == 0 ? "\t" : " ", entry (i),
+            (i % 16) == 15 ? "\n" : "");
+  printf ("};\n\n");
+}
+
+void
+print_table16 (const char *name, int rows, int size, int (*entry) (int))
+{
+  int i, j;
+
+  printf ("static const uint16_t %s[%d][%d] = {\n", name, rows, size);
+  for (i = 0; i < rows; ++i)
+    {
+      printf ("\t{\n");
+      for (j = 0; j < size; ++j)
+        printf ("%s0x%04x,%s", (j % 8) == 0 ? "\t\t" : " ",
+                entry ((i << (size == 65536 ? 16 : 8)) | j),
+                (j % 8) == 7 ? "\n" : "");
+      printf ("\t},\n");
+    }
+  printf ("};\n\n");
+}
@@ -27,14 +27,20 @@
 #include <sys/types.h>
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
 
+#include "i8080-profile.h"
+#include "i8080-replay.h"
+#include "i8080-stats.h"
 #include "i8080.h"
 
 /*
@@ -77,6 +83,8 @@
 #define SI_CYCLES_PER_INT 16666
 /* 8 pixels per bit, see above */
 #define SI_SCREEN_BITS 7168
+/* Addresses and subroutines printed after a profile */
+#define SI_PROFILE_TOP 20
 
 /*
  * SI_SCREEN_WIDTH and SI_SCREEN_HEIGHT are name based on the rotated
@@ -100,29 +108,33 @@ struct spaceinvaders
   struct i8080 cpu;
   uint8_t *memory;
   size_t memory_size;
+  uint8_t rom_scratch[I8080_PAGE_SIZE]; /* Sink for writes to ROM */
   SDL_Window *window;
   SDL_Renderer *renderer;
   SDL_Texture *texture;
   uint32_t *video_buffer;
-  bool exit_flag;       /* Signals the end of the loop. */
-  bool pause_flag;      /* 1 if emulation is paused. */
-  bool color_flag;      /* 1 for color, 0 for black and white */
-  uint8_t inp0;         /* Input port 0, unused? */
-  uint8_t inp1;         /* Input port 1 */
-  uint8_t inp2;         /* Input port 2 */
-  uint8_t shift0;       /* Shift register lsb */
-  uint8_t shift1;       /* Shift register msb */
-  uint8_t shift_offset; /* Shift offset */
-  uint8_t next_int;     /* RST 1 (0xcf) or RST 2 (0xd7) */
+  bool exit_flag;        /* Signals the end of the loop. */
+  bool pause_flag;       /* 1 if emulation is paused. */
+  bool color_flag;       /* 1 for color, 0 for black and white */
+  uint8_t inp0;          /* Input port 0, unused? */
+  uint8_t inp1;          /* Input port 1 */
+  uint8_t inp2;          /* Input port 2 */
+  uint8_t shift0;        /* Shift register lsb */
+  uint8_t shift1;        /* Shift register msb */
+  uint8_t shift_offset;  /* Shift offset */
+  uint8_t next_int;      /* RST 1 (0xcf) or RST 2 (0xd7) */
+  struct replay *replay; /* Log of input and interrupts, if any */
   uint32_t curr_time;
   uint32_t prev_time;
   uint32_t delta_time;
 };
 
 static void usage (void);
+static int spaceinvaders_replay (struct spaceinvaders *, const char *);
 static struct spaceinvaders *spaceinvaders_create (void);
 static void spaceinvaders_destroy (struct spaceinvaders *);
 static int spaceinvaders_load_file (struct spaceinvaders *, const char *);
+static void spaceinvaders_map_memory (struct spaceinvaders *);
 static int sdl_init (struct spaceinvaders *);
 static uint8_t spaceinvaders_read_byte (void *, uint16_t);
 static void spaceinvaders_write_byte (void *, uint16_t, uint8_t);
@@ -133,6 +145,7 @@ static void spaceinvaders_update_screen (struct spaceinvaders *);
 static void spaceinvaders_handle_keydown (struct spaceinvaders *,
                                           SDL_Scancode);
 static void spaceinvaders_handle_keyup (struct spaceinvaders *, SDL_Scancode);
+static void spaceinvaders_interrupt (struct i8080 *, void *, uintmax_t);
 static void spaceinvaders_handle_cpu (struct spaceinvaders *);
 static void spaceinvaders_set_pixel (struct spaceinvaders *, uint32_t,
                                      uint32_t, uint32_t);
@@ -146,29 +159,178 @@ int
 main (int argc, char **argv)
 {
   struct spaceinvaders *emu;
-  if (argc != 2)
+  const char *record, *play, *profile_file, *stats_file;
+  int ch, status;
+
+  record = play = profile_file = stats_file = NULL;
+  while ((ch = getopt (argc, argv, "P:p:r:S:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'P':
+          profile_file = optarg;
+          break;
+        case 'p':
+          play = optarg;
+          break;
+        case 'r':
+          record = optarg;
+          break;
+        case 'S':
+          stats_file = optarg;
+          break;
+        default:
+          usage ();
+        }
+    }
+  argc -= optind;
+  argv += optind;
+  if (argc != 1 || (record != NULL && play != NULL)
+      || (profile_file != NULL && play == NULL))
     usage ();
+
   emu = spaceinvaders_create ();
   if (emu == NULL)
     return 1;
-  if (spaceinvaders_load_file (emu, argv[1]) < 0 || sdl_init (emu) < 0)
+  if (spaceinvaders_load_file (emu, argv[0]) < 0)
+    {
+      spaceinvaders_destroy (emu);
+      return 1;
+    }
+  if (stats_file != NULL && i8080_stats_enable (&emu->cpu) < 0)
+    {
+      fprintf (stderr, "Cannot count opcodes, is I8080_STATS enabled?\n");
+      spaceinvaders_destroy (emu);
+      return 1;
+    }
+
+  if (play != NULL)
+    {
+      emu->replay = replay_open (play, REPLAY_PLAY);
+      status = emu->replay == NULL
+               || spaceinvaders_replay (emu, profile_file) < 0;
+      if (stats_file != NULL
+          && stats_write_json (emu->cpu.stats, stats_file) < 0)
+        status = 1;
+      spaceinvaders_destroy (emu);
+      return status;
+    }
+
+  if (record != NULL)
+    {
+      emu->replay = replay_open (record, REPLAY_RECORD);
+      if (emu->replay == NULL)
+        {
+          spaceinvaders_destroy (emu);
+          return 1;
+        }
+    }
+  if (i8080_schedule (&emu->cpu, SI_CYCLES_PER_INT, spaceinvaders_interrupt,
+                      emu)
+          < 0
+      || sdl_init (emu) < 0)
     {
       spaceinvaders_destroy (emu);
       return 1;
     }
   while (!emu->exit_flag)
     spaceinvaders_loop (emu);
+  status = 0;
+  if (emu->replay != NULL
+      && replay_close (emu->replay, emu->cpu.cycles,
+                       replay_hash (emu->memory, SI_MEMORY_SIZE))
+             < 0)
+    status = 1;
+  emu->replay = NULL;
+  if (stats_file != NULL && stats_write_json (emu->cpu.stats, stats_file) < 0)
+    status = 1;
   spaceinvaders_destroy (emu);
-  return 0;
+  return status;
 }
 
 static void
 usage (void)
 {
-  fprintf (stderr, "spaceinvaders file\n");
+  fprintf (stderr, "spaceinvaders [-p log [-P folded] | -r log] [-S json] "
+                   "file\n");
+  fprintf (stderr, "  -P  Profile the replay, write its call graph as folded "
+                   "stacks to a\n");
+  fprintf (stderr, "      file and print the busiest code to stderr\n");
+  fprintf (stderr, "  -p  Replay a log without a window and check the end\n");
+  fprintf (stderr, "  -r  Record input and interrupts to a log\n");
+  fprintf (stderr, "  -S  Write opcode counts and cycles to a file as JSON "
+                   "on exit\n");
   exit (1);
 }
 
+/*
+ * Run a recorded session as fast as possible, sending the interrupts at
+ * the logged cycle counts. The ports read the logged input. With a file
+ * to write the call graph to, the session is profiled.
+ */
+static int
+spaceinvaders_replay (struct spaceinvaders *emu, const char *profile_file)
+{
+  struct i8080 *cpu = &emu->cpu;
+  struct profile *prof;
+  struct timespec start, end;
+  uintmax_t at, instructions, count;
+  uint64_t hash;
+  uint8_t opcode;
+  double seconds;
+  bool more;
+  int status;
+
+  prof = NULL;
+  if (profile_file != NULL)
+    {
+      prof = profile_create (cpu);
+      if (prof == NULL)
+        return -1;
+    }
+
+  instructions = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  do
+    {
+      more = replay_next_interrupt (emu->replay, &at, &opcode);
+      if (!more)
+        at = replay_end_cycles (emu->replay);
+      while (cpu->cycles < at)
+        {
+          if (i8080_run (cpu, at - cpu->cycles, &count) == I8080_EXIT_HALT)
+            at = cpu->cycles;
+          instructions += count;
+        }
+      if (more)
+        i8080_interrupt (cpu, opcode);
+    }
+  while (more);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  seconds = (double) (end.tv_sec - start.tv_sec)
+            + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+  hash = replay_hash (emu->memory, SI_MEMORY_SIZE);
+  printf ("Instruction count: %ju\n", instructions);
+  printf ("Cycle count:       %ju\n", cpu->cycles);
+  printf ("Memory hash:       %016" PRIx64 "\n", hash);
+  printf ("Seconds:           %.3f\n", seconds);
+  if (seconds > 0)
+    printf ("Emulated MHz:      %.1f\n", (double) cpu->cycles / seconds / 1e6);
+  status = replay_close (emu->replay, cpu->cycles, hash);
+  emu->replay = NULL;
+
+  if (prof != NULL)
+    {
+      if (profile_stop (prof) < 0
+          || profile_write_folded (prof, profile_file) < 0)
+        status = -1;
+      profile_print (prof, stderr, SI_PROFILE_TOP);
+      profile_destroy (prof);
+    }
+  return status;
+}
+
 static struct spaceinvaders *
 spaceinvaders_create (void)
 {
@@ -183,6 +345,12 @@ spaceinvaders_create (void)
   emu->cpu.write_byte = spaceinvaders_write_byte;
   emu->cpu.io_inb = spaceinvaders_io_inb;
   emu->cpu.io_outb = spaceinvaders_io_outb;
+  /* The ROM is only ever executed so caching it always pays off. */
+  if (i8080_cache_enable (&emu->cpu) < 0)
+    {
+      free (emu);
+      return NULL;
+    }
   emu->color_flag = true;
   emu->next_int = 0xcf;
   return emu;
@@ -197,6 +365,13 @@ spaceinvaders_destroy (struct spaceinvaders *emu)
       SDL_DestroyRenderer (emu->renderer);
       SDL_DestroyWindow (emu->window);
       SDL_Quit ();
+      /* Only left open if something failed. */
+      if (emu->replay != NULL)
+        replay_close (emu->replay, emu->cpu.cycles,
+                      replay_hash (emu->memory, SI_MEMORY_SIZE));
+      i8080_cache_disable (&emu->cpu);
+      i8080_stats_disable (&emu->cpu);
+      i8080_events_free (&emu->cpu);
       free (emu->video_buffer);
       free (emu->memory);
       free (emu);
@@ -329,10 +504,28 @@ spaceinvaders_load_file (struct spaceinvaders *emu, const char *file)
 
   emu->memory = memory;
   emu->memory_size = UINT16_MAX;
+  spaceinvaders_map_memory (emu);
   fclose (fp);
   return 0;
 }
 
+/*
+ * Serve ROM, RAM and the RAM mirror straight from memory. Everything
+ * else, including the odd edges of the mirror, is left to
+ * spaceinvaders_read_byte() and spaceinvaders_write_byte().
+ */
+static void
+spaceinvaders_map_memory (struct spaceinvaders *emu)
+{
+  uint32_t address;
+
+  i8080_map_read (&emu->cpu, 0x0000, 0x4000, emu->memory);
+  i8080_map_read (&emu->cpu, 0x4000, 0x2000, &emu->memory[0x2000]);
+  for (address = 0x0000; address < 0x2000; address += I8080_PAGE_SIZE)
+    i8080_map_write (&emu->cpu, address, I8080_PAGE_SIZE, emu->rom_scratch);
+  i8080_map_write (&emu->cpu, 0x2000, 0x2000, &emu->memory[0x2000]);
+}
+
 static uint8_t
 spaceinvaders_read_byte (void *emuptr, uint16_t address)
 {
@@ -387,6 +580,8 @@ spaceinvaders_io_inb (void *emuptr, uint8_t port)
       break;
     }
 
+  if (emu->replay != NULL)
+    value = replay_inb (emu->replay, emu->cpu.cycles, port, value);
   return value;
 }
 
@@ -489,7 +684,7 @@ spaceinvaders_handle_keydown (struct spaceinvaders *emu, SDL_Scancode key)
       emu->inp2 |= 0x40;
       break;
     case SDL_SCANCODE_ESCAPE: /* Exit */
-      emu->exit_flag = false;
+      emu->exit_flag = true;
       break;
     case SDL_SCANCODE_E: /* Toggle color emulation */
       emu->color_flag = (emu->color_flag == 1);
@@ -546,30 +741,36 @@ spaceinvaders_handle_keyup (struct spaceinvaders *emu, SDL_Scancode key)
  * we also update the actual screen based on the contents of vram.
  */
 static void
+spaceinvaders_interrupt (struct i8080 *cpu, void *data, uintmax_t at)
+{
+  struct spaceinvaders *emu = (struct spaceinvaders *) data;
+
+  if (emu->replay != NULL)
+    replay_interrupt (emu->replay, cpu->cycles, emu->next_int);
+  i8080_interrupt (cpu, emu->next_int);
+  if (emu->next_int == 0xcf)
+    emu->next_int = 0xd7;
+  else
+    {
+      spaceinvaders_handle_vram (emu);
+      emu->next_int = 0xcf;
+    }
+  /* Cannot fail, the event being fired left room for it. */
+  i8080_schedule (cpu, at + SI_CYCLES_PER_INT, spaceinvaders_interrupt, emu);
+}
+
+/* Run this frame's share of cycles, with the interrupts on the way. */
+static void
 spaceinvaders_handle_cpu (struct spaceinvaders *emu)
 {
   struct i8080 *cpu = &emu->cpu;
   const uint64_t need = (emu->delta_time * SI_CLOCK_SPEED) / 1000;
-  uint64_t i, prev, diff;
+  uintmax_t end;
 
-  for (i = diff = 0; i < need; i += diff)
-    {
-      prev = emu->cpu.cycles;
-      i8080_step (cpu);
-      diff = cpu->cycles - prev;
-      if (cpu->cycles >= SI_CYCLES_PER_INT)
-        {
-          cpu->cycles -= SI_CYCLES_PER_INT;
-          i8080_interrupt (cpu, emu->next_int);
-          if (emu->next_int == 0xcf)
-            emu->next_int = 0xd7;
-          else
-            {
-              spaceinvaders_handle_vram (emu);
-              emu->next_int = 0xcf;
-            }
-        }
-    }
+  end = cpu->cycles + need;
+  while (cpu->cycles < end)
+    if (i8080_run (cpu, end - cpu->cycles, NULL) == I8080_EXIT_HALT)
+      break;
 }
 
 /*